@@ -0,0 +1,642 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "enc_segments.h"
+#include "objpool.h"
+#include "thread_queue.h"
+
+#include "libavutil/buffer.h"
+#include "libavutil/error.h"
+#include "libavutil/fifo.h"
+#include "libavutil/macros.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "libavutil/thread.h"
+
+// number of frames queued for each segment encoder
+#define SEGMENT_QUEUE_SIZE      8
+// segment length for encoders without a fixed GOP size
+#define DEFAULT_SEGMENT_FRAMES  250
+
+typedef struct SegmentWorker {
+    EncSegments    *es;
+
+    pthread_t       thread;
+    /* an already opened encoder for the first segment, taken by the thread */
+    AVCodecContext *enc;
+    /* frames to encode; a frame without data ends the current segment */
+    ThreadQueue    *queue;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+
+    /* the fields below are protected by lock */
+
+    /* encoded AVPacket*, NULL marks the end of a segment */
+    AVFifo         *packets;
+    /* number of complete segments in packets */
+    int             segments_done;
+    /* set when the thread exits, its exit status is then in ret */
+    int             finished;
+    int             ret;
+} SegmentWorker;
+
+struct EncSegments {
+    /* configuration of the segment encoders, never opened */
+    AVCodecContext *tmpl;
+    AVDictionary   *opts;
+    /* the encoder for segment 0, opened by encseg_alloc() */
+    AVCodecContext *first;
+
+    /* segment n is encoded by workers[n % nb_workers] */
+    SegmentWorker  *workers;
+    unsigned int    nb_workers;
+    unsigned int    nb_started;
+
+    int             segment_frames;
+    /* the segment receiving frames and its frame count */
+    int64_t         segment_in;
+    int             segment_in_frames;
+    /* the segment being returned */
+    int64_t         segment_out;
+    int             flushing;
+
+    AVFrame        *frame;
+
+    /* packets of segment_out */
+    AVPacket      **pkts;
+    int             nb_pkts;
+    int             pkts_pos;
+
+    /* Decoding timestamps are regenerated from the presentation timestamps:
+     * the dts of packet n is the pts of the (n - delay)-th frame in
+     * presentation order, where delay is the reordering delay of the
+     * encoder. This would not hold at segment boundaries for the timestamps
+     * generated by the segment encoders. */
+    atomic_int      delay;
+    int64_t         nb_packets;
+    AVFifo         *pts;
+};
+
+static void frame_move(void *dst, void *src)
+{
+    av_frame_move_ref(dst, src);
+}
+
+/* Copy the encoder configuration set through the AVOptions and the fields
+ * ffmpeg sets directly. */
+static int enc_config_copy(AVCodecContext *dst, const AVCodecContext *src)
+{
+    int ret;
+
+    ret = av_opt_copy(dst, src);
+    if (ret < 0)
+        return ret;
+
+    if (src->priv_data && dst->priv_data && src->codec->priv_class) {
+        ret = av_opt_copy(dst->priv_data, src->priv_data);
+        if (ret < 0)
+            return ret;
+    }
+
+    dst->framerate = src->framerate;
+
+    if (src->hw_device_ctx) {
+        dst->hw_device_ctx = av_buffer_ref(src->hw_device_ctx);
+        if (!dst->hw_device_ctx)
+            return AVERROR(ENOMEM);
+    }
+    if (src->hw_frames_ctx) {
+        dst->hw_frames_ctx = av_buffer_ref(src->hw_frames_ctx);
+        if (!dst->hw_frames_ctx)
+            return AVERROR(ENOMEM);
+    }
+
+#define COPY_ARRAY(field, nb)                                               \
+    if (src->field) {                                                       \
+        dst->field = av_memdup(src->field, sizeof(*src->field) * (nb));     \
+        if (!dst->field)                                                    \
+            return AVERROR(ENOMEM);                                         \
+    }
+    COPY_ARRAY(intra_matrix,        64);
+    COPY_ARRAY(inter_matrix,        64);
+    COPY_ARRAY(chroma_intra_matrix, 64);
+    COPY_ARRAY(rc_override,         src->rc_override_count);
+#undef COPY_ARRAY
+
+    return 0;
+}
+
+/* Open a segment encoder. If unused is not NULL, the options not found are
+ * returned there. */
+static int segment_encoder_open(EncSegments *es, AVCodecContext **penc,
+                                AVDictionary **unused)
+{
+    AVCodecContext *enc;
+    AVDictionary  *opts = NULL;
+    int ret;
+
+    enc = avcodec_alloc_context3(es->tmpl->codec);
+    if (!enc)
+        return AVERROR(ENOMEM);
+
+    ret = enc_config_copy(enc, es->tmpl);
+    if (ret >= 0)
+        ret = av_dict_copy(&opts, es->opts, 0);
+    if (ret >= 0)
+        ret = avcodec_open2(enc, enc->codec, &opts);
+    if (ret >= 0 && unused) {
+        av_dict_free(unused);
+        *unused = opts;
+        opts    = NULL;
+    }
+    av_dict_free(&opts);
+    if (ret < 0) {
+        av_log(enc, AV_LOG_ERROR, "Error opening the segment encoder: %s\n",
+               av_err2str(ret));
+        avcodec_free_context(&enc);
+        return ret;
+    }
+
+    atomic_store(&es->delay, FFMAX(enc->has_b_frames, 0));
+
+    *penc = enc;
+    return 0;
+}
+
+/* Pass an encoded packet, or the end of the segment when pkt is NULL, to the
+ * output side. */
+static int segment_packet_push(SegmentWorker *w, AVPacket *pkt)
+{
+    AVPacket *p = NULL;
+    int ret;
+
+    if (pkt) {
+        p = av_packet_alloc();
+        if (!p)
+            return AVERROR(ENOMEM);
+        av_packet_move_ref(p, pkt);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    ret = av_fifo_write(w->packets, &p, 1);
+    if (ret >= 0 && !p) {
+        w->segments_done++;
+        pthread_cond_signal(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if (ret < 0)
+        av_packet_free(&p);
+
+    return ret;
+}
+
+static void *segment_thread(void *arg)
+{
+    SegmentWorker  *w = arg;
+    AVCodecContext *enc = w->enc;
+    AVFrame     *frame;
+    AVPacket      *pkt;
+    int ret = 0;
+
+    ff_thread_setname("encseg");
+
+    frame = av_frame_alloc();
+    pkt   = av_packet_alloc();
+    if (!frame || !pkt) {
+        ret = AVERROR(ENOMEM);
+        goto finish;
+    }
+
+    while (1) {
+        int stream_idx;
+
+        // no more segments, or aborted
+        ret = tq_receive(w->queue, &stream_idx, frame);
+        if (ret < 0) {
+            ret = 0;
+            break;
+        }
+
+        if (!enc) {
+            ret = segment_encoder_open(w->es, &enc, NULL);
+            if (ret < 0)
+                break;
+        }
+
+        ret = avcodec_send_frame(enc, frame->buf[0] ? frame : NULL);
+        av_frame_unref(frame);
+        if (ret < 0)
+            break;
+
+        while ((ret = avcodec_receive_packet(enc, pkt)) >= 0) {
+            ret = segment_packet_push(w, pkt);
+            if (ret < 0)
+                goto finish;
+        }
+
+        if (ret == AVERROR_EOF) {
+            avcodec_free_context(&enc);
+            ret = segment_packet_push(w, NULL);
+            if (ret < 0)
+                break;
+        } else if (ret != AVERROR(EAGAIN))
+            break;
+    }
+
+finish:
+    avcodec_free_context(&enc);
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+
+    tq_receive_finish(w->queue, 0);
+
+    pthread_mutex_lock(&w->lock);
+    w->finished = 1;
+    w->ret      = ret;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+static int worker_start(EncSegments *es, SegmentWorker *w)
+{
+    ObjPool *op;
+    int ret;
+
+    w->es = es;
+
+    w->packets = av_fifo_alloc2(64, sizeof(AVPacket*), AV_FIFO_FLAG_AUTO_GROW);
+    if (!w->packets)
+        return AVERROR(ENOMEM);
+
+    op = objpool_alloc_frames();
+    if (!op)
+        goto fail;
+
+    w->queue = tq_alloc(1, SEGMENT_QUEUE_SIZE, op, frame_move,
+                        TQ_FLAG_LOCKLESS | TQ_FLAG_SINGLE_PRODUCER);
+    if (!w->queue) {
+        objpool_free(&op);
+        goto fail;
+    }
+
+    ret = pthread_mutex_init(&w->lock, NULL);
+    if (ret) {
+        tq_free(&w->queue);
+        av_fifo_freep2(&w->packets);
+        return AVERROR(ret);
+    }
+    ret = pthread_cond_init(&w->cond, NULL);
+    if (ret) {
+        pthread_mutex_destroy(&w->lock);
+        tq_free(&w->queue);
+        av_fifo_freep2(&w->packets);
+        return AVERROR(ret);
+    }
+
+    w->enc = es->first;
+
+    ret = pthread_create(&w->thread, NULL, segment_thread, w);
+    if (ret) {
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        tq_free(&w->queue);
+        av_fifo_freep2(&w->packets);
+        return AVERROR(ret);
+    }
+
+    es->first = NULL;
+    es->nb_started++;
+
+    return 0;
+fail:
+    av_fifo_freep2(&w->packets);
+    return AVERROR(ENOMEM);
+}
+
+static void worker_stop(SegmentWorker *w)
+{
+    AVPacket *pkt;
+
+    tq_receive_finish(w->queue, 0);
+    tq_send_finish(w->queue, 0);
+
+    pthread_join(w->thread, NULL);
+
+    while (av_fifo_read(w->packets, &pkt, 1) >= 0)
+        av_packet_free(&pkt);
+    av_fifo_freep2(&w->packets);
+
+    tq_free(&w->queue);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+}
+
+/* Wait for a worker thread that stopped accepting frames to exit, and return
+ * the error that made it exit. */
+static int worker_status(SegmentWorker *w)
+{
+    int ret;
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->finished)
+        pthread_cond_wait(&w->cond, &w->lock);
+    ret = w->ret;
+    pthread_mutex_unlock(&w->lock);
+
+    return ret < 0 ? ret : AVERROR_BUG;
+}
+
+static int segment_end(EncSegments *es)
+{
+    SegmentWorker *w = &es->workers[es->segment_in % es->nb_workers];
+    int ret;
+
+    // es->frame holds no data here, which marks the end of the segment
+    ret = tq_send(w->queue, 0, es->frame);
+    if (ret < 0)
+        return worker_status(w);
+
+    es->segment_in++;
+    es->segment_in_frames = 0;
+
+    return 0;
+}
+
+int encseg_send_frame(EncSegments *es, const AVFrame *frame)
+{
+    unsigned int idx;
+    SegmentWorker *w;
+    int ret;
+
+    if (es->flushing)
+        return AVERROR_EOF;
+
+    if (!frame) {
+        ret = 0;
+        es->flushing = 1;
+
+        if (es->segment_in_frames)
+            ret = segment_end(es);
+
+        for (unsigned int i = 0; i < es->nb_started; i++)
+            tq_send_finish(es->workers[i].queue, 0);
+
+        return ret;
+    }
+
+    if (es->segment_in_frames == es->segment_frames) {
+        ret = segment_end(es);
+        if (ret < 0)
+            return ret;
+    }
+
+    idx = es->segment_in % es->nb_workers;
+    w   = &es->workers[idx];
+    if (idx == es->nb_started) {
+        ret = worker_start(es, w);
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = av_frame_ref(es->frame, frame);
+    if (ret < 0)
+        return ret;
+
+    ret = tq_send(w->queue, 0, es->frame);
+    if (ret < 0) {
+        av_frame_unref(es->frame);
+        return worker_status(w);
+    }
+
+    es->segment_in_frames++;
+
+    return 0;
+}
+
+static int pts_cmp(const void *a, const void *b)
+{
+    return FFDIFFSIGN(*(const int64_t*)a, *(const int64_t*)b);
+}
+
+static void pkts_free(EncSegments *es)
+{
+    for (int i = 0; i < es->nb_pkts; i++)
+        av_packet_free(&es->pkts[i]);
+    av_freep(&es->pkts);
+    es->nb_pkts  = 0;
+    es->pkts_pos = 0;
+}
+
+/* Take the packets of segment_out from its worker. */
+static int segment_fetch(EncSegments *es, int block)
+{
+    SegmentWorker *w = &es->workers[es->segment_out % es->nb_workers];
+    int64_t *pts;
+    AVPacket *pkt;
+    int ret = 0, nb_pts = 0;
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->segments_done) {
+        if (w->finished) {
+            ret = w->ret < 0 ? w->ret : AVERROR_BUG;
+            break;
+        }
+        if (!block) {
+            ret = AVERROR(EAGAIN);
+            break;
+        }
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    if (ret < 0) {
+        pthread_mutex_unlock(&w->lock);
+        return ret;
+    }
+
+    while (av_fifo_read(w->packets, &pkt, 1) >= 0 && pkt) {
+        ret = av_dynarray_add_nofree(&es->pkts, &es->nb_pkts, pkt);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            break;
+        }
+    }
+    w->segments_done--;
+    pthread_mutex_unlock(&w->lock);
+
+    es->segment_out++;
+
+    if (ret < 0)
+        return ret;
+
+    // the presentation timestamps of the segment, in presentation order
+    pts = av_malloc_array(es->nb_pkts, sizeof(*pts));
+    if (!pts)
+        return AVERROR(ENOMEM);
+    for (int i = 0; i < es->nb_pkts; i++)
+        if (es->pkts[i]->pts != AV_NOPTS_VALUE)
+            pts[nb_pts++] = es->pkts[i]->pts;
+    qsort(pts, nb_pts, sizeof(*pts), pts_cmp);
+
+    ret = av_fifo_write(es->pts, pts, nb_pts);
+    av_freep(&pts);
+
+    return ret;
+}
+
+int encseg_receive_packet(EncSegments *es, AVPacket *pkt)
+{
+    while (es->pkts_pos >= es->nb_pkts) {
+        int ret;
+
+        pkts_free(es);
+
+        if (es->segment_out >= es->segment_in)
+            return es->flushing ? AVERROR_EOF : AVERROR(EAGAIN);
+
+        ret = segment_fetch(es, es->flushing);
+        if (ret < 0)
+            return ret;
+    }
+
+    av_packet_move_ref(pkt, es->pkts[es->pkts_pos++]);
+
+    if (es->nb_packets++ >= atomic_load(&es->delay) && pkt->pts != AV_NOPTS_VALUE)
+        av_fifo_read(es->pts, &pkt->dts, 1);
+
+    return 0;
+}
+
+/* Export the parameters of an opened encoder to the unopened enc. */
+static int enc_params_export(AVCodecContext *enc, const AVCodecContext *src)
+{
+    AVCodecParameters *par;
+    int ret;
+
+    par = avcodec_parameters_alloc();
+    if (!par)
+        return AVERROR(ENOMEM);
+
+    ret = avcodec_parameters_from_context(par, src);
+    if (ret >= 0)
+        ret = avcodec_parameters_to_context(enc, par);
+    avcodec_parameters_free(&par);
+    if (ret < 0)
+        return ret;
+
+    if (src->nb_coded_side_data) {
+        enc->coded_side_data = av_calloc(src->nb_coded_side_data,
+                                         sizeof(*enc->coded_side_data));
+        if (!enc->coded_side_data)
+            return AVERROR(ENOMEM);
+
+        for (int i = 0; i < src->nb_coded_side_data; i++) {
+            const AVPacketSideData *sd_src = &src->coded_side_data[i];
+            AVPacketSideData       *sd_dst = &enc->coded_side_data[i];
+
+            sd_dst->data = av_memdup(sd_src->data, sd_src->size);
+            if (!sd_dst->data)
+                return AVERROR(ENOMEM);
+            sd_dst->size = sd_src->size;
+            sd_dst->type = sd_src->type;
+            enc->nb_coded_side_data++;
+        }
+    }
+
+    return 0;
+}
+
+int encseg_alloc(EncSegments **pes, AVCodecContext *enc,
+                 AVDictionary **opts, unsigned int nb_threads)
+{
+    EncSegments *es;
+    int ret;
+
+    es = av_mallocz(sizeof(*es));
+    if (!es)
+        return AVERROR(ENOMEM);
+
+    atomic_init(&es->delay, 0);
+
+    es->nb_workers = nb_threads;
+
+    es->workers = av_calloc(nb_threads, sizeof(*es->workers));
+    es->frame   = av_frame_alloc();
+    es->pts     = av_fifo_alloc2(DEFAULT_SEGMENT_FRAMES, sizeof(int64_t),
+                                 AV_FIFO_FLAG_AUTO_GROW);
+    es->tmpl    = avcodec_alloc_context3(enc->codec);
+    if (!es->workers || !es->frame || !es->pts || !es->tmpl) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    ret = enc_config_copy(es->tmpl, enc);
+    if (ret < 0)
+        goto fail;
+
+    ret = av_dict_copy(&es->opts, *opts, 0);
+    if (ret < 0)
+        goto fail;
+
+    /* the first segment encoder stands in for enc, which is never opened */
+    ret = segment_encoder_open(es, &es->first, opts);
+    if (ret < 0)
+        goto fail;
+
+    ret = enc_params_export(enc, es->first);
+    if (ret < 0)
+        goto fail;
+
+    es->segment_frames = es->first->gop_size > 0 ? es->first->gop_size :
+                                                   DEFAULT_SEGMENT_FRAMES;
+
+    *pes = es;
+    return 0;
+fail:
+    encseg_free(&es);
+    return ret;
+}
+
+void encseg_free(EncSegments **pes)
+{
+    EncSegments *es = *pes;
+
+    if (!es)
+        return;
+
+    for (unsigned int i = 0; i < es->nb_started; i++)
+        worker_stop(&es->workers[i]);
+    av_freep(&es->workers);
+
+    pkts_free(es);
+    av_fifo_freep2(&es->pts);
+    av_frame_free(&es->frame);
+
+    avcodec_free_context(&es->first);
+    avcodec_free_context(&es->tmpl);
+    av_dict_free(&es->opts);
+
+    av_freep(pes);
+}
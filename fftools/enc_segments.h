@@ -0,0 +1,79 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FFTOOLS_ENC_SEGMENTS_H
+#define FFTOOLS_ENC_SEGMENTS_H
+
+#include "libavcodec/avcodec.h"
+#include "libavcodec/packet.h"
+
+#include "libavutil/dict.h"
+#include "libavutil/frame.h"
+
+/**
+ * Segmented video encoder.
+ *
+ * The input frames are split into segments of one GOP, each of which is
+ * encoded by a new encoder instance, so that several segments can be encoded
+ * in parallel. Every segment starts with a keyframe and does not reference
+ * other segments. The packets are returned in order, with decoding timestamps
+ * as a single encoder would generate them.
+ *
+ * The send/receive API follows avcodec_send_frame()/avcodec_receive_packet().
+ */
+typedef struct EncSegments EncSegments;
+
+/**
+ * Allocate a segmented encoder.
+ *
+ * The encoder for the first segment is opened immediately and replaces enc,
+ * which must not be opened: its output parameters, e.g. extradata and coded
+ * side data, are exported to enc on success.
+ *
+ * @param enc the encoder context to copy the configuration from; it must be
+ *            fully set up, but not opened
+ * @param opts the options to open each segment encoder with; on return, the
+ *             options that were not found, as with avcodec_open2(); the
+ *             segment length is the GOP size set in opts or enc, or a
+ *             default when it is not positive
+ * @param nb_threads the maximum number of segments encoded at the same time
+ */
+int encseg_alloc(EncSegments **pes, AVCodecContext *enc,
+                 AVDictionary **opts, unsigned int nb_threads);
+
+void encseg_free(EncSegments **pes);
+
+/**
+ * Submit a frame for encoding, or NULL to flush.
+ *
+ * @return 0 on success, AVERROR_EOF after flushing, another negative error
+ *         code if encoding failed
+ */
+int encseg_send_frame(EncSegments *es, const AVFrame *frame);
+
+/**
+ * Get the next encoded packet. Once flushing, this blocks until the next
+ * packet is available.
+ *
+ * @return 0 on success, AVERROR(EAGAIN) when the next packet is not available
+ *         yet, AVERROR_EOF when flushed and all packets have been returned,
+ *         another negative error code if encoding failed
+ */
+int encseg_receive_packet(EncSegments *es, AVPacket *pkt);
+
+#endif /* FFTOOLS_ENC_SEGMENTS_H */
@@ -104,7 +104,9 @@
 
 #include "ffmpeg.h"
 #include "cmdutils.h"
+#include "objpool.h"
 #include "sync_queue.h"
+#include "thread_queue.h"
 
 #include "libavutil/avassert.h"
 
@@ -127,6 +129,7 @@ typedef struct BenchmarkTimeStamps {
 } BenchmarkTimeStamps;
 
 static int trigger_fix_sub_duration_heartbeat(OutputStream *ost, const AVPacket *pkt);
+static int enc_thread_stop(OutputStream *ost, int flush);
 static BenchmarkTimeStamps get_benchmark_time_stamps(void);
 static int64_t getmaxrss(void);
 static int ifilter_has_all_input_formats(FilterGraph *fg);
@@ -139,6 +142,10 @@ unsigned nb_output_dumped = 0;
 
 static BenchmarkTimeStamps current_time;
 AVIOContext *progress_avio = NULL;
+AVIOContext *stats_pipeline_avio = NULL;
+
+/* time spent in each pipeline stage in microseconds, summed over threads */
+static atomic_int_least64_t stage_time[STAGE_NB];
 
 InputFile   **input_files   = NULL;
 int        nb_input_files   = 0;
@@ -328,7 +335,7 @@ void term_exit(void)
 }
 
 static volatile int received_sigterm = 0;
-static volatile int received_nb_signals = 0;
+volatile int received_nb_signals = 0;
 static atomic_int transcode_init_done = ATOMIC_VAR_INIT(0);
 static volatile int ffmpeg_exited = 0;
 int main_return_code = 0;
@@ -548,6 +555,11 @@ static void ffmpeg_cleanup(int ret)
     }
     av_freep(&filtergraphs);
 
+    /* stop the encoding threads before their muxers are closed */
+    for (i = 0; i < nb_output_files; i++)
+        for (j = 0; j < output_files[i]->nb_streams; j++)
+            enc_thread_stop(output_files[i]->streams[j], 0);
+
     /* close files */
     for (i = 0; i < nb_output_files; i++)
         of_close(&output_files[i]);
@@ -555,6 +567,16 @@ static void ffmpeg_cleanup(int ret)
     for (i = 0; i < nb_input_files; i++)
         ifile_close(&input_files[i]);
 
+    /* closed only now, as it is checked by the demuxing, encoding and
+     * muxing threads */
+    if (stats_pipeline_avio) {
+        int err = avio_closep(&stats_pipeline_avio);
+        if (err < 0)
+            av_log(NULL, AV_LOG_ERROR,
+                   "Error closing pipeline stats, loss of information possible: %s\n",
+                   av_err2str(err));
+    }
+
     if (vstats_file) {
         if (fclose(vstats_file))
             av_log(NULL, AV_LOG_ERROR,
@@ -562,9 +584,11 @@ static void ffmpeg_cleanup(int ret)
                    av_err2str(AVERROR(errno)));
     }
     av_freep(&vstats_filename);
+    av_freep(&worker_source);
     of_enc_stats_close();
 
     av_freep(&filter_nbthreads);
+    av_freep(&filter_thread_type);
 
     av_freep(&input_files);
     av_freep(&output_files);
@@ -661,10 +685,21 @@ static void update_benchmark(const char *fmt, ...)
     }
 }
 
+int64_t stage_time_start(void)
+{
+    return stats_pipeline_avio ? av_gettime_relative() : 0;
+}
+
+void stage_time_end(enum PipelineStage stage, int64_t start)
+{
+    if (stats_pipeline_avio)
+        atomic_fetch_add(&stage_time[stage], av_gettime_relative() - start);
+}
+
 static void close_output_stream(OutputStream *ost)
 {
     OutputFile *of = output_files[ost->file_index];
-    ost->finished |= ENCODER_FINISHED;
+    atomic_fetch_or(&ost->finished, ENCODER_FINISHED);
 
     if (ost->sq_idx_encode >= 0)
         sq_send(of->sq_encode, ost->sq_idx_encode, SQFRAME(NULL));
@@ -758,17 +793,21 @@ static void update_video_stats(OutputStream *ost, const AVPacket *pkt, int write
     const uint8_t *sd = av_packet_get_side_data(pkt, AV_PKT_DATA_QUALITY_STATS,
                                                 NULL);
     AVCodecContext *enc = ost->enc_ctx;
-    int64_t frame_number;
+    int64_t frame_number, error;
+    int quality, pict_type;
+    uint64_t data_size;
     double ti1, bitrate, avg_bitrate;
 
-    ost->quality   = sd ? AV_RL32(sd) : -1;
-    ost->pict_type = sd ? sd[4] : AV_PICTURE_TYPE_NONE;
+    quality   = sd ? AV_RL32(sd) : -1;
+    pict_type = sd ? sd[4] : AV_PICTURE_TYPE_NONE;
+    atomic_store(&ost->quality,   quality);
+    atomic_store(&ost->pict_type, pict_type);
 
     for (int i = 0; i<FF_ARRAY_ELEMS(ost->error); i++) {
         if (sd && i < sd[5])
-            ost->error[i] = AV_RL64(sd + 8 + 8*i);
+            atomic_store(&ost->error[i], AV_RL64(sd + 8 + 8*i));
         else
-            ost->error[i] = -1;
+            atomic_store(&ost->error[i], -1);
     }
 
     if (!write_vstats)
@@ -783,17 +822,18 @@ static void update_video_stats(OutputStream *ost, const AVPacket *pkt, int write
         }
     }
 
-    frame_number = ost->packets_encoded;
+    frame_number = atomic_load(&ost->packets_encoded);
     if (vstats_version <= 1) {
         fprintf(vstats_file, "frame= %5"PRId64" q= %2.1f ", frame_number,
-                ost->quality / (float)FF_QP2LAMBDA);
+                quality / (float)FF_QP2LAMBDA);
     } else  {
         fprintf(vstats_file, "out= %2d st= %2d frame= %5"PRId64" q= %2.1f ", ost->file_index, ost->index, frame_number,
-                ost->quality / (float)FF_QP2LAMBDA);
+                quality / (float)FF_QP2LAMBDA);
     }
 
-    if (ost->error[0]>=0 && (enc->flags & AV_CODEC_FLAG_PSNR))
-        fprintf(vstats_file, "PSNR= %6.2f ", psnr(ost->error[0] / (enc->width * enc->height * 255.0 * 255.0)));
+    error = atomic_load(&ost->error[0]);
+    if (error >= 0 && (enc->flags & AV_CODEC_FLAG_PSNR))
+        fprintf(vstats_file, "PSNR= %6.2f ", psnr(error / (enc->width * enc->height * 255.0 * 255.0)));
 
     fprintf(vstats_file,"f_size= %6d ", pkt->size);
     /* compute pts value */
@@ -802,10 +842,11 @@ static void update_video_stats(OutputStream *ost, const AVPacket *pkt, int write
         ti1 = 0.01;
 
     bitrate     = (pkt->size * 8) / av_q2d(enc->time_base) / 1000.0;
-    avg_bitrate = (double)(ost->data_size_enc * 8) / ti1 / 1000.0;
+    data_size   = atomic_load(&ost->data_size_enc);
+    avg_bitrate = (double)(data_size * 8) / ti1 / 1000.0;
     fprintf(vstats_file, "s_size= %8.0fkB time= %0.3f br= %7.1fkbits/s avg_br= %7.1fkbits/s ",
-           (double)ost->data_size_enc / 1024, ti1, bitrate, avg_bitrate);
-    fprintf(vstats_file, "type= %c\n", av_get_picture_type_char(ost->pict_type));
+           (double)data_size / 1024, ti1, bitrate, avg_bitrate);
+    fprintf(vstats_file, "type= %c\n", av_get_picture_type_char(pict_type));
 }
 
 void enc_stats_write(OutputStream *ost, EncStats *es,
@@ -863,7 +904,7 @@ void enc_stats_write(OutputStream *ost, EncStats *es,
             }
             case ENC_STATS_AVG_BITRATE: {
                 double duration = pkt->dts * av_q2d(tb);
-                avio_printf(io, "%g",  duration > 0 ? 8.0 * ost->data_size_enc / duration : -1.);
+                avio_printf(io, "%g",  duration > 0 ? 8.0 * atomic_load(&ost->data_size_enc) / duration : -1.);
                 continue;
             }
             default: av_assert0(0);
@@ -874,22 +915,61 @@ void enc_stats_write(OutputStream *ost, EncStats *es,
     avio_flush(io);
 }
 
+/*
+ * Track the frames held by the encoder for -stats_pipeline. Packets do not
+ * map one to one to frames (audio priming, reordered or dropped video
+ * frames), so a frame counts as consumed once a packet with the same or a
+ * later timestamp is output. Without timestamps, one frame is consumed per
+ * packet.
+ */
+static void enc_pending_update(OutputStream *ost, const AVFrame *frame,
+                               const AVPacket *pkt, int eof)
+{
+    AVFifo *pending = ost->enc_pending_pts;
+    int64_t pts;
+
+    if (!pending)
+        return;
+
+    if (eof)
+        av_fifo_reset2(pending);
+    /* on allocation failure, the frame is just not accounted for */
+    if (frame)
+        av_fifo_write(pending, &frame->pts, 1);
+    while (pkt && av_fifo_peek(pending, &pts, 1, 0) >= 0) {
+        int ts_known = pts != AV_NOPTS_VALUE && pkt->pts != AV_NOPTS_VALUE;
+
+        if (ts_known && pts > pkt->pts)
+            break;
+        av_fifo_drain2(pending, 1);
+        if (!ts_known)
+            break;
+    }
+
+    atomic_store(&ost->enc_frames_pending, av_fifo_can_read(pending));
+}
+
 static int encode_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
 {
     AVCodecContext   *enc = ost->enc_ctx;
     AVPacket         *pkt = ost->pkt;
     const char *type_desc = av_get_media_type_string(enc->codec_type);
     const char    *action = frame ? "encode" : "flush";
+    int64_t t;
     int ret;
 
     if (frame) {
         if (ost->enc_stats_pre.io)
             enc_stats_write(ost, &ost->enc_stats_pre, frame, NULL,
-                            ost->frames_encoded);
+                            atomic_load(&ost->frames_encoded));
 
-        ost->frames_encoded++;
+        atomic_fetch_add(&ost->frames_encoded, 1);
         ost->samples_encoded += frame->nb_samples;
 
+        // set here rather than in reap_filters(), this may run on the encoder thread
+        if (enc->codec_type == AVMEDIA_TYPE_VIDEO && !ost->frame_aspect_ratio.num)
+            enc->sample_aspect_ratio = frame->sample_aspect_ratio;
+
         if (debug_ts) {
             av_log(ost, AV_LOG_INFO, "encoder <- type:%s "
                    "frame_pts:%s frame_pts_time:%s time_base:%d/%d\n",
@@ -901,15 +981,23 @@ static int encode_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
 
     update_benchmark(NULL);
 
-    ret = avcodec_send_frame(enc, frame);
+    t = stage_time_start();
+    ret = ost->enc_seg ? encseg_send_frame(ost->enc_seg, frame) :
+                         avcodec_send_frame(enc, frame);
+    stage_time_end(STAGE_ENCODE, t);
     if (ret < 0 && !(ret == AVERROR_EOF && !frame)) {
         av_log(ost, AV_LOG_ERROR, "Error submitting %s frame to the encoder\n",
                type_desc);
         return ret;
     }
+    if (frame)
+        enc_pending_update(ost, frame, NULL, 0);
 
     while (1) {
-        ret = avcodec_receive_packet(enc, pkt);
+        t = stage_time_start();
+        ret = ost->enc_seg ? encseg_receive_packet(ost->enc_seg, pkt) :
+                             avcodec_receive_packet(enc, pkt);
+        stage_time_end(STAGE_ENCODE, t);
         update_benchmark("%s_%s %d.%d", action, type_desc,
                          ost->file_index, ost->index);
 
@@ -923,18 +1011,23 @@ static int encode_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
             av_assert0(frame); // should never happen during flushing
             return 0;
         } else if (ret == AVERROR_EOF) {
-            of_output_packet(of, pkt, ost, 1);
-            return ret;
+            int ret_mux;
+
+            enc_pending_update(ost, NULL, NULL, 1);
+            ret_mux = of_output_packet(of, pkt, ost, 1);
+            return ret_mux < 0 ? ret_mux : ret;
         } else if (ret < 0) {
             av_log(ost, AV_LOG_ERROR, "%s encoding failed\n", type_desc);
             return ret;
         }
 
+        enc_pending_update(ost, NULL, pkt, 0);
+
         if (enc->codec_type == AVMEDIA_TYPE_VIDEO)
             update_video_stats(ost, pkt, !!vstats_filename);
         if (ost->enc_stats_post.io)
             enc_stats_write(ost, &ost->enc_stats_post, NULL, pkt,
-                            ost->packets_encoded);
+                            atomic_load(&ost->packets_encoded));
 
         if (debug_ts) {
             av_log(ost, AV_LOG_INFO, "encoder -> type:%s "
@@ -966,23 +1059,195 @@ static int encode_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
             exit_program(1);
         }
 
-        ost->data_size_enc += pkt->size;
+        atomic_fetch_add(&ost->data_size_enc, pkt->size);
 
-        ost->packets_encoded++;
+        atomic_fetch_add(&ost->packets_encoded, 1);
 
-        of_output_packet(of, pkt, ost, 0);
+        ret = of_output_packet(of, pkt, ost, 0);
+        if (ret < 0)
+            return ret;
     }
 
     av_assert0(0);
 }
 
+#define ENC_QUEUE_SIZE 4
+
+static void frame_move(void *dst, void *src)
+{
+    av_frame_move_ref(dst, src);
+}
+
+static void *encoder_thread(void *arg)
+{
+    OutputStream *ost = arg;
+    OutputFile    *of = output_files[ost->file_index];
+    AVFrame    *frame = NULL;
+    char name[16];
+    int ret = 0;
+
+    snprintf(name, sizeof(name), "enc%d:%d:%s", ost->file_index, ost->index,
+             ost->enc_ctx->codec->name);
+    ff_thread_setname(name);
+
+    frame = av_frame_alloc();
+    if (!frame) {
+        ret = AVERROR(ENOMEM);
+        goto finish;
+    }
+
+    while (1) {
+        int stream_idx;
+
+        ret = tq_receive(ost->enc_queue, &stream_idx, frame);
+        if (stream_idx < 0) {
+            // aborted by enc_thread_stop(), do not flush the encoder
+            ret = 0;
+            break;
+        }
+
+        // EOF from the sending side flushes the encoder
+        ret = encode_frame(of, ost, ret < 0 ? NULL : frame);
+        av_frame_unref(frame);
+        if (ret < 0)
+            break;
+    }
+
+finish:
+    av_frame_free(&frame);
+
+    tq_receive_finish(ost->enc_queue, 0);
+
+    return (void*)(intptr_t)ret;
+}
+
+/**
+ * Terminate the encoding thread for the given stream.
+ *
+ * @param flush when non-zero, the encoder is flushed before the thread exits;
+ *              otherwise any frames still queued are discarded
+ * @return the thread exit status, i.e. AVERROR_EOF after a successful flush
+ */
+static int enc_thread_stop(OutputStream *ost, int flush)
+{
+    void *ret;
+
+    if (!ost->enc_queue)
+        return 0;
+
+    if (!flush)
+        tq_receive_finish(ost->enc_queue, 0);
+    tq_send_finish(ost->enc_queue, 0);
+
+    pthread_join(ost->enc_thread, &ret);
+
+    tq_free(&ost->enc_queue);
+    av_frame_free(&ost->enc_queue_frame);
+
+    return (int)(intptr_t)ret;
+}
+
+static int enc_thread_start(OutputStream *ost)
+{
+    ObjPool *op;
+    int ret;
+
+    ost->enc_queue_frame = av_frame_alloc();
+    if (!ost->enc_queue_frame)
+        return AVERROR(ENOMEM);
+
+    op = objpool_alloc_frames();
+    if (!op)
+        goto fail;
+
+    ost->enc_queue = tq_alloc(1, ENC_QUEUE_SIZE, op, frame_move,
+                              TQ_FLAG_LOCKLESS | TQ_FLAG_SINGLE_PRODUCER);
+    if (!ost->enc_queue) {
+        objpool_free(&op);
+        goto fail;
+    }
+
+    ret = pthread_create(&ost->enc_thread, NULL, encoder_thread, ost);
+    if (ret) {
+        tq_free(&ost->enc_queue);
+        av_frame_free(&ost->enc_queue_frame);
+        return AVERROR(ret);
+    }
+
+    return 0;
+fail:
+    av_frame_free(&ost->enc_queue_frame);
+    return AVERROR(ENOMEM);
+}
+
+/*
+ * Audio and video encoding is moved to a dedicated thread per output stream
+ * once the muxer of its file is running, so that packets can be sent to it
+ * from any thread. Encoding stays on the main thread when the encoder output
+ * feeds state shared with other streams.
+ */
+static int enc_threads_start(void)
+{
+    if (do_benchmark_all || vstats_filename)
+        return 0;
+
+    for (OutputStream *ost = ost_iter(NULL); ost; ost = ost_iter(ost)) {
+        int ret;
+
+        if (!ost->enc_ctx || ost->enc_queue || !ost->initialized ||
+            atomic_load(&ost->finished) ||
+            !of_running(output_files[ost->file_index]))
+            continue;
+
+        if ((ost->enc_ctx->codec_type != AVMEDIA_TYPE_VIDEO &&
+             ost->enc_ctx->codec_type != AVMEDIA_TYPE_AUDIO) ||
+            ost->fix_sub_duration_heartbeat ||
+            ost->enc_stats_pre.io || ost->enc_stats_post.io)
+            continue;
+
+        ret = enc_thread_start(ost);
+        if (ret < 0) {
+            av_log(ost, AV_LOG_ERROR, "Error starting the encoding thread: %s\n",
+                   av_err2str(ret));
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/* Send a frame to the encoder, either directly or through its thread. */
+static int enc_send_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
+{
+    int ret;
+
+    if (!ost->enc_queue)
+        return encode_frame(of, ost, frame);
+
+    if (!frame)
+        return enc_thread_stop(ost, 1);
+
+    ret = av_frame_ref(ost->enc_queue_frame, frame);
+    if (ret < 0)
+        return ret;
+
+    ret = tq_send(ost->enc_queue, 0, ost->enc_queue_frame);
+    if (ret < 0) {
+        av_frame_unref(ost->enc_queue_frame);
+        // the encoding thread has terminated, return its status
+        return enc_thread_stop(ost, 1);
+    }
+
+    return 0;
+}
+
 static int submit_encode_frame(OutputFile *of, OutputStream *ost,
                                AVFrame *frame)
 {
     int ret;
 
     if (ost->sq_idx_encode < 0)
-        return encode_frame(of, ost, frame);
+        return enc_send_frame(of, ost, frame);
 
     if (frame) {
         ret = av_frame_ref(ost->sq_frame, frame);
@@ -1011,7 +1276,7 @@ static int submit_encode_frame(OutputFile *of, OutputStream *ost,
             return (ret == AVERROR(EAGAIN)) ? 0 : ret;
         }
 
-        ret = encode_frame(of, ost, enc_frame);
+        ret = enc_send_frame(of, ost, enc_frame);
         if (enc_frame)
             av_frame_unref(enc_frame);
         if (ret < 0) {
@@ -1056,7 +1321,7 @@ static void do_subtitle_out(OutputFile *of,
     int subtitle_out_size, nb, i, ret;
     AVCodecContext *enc;
     AVPacket *pkt = ost->pkt;
-    int64_t pts;
+    int64_t pts, t;
 
     if (sub->pts == AV_NOPTS_VALUE) {
         av_log(ost, AV_LOG_ERROR, "Subtitle packets must have a pts\n");
@@ -1097,9 +1362,11 @@ static void do_subtitle_out(OutputFile *of,
         if (i == 1)
             sub->num_rects = 0;
 
-        ost->frames_encoded++;
+        atomic_fetch_add(&ost->frames_encoded, 1);
 
+        t = stage_time_start();
         subtitle_out_size = avcodec_encode_subtitle(enc, pkt->data, pkt->size, sub);
+        stage_time_end(STAGE_ENCODE, t);
         if (i == 1)
             sub->num_rects = save_num_rects;
         if (subtitle_out_size < 0) {
@@ -1121,7 +1388,8 @@ static void do_subtitle_out(OutputFile *of,
         }
         pkt->dts = pkt->pts;
 
-        of_output_packet(of, pkt, ost, 0);
+        if (of_output_packet(of, pkt, ost, 0) < 0)
+            exit_program(1);
     }
 }
 
@@ -1388,8 +1656,10 @@ static int reap_filters(int flush)
         filtered_frame = ost->filtered_frame;
 
         while (1) {
+            int64_t t = stage_time_start();
             ret = av_buffersink_get_frame_flags(filter, filtered_frame,
                                                AV_BUFFERSINK_FLAG_NO_REQUEST);
+            stage_time_end(STAGE_FILTER, t);
             if (ret < 0) {
                 if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
                     av_log(NULL, AV_LOG_WARNING,
@@ -1400,7 +1670,7 @@ static int reap_filters(int flush)
                 }
                 break;
             }
-            if (ost->finished) {
+            if (atomic_load(&ost->finished)) {
                 av_frame_unref(filtered_frame);
                 continue;
             }
@@ -1420,9 +1690,6 @@ static int reap_filters(int flush)
 
             switch (av_buffersink_get_type(filter)) {
             case AVMEDIA_TYPE_VIDEO:
-                if (!ost->frame_aspect_ratio.num)
-                    enc->sample_aspect_ratio = filtered_frame->sample_aspect_ratio;
-
                 do_video_out(of, ost, filtered_frame);
                 break;
             case AVMEDIA_TYPE_AUDIO:
@@ -1541,7 +1808,7 @@ static void print_final_stats(int64_t total_size)
                    i, j, av_get_media_type_string(type));
             if (ost->enc_ctx) {
                 av_log(NULL, AV_LOG_VERBOSE, "%"PRIu64" frames encoded",
-                       ost->frames_encoded);
+                       atomic_load(&ost->frames_encoded));
                 if (type == AVMEDIA_TYPE_AUDIO)
                     av_log(NULL, AV_LOG_VERBOSE, " (%"PRIu64" samples)", ost->samples_encoded);
                 av_log(NULL, AV_LOG_VERBOSE, "; ");
@@ -1602,7 +1869,8 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
     av_bprint_init(&buf_script, 0, AV_BPRINT_SIZE_AUTOMATIC);
     for (OutputStream *ost = ost_iter(NULL); ost; ost = ost_iter(ost)) {
         const AVCodecContext * const enc = ost->enc_ctx;
-        const float q = enc ? ost->quality / (float) FF_QP2LAMBDA : -1;
+        const float q = enc ? atomic_load(&ost->quality) / (float) FF_QP2LAMBDA : -1;
+        const int64_t last_mux_dts = atomic_load(&ost->last_mux_dts);
 
         if (vid && ost->st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
             av_bprintf(&buf, "q=%2.1f ", q);
@@ -1632,7 +1900,7 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
             }
 
             if (enc && (enc->flags & AV_CODEC_FLAG_PSNR) &&
-                (ost->pict_type != AV_PICTURE_TYPE_NONE || is_last_report)) {
+                (atomic_load(&ost->pict_type) != AV_PICTURE_TYPE_NONE || is_last_report)) {
                 int j;
                 double error, error_sum = 0;
                 double scale, scale_sum = 0;
@@ -1644,7 +1912,7 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
                         error = enc->error[j];
                         scale = enc->width * enc->height * 255.0 * 255.0 * frame_number;
                     } else {
-                        error = ost->error[j];
+                        error = atomic_load(&ost->error[j]);
                         scale = enc->width * enc->height * 255.0 * 255.0;
                     }
                     if (j)
@@ -1664,8 +1932,8 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
             vid = 1;
         }
         /* compute min output value */
-        if (ost->last_mux_dts != AV_NOPTS_VALUE) {
-            pts = FFMAX(pts, ost->last_mux_dts);
+        if (last_mux_dts != AV_NOPTS_VALUE) {
+            pts = FFMAX(pts, last_mux_dts);
             if (copy_ts) {
                 if (copy_ts_first_pts == AV_NOPTS_VALUE && pts > 1)
                     copy_ts_first_pts = pts;
@@ -1763,6 +2031,74 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
         print_final_stats(total_size);
 }
 
+static void print_pipeline_stats(int is_last_report, int64_t timer_start,
+                                 int64_t cur_time)
+{
+    static const char *const stage_names[STAGE_NB] = {
+        [STAGE_DEMUX]  = "demux",
+        [STAGE_DECODE] = "decode",
+        [STAGE_FILTER] = "filter",
+        [STAGE_ENCODE] = "encode",
+        [STAGE_MUX]    = "mux",
+    };
+    static int64_t last_time = -1;
+    AVBPrint buf;
+
+    if (!stats_pipeline_avio)
+        return;
+
+    if (!is_last_report) {
+        if (last_time != -1 && cur_time - last_time < stats_period)
+            return;
+        last_time = cur_time;
+    }
+
+    av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
+
+    av_bprintf(&buf, "{\"time\":%.6f,\"stages\":{",
+               (cur_time - timer_start) / 1000000.0);
+    for (int i = 0; i < STAGE_NB; i++)
+        av_bprintf(&buf, "%s\"%s\":%.6f", i ? "," : "", stage_names[i],
+                   atomic_load(&stage_time[i]) / 1000000.0);
+
+    av_bprintf(&buf, "},\"inputs\":[");
+    for (int i = 0; i < nb_input_files; i++)
+        av_bprintf(&buf, "%s{\"file\":%d,\"demux_queue\":%d}",
+                   i ? "," : "", i, ifile_queue_size(input_files[i]));
+
+    av_bprintf(&buf, "],\"outputs\":[");
+    for (int i = 0; i < nb_output_files; i++) {
+        OutputFile *of = output_files[i];
+        unsigned int mux_sq;
+        size_t mux_queue;
+
+        of_queue_stats(of, &mux_queue, &mux_sq);
+        av_bprintf(&buf, "%s{\"file\":%d,\"mux_queue\":%zu,"
+                   "\"mux_sync_queue\":%u,\"enc_sync_queue\":%u,\"streams\":[",
+                   i ? "," : "", i, mux_queue, mux_sq,
+                   of->sq_encode ? sq_nb_buffered(of->sq_encode) : 0);
+
+        for (int j = 0; j < of->nb_streams; j++) {
+            OutputStream *ost = of->streams[j];
+
+            av_bprintf(&buf, "%s{\"index\":%d,\"enc_queue\":%zu,"
+                       "\"frames_in_flight\":%d,\"sync_queue_bytes\":%zu}",
+                       j ? "," : "", j,
+                       ost->enc_queue ? tq_nb_items(ost->enc_queue) : 0,
+                       atomic_load(&ost->enc_frames_pending),
+                       of_stream_sq_bytes(of, ost));
+        }
+        av_bprintf(&buf, "]}");
+    }
+
+    av_bprintf(&buf, "],\"progress\":\"%s\"}\n",
+               is_last_report ? "end" : "continue");
+
+    avio_write(stats_pipeline_avio, buf.str, FFMIN(buf.len, buf.size - 1));
+    avio_flush(stats_pipeline_avio);
+    av_bprint_finalize(&buf, NULL);
+}
+
 static int ifilter_parameters_from_codecpar(InputFilter *ifilter, AVCodecParameters *par)
 {
     int ret;
@@ -1826,7 +2162,8 @@ static void flush_encoders(void)
                     exit_program(1);
                 }
 
-                of_output_packet(of, ost->pkt, ost, 1);
+                if (of_output_packet(of, ost->pkt, ost, 1) < 0)
+                    exit_program(1);
             }
 
             init_output_stream_wrapper(ost, NULL, 1);
@@ -1851,7 +2188,7 @@ static int check_output_constraints(InputStream *ist, OutputStream *ost)
     if (ost->ist != ist)
         return 0;
 
-    if (ost->finished & MUXER_FINISHED)
+    if (atomic_load(&ost->finished) & MUXER_FINISHED)
         return 0;
 
     if (of->start_time != AV_NOPTS_VALUE && ist->pts < of->start_time)
@@ -1860,18 +2197,25 @@ static int check_output_constraints(InputStream *ist, OutputStream *ost)
     return 1;
 }
 
-static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *pkt)
+/*
+ * When can_move is set, the packet is not needed by the caller anymore and
+ * its reference is moved to the output instead of being copied.
+ */
+static void do_streamcopy(InputStream *ist, OutputStream *ost, AVPacket *pkt,
+                         int can_move)
 {
     OutputFile *of = output_files[ost->file_index];
     InputFile   *f = input_files [ist->file_index];
     int64_t start_time = (of->start_time == AV_NOPTS_VALUE) ? 0 : of->start_time;
     int64_t ost_tb_start_time = av_rescale_q(start_time, AV_TIME_BASE_Q, ost->mux_timebase);
+    int64_t pts = AV_NOPTS_VALUE, dts, dur;
     AVPacket *opkt = ost->pkt;
 
     av_packet_unref(opkt);
     // EOF: flush output bitstream filters.
     if (!pkt) {
-        of_output_packet(of, opkt, ost, 1);
+        if (of_output_packet(of, opkt, ost, 1) < 0)
+            exit_program(1);
         return;
     }
 
@@ -1904,30 +2248,25 @@ static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *p
         }
     }
 
-    if (av_packet_ref(opkt, pkt) < 0)
-        exit_program(1);
-
-    opkt->time_base = ost->mux_timebase;
-
     if (pkt->pts != AV_NOPTS_VALUE)
-        opkt->pts = av_rescale_q(pkt->pts, ist->st->time_base, opkt->time_base) - ost_tb_start_time;
+        pts = av_rescale_q(pkt->pts, ist->st->time_base, ost->mux_timebase) - ost_tb_start_time;
 
     if (pkt->dts == AV_NOPTS_VALUE) {
-        opkt->dts = av_rescale_q(ist->dts, AV_TIME_BASE_Q, opkt->time_base);
+        dts = av_rescale_q(ist->dts, AV_TIME_BASE_Q, ost->mux_timebase);
     } else if (ost->st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
         int duration = av_get_audio_frame_duration2(ist->par, pkt->size);
         if(!duration)
             duration = ist->par->frame_size;
-        opkt->dts = av_rescale_delta(ist->st->time_base, pkt->dts,
-                                    (AVRational){1, ist->par->sample_rate}, duration,
-                                    &ist->filter_in_rescale_delta_last, opkt->time_base);
+        dts = av_rescale_delta(ist->st->time_base, pkt->dts,
+                               (AVRational){1, ist->par->sample_rate}, duration,
+                               &ist->filter_in_rescale_delta_last, ost->mux_timebase);
         /* dts will be set immediately afterwards to what pts is now */
-        opkt->pts = opkt->dts - ost_tb_start_time;
+        pts = dts - ost_tb_start_time;
     } else
-        opkt->dts = av_rescale_q(pkt->dts, ist->st->time_base, opkt->time_base);
-    opkt->dts -= ost_tb_start_time;
+        dts = av_rescale_q(pkt->dts, ist->st->time_base, ost->mux_timebase);
+    dts -= ost_tb_start_time;
 
-    opkt->duration = av_rescale_q(pkt->duration, ist->st->time_base, opkt->time_base);
+    dur = av_rescale_q(pkt->duration, ist->st->time_base, ost->mux_timebase);
 
     {
         int ret = trigger_fix_sub_duration_heartbeat(ost, pkt);
@@ -1939,7 +2278,18 @@ static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *p
         }
     }
 
-    of_output_packet(of, opkt, ost, 0);
+    if (can_move)
+        av_packet_move_ref(opkt, pkt);
+    else if (av_packet_ref(opkt, pkt) < 0)
+        exit_program(1);
+
+    opkt->time_base = ost->mux_timebase;
+    opkt->pts       = pts;
+    opkt->dts       = dts;
+    opkt->duration  = dur;
+
+    if (of_output_packet(of, opkt, ost, 0) < 0)
+        exit_program(1);
 
     ost->streamcopy_started = 1;
 }
@@ -1980,6 +2330,7 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame, int keep_ref
     AVFrameSideData *sd;
     int need_reinit, ret;
     int buffersrc_flags = AV_BUFFERSRC_FLAG_PUSH;
+    int64_t t;
 
     if (keep_reference)
         buffersrc_flags |= AV_BUFFERSRC_FLAG_KEEP_REF;
@@ -2044,7 +2395,9 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame, int keep_ref
         }
     }
 
+    t = stage_time_start();
     ret = av_buffersrc_add_frame_flags(ifilter->filter, frame, buffersrc_flags);
+    stage_time_end(STAGE_FILTER, t);
     if (ret < 0) {
         if (ret != AVERROR_EOF)
             av_log(NULL, AV_LOG_ERROR, "Error while filtering: %s\n", av_err2str(ret));
@@ -2124,13 +2477,46 @@ static int decode(InputStream *ist, AVCodecContext *avctx,
     return 0;
 }
 
+/* Check whether all the output streams fed by the filter input are finished */
+static int ifilter_outputs_finished(const InputFilter *ifilter)
+{
+    const FilterGraph *fg = ifilter->graph;
+
+    for (int i = 0; i < fg->nb_outputs; i++) {
+        OutputStream *ost = fg->outputs[i]->ost;
+        if (!ost || !atomic_load(&ost->finished))
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Fan out a decoded frame to all the filtergraphs using it. Every filtergraph
+ * but the last one takes a new reference to the same frame data, the last one
+ * takes over decoded_frame itself. Filtergraphs whose outputs are all finished
+ * do not get any more frames, since those would only be dropped after
+ * filtering.
+ *
+ * There is no queue per filtergraph here: all the filtergraphs are run by
+ * this thread, so a queue would only hold frames until they are pushed right
+ * after. The consumers are decoupled further down, where each encoding thread
+ * has its own bounded queue and only stalls decoding once it is full.
+ */
 static int send_frame_to_filters(InputStream *ist, AVFrame *decoded_frame)
 {
-    int i, ret;
+    int i, ret = 0, last = -1;
 
-    av_assert1(ist->nb_filters > 0); /* ensure ret is initialized */
-    for (i = 0; i < ist->nb_filters; i++) {
-        ret = ifilter_send_frame(ist->filters[i], decoded_frame, i < ist->nb_filters - 1);
+    av_assert1(ist->nb_filters > 0);
+    for (i = 0; i < ist->nb_filters; i++)
+        if (!ifilter_outputs_finished(ist->filters[i]))
+            last = i;
+
+    for (i = 0; i <= last; i++) {
+        if (i < last && ifilter_outputs_finished(ist->filters[i]))
+            continue;
+
+        ret = ifilter_send_frame(ist->filters[i], decoded_frame, i < last);
         if (ret == AVERROR_EOF)
             ret = 0; /* ignore */
         if (ret < 0) {
@@ -2149,9 +2535,12 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output,
     AVCodecContext *avctx = ist->dec_ctx;
     int ret, err = 0;
     AVRational decoded_frame_tb;
+    int64_t t;
 
     update_benchmark(NULL);
+    t = stage_time_start();
     ret = decode(ist, avctx, decoded_frame, got_output, pkt);
+    stage_time_end(STAGE_DECODE, t);
     update_benchmark("decode_audio %d.%d", ist->file_index, ist->st->index);
     if (ret < 0)
         *decode_failed = 1;
@@ -2206,6 +2595,7 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int64_
     int i, ret = 0, err = 0;
     int64_t best_effort_timestamp;
     int64_t dts = AV_NOPTS_VALUE;
+    int64_t t;
 
     // With fate-indeo3-2, we're getting 0-sized packets before EOF for some
     // reason. This seems like a semi-critical bug. Don't trigger EOF, and
@@ -2230,7 +2620,9 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int64_
     }
 
     update_benchmark(NULL);
+    t = stage_time_start();
     ret = decode(ist, ist->dec_ctx, decoded_frame, got_output, pkt);
+    stage_time_end(STAGE_DECODE, t);
     update_benchmark("decode_video %d.%d", ist->file_index, ist->st->index);
     if (ret < 0)
         *decode_failed = 1;
@@ -2516,8 +2908,10 @@ static int transcode_subtitles(InputStream *ist, const AVPacket *pkt,
                                int *got_output, int *decode_failed)
 {
     AVSubtitle subtitle;
+    int64_t t = stage_time_start();
     int ret = avcodec_decode_subtitle2(ist->dec_ctx,
                                        &subtitle, got_output, pkt);
+    stage_time_end(STAGE_DECODE, t);
 
     check_decode_result(NULL, got_output, ret);
 
@@ -2548,13 +2942,23 @@ static int send_filter_eof(InputStream *ist)
     return 0;
 }
 
-/* pkt = NULL means EOF (needed to flush decoder buffers) */
-static int process_input_packet(InputStream *ist, const AVPacket *pkt, int no_eof)
+static int streamcopy_needed(InputStream *ist, OutputStream *ost,
+                             const AVPacket *pkt, int no_eof)
+{
+    return check_output_constraints(ist, ost) && !ost->enc_ctx &&
+           (pkt || !no_eof);
+}
+
+/* pkt = NULL means EOF (needed to flush decoder buffers)
+ * the packet may be consumed by streamcopy, it must not be used after this
+ * function returns */
+static int process_input_packet(InputStream *ist, AVPacket *pkt, int no_eof)
 {
     const AVCodecParameters *par = ist->par;
     int ret = 0;
     int repeating = 0;
     int eof_reached = 0;
+    int nb_streamcopy = 0;
 
     AVPacket *avpkt = ist->pkt;
 
@@ -2575,7 +2979,7 @@ static int process_input_packet(InputStream *ist, const AVPacket *pkt, int no_eo
     if (ist->next_pts == AV_NOPTS_VALUE)
         ist->next_pts = ist->pts;
 
-    if (pkt) {
+    if (pkt && ist->decoding_needed) {
         av_packet_unref(avpkt);
         ret = av_packet_ref(avpkt, pkt);
         if (ret < 0)
@@ -2730,12 +3134,17 @@ static int process_input_packet(InputStream *ist, const AVPacket *pkt, int no_eo
     } else if (!ist->decoding_needed)
         eof_reached = 1;
 
+    /* the last output stream the packet is copied to can take it over */
+    if (pkt) {
+        for (OutputStream *ost = ost_iter(NULL); ost; ost = ost_iter(ost))
+            nb_streamcopy += streamcopy_needed(ist, ost, pkt, no_eof);
+    }
+
     for (OutputStream *ost = ost_iter(NULL); ost; ost = ost_iter(ost)) {
-        if (!check_output_constraints(ist, ost) || ost->enc_ctx ||
-            (!pkt && no_eof))
+        if (!streamcopy_needed(ist, ost, pkt, no_eof))
             continue;
 
-        do_streamcopy(ist, ost, pkt);
+        do_streamcopy(ist, ost, pkt, pkt && !--nb_streamcopy);
     }
 
     return !eof_reached;
@@ -3230,7 +3639,20 @@ static int init_output_stream(OutputStream *ost, AVFrame *frame,
             return ret;
         }
 
-        if ((ret = avcodec_open2(ost->enc_ctx, codec, &ost->encoder_opts)) < 0) {
+        if (ost->enc_segments > 1 &&
+            (ost->enc_ctx->flags & (AV_CODEC_FLAG_PASS1 | AV_CODEC_FLAG_PASS2))) {
+            av_log(ost, AV_LOG_WARNING, "Segmented encoding is not "
+                   "supported with two-pass encoding, disabling it\n");
+            ost->enc_segments = 0;
+        }
+
+        // the segment encoders stand in for enc_ctx, which is not opened then
+        if (ost->enc_segments > 1)
+            ret = encseg_alloc(&ost->enc_seg, ost->enc_ctx,
+                               &ost->encoder_opts, ost->enc_segments);
+        else
+            ret = avcodec_open2(ost->enc_ctx, codec, &ost->encoder_opts);
+        if (ret < 0) {
             if (ret == AVERROR_EXPERIMENTAL)
                 abort_codec_experimental(codec, 1);
             snprintf(error, error_len,
@@ -3309,7 +3731,7 @@ static int init_output_stream(OutputStream *ost, AVFrame *frame,
     if (ret < 0)
         return ret;
 
-    return ret;
+    return enc_threads_start();
 }
 
 static int transcode_init(void)
@@ -3455,7 +3877,7 @@ static int transcode_init(void)
 static int need_output(void)
 {
     for (OutputStream *ost = ost_iter(NULL); ost; ost = ost_iter(ost)) {
-        if (ost->finished)
+        if (atomic_load(&ost->finished))
             continue;
 
         return 1;
@@ -3480,18 +3902,19 @@ static OutputStream *choose_output(void)
         if (ost->filter && ost->last_filter_pts != AV_NOPTS_VALUE) {
             opts = ost->last_filter_pts;
         } else {
-            opts = ost->last_mux_dts == AV_NOPTS_VALUE ?
-                   INT64_MIN : ost->last_mux_dts;
-            if (ost->last_mux_dts == AV_NOPTS_VALUE)
+            opts = atomic_load(&ost->last_mux_dts);
+            if (opts == AV_NOPTS_VALUE) {
+                opts = INT64_MIN;
                 av_log(ost, AV_LOG_DEBUG,
                     "cur_dts is invalid [init:%d i_done:%d finish:%d] (this is harmless if it occurs once at the start per stream)\n",
-                    ost->initialized, ost->inputs_done, ost->finished);
+                    ost->initialized, ost->inputs_done, atomic_load(&ost->finished));
+            }
         }
 
         if (!ost->initialized && !ost->inputs_done)
             return ost->unavailable ? NULL : ost;
 
-        if (!ost->finished && opts < opts_min) {
+        if (!atomic_load(&ost->finished) && opts < opts_min) {
             opts_min = opts;
             ost_min  = ost->unavailable ? NULL : ost;
         }
@@ -3799,7 +4222,8 @@ static int process_input(int file_index)
                 if (ost->ist == ist &&
                     (!ost->enc_ctx || ost->enc_ctx->codec_type == AVMEDIA_TYPE_SUBTITLE)) {
                     OutputFile *of = output_files[ost->file_index];
-                    of_output_packet(of, ost->pkt, ost, 1);
+                    if (of_output_packet(of, ost->pkt, ost, 1) < 0)
+                        exit_program(1);
                 }
             }
         }
@@ -3875,9 +4299,12 @@ static int transcode_from_filter(FilterGraph *graph, InputStream **best_ist)
     int nb_requests, nb_requests_max = 0;
     InputFilter *ifilter;
     InputStream *ist;
+    int64_t t;
 
     *best_ist = NULL;
+    t = stage_time_start();
     ret = avfilter_graph_request_oldest(graph->graph);
+    stage_time_end(STAGE_FILTER, t);
     if (ret >= 0)
         return reap_filters(0);
 
@@ -4044,6 +4471,7 @@ static int transcode(void)
 
         /* dump report by using the output first video and audio streams */
         print_report(0, timer_start, cur_time);
+        print_pipeline_stats(0, timer_start, cur_time);
     }
 
     /* at the end of stream, we must flush the decoder buffers */
@@ -4065,6 +4493,7 @@ static int transcode(void)
 
     /* dump report by using the first video and audio streams */
     print_report(1, timer_start, av_gettime_relative());
+    print_pipeline_stats(1, timer_start, av_gettime_relative());
 
     /* close each encoder */
     for (OutputStream *ost = ost_iter(NULL); ost; ost = ost_iter(ost)) {
@@ -4161,6 +4590,18 @@ int main(int argc, char **argv)
     if (ret < 0)
         exit_program(1);
 
+    /* in worker mode, only the job processes get past this point */
+    if (worker_source) {
+        ret = worker_run(&argc, &argv);
+        if (ret <= 0)
+            exit_program(ret < 0);
+
+        parse_loglevel(argc, argv, options);
+        ret = ffmpeg_parse_options(argc, argv);
+        if (ret < 0)
+            exit_program(1);
+    }
+
     if (nb_output_files <= 0 && nb_input_files == 0) {
         show_usage();
         av_log(NULL, AV_LOG_WARNING, "Use -h to get full help or, even better, run 'man %s'\n", program_name);
@@ -4178,6 +4619,7 @@ int main(int argc, char **argv)
         exit_program(1);
     if (do_benchmark) {
         int64_t utime, stime, rtime;
+        uint64_t nb_packets = 0;
         current_time = get_benchmark_time_stamps();
         utime = current_time.user_usec - ti.user_usec;
         stime = current_time.sys_usec  - ti.sys_usec;
@@ -4185,6 +4627,11 @@ int main(int argc, char **argv)
         av_log(NULL, AV_LOG_INFO,
                "bench: utime=%0.3fs stime=%0.3fs rtime=%0.3fs\n",
                utime / 1000000.0, stime / 1000000.0, rtime / 1000000.0);
+
+        for (OutputStream *ost = ost_iter(NULL); ost; ost = ost_iter(ost))
+            nb_packets += atomic_load(&ost->packets_written);
+        av_log(NULL, AV_LOG_INFO, "bench: packets=%"PRIu64" rate=%0.1f/s\n",
+               nb_packets, rtime > 0 ? nb_packets * 1000000.0 / rtime : 0.0);
     }
     av_log(NULL, AV_LOG_DEBUG, "%"PRIu64" frames successfully decoded, %"PRIu64" decoding errors\n",
            decode_error_stat[0], decode_error_stat[1]);
@@ -27,7 +27,9 @@
 #include <signal.h>
 
 #include "cmdutils.h"
+#include "enc_segments.h"
 #include "sync_queue.h"
+#include "thread_queue.h"
 
 #include "libavformat/avformat.h"
 #include "libavformat/avio.h"
@@ -72,6 +74,16 @@ enum HWAccelID {
     HWACCEL_GENERIC,
 };
 
+/* processing stages, for -stats_pipeline */
+enum PipelineStage {
+    STAGE_DEMUX,
+    STAGE_DECODE,
+    STAGE_FILTER,
+    STAGE_ENCODE,
+    STAGE_MUX,
+    STAGE_NB,
+};
+
 typedef struct HWDevice {
     const char *name;
     enum AVHWDeviceType type;
@@ -160,6 +172,8 @@ typedef struct OptionsContext {
     float mux_preload;
     float mux_max_delay;
     float shortest_buf_duration;
+    int64_t shortest_buf_size;
+    float shortest_buf_tolerance;
     int shortest;
     int bitexact;
 
@@ -252,6 +266,8 @@ typedef struct OptionsContext {
     int        nb_enc_time_bases;
     SpecifierOpt *autoscale;
     int        nb_autoscale;
+    SpecifierOpt *enc_segments;
+    int        nb_enc_segments;
     SpecifierOpt *bits_per_raw_sample;
     int        nb_bits_per_raw_sample;
     SpecifierOpt *enc_stats_pre;
@@ -575,8 +591,9 @@ typedef struct OutputStream {
     /* predicted pts of the next frame to be encoded
      * audio/video encoding only */
     int64_t next_pts;
-    /* dts of the last packet sent to the muxing queue, in AV_TIME_BASE_Q */
-    int64_t last_mux_dts;
+    /* dts of the last packet sent to the muxing queue, in AV_TIME_BASE_Q;
+     * may be updated from the encoder thread */
+    atomic_int_least64_t last_mux_dts;
     /* pts of the last frame received from the filters, in AV_TIME_BASE_Q */
     int64_t last_filter_pts;
 
@@ -610,6 +627,9 @@ typedef struct OutputStream {
     int autoscale;
     int bitexact;
     int bits_per_raw_sample;
+    /* number of GOP-aligned segments encoded in parallel, see enc_segments.h */
+    int enc_segments;
+    EncSegments *enc_seg;
 #if FFMPEG_ROTATION_METADATA
     double rotate_override_value;
 #endif
@@ -636,7 +656,9 @@ typedef struct OutputStream {
     AVDictionary *sws_dict;
     AVDictionary *swr_opts;
     char *apad;
-    OSTFinished finished;        /* no more packets should be written for this stream */
+    /* OSTFinished flags, no more packets should be written for this stream;
+     * may be updated from the encoder and muxer threads */
+    atomic_int finished;
     int unavailable;                     /* true if the steram is unavailable (possibly temporarily) */
 
     // init_output_stream() has been called for this stream
@@ -653,27 +675,28 @@ typedef struct OutputStream {
 
     int keep_pix_fmt;
 
-    /* stats */
+    /* stats, the atomic ones are updated from the encoder thread and read
+     * by print_report() */
     // combined size of all the packets sent to the muxer
     uint64_t data_size_mux;
     // combined size of all the packets received from the encoder
-    uint64_t data_size_enc;
+    atomic_uint_least64_t data_size_enc;
     // number of packets send to the muxer
     atomic_uint_least64_t packets_written;
     // number of frames/samples sent to the encoder
-    uint64_t frames_encoded;
+    atomic_uint_least64_t frames_encoded;
     uint64_t samples_encoded;
     // number of packets received from the encoder
-    uint64_t packets_encoded;
+    atomic_uint_least64_t packets_encoded;
 
     /* packet quality factor */
-    int quality;
+    atomic_int quality;
 
     /* packet picture type */
-    int pict_type;
+    atomic_int pict_type;
 
     /* frame encode sum of squared error values */
-    int64_t error[4];
+    atomic_int_least64_t error[4];
 
     int sq_idx_encode;
     int sq_idx_mux;
@@ -681,6 +704,18 @@ typedef struct OutputStream {
     EncStats enc_stats_pre;
     EncStats enc_stats_post;
 
+    /* audio/video encoding thread, NULL queue when encoding synchronously */
+    pthread_t    enc_thread;
+    ThreadQueue *enc_queue;
+    /* temporary storage for frames submitted to enc_queue */
+    AVFrame     *enc_queue_frame;
+    /* pts of the frames sent to the encoder that no packet has caught up
+     * with yet, only accessed by the thread encoding the stream; allocated
+     * with -stats_pipeline */
+    AVFifo      *enc_pending_pts;
+    /* number of entries in enc_pending_pts, read by -stats_pipeline */
+    atomic_int   enc_frames_pending;
+
     /*
      * bool on whether this stream should be utilized for splitting
      * subtitles utilizing fix_sub_duration at random access points.
@@ -741,9 +776,11 @@ extern int64_t stats_period;
 extern int qp_hist;
 extern int stdin_interaction;
 extern AVIOContext *progress_avio;
+extern AVIOContext *stats_pipeline_avio;
 extern float max_error_rate;
 
 extern char *filter_nbthreads;
+extern char *filter_thread_type;
 extern int filter_complex_nbthreads;
 extern int vstats_version;
 extern int auto_conversion_filters;
@@ -755,6 +792,10 @@ extern HWDevice *filter_hw_device;
 
 extern unsigned nb_output_dumped;
 extern int main_return_code;
+extern volatile int received_nb_signals;
+
+extern char *worker_source;
+extern int   worker_jobs;
 
 extern int ignore_unknown_streams;
 extern int copy_unknown_streams;
@@ -768,6 +809,14 @@ extern int do_psnr;
 void term_init(void);
 void term_exit(void);
 
+/*
+ * Get the starting timestamp for timing a call in the given pipeline stage,
+ * to be passed to stage_time_end() after the call. Does nothing unless
+ * -stats_pipeline is used. May be called from any thread.
+ */
+int64_t stage_time_start(void);
+void    stage_time_end(enum PipelineStage stage, int64_t start);
+
 void show_usage(void);
 
 void remove_avoptions(AVDictionary **a, AVDictionary *b);
@@ -800,6 +849,15 @@ HWDevice *hw_device_get_by_name(const char *name);
 int hw_device_init_from_string(const char *arg, HWDevice **dev);
 void hw_device_free_all(void);
 
+/**
+ * Run jobs read from worker_source, each in a new process.
+ *
+ * @return 1 in a job process, with argc/argv set to the job command line;
+ *         0 in the worker process once there are no more jobs to run,
+ *         a negative error code on failure
+ */
+int worker_run(int *argc, char ***argv);
+
 int hw_device_setup_for_decode(InputStream *ist);
 int hw_device_setup_for_encode(OutputStream *ost);
 int hw_device_setup_for_filter(FilterGraph *fg);
@@ -829,9 +887,28 @@ void of_enc_stats_close(void);
  * If eof is set, instead indicate EOF to all bitstream filters and
  * therefore flush any delayed packets to the output.  A blank packet
  * must be supplied in this case.
+ *
+ * May be called from the encoding threads once of_running() returns 1 for
+ * this file. Errors are logged here; a negative error code is only returned
+ * when they should abort the program (-xerror), which is left to the caller.
  */
-void of_output_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int eof);
+int of_output_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int eof);
 int64_t of_filesize(OutputFile *of);
+/*
+ * Return 1 if the muxer has been initialized and its thread started, after
+ * which packets may be submitted to it from any thread; 0 otherwise.
+ */
+int of_running(OutputFile *of);
+/*
+ * Get the number of packets currently waiting in the muxer thread queue and
+ * in the muxing sync queue, for statistics.
+ */
+void of_queue_stats(OutputFile *of, size_t *mux_queue, unsigned int *sync_queue);
+/**
+ * Get the size of the data buffered in the sync queues for the given
+ * output stream. May be called from any thread.
+ */
+size_t of_stream_sq_bytes(OutputFile *of, const OutputStream *ost);
 
 int ifile_open(const OptionsContext *o, const char *filename);
 void ifile_close(InputFile **f);
@@ -847,6 +924,11 @@ void ifile_close(InputFile **f);
  * - a negative error code on failure
  */
 int ifile_get_packet(InputFile *f, AVPacket **pkt);
+/*
+ * Get the number of packets read by the demuxing thread and not yet
+ * retrieved with ifile_get_packet(), for statistics.
+ */
+int ifile_queue_size(InputFile *f);
 
 /* iterate over all input streams in all input files;
  * pass NULL to start iteration */
@@ -64,6 +64,18 @@ typedef struct DemuxStream {
     int64_t max_pts; /* pts with the higher value in a current stream */
 } DemuxStream;
 
+/* maximum number of packets sent to the main thread in one message */
+#define DEMUX_BATCH_SIZE 16
+
+typedef struct DemuxMsg {
+    AVPacket *pkt[DEMUX_BATCH_SIZE];
+    // repeat_pict from the demuxer-internal parser
+    int repeat_pict[DEMUX_BATCH_SIZE];
+    int nb_pkts;
+
+    int looping;
+} DemuxMsg;
+
 typedef struct Demuxer {
     InputFile f;
 
@@ -85,15 +97,14 @@ typedef struct Demuxer {
     int                   thread_queue_size;
     pthread_t             thread;
     int                   non_blocking;
-} Demuxer;
+    /* packets may be grouped into batches before being sent to the main thread */
+    int                   batch;
 
-typedef struct DemuxMsg {
-    AVPacket *pkt;
-    int looping;
-
-    // repeat_pict from the demuxer-internal parser
-    int repeat_pict;
-} DemuxMsg;
+    /* the last batch received by the main thread, and the index of the next
+     * packet in it to be returned by ifile_get_packet() */
+    DemuxMsg              msg;
+    int                   msg_pos;
+} Demuxer;
 
 static DemuxStream *ds_from_ist(InputStream *ist)
 {
@@ -260,11 +271,45 @@ static void thread_set_name(InputFile *f)
     ff_thread_setname(name);
 }
 
+static void demux_msg_free(DemuxMsg *msg, int start)
+{
+    for (int i = start; i < msg->nb_pkts; i++)
+        av_packet_free(&msg->pkt[i]);
+    msg->nb_pkts = 0;
+}
+
+static int demux_send(Demuxer *d, DemuxMsg *msg, unsigned *flags)
+{
+    int ret;
+
+    ret = av_thread_message_queue_send(d->in_thread_queue, msg, *flags);
+    if (*flags && ret == AVERROR(EAGAIN)) {
+        *flags = 0;
+        ret = av_thread_message_queue_send(d->in_thread_queue, msg, *flags);
+        av_log(d->f.ctx, AV_LOG_WARNING,
+               "Thread message queue blocking; consider raising the "
+               "thread_queue_size option (current value: %d)\n",
+               d->thread_queue_size);
+    }
+    if (ret < 0) {
+        if (ret != AVERROR_EOF)
+            av_log(d->f.ctx, AV_LOG_ERROR,
+                   "Unable to send packet to main thread: %s\n",
+                   av_err2str(ret));
+        demux_msg_free(msg, 0);
+        return ret;
+    }
+
+    msg->nb_pkts = 0;
+    return 0;
+}
+
 static void *input_thread(void *arg)
 {
     Demuxer   *d = arg;
     InputFile *f = &d->f;
     AVPacket *pkt;
+    DemuxMsg msg = { { NULL } };
     unsigned flags = d->non_blocking ? AV_THREAD_MESSAGE_NONBLOCK : 0;
     int ret = 0;
 
@@ -277,19 +322,35 @@ static void *input_thread(void *arg)
     thread_set_name(f);
 
     while (1) {
-        DemuxMsg msg = { NULL };
+        int64_t t = stage_time_start();
 
         ret = av_read_frame(f->ctx, pkt);
+        stage_time_end(STAGE_DEMUX, t);
 
         if (ret == AVERROR(EAGAIN)) {
+            if (msg.nb_pkts) {
+                ret = demux_send(d, &msg, &flags);
+                if (ret < 0)
+                    break;
+            }
             av_usleep(10000);
             continue;
         }
         if (ret < 0) {
+            int err = ret;
+
+            /* hand over the packets read so far */
+            if (msg.nb_pkts) {
+                ret = demux_send(d, &msg, &flags);
+                if (ret < 0)
+                    break;
+            }
+            ret = err;
+
             if (d->loop) {
                 /* signal looping to the consumer thread */
-                msg.looping = 1;
-                ret = av_thread_message_queue_send(d->in_thread_queue, &msg, 0);
+                DemuxMsg msg_loop = { .looping = 1 };
+                ret = av_thread_message_queue_send(d->in_thread_queue, &msg_loop, 0);
                 if (ret >= 0)
                     ret = seek_to_start(d);
                 if (ret >= 0)
@@ -331,38 +392,32 @@ static void *input_thread(void *arg)
             }
         }
 
-        ts_fixup(d, pkt, &msg.repeat_pict);
+        ts_fixup(d, pkt, &msg.repeat_pict[msg.nb_pkts]);
 
-        msg.pkt = av_packet_alloc();
-        if (!msg.pkt) {
+        msg.pkt[msg.nb_pkts] = av_packet_alloc();
+        if (!msg.pkt[msg.nb_pkts]) {
             av_packet_unref(pkt);
             ret = AVERROR(ENOMEM);
             break;
         }
-        av_packet_move_ref(msg.pkt, pkt);
-        ret = av_thread_message_queue_send(d->in_thread_queue, &msg, flags);
-        if (flags && ret == AVERROR(EAGAIN)) {
-            flags = 0;
-            ret = av_thread_message_queue_send(d->in_thread_queue, &msg, flags);
-            av_log(f->ctx, AV_LOG_WARNING,
-                   "Thread message queue blocking; consider raising the "
-                   "thread_queue_size option (current value: %d)\n",
-                   d->thread_queue_size);
-        }
-        if (ret < 0) {
-            if (ret != AVERROR_EOF)
-                av_log(f->ctx, AV_LOG_ERROR,
-                       "Unable to send packet to main thread: %s\n",
-                       av_err2str(ret));
-            av_packet_free(&msg.pkt);
+        av_packet_move_ref(msg.pkt[msg.nb_pkts++], pkt);
+
+        /* keep accumulating packets while the main thread still has some
+         * queued, so that it is never left waiting for a partial batch */
+        if (d->batch && msg.nb_pkts < DEMUX_BATCH_SIZE &&
+            av_thread_message_queue_nb_elems(d->in_thread_queue) > 0)
+            continue;
+
+        ret = demux_send(d, &msg, &flags);
+        if (ret < 0)
             break;
-        }
     }
 
 finish:
     av_assert0(ret < 0);
     av_thread_message_queue_set_err_recv(d->in_thread_queue, ret);
 
+    demux_msg_free(&msg, 0);
     av_packet_free(&pkt);
 
     av_log(d, AV_LOG_VERBOSE, "Terminating demuxer thread\n");
@@ -379,7 +434,8 @@ static void thread_stop(Demuxer *d)
         return;
     av_thread_message_queue_set_err_send(d->in_thread_queue, AVERROR_EOF);
     while (av_thread_message_queue_recv(d->in_thread_queue, &msg, 0) >= 0)
-        av_packet_free(&msg.pkt);
+        demux_msg_free(&msg, 0);
+    demux_msg_free(&d->msg, d->msg_pos);
 
     pthread_join(d->thread, NULL);
     av_thread_message_queue_free(&d->in_thread_queue);
@@ -398,6 +454,10 @@ static int thread_start(Demuxer *d)
         (f->ctx->pb ? !f->ctx->pb->seekable :
          strcmp(f->ctx->iformat->name, "lavfi")))
         d->non_blocking = 1;
+    /* batching may delay a packet until the next one is read, so only
+     * do it for inputs that can be read without waiting */
+    d->batch = !d->non_blocking && f->ctx->pb &&
+               (f->ctx->pb->seekable & AVIO_SEEKABLE_NORMAL);
     ret = av_thread_message_queue_alloc(&d->in_thread_queue,
                                         d->thread_queue_size, sizeof(DemuxMsg));
     if (ret < 0)
@@ -437,7 +497,6 @@ int ifile_get_packet(InputFile *f, AVPacket **pkt)
 {
     Demuxer *d = demuxer_from_ifile(f);
     InputStream *ist;
-    DemuxMsg msg;
     int ret;
 
     if (!d->in_thread_queue) {
@@ -465,21 +524,36 @@ int ifile_get_packet(InputFile *f, AVPacket **pkt)
         }
     }
 
-    ret = av_thread_message_queue_recv(d->in_thread_queue, &msg,
-                                       d->non_blocking ?
-                                       AV_THREAD_MESSAGE_NONBLOCK : 0);
-    if (ret < 0)
-        return ret;
-    if (msg.looping)
-        return 1;
+    if (d->msg_pos >= d->msg.nb_pkts) {
+        ret = av_thread_message_queue_recv(d->in_thread_queue, &d->msg,
+                                           d->non_blocking ?
+                                           AV_THREAD_MESSAGE_NONBLOCK : 0);
+        if (ret < 0)
+            return ret;
+        d->msg_pos = 0;
+        if (d->msg.looping)
+            return 1;
+    }
+
+    *pkt = d->msg.pkt[d->msg_pos];
+    d->msg.pkt[d->msg_pos] = NULL;
 
-    ist = f->streams[msg.pkt->stream_index];
-    ist->last_pkt_repeat_pict = msg.repeat_pict;
+    ist = f->streams[(*pkt)->stream_index];
+    ist->last_pkt_repeat_pict = d->msg.repeat_pict[d->msg_pos++];
 
-    *pkt = msg.pkt;
     return 0;
 }
 
+int ifile_queue_size(InputFile *f)
+{
+    Demuxer *d = demuxer_from_ifile(f);
+
+    if (!d->in_thread_queue)
+        return 0;
+
+    return FFMAX(av_thread_message_queue_nb_elems(d->in_thread_queue), 0);
+}
+
 static void ist_free(InputStream **pist)
 {
     InputStream *ist = *pist;
@@ -1120,6 +1120,12 @@ int configure_filtergraph(FilterGraph *fg)
     if (!(fg->graph = avfilter_graph_alloc()))
         return AVERROR(ENOMEM);
 
+    if (filter_thread_type) {
+        ret = av_opt_set(fg->graph, "thread_type", filter_thread_type, 0);
+        if (ret < 0)
+            goto fail;
+    }
+
     if (simple) {
         OutputStream *ost = fg->outputs[0]->ost;
 
@@ -63,7 +63,7 @@ static int write_packet(Muxer *mux, OutputStream *ost, AVPacket *pkt)
     MuxStream *ms = ms_from_ost(ost);
     AVFormatContext *s = mux->fc;
     AVStream *st = ost->st;
-    int64_t fs;
+    int64_t fs, t;
     uint64_t frame_num;
     int ret;
 
@@ -147,7 +147,9 @@ static int write_packet(Muxer *mux, OutputStream *ost, AVPacket *pkt)
     if (ms->stats.io)
         enc_stats_write(ost, &ms->stats, NULL, pkt, frame_num);
 
+    t = stage_time_start();
     ret = av_interleaved_write_frame(s, pkt);
+    stage_time_end(STAGE_MUX, t);
     if (ret < 0) {
         print_error("av_interleaved_write_frame()", ret);
         goto fail;
@@ -247,7 +249,7 @@ static int thread_submit_packet(Muxer *mux, OutputStream *ost, AVPacket *pkt)
 {
     int ret = 0;
 
-    if (!pkt || ost->finished & MUXER_FINISHED)
+    if (!pkt || atomic_load(&ost->finished) & MUXER_FINISHED)
         goto finish;
 
     ret = tq_send(mux->tq, ost->index, pkt);
@@ -260,7 +262,7 @@ finish:
     if (pkt)
         av_packet_unref(pkt);
 
-    ost->finished |= MUXER_FINISHED;
+    atomic_fetch_or(&ost->finished, MUXER_FINISHED);
     tq_send_finish(mux->tq, ost->index);
     return ret == AVERROR_EOF ? 0 : ret;
 }
@@ -326,7 +328,7 @@ static int submit_packet(Muxer *mux, AVPacket *pkt, OutputStream *ost)
     return 0;
 }
 
-void of_output_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int eof)
+int of_output_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int eof)
 {
     Muxer *mux = mux_from_of(of);
     MuxStream *ms = ms_from_ost(ost);
@@ -334,7 +336,8 @@ void of_output_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int eof)
     int ret = 0;
 
     if (!eof && pkt->dts != AV_NOPTS_VALUE)
-        ost->last_mux_dts = av_rescale_q(pkt->dts, pkt->time_base, AV_TIME_BASE_Q);
+        atomic_store(&ost->last_mux_dts,
+                     av_rescale_q(pkt->dts, pkt->time_base, AV_TIME_BASE_Q));
 
     /* apply the output bitstream filters */
     if (ms->bsf_ctx) {
@@ -349,7 +352,7 @@ void of_output_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int eof)
         while (!bsf_eof) {
             ret = av_bsf_receive_packet(ms->bsf_ctx, pkt);
             if (ret == AVERROR(EAGAIN))
-                return;
+                return 0;
             else if (ret == AVERROR_EOF)
                 bsf_eof = 1;
             else if (ret < 0) {
@@ -367,16 +370,14 @@ void of_output_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int eof)
             goto mux_fail;
     }
 
-    return;
+    return 0;
 
 mux_fail:
     err_msg = "submitting a packet to the muxer";
 
 fail:
     av_log(ost, AV_LOG_ERROR, "Error %s\n", err_msg);
-    if (exit_on_error)
-        exit_program(1);
-
+    return exit_on_error ? ret : 0;
 }
 
 static int thread_stop(Muxer *mux)
@@ -411,7 +412,8 @@ static int thread_start(Muxer *mux)
     if (!op)
         return AVERROR(ENOMEM);
 
-    mux->tq = tq_alloc(fc->nb_streams, mux->thread_queue_size, op, pkt_move);
+    mux->tq = tq_alloc(fc->nb_streams, mux->thread_queue_size, op, pkt_move,
+                       TQ_FLAG_LOCKLESS);
     if (!mux->tq) {
         objpool_free(&op);
         return AVERROR(ENOMEM);
@@ -667,7 +669,9 @@ static void ost_free(OutputStream **post)
     av_frame_free(&ost->sq_frame);
     av_frame_free(&ost->last_frame);
     av_packet_free(&ost->pkt);
+    av_fifo_freep2(&ost->enc_pending_pts);
     av_dict_free(&ost->encoder_opts);
+    encseg_free(&ost->enc_seg);
 
     av_freep(&ost->kf.pts);
     av_expr_free(ost->kf.pexpr);
@@ -744,6 +748,33 @@ void of_close(OutputFile **pof)
     av_freep(pof);
 }
 
+int of_running(OutputFile *of)
+{
+    Muxer *mux = mux_from_of(of);
+    return !!mux->tq;
+}
+
+void of_queue_stats(OutputFile *of, size_t *mux_queue, unsigned int *sync_queue)
+{
+    Muxer *mux = mux_from_of(of);
+
+    *mux_queue  = mux->tq     ? tq_nb_items(mux->tq)       : 0;
+    *sync_queue = mux->sq_mux ? sq_nb_buffered(mux->sq_mux) : 0;
+}
+
+size_t of_stream_sq_bytes(OutputFile *of, const OutputStream *ost)
+{
+    Muxer *mux = mux_from_of(of);
+    size_t bytes = 0;
+
+    if (ost->sq_idx_encode >= 0)
+        bytes += sq_buffered_bytes(of->sq_encode, ost->sq_idx_encode);
+    if (ost->sq_idx_mux >= 0)
+        bytes += sq_buffered_bytes(mux->sq_mux, ost->sq_idx_mux);
+
+    return bytes;
+}
+
 int64_t of_filesize(OutputFile *of)
 {
     Muxer *mux = mux_from_of(of);
@@ -55,6 +55,7 @@ static const char *const opt_name_copy_initial_nonkeyframes[] = {"copyinkf", NUL
 static const char *const opt_name_copy_prior_start[]          = {"copypriorss", NULL};
 static const char *const opt_name_disposition[]               = {"disposition", NULL};
 static const char *const opt_name_enc_time_bases[]            = {"enc_time_base", NULL};
+static const char *const opt_name_enc_segments[]              = {"enc_segments", NULL};
 static const char *const opt_name_enc_stats_pre[]             = {"enc_stats_pre", NULL};
 static const char *const opt_name_enc_stats_post[]            = {"enc_stats_post", NULL};
 static const char *const opt_name_mux_stats[]                 = {"mux_stats", NULL};
@@ -476,6 +477,13 @@ static OutputStream *new_output_stream(Muxer *mux, const OptionsContext *o,
     if (!ost->pkt)
         report_and_exit(AVERROR(ENOMEM));
 
+    if (ost->enc_ctx && stats_pipeline_avio) {
+        ost->enc_pending_pts = av_fifo_alloc2(16, sizeof(int64_t),
+                                              AV_FIFO_FLAG_AUTO_GROW);
+        if (!ost->enc_pending_pts)
+            report_and_exit(AVERROR(ENOMEM));
+    }
+
     if (ost->enc_ctx) {
         AVCodecContext *enc = ost->enc_ctx;
         AVIOContext *s = NULL;
@@ -644,7 +652,7 @@ static OutputStream *new_output_stream(Muxer *mux, const OptionsContext *o,
         ost->ist->discard = 0;
         ost->ist->st->discard = ost->ist->user_set_discard;
     }
-    ost->last_mux_dts = AV_NOPTS_VALUE;
+    atomic_init(&ost->last_mux_dts, AV_NOPTS_VALUE);
     ost->last_filter_pts = AV_NOPTS_VALUE;
 
     MATCH_PER_STREAM_OPT(copy_initial_nonkeyframes, i,
@@ -889,6 +897,8 @@ static OutputStream *new_video_stream(Muxer *mux, const OptionsContext *o, Input
 
         MATCH_PER_STREAM_OPT(force_fps, i, ost->force_fps, oc, st);
 
+        MATCH_PER_STREAM_OPT(enc_segments, i, ost->enc_segments, oc, st);
+
         ost->top_field_first = -1;
         MATCH_PER_STREAM_OPT(top_field_first, i, ost->top_field_first, oc, st);
 
@@ -1070,7 +1080,7 @@ static OutputStream *new_unknown_stream(Muxer *mux, const OptionsContext *o, Inp
 static OutputStream *new_attachment_stream(Muxer *mux, const OptionsContext *o, InputStream *ist)
 {
     OutputStream *ost = new_output_stream(mux, o, AVMEDIA_TYPE_ATTACHMENT, ist);
-    ost->finished    = 1;
+    atomic_store(&ost->finished, 1);
     return ost;
 }
 
@@ -1448,7 +1458,8 @@ static void create_streams(Muxer *mux, const OptionsContext *o)
     }
 }
 
-static int setup_sync_queues(Muxer *mux, AVFormatContext *oc, int64_t buf_size_us)
+static int setup_sync_queues(Muxer *mux, AVFormatContext *oc, int64_t buf_size_us,
+                             size_t buf_size_bytes, int64_t tolerance_us)
 {
     OutputFile *of = &mux->of;
     int nb_av_enc = 0, nb_interleaved = 0;
@@ -1481,7 +1492,8 @@ static int setup_sync_queues(Muxer *mux, AVFormatContext *oc, int64_t buf_size_u
      * one encoded audio/video stream is frame-limited, then we
      * synchronize them before encoding */
     if ((of->shortest && nb_av_enc > 1) || limit_frames_av_enc) {
-        of->sq_encode = sq_alloc(SYNC_QUEUE_FRAMES, buf_size_us);
+        of->sq_encode = sq_alloc(SYNC_QUEUE_FRAMES, buf_size_us,
+                                 buf_size_bytes, tolerance_us);
         if (!of->sq_encode)
             return AVERROR(ENOMEM);
 
@@ -1510,7 +1522,8 @@ static int setup_sync_queues(Muxer *mux, AVFormatContext *oc, int64_t buf_size_u
     /* if there are any additional interleaved streams, then ALL the streams
      * are also synchronized before sending them to the muxer */
     if (nb_interleaved > nb_av_enc) {
-        mux->sq_mux = sq_alloc(SYNC_QUEUE_PACKETS, buf_size_us);
+        mux->sq_mux = sq_alloc(SYNC_QUEUE_PACKETS, buf_size_us,
+                               buf_size_bytes, tolerance_us);
         if (!mux->sq_mux)
             return AVERROR(ENOMEM);
 
@@ -2381,7 +2394,15 @@ int of_open(const OptionsContext *o, const char *filename)
         exit_program(1);
     }
 
-    err = setup_sync_queues(mux, oc, o->shortest_buf_duration * AV_TIME_BASE);
+    if (o->shortest_buf_size < 0) {
+        av_log(mux, AV_LOG_FATAL, "Invalid -shortest_buf_size: %"PRId64"\n",
+               o->shortest_buf_size);
+        exit_program(1);
+    }
+    err = setup_sync_queues(mux, oc, o->shortest_buf_duration * AV_TIME_BASE,
+                            o->shortest_buf_size,
+                            o->shortest_buf_tolerance < 0 ? -1 :
+                            o->shortest_buf_tolerance * AV_TIME_BASE);
     if (err < 0) {
         av_log(mux, AV_LOG_FATAL, "Error setting up output sync queues\n");
         exit_program(1);
@@ -84,6 +84,7 @@ int qp_hist           = 0;
 int stdin_interaction = 1;
 float max_error_rate  = 2.0/3;
 char *filter_nbthreads;
+char *filter_thread_type;
 int filter_complex_nbthreads = 0;
 int vstats_version = 2;
 int auto_conversion_filters = 1;
@@ -149,6 +150,7 @@ static void init_options(OptionsContext *o)
     o->input_sync_ref = -1;
     o->find_stream_info = 1;
     o->shortest_buf_duration = 10.f;
+    o->shortest_buf_tolerance = -1.f;
 }
 
 static int show_hwaccels(void *optctx, const char *opt, const char *arg)
@@ -298,6 +300,13 @@ static int opt_filter_threads(void *optctx, const char *opt, const char *arg)
     return 0;
 }
 
+static int opt_filter_thread_type(void *optctx, const char *opt, const char *arg)
+{
+    av_free(filter_thread_type);
+    filter_thread_type = av_strdup(arg);
+    return 0;
+}
+
 static int opt_abort_on(void *optctx, const char *opt, const char *arg)
 {
     static const AVOption opts[] = {
@@ -907,6 +916,17 @@ static int opt_vstats_file(void *optctx, const char *opt, const char *arg)
     return 0;
 }
 
+static int opt_worker(void *optctx, const char *opt, const char *arg)
+{
+    av_free(worker_source);
+    worker_source = av_strdup(arg);
+    if (!worker_source)
+        return AVERROR(ENOMEM);
+    /* jobs may run concurrently and cannot share the terminal */
+    stdin_interaction = 0;
+    return 0;
+}
+
 static int opt_vstats(void *optctx, const char *opt, const char *arg)
 {
     char filename[40];
@@ -1331,6 +1351,24 @@ static int opt_progress(void *optctx, const char *opt, const char *arg)
     return 0;
 }
 
+static int opt_stats_pipeline(void *optctx, const char *opt, const char *arg)
+{
+    AVIOContext *avio = NULL;
+    int ret;
+
+    if (!strcmp(arg, "-"))
+        arg = "pipe:";
+    ret = avio_open2(&avio, arg, AVIO_FLAG_WRITE, &int_cb, NULL);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Failed to open pipeline stats URL \"%s\": %s\n",
+               arg, av_err2str(ret));
+        return ret;
+    }
+    avio_closep(&stats_pipeline_avio);
+    stats_pipeline_avio = avio;
+    return 0;
+}
+
 int opt_timelimit(void *optctx, const char *opt, const char *arg)
 {
 #if HAVE_SETRLIMIT
@@ -1463,6 +1501,10 @@ const OptionDef options[] = {
         "finish encoding within shortest input" },
     { "shortest_buf_duration", HAS_ARG | OPT_FLOAT | OPT_EXPERT | OPT_OFFSET | OPT_OUTPUT, { .off = OFFSET(shortest_buf_duration) },
         "maximum buffering duration (in seconds) for the -shortest option" },
+    { "shortest_buf_size", HAS_ARG | OPT_INT64 | OPT_EXPERT | OPT_OFFSET | OPT_OUTPUT, { .off = OFFSET(shortest_buf_size) },
+        "maximum size of the data buffered (in bytes) for the -shortest option, 0 for no limit", "size" },
+    { "shortest_buf_tolerance", HAS_ARG | OPT_FLOAT | OPT_EXPERT | OPT_OFFSET | OPT_OUTPUT, { .off = OFFSET(shortest_buf_tolerance) },
+        "on -shortest buffer overflow, release all frames this far (in seconds) behind the head of their stream", "duration" },
     { "bitexact",       OPT_BOOL | OPT_EXPERT | OPT_OFFSET |
                         OPT_OUTPUT | OPT_INPUT,                      { .off = OFFSET(bitexact) },
         "bitexact mode" },
@@ -1499,6 +1541,8 @@ const OptionDef options[] = {
         "set stream filtergraph", "filter_graph" },
     { "filter_threads", HAS_ARG,                                     { .func_arg = opt_filter_threads },
         "number of non-complex filter threads" },
+    { "filter_thread_type", HAS_ARG,                                 { .func_arg = opt_filter_thread_type },
+        "allowed filter threading types", "type" },
     { "filter_script",  HAS_ARG | OPT_STRING | OPT_SPEC | OPT_OUTPUT, { .off = OFFSET(filter_scripts) },
         "read stream filtergraph description from a file", "filename" },
     { "reinit_filter",  HAS_ARG | OPT_INT | OPT_SPEC | OPT_INPUT,    { .off = OFFSET(reinit_filters) },
@@ -1516,7 +1560,13 @@ const OptionDef options[] = {
     { "stats",          OPT_BOOL,                                    { &print_stats },
         "print progress report during encoding", },
     { "stats_period",    HAS_ARG | OPT_EXPERT,                       { .func_arg = opt_stats_period },
-        "set the period at which ffmpeg updates stats and -progress output", "time" },
+        "set the period at which ffmpeg updates stats, -progress and -stats_pipeline output", "time" },
+    { "stats_pipeline", HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_stats_pipeline },
+        "write per-stage timing and queue fill levels as JSON lines to the given URL", "url" },
+    { "worker",         HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_worker },
+        "run the command lines read from stdin (\"-\") or a UNIX socket as jobs", "source" },
+    { "worker_jobs",    HAS_ARG | OPT_INT | OPT_EXPERT,              { &worker_jobs },
+        "maximum number of jobs run at the same time in worker mode", "number" },
     { "attach",         HAS_ARG | OPT_PERFILE | OPT_EXPERT |
                         OPT_OUTPUT,                                  { .func_arg = opt_attach },
         "add an attachment to the output file", "filename" },
@@ -1660,6 +1710,9 @@ const OptionDef options[] = {
     { "autoscale",        HAS_ARG | OPT_BOOL | OPT_SPEC |
                           OPT_EXPERT | OPT_OUTPUT,                               { .off = OFFSET(autoscale) },
         "automatically insert a scale filter at the end of the filter graph" },
+    { "enc_segments",     OPT_VIDEO | HAS_ARG | OPT_INT | OPT_SPEC |
+                          OPT_EXPERT | OPT_OUTPUT,                               { .off = OFFSET(enc_segments) },
+        "encode this many GOP-aligned segments of the stream in parallel", "number" },
     { "fix_sub_duration_heartbeat", OPT_VIDEO | OPT_BOOL | OPT_EXPERT |
                                     OPT_SPEC | OPT_OUTPUT,                       { .off = OFFSET(fix_sub_duration_heartbeat) },
         "set this video output stream to be a heartbeat stream for "
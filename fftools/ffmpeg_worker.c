@@ -0,0 +1,454 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Worker mode: read jobs, i.e. ffmpeg command lines, from standard input or
+ * a UNIX socket and run each of them in a child process forked from the
+ * worker. The children inherit everything set up by the worker before it
+ * started accepting jobs - registered components, network initialization,
+ * global options and hardware devices - so that this cost is only paid once.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if HAVE_FORK
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if HAVE_SYS_UN_H
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#endif
+
+#include "libavutil/avstring.h"
+#include "libavutil/bprint.h"
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+
+#include "ffmpeg.h"
+
+char *worker_source;
+int   worker_jobs = 1;
+
+#if HAVE_FORK
+
+#define MAX_JOB_ARGS 4096
+
+typedef struct WorkerJob {
+    pid_t    pid;
+    uint64_t id;
+} WorkerJob;
+
+typedef struct Worker {
+    /* fd jobs are read from */
+    int          in_fd;
+    /* fd job results are written to, -1 for logging them */
+    int          out_fd;
+    /* listening socket, -1 when reading from stdin */
+    int          listen_fd;
+
+    AVBPrint     line;
+    int          eof;
+
+    WorkerJob   *jobs;
+    int          nb_jobs;
+    uint64_t     nb_jobs_started;
+} Worker;
+
+static void job_report(Worker *w, const WorkerJob *job, int status)
+{
+    char buf[64];
+
+    if (WIFEXITED(status))
+        snprintf(buf, sizeof(buf), "%"PRIu64" exit %d\n", job->id,
+                 WEXITSTATUS(status));
+    else
+        snprintf(buf, sizeof(buf), "%"PRIu64" signal %d\n", job->id,
+                 WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+
+    av_log(NULL, AV_LOG_VERBOSE, "Job %s", buf);
+
+    if (w->out_fd >= 0) {
+        size_t len = strlen(buf);
+        /* the client may be gone, nothing to do about it then */
+        if (write(w->out_fd, buf, len) != (ssize_t)len)
+            av_log(NULL, AV_LOG_WARNING, "Error reporting the result of job "
+                   "%"PRIu64"\n", job->id);
+    } else if (!WIFEXITED(status) || WEXITSTATUS(status))
+        av_log(NULL, AV_LOG_ERROR, "Job %"PRIu64" failed\n", job->id);
+}
+
+/* Reap finished jobs. Block until at least one job finishes if wait is set
+ * and any job is running. */
+static int jobs_reap(Worker *w, int wait)
+{
+    while (w->nb_jobs) {
+        int status;
+        pid_t pid = waitpid(-1, &status, wait ? 0 : WNOHANG);
+
+        if (pid < 0) {
+            if (errno == EINTR && !received_nb_signals)
+                continue;
+            return errno == EINTR ? AVERROR_EXIT : AVERROR(errno);
+        }
+        if (!pid)
+            break;
+
+        for (int i = 0; i < w->nb_jobs; i++) {
+            if (w->jobs[i].pid != pid)
+                continue;
+
+            job_report(w, &w->jobs[i], status);
+            w->jobs[i] = w->jobs[--w->nb_jobs];
+            break;
+        }
+        wait = 0;
+    }
+
+    return 0;
+}
+
+/* Read the next job line into w->line, reaping finished jobs while waiting.
+ * Return 1 when a line is available, 0 on EOF. */
+static int line_read(Worker *w)
+{
+    av_bprint_clear(&w->line);
+
+    while (!w->eof) {
+        struct pollfd pfd = { .fd = w->in_fd, .events = POLLIN };
+        char c;
+        int ret;
+
+        if (received_nb_signals)
+            return AVERROR_EXIT;
+
+        ret = jobs_reap(w, 0);
+        if (ret < 0)
+            return ret;
+
+        ret = poll(&pfd, 1, 100);
+        if (ret < 0 && errno != EINTR)
+            return AVERROR(errno);
+        if (ret <= 0)
+            continue;
+
+        /* jobs are short and rare compared to the work they describe,
+         * so reading one byte at a time is fine */
+        ret = read(w->in_fd, &c, 1);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return AVERROR(errno);
+        }
+        if (!ret) {
+            w->eof = 1;
+            break;
+        }
+
+        if (c == '\n')
+            return 1;
+        av_bprint_chars(&w->line, c, 1);
+        if (!av_bprint_is_complete(&w->line))
+            return AVERROR(ENOMEM);
+    }
+
+    return w->line.len > 0;
+}
+
+/* Split a job line into arguments. Single quotes and backslashes can be used
+ * to include whitespace in an argument, as for filtergraph descriptions. */
+static int line_split(const char *line, int *argc, char ***argv)
+{
+    char **args = NULL;
+    int nb_args = 0, ret;
+
+    /* argv[0] is the program name */
+    ret = av_dynarray_add_nofree(&args, &nb_args, av_strdup(program_name));
+    if (ret < 0)
+        goto fail;
+
+    while (1) {
+        char *arg;
+
+        line += strspn(line, " \t\r");
+        if (!*line)
+            break;
+
+        if (nb_args >= MAX_JOB_ARGS) {
+            ret = AVERROR(E2BIG);
+            goto fail;
+        }
+
+        arg = av_get_token(&line, " \t\r");
+        if (!arg) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        ret = av_dynarray_add_nofree(&args, &nb_args, arg);
+        if (ret < 0) {
+            av_freep(&arg);
+            goto fail;
+        }
+    }
+
+    /* argv is NULL-terminated */
+    ret = av_dynarray_add_nofree(&args, &nb_args, NULL);
+    if (ret < 0)
+        goto fail;
+
+    *argc = nb_args - 1;
+    *argv = args;
+    return 0;
+fail:
+    for (int i = 0; i < nb_args; i++)
+        av_freep(&args[i]);
+    av_freep(&args);
+    return ret;
+}
+
+static int worker_listen(Worker *w, const char *path)
+{
+#if HAVE_SYS_UN_H
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        av_log(NULL, AV_LOG_FATAL, "Worker socket path too long: %s\n", path);
+        return AVERROR(ENAMETOOLONG);
+    }
+    av_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return AVERROR(errno);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 1) < 0) {
+        int ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_FATAL, "Error listening on worker socket %s: %s\n",
+               path, av_err2str(ret));
+        close(fd);
+        return ret;
+    }
+
+    w->listen_fd = fd;
+    return 0;
+#else
+    av_log(NULL, AV_LOG_FATAL, "UNIX sockets are not supported on this platform\n");
+    return AVERROR(ENOSYS);
+#endif
+}
+
+/* Wait for the next client connection on the listening socket. */
+static int worker_accept(Worker *w)
+{
+#if HAVE_SYS_UN_H
+    while (!received_nb_signals) {
+        struct pollfd pfd = { .fd = w->listen_fd, .events = POLLIN };
+        int ret = poll(&pfd, 1, 100);
+        int fd;
+
+        if (ret < 0 && errno != EINTR)
+            return AVERROR(errno);
+        if (ret <= 0)
+            continue;
+
+        fd = accept(w->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED)
+                continue;
+            return AVERROR(errno);
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        w->in_fd  = fd;
+        w->out_fd = fd;
+        w->eof    = 0;
+        return 0;
+    }
+#endif
+    return AVERROR_EXIT;
+}
+
+/* Set up the state of a newly forked job process. */
+static void job_child_init(Worker *w)
+{
+    if (w->listen_fd >= 0) {
+        close(w->listen_fd);
+        close(w->in_fd);
+    } else {
+        /* standard input carries the job descriptions, keep jobs off it */
+        int fd = open("/dev/null", O_RDONLY);
+        if (fd >= 0) {
+            dup2(fd, 0);
+            close(fd);
+        }
+    }
+
+    av_bprint_finalize(&w->line, NULL);
+    av_freep(&w->jobs);
+    av_freep(&worker_source);
+}
+
+/* Run the jobs read from the current input. Return 1 in the child process
+ * of a job, with argc/argv replaced by the job's command line. */
+static int jobs_run(Worker *w, int *argc, char ***argv)
+{
+    int ret;
+
+    while ((ret = line_read(w)) > 0) {
+        WorkerJob *job;
+        char **job_argv;
+        int job_argc;
+        pid_t pid;
+
+        ret = line_split(w->line.str, &job_argc, &job_argv);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Error parsing job: %s\n", av_err2str(ret));
+            continue;
+        }
+        if (job_argc < 2) {
+            av_freep(&job_argv[0]);
+            av_freep(&job_argv);
+            continue;
+        }
+
+        while (w->nb_jobs >= worker_jobs) {
+            ret = jobs_reap(w, 1);
+            if (ret < 0)
+                return ret;
+        }
+
+        /* make sure buffered output is not duplicated in the child */
+        fflush(stdout);
+        fflush(stderr);
+
+        pid = fork();
+        if (!pid) {
+            job_child_init(w);
+            *argc = job_argc;
+            *argv = job_argv;
+            return 1;
+        }
+
+        for (int i = 0; i < job_argc; i++)
+            av_freep(&job_argv[i]);
+        av_freep(&job_argv);
+
+        if (pid < 0) {
+            ret = AVERROR(errno);
+            av_log(NULL, AV_LOG_ERROR, "Error starting job: %s\n", av_err2str(ret));
+            return ret;
+        }
+
+        job      = &w->jobs[w->nb_jobs++];
+        job->pid = pid;
+        job->id  = w->nb_jobs_started++;
+        av_log(NULL, AV_LOG_VERBOSE, "Started job %"PRIu64" (pid %d)\n",
+               job->id, (int)pid);
+    }
+    if (ret < 0)
+        return ret;
+
+    /* report all the jobs from this input before closing it */
+    while (w->nb_jobs) {
+        ret = jobs_reap(w, 1);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+int worker_run(int *argc, char ***argv)
+{
+    Worker w = { .in_fd = 0, .out_fd = -1, .listen_fd = -1 };
+    int ret;
+
+    if (worker_jobs <= 0) {
+        av_log(NULL, AV_LOG_FATAL, "Invalid number of worker jobs: %d\n", worker_jobs);
+        return AVERROR(EINVAL);
+    }
+
+    w.jobs = av_calloc(worker_jobs, sizeof(*w.jobs));
+    if (!w.jobs)
+        return AVERROR(ENOMEM);
+    av_bprint_init(&w.line, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    if (strcmp(worker_source, "-")) {
+        ret = worker_listen(&w, worker_source);
+        if (ret < 0)
+            goto finish;
+    }
+
+    av_log(NULL, AV_LOG_INFO, "Waiting for jobs on %s\n",
+           w.listen_fd >= 0 ? worker_source : "standard input");
+
+    while (1) {
+        if (w.listen_fd >= 0) {
+            ret = worker_accept(&w);
+            if (ret < 0)
+                break;
+        }
+
+        ret = jobs_run(&w, argc, argv);
+        if (ret > 0)
+            return ret;
+
+        if (w.listen_fd < 0)
+            break;
+        close(w.in_fd);
+        if (ret < 0 && ret != AVERROR_EXIT)
+            av_log(NULL, AV_LOG_ERROR, "Error serving worker client: %s\n",
+                   av_err2str(ret));
+    }
+
+    /* leave jobs interrupted by a signal to finish on their own */
+    if (ret == AVERROR_EXIT)
+        ret = 0;
+
+finish:
+    if (w.listen_fd >= 0) {
+        close(w.listen_fd);
+        unlink(worker_source);
+    }
+    av_bprint_finalize(&w.line, NULL);
+    av_freep(&w.jobs);
+
+    return ret;
+}
+
+#else
+
+int worker_run(int *argc, char ***argv)
+{
+    av_log(NULL, AV_LOG_FATAL, "Worker mode is not supported on this platform\n");
+    return AVERROR(ENOSYS);
+}
+
+#endif /* HAVE_FORK */
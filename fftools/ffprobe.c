@@ -29,6 +29,15 @@
 #include <string.h>
 #include <math.h>
 
+#if HAVE_FORK
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #include "libavformat/avformat.h"
 #include "libavformat/version.h"
 #include "libavcodec/avcodec.h"
@@ -38,6 +47,7 @@
 #include "libavutil/avstring.h"
 #include "libavutil/bprint.h"
 #include "libavutil/channel_layout.h"
+#include "libavutil/cpu.h"
 #include "libavutil/display.h"
 #include "libavutil/hash.h"
 #include "libavutil/hdr_dynamic_metadata.h"
@@ -100,6 +110,7 @@ static int do_count_frames = 0;
 static int do_count_packets = 0;
 static int do_read_frames  = 0;
 static int do_read_packets = 0;
+static int do_index_only   = 0;
 static int do_show_chapters = 0;
 static int do_show_error   = 0;
 static int do_show_format  = 0;
@@ -284,6 +295,8 @@ static const char *input_filename;
 static const char *print_input_filename;
 static const AVInputFormat *iformat = NULL;
 static const char *output_filename = NULL;
+static const char *input_list;
+static int nb_probe_jobs = 0;
 
 static struct AVHashContext *hash;
 
@@ -2516,9 +2529,12 @@ static void show_packet(WriterContext *w, InputFile *ifile, AVPacket *pkt, int p
     print_fmt("flags", "%c%c%c",      pkt->flags & AV_PKT_FLAG_KEY ? 'K' : '_',
               pkt->flags & AV_PKT_FLAG_DISCARD ? 'D' : '_',
               pkt->flags & AV_PKT_FLAG_CORRUPT ? 'C' : '_');
-    if (do_show_data)
-        writer_print_data(w, "data", pkt->data, pkt->size);
-    writer_print_data_hash(w, "data_hash", pkt->data, pkt->size);
+    /* the data is not available for packets read from the index */
+    if (pkt->data || !pkt->size) {
+        if (do_show_data)
+            writer_print_data(w, "data", pkt->data, pkt->size);
+        writer_print_data_hash(w, "data_hash", pkt->data, pkt->size);
+    }
 
     if (pkt->side_data_elems) {
         size_t size;
@@ -2935,13 +2951,153 @@ end:
     return ret;
 }
 
+typedef struct IndexPacket {
+    int64_t pos;
+    int64_t timestamp;
+    int size;
+    int flags;
+    int stream_index;
+} IndexPacket;
+
+static int cmp_index_packet(const void *a, const void *b)
+{
+    const IndexPacket *pa = a, *pb = b;
+
+    if (pa->pos != pb->pos)
+        return pa->pos > pb->pos ? 1 : -1;
+    if (pa->stream_index != pb->stream_index)
+        return pa->stream_index - pb->stream_index;
+    return FFDIFFSIGN(pa->timestamp, pb->timestamp);
+}
+
+/* Get the size and position of a packet whose index entry only gives a
+ * position to seek to, e.g. a Matroska cue or a NUT syncpoint, by seeking to
+ * the entry and reading the first packet of the stream from there. */
+static int index_packet_resolve(AVFormatContext *fmt_ctx, IndexPacket *ipkt,
+                                AVPacket *pkt)
+{
+    int ret;
+
+    ret = avformat_seek_file(fmt_ctx, ipkt->stream_index, ipkt->timestamp,
+                             ipkt->timestamp, ipkt->timestamp, 0);
+    if (ret < 0)
+        return ret;
+
+    while ((ret = av_read_frame(fmt_ctx, pkt)) >= 0) {
+        if (pkt->stream_index == ipkt->stream_index) {
+            ipkt->size = pkt->size;
+            if (pkt->pos >= 0)
+                ipkt->pos = pkt->pos;
+            av_packet_unref(pkt);
+            return 0;
+        }
+        av_packet_unref(pkt);
+    }
+
+    return ret;
+}
+
+/* list the packets from the demuxer index, in file order; only the fields
+ * stored in the index are filled, except for the size and position of the
+ * packets the index only gives a position to seek to */
+static int read_index_packets(WriterContext *w, InputFile *ifile)
+{
+    AVFormatContext *fmt_ctx = ifile->fmt_ctx;
+    IndexPacket *ipkts = NULL;
+    AVPacket *pkt = NULL;
+    size_t nb_ipkts = 0;
+    int i, ret = 0;
+
+    if (fmt_ctx->iformat->flags & AVFMT_GENERIC_INDEX) {
+        av_log(NULL, AV_LOG_ERROR, "The %s format has no index to read "
+               "packets from\n", fmt_ctx->iformat->name);
+        return AVERROR(ENOSYS);
+    }
+
+    /* some demuxers only load their index when seeking, e.g. the Matroska
+     * cues, until then it only has the entries of the packets read so far */
+    {
+        int64_t ts = fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0;
+        avformat_seek_file(fmt_ctx, -1, INT64_MIN, ts, ts, 0);
+    }
+
+    for (i = 0; i < fmt_ctx->nb_streams; i++)
+        if (selected_streams[i])
+            nb_ipkts += avformat_index_get_entries_count(fmt_ctx->streams[i]);
+
+    ipkts = av_malloc_array(nb_ipkts, sizeof(*ipkts));
+    pkt   = av_packet_alloc();
+    if ((nb_ipkts && !ipkts) || !pkt) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    nb_ipkts = 0;
+    for (i = 0; i < fmt_ctx->nb_streams; i++) {
+        AVStream *st = fmt_ctx->streams[i];
+        int nb_entries = avformat_index_get_entries_count(st);
+
+        if (!selected_streams[i])
+            continue;
+
+        /* copied, since reading packets may add index entries */
+        for (int j = 0; j < nb_entries; j++) {
+            const AVIndexEntry *e = avformat_index_get_entry(st, j);
+            ipkts[nb_ipkts++] = (IndexPacket){
+                .pos          = e->pos,
+                .timestamp    = e->timestamp,
+                .size         = e->size,
+                .flags        = e->flags,
+                .stream_index = i,
+            };
+        }
+    }
+
+    for (size_t n = 0; n < nb_ipkts; n++) {
+        if (ipkts[n].size)
+            continue;
+        ret = index_packet_resolve(fmt_ctx, &ipkts[n], pkt);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_WARNING, "Could not find the packet of stream "
+                   "%d at index position %"PRId64": %s\n",
+                   ipkts[n].stream_index, ipkts[n].pos, av_err2str(ret));
+            ret = 0;
+        }
+    }
+
+    if (nb_ipkts)
+        qsort(ipkts, nb_ipkts, sizeof(*ipkts), cmp_index_packet);
+
+    for (size_t n = 0; n < nb_ipkts; n++) {
+        const IndexPacket *ipkt = &ipkts[n];
+
+        if (do_show_packets) {
+            pkt->stream_index = ipkt->stream_index;
+            pkt->dts          = ipkt->timestamp;
+            pkt->size         = ipkt->size;
+            pkt->pos          = ipkt->pos;
+            pkt->flags        = (ipkt->flags & AVINDEX_KEYFRAME      ? AV_PKT_FLAG_KEY     : 0) |
+                                (ipkt->flags & AVINDEX_DISCARD_FRAME ? AV_PKT_FLAG_DISCARD : 0);
+            show_packet(w, ifile, pkt, n);
+        }
+        nb_streams_packets[ipkts[n].stream_index]++;
+    }
+
+end:
+    av_packet_free(&pkt);
+    av_freep(&ipkts);
+    return ret;
+}
+
 static int read_packets(WriterContext *w, InputFile *ifile)
 {
     AVFormatContext *fmt_ctx = ifile->fmt_ctx;
     int i, ret = 0;
     int64_t cur_ts = fmt_ctx->start_time;
 
-    if (read_intervals_nb == 0) {
+    if (do_index_only) {
+        ret = read_index_packets(w, ifile);
+    } else if (read_intervals_nb == 0) {
         ReadInterval interval = (ReadInterval) { .has_start = 0, .has_end = 0 };
         ret = read_interval_packets(w, ifile, &interval, &cur_ts);
     } else {
@@ -3447,6 +3603,12 @@ static int probe_file(WriterContext *wctx, const char *filename,
     do_read_frames = do_show_frames || do_count_frames;
     do_read_packets = do_show_packets || do_count_packets;
 
+    if (do_index_only && (do_read_frames || read_intervals_nb)) {
+        av_log(NULL, AV_LOG_ERROR, "-index_only cannot be used with frames "
+               "or read intervals\n");
+        return AVERROR(EINVAL);
+    }
+
     ret = open_input_file(&ifile, filename, print_filename);
     if (ret < 0)
         goto end;
@@ -4016,6 +4178,7 @@ static const OptionDef real_options[] = {
     { "show_chapters", 0, { .func_arg = &opt_show_chapters }, "show chapters info" },
     { "count_frames", OPT_BOOL, { &do_count_frames }, "count the number of frames per stream" },
     { "count_packets", OPT_BOOL, { &do_count_packets }, "count the number of packets per stream" },
+    { "index_only", OPT_BOOL, { &do_index_only }, "read packets info from the container index instead of the file data" },
     { "show_program_version",  0, { .func_arg = &opt_show_program_version },  "show ffprobe version" },
     { "show_library_versions", 0, { .func_arg = &opt_show_library_versions }, "show library versions" },
     { "show_versions",         0, { .func_arg = &opt_show_versions }, "show program and library versions" },
@@ -4028,6 +4191,8 @@ static const OptionDef real_options[] = {
     { "i", HAS_ARG, {.func_arg = opt_input_file_i}, "read specified file", "input_file"},
     { "o", HAS_ARG, {.func_arg = opt_output_file_o}, "write to specified output", "output_file"},
     { "print_filename", HAS_ARG, {.func_arg = opt_print_filename}, "override the printed input filename", "print_file"},
+    { "input_list", OPT_STRING | HAS_ARG, { &input_list }, "probe each input listed in the specified file, one per line", "list_file" },
+    { "jobs", OPT_INT | HAS_ARG, { &nb_probe_jobs }, "set the number of inputs from -input_list probed at the same time", "number" },
     { "find_stream_info", OPT_BOOL | OPT_INPUT | OPT_EXPERT, { &find_stream_info },
         "read and decode the streams to fill missing information with heuristics" },
     { NULL, },
@@ -4050,13 +4215,440 @@ static inline int check_section_show_entries(int section_id)
             do_show_##varname = 1;                                      \
     } while (0)
 
+/* print everything requested for one input, as a complete document */
+static int print_document(const Writer *w, const char *w_args,
+                          const char *filename, const char *print_filename)
+{
+    WriterContext *wctx;
+    int ret, input_ret;
+
+    if ((ret = writer_open(&wctx, w, w_args,
+                           sections, FF_ARRAY_ELEMS(sections), output_filename)) < 0)
+        return ret;
+
+    if (w == &xml_writer)
+        wctx->string_validation_utf8_flags |= AV_UTF8_FLAG_EXCLUDE_XML_INVALID_CONTROL_CODES;
+
+    writer_print_section_header(wctx, SECTION_ID_ROOT);
+
+    if (do_show_program_version)
+        ffprobe_show_program_version(wctx);
+    if (do_show_library_versions)
+        ffprobe_show_library_versions(wctx);
+    if (do_show_pixel_formats)
+        ffprobe_show_pixel_formats(wctx);
+
+    if (!filename &&
+        ((do_show_format || do_show_programs || do_show_streams || do_show_chapters || do_show_packets || do_show_error) ||
+         (!do_show_program_version && !do_show_library_versions && !do_show_pixel_formats))) {
+        show_usage();
+        av_log(NULL, AV_LOG_ERROR, "You have to specify one input file.\n");
+        av_log(NULL, AV_LOG_ERROR, "Use -h to get full help or, even better, run 'man %s'.\n", program_name);
+        ret = AVERROR(EINVAL);
+    } else if (filename) {
+        ret = probe_file(wctx, filename, print_filename);
+        if (ret < 0 && do_show_error)
+            show_error(wctx, ret);
+    }
+
+    input_ret = ret;
+
+    writer_print_section_footer(wctx);
+    ret = writer_close(&wctx);
+    if (ret < 0)
+        av_log(NULL, AV_LOG_ERROR, "Writing output failed: %s\n", av_err2str(ret));
+
+    return FFMIN(ret, input_ret);
+}
+
+#if HAVE_FORK
+
+/*
+ * Batch probing: every input from the list is probed in a child process
+ * forked after all the global initialization is done, so that this cost
+ * is paid once for the whole list while the probes are isolated from each
+ * other. The documents are written in the order of the list; the output of
+ * a probe is buffered until all the preceding ones are written.
+ */
+
+typedef struct ProbeJob {
+    pid_t    pid;
+    /* read end of the pipe the child writes its document to, -1 at EOF */
+    int      fd;
+    AVBPrint output;
+    int      finished;
+    int      failed;
+} ProbeJob;
+
+typedef struct ProbeBatch {
+    int          list_fd;
+    AVBPrint     list;
+    int          list_eof;
+
+    AVIOContext *avio;
+
+    /* ring of the jobs started but not written yet, indexed by job number */
+    ProbeJob    *jobs;
+    int          nb_jobs_max;
+    int          nb_running;
+    uint64_t     nb_started;
+    uint64_t     nb_written;
+    int          nb_failed;
+} ProbeBatch;
+
+static ProbeJob *batch_job(ProbeBatch *b, uint64_t idx)
+{
+    return &b->jobs[idx % b->nb_jobs_max];
+}
+
+static int batch_write(ProbeBatch *b, const char *data, size_t size)
+{
+    if (b->avio) {
+        avio_write(b->avio, data, size);
+        return b->avio->error;
+    }
+    return fwrite(data, 1, size, stdout) == size ? 0 : AVERROR(EIO);
+}
+
+/* write out the documents of all the finished jobs at the head of the list,
+ * and the output the next one produced so far */
+static int batch_flush(ProbeBatch *b)
+{
+    while (b->nb_written < b->nb_started) {
+        ProbeJob *job = batch_job(b, b->nb_written);
+        int ret;
+
+        if (job->output.len) {
+            ret = batch_write(b, job->output.str, job->output.len);
+            if (ret < 0)
+                return ret;
+            av_bprint_clear(&job->output);
+        }
+        if (!job->finished)
+            break;
+
+        av_bprint_finalize(&job->output, NULL);
+        b->nb_failed += job->failed;
+        b->nb_written++;
+    }
+    if (!b->avio)
+        fflush(stdout);
+
+    return 0;
+}
+
+static int batch_read_job(ProbeBatch *b, ProbeJob *job)
+{
+    char buf[4096];
+    ssize_t len = read(job->fd, buf, sizeof(buf));
+    int status;
+
+    if (len < 0)
+        return errno == EINTR ? 0 : AVERROR(errno);
+    if (len > 0) {
+        av_bprint_append_data(&job->output, buf, len);
+        return av_bprint_is_complete(&job->output) ? 0 : AVERROR(ENOMEM);
+    }
+
+    /* the document is complete once the pipe is closed */
+    close(job->fd);
+    job->fd = -1;
+    while (waitpid(job->pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return AVERROR(errno);
+    }
+    job->finished = 1;
+    job->failed   = !WIFEXITED(status) || WEXITSTATUS(status);
+    b->nb_running--;
+
+    return 0;
+}
+
+static int batch_start_job(ProbeBatch *b, const Writer *w, const char *w_args,
+                           const char *filename)
+{
+    ProbeJob *job = batch_job(b, b->nb_started);
+    int fds[2];
+    pid_t pid;
+
+    if (pipe(fds) < 0)
+        return AVERROR(errno);
+
+    /* make sure buffered output is not duplicated in the child */
+    fflush(stdout);
+    fflush(stderr);
+
+    pid = fork();
+    if (!pid) {
+        int ret;
+
+        close(fds[0]);
+        for (uint64_t i = b->nb_written; i < b->nb_started; i++)
+            if (batch_job(b, i)->fd >= 0)
+                close(batch_job(b, i)->fd);
+        if (b->list_fd) {
+            close(b->list_fd);
+        } else {
+            /* standard input carries the list, keep the probes off it */
+            int fd = open("/dev/null", O_RDONLY);
+            if (fd >= 0) {
+                dup2(fd, 0);
+                close(fd);
+            }
+        }
+        dup2(fds[1], 1);
+        close(fds[1]);
+
+        output_filename = NULL;
+        ret = print_document(w, w_args, filename, NULL);
+        fflush(stdout);
+        _exit(ret < 0);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        int ret = AVERROR(errno);
+        close(fds[0]);
+        return ret;
+    }
+
+    job->pid      = pid;
+    job->fd       = fds[0];
+    job->finished = 0;
+    job->failed   = 0;
+    av_bprint_init(&job->output, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    b->nb_started++;
+    b->nb_running++;
+
+    return 0;
+}
+
+/* start jobs for the complete lines read from the list, as long as there is
+ * room for them */
+static int batch_start_jobs(ProbeBatch *b, const Writer *w, const char *w_args)
+{
+    while (b->nb_running < nb_probe_jobs &&
+           b->nb_started - b->nb_written < b->nb_jobs_max) {
+        char *line = b->list.str;
+        char *end  = memchr(line, '\n', b->list.len);
+        size_t len;
+        int ret;
+
+        if (!end) {
+            if (!b->list_eof || !b->list.len)
+                break;
+            /* last line without a newline */
+            end = line + b->list.len;
+        }
+        len = end - line;
+
+        *end = 0;
+        if (len && line[len - 1] == '\r')
+            line[len - 1] = 0;
+
+        ret = *line ? batch_start_job(b, w, w_args, line) : 0;
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Error starting the probe of %s: %s\n",
+                   line, av_err2str(ret));
+            return ret;
+        }
+
+        len = FFMIN(len + 1, b->list.len);
+        memmove(b->list.str, b->list.str + len, b->list.len - len);
+        b->list.len -= len;
+        b->list.str[b->list.len] = 0;
+    }
+
+    return 0;
+}
+
+static int batch_read_list(ProbeBatch *b)
+{
+    char buf[4096];
+    ssize_t len = read(b->list_fd, buf, sizeof(buf));
+
+    if (len < 0)
+        return errno == EINTR ? 0 : AVERROR(errno);
+    if (!len) {
+        b->list_eof = 1;
+        return 0;
+    }
+
+    av_bprint_append_data(&b->list, buf, len);
+    return av_bprint_is_complete(&b->list) ? 0 : AVERROR(ENOMEM);
+}
+
+static int probe_list(const Writer *w, const char *w_args)
+{
+    ProbeBatch b = { .list_fd = -1 };
+    struct pollfd *pfds = NULL;
+    int ret = 0;
+
+    if (nb_probe_jobs <= 0)
+        nb_probe_jobs = av_cpu_count();
+
+    b.nb_jobs_max = 2 * nb_probe_jobs;
+    b.jobs = av_calloc(b.nb_jobs_max, sizeof(*b.jobs));
+    pfds   = av_calloc(b.nb_jobs_max + 1, sizeof(*pfds));
+    if (!b.jobs || !pfds) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    av_bprint_init(&b.list, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    b.list_fd = strcmp(input_list, "-") ? open(input_list, O_RDONLY) : 0;
+    if (b.list_fd < 0) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Could not open input list %s: %s\n",
+               input_list, av_err2str(ret));
+        goto end;
+    }
+
+    if (output_filename) {
+        ret = avio_open(&b.avio, output_filename, AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Failed to open output '%s' with error: %s\n",
+                   output_filename, av_err2str(ret));
+            goto end;
+        }
+    }
+
+    while (1) {
+        int nb_pfds = 0, list_pfd = -1;
+
+        ret = batch_start_jobs(&b, w, w_args);
+        if (ret < 0)
+            break;
+        ret = batch_flush(&b);
+        if (ret < 0)
+            break;
+
+        if (b.list_eof && !b.list.len && b.nb_written == b.nb_started)
+            break;
+
+        if (!b.list_eof && !memchr(b.list.str, '\n', b.list.len)) {
+            list_pfd = nb_pfds;
+            pfds[nb_pfds++] = (struct pollfd){ .fd = b.list_fd, .events = POLLIN };
+        }
+        for (uint64_t i = b.nb_written; i < b.nb_started; i++) {
+            ProbeJob *job = batch_job(&b, i);
+            if (job->fd >= 0)
+                pfds[nb_pfds++] = (struct pollfd){ .fd = job->fd, .events = POLLIN };
+        }
+
+        if (poll(pfds, nb_pfds, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            ret = AVERROR(errno);
+            break;
+        }
+
+        for (int i = 0; i < nb_pfds && ret >= 0; i++) {
+            if (!pfds[i].revents)
+                continue;
+            if (i == list_pfd) {
+                ret = batch_read_list(&b);
+                continue;
+            }
+            for (uint64_t j = b.nb_written; j < b.nb_started; j++) {
+                ProbeJob *job = batch_job(&b, j);
+                if (job->fd == pfds[i].fd) {
+                    ret = batch_read_job(&b, job);
+                    break;
+                }
+            }
+        }
+        if (ret < 0)
+            break;
+    }
+    if (ret < 0)
+        av_log(NULL, AV_LOG_ERROR, "Error probing the input list: %s\n",
+               av_err2str(ret));
+
+    /* let the remaining probes finish, their output is discarded */
+    for (uint64_t i = b.nb_written; i < b.nb_started; i++) {
+        ProbeJob *job = batch_job(&b, i);
+        if (job->fd >= 0) {
+            close(job->fd);
+            waitpid(job->pid, NULL, 0);
+        }
+        av_bprint_finalize(&job->output, NULL);
+    }
+
+    if (ret >= 0 && b.nb_failed)
+        ret = AVERROR_EXTERNAL;
+
+end:
+    if (b.list_fd > 0)
+        close(b.list_fd);
+    if (b.avio) {
+        int err = avio_closep(&b.avio);
+        if (ret >= 0)
+            ret = err;
+    }
+    av_bprint_finalize(&b.list, NULL);
+    av_freep(&b.jobs);
+    av_freep(&pfds);
+
+    return ret;
+}
+
+#else
+
+/* without fork(), the inputs from the list are probed one after the other */
+static int probe_list(const Writer *w, const char *w_args)
+{
+    FILE *f = strcmp(input_list, "-") ? fopen(input_list, "r") : stdin;
+    AVBPrint line;
+    char buf[4096];
+    int ret = 0;
+
+    if (output_filename) {
+        av_log(NULL, AV_LOG_ERROR, "-input_list can only be written to the "
+               "standard output on this platform\n");
+        return AVERROR(ENOSYS);
+    }
+    if (!f) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Could not open input list %s: %s\n",
+               input_list, av_err2str(ret));
+        return ret;
+    }
+
+    av_bprint_init(&line, 0, AV_BPRINT_SIZE_UNLIMITED);
+    while (fgets(buf, sizeof(buf), f)) {
+        size_t len = strlen(buf);
+
+        /* paths longer than the buffer are read in several pieces */
+        av_bprint_append_data(&line, buf, len);
+        if (!av_bprint_is_complete(&line)) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        if ((!len || buf[len - 1] != '\n') && !feof(f))
+            continue;
+
+        line.str[strcspn(line.str, "\r\n")] = 0;
+        if (*line.str)
+            ret = FFMIN(ret, print_document(w, w_args, line.str, NULL));
+        av_bprint_clear(&line);
+    }
+    av_bprint_finalize(&line, NULL);
+
+    if (f != stdin)
+        fclose(f);
+
+    return ret;
+}
+
+#endif /* HAVE_FORK */
+
 int main(int argc, char **argv)
 {
     const Writer *w;
-    WriterContext *wctx;
     char *buf;
     char *w_name = NULL, *w_args = NULL;
-    int ret, input_ret, i;
+    int ret, i;
 
     init_dynload();
 
@@ -4153,42 +4745,16 @@ int main(int argc, char **argv)
         goto end;
     }
 
-    if ((ret = writer_open(&wctx, w, w_args,
-                           sections, FF_ARRAY_ELEMS(sections), output_filename)) >= 0) {
-        if (w == &xml_writer)
-            wctx->string_validation_utf8_flags |= AV_UTF8_FLAG_EXCLUDE_XML_INVALID_CONTROL_CODES;
-
-        writer_print_section_header(wctx, SECTION_ID_ROOT);
-
-        if (do_show_program_version)
-            ffprobe_show_program_version(wctx);
-        if (do_show_library_versions)
-            ffprobe_show_library_versions(wctx);
-        if (do_show_pixel_formats)
-            ffprobe_show_pixel_formats(wctx);
-
-        if (!input_filename &&
-            ((do_show_format || do_show_programs || do_show_streams || do_show_chapters || do_show_packets || do_show_error) ||
-             (!do_show_program_version && !do_show_library_versions && !do_show_pixel_formats))) {
-            show_usage();
-            av_log(NULL, AV_LOG_ERROR, "You have to specify one input file.\n");
-            av_log(NULL, AV_LOG_ERROR, "Use -h to get full help or, even better, run 'man %s'.\n", program_name);
+    if (input_list) {
+        if (input_filename) {
+            av_log(NULL, AV_LOG_ERROR, "-input_list cannot be used together "
+                   "with an input file\n");
             ret = AVERROR(EINVAL);
-        } else if (input_filename) {
-            ret = probe_file(wctx, input_filename, print_input_filename);
-            if (ret < 0 && do_show_error)
-                show_error(wctx, ret);
+            goto end;
         }
-
-        input_ret = ret;
-
-        writer_print_section_footer(wctx);
-        ret = writer_close(&wctx);
-        if (ret < 0)
-            av_log(NULL, AV_LOG_ERROR, "Writing output failed: %s\n", av_err2str(ret));
-
-        ret = FFMIN(ret, input_ret);
-    }
+        ret = probe_list(w, w_args);
+    } else
+        ret = print_document(w, w_args, input_filename, print_input_filename);
 
 end:
     av_freep(&print_format);
@@ -16,10 +16,12 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "libavutil/avassert.h"
+#include "libavutil/common.h"
 #include "libavutil/error.h"
 #include "libavutil/fifo.h"
 #include "libavutil/mathematics.h"
@@ -40,6 +42,9 @@ typedef struct SyncQueueStream {
 
     uint64_t         frames_sent;
     uint64_t         frames_max;
+
+    /* size of the data buffered in fifo */
+    atomic_size_t    buffered_bytes;
 } SyncQueueStream;
 
 struct SyncQueue {
@@ -55,10 +60,20 @@ struct SyncQueue {
 
     // maximum buffering duration in microseconds
     int64_t buf_size_us;
+    // maximum size of the buffered data in bytes, 0 for no limit
+    size_t  buf_size_bytes;
+    // on overflow, frames that are more than this behind the head of their
+    // stream are released at once; negative to release one frame at a time
+    int64_t tolerance_us;
+    // total size of the buffered data in bytes
+    size_t  buffered_bytes;
 
     SyncQueueStream *streams;
     unsigned int  nb_streams;
 
+    // total number of frames buffered in all the streams, for statistics
+    atomic_uint   nb_buffered;
+
     // pool of preallocated frames to avoid constant allocations
     ObjPool *pool;
 };
@@ -84,6 +99,35 @@ static int frame_null(const SyncQueue *sq, SyncQueueFrame frame)
     return (sq->type == SYNC_QUEUE_PACKETS) ? (frame.p == NULL) : (frame.f == NULL);
 }
 
+static size_t frame_size(const SyncQueue *sq, SyncQueueFrame frame)
+{
+    size_t size = 0;
+
+    if (sq->type == SYNC_QUEUE_PACKETS)
+        return frame.p->buf ? frame.p->buf->size : frame.p->size;
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(frame.f->buf) && frame.f->buf[i]; i++)
+        size += frame.f->buf[i]->size;
+    for (int i = 0; i < frame.f->nb_extended_buf; i++)
+        size += frame.f->extended_buf[i]->size;
+
+    return size;
+}
+
+static void buffered_bytes_update(SyncQueue *sq, SyncQueueStream *st,
+                                  SyncQueueFrame frame, int add)
+{
+    size_t size = frame_size(sq, frame);
+
+    if (add) {
+        sq->buffered_bytes += size;
+        atomic_fetch_add(&st->buffered_bytes, size);
+    } else {
+        sq->buffered_bytes -= size;
+        atomic_fetch_sub(&st->buffered_bytes, size);
+    }
+}
+
 static void finish_stream(SyncQueue *sq, unsigned int stream_idx)
 {
     SyncQueueStream *st = &sq->streams[stream_idx];
@@ -171,6 +215,9 @@ static void stream_update_ts(SyncQueue *sq, unsigned int stream_idx, int64_t ts)
 /* If the queue for the given stream (or all streams when stream_idx=-1)
  * is overflowing, trigger a fake heartbeat on lagging streams.
  *
+ * The queue overflows when it holds more than buf_size_us worth of frames for
+ * a stream, or more than buf_size_bytes of data in total.
+ *
  * @return 1 if heartbeat triggered, 0 otherwise
  */
 static int overflow_heartbeat(SyncQueue *sq, int stream_idx)
@@ -178,6 +225,23 @@ static int overflow_heartbeat(SyncQueue *sq, int stream_idx)
     SyncQueueStream *st;
     SyncQueueFrame frame;
     int64_t tail_ts = AV_NOPTS_VALUE;
+    int64_t target_ts;
+    int over_budget = sq->buf_size_bytes && sq->buffered_bytes > sq->buf_size_bytes;
+
+    /* over the memory budget, release data from the stream holding most of it */
+    if (over_budget) {
+        size_t max_bytes = 0;
+
+        stream_idx = -1;
+
+        for (int i = 0; i < sq->nb_streams; i++) {
+            size_t bytes = atomic_load(&sq->streams[i].buffered_bytes);
+            if (sq->streams[i].head_ts != AV_NOPTS_VALUE && bytes > max_bytes) {
+                max_bytes  = bytes;
+                stream_idx = i;
+            }
+        }
+    }
 
     /* if no stream specified, pick the one that is most ahead */
     if (stream_idx < 0) {
@@ -205,23 +269,31 @@ static int overflow_heartbeat(SyncQueue *sq, int stream_idx)
                        av_fifo_peek(st->fifo, &frame, 1, i) >= 0; i++)
         tail_ts = frame_ts(sq, frame);
 
-    /* overflow triggers when the tail is over specified duration behind the head */
+    /* overflow triggers when the tail is over specified duration behind the head,
+     * or when over the memory budget */
     if (tail_ts == AV_NOPTS_VALUE || tail_ts >= st->head_ts ||
-        av_rescale_q(st->head_ts - tail_ts, st->tb, AV_TIME_BASE_Q) < sq->buf_size_us)
+        (av_rescale_q(st->head_ts - tail_ts, st->tb, AV_TIME_BASE_Q) < sq->buf_size_us &&
+         !over_budget))
         return 0;
 
-    /* signal a fake timestamp for all streams that prevent tail_ts from being output */
-    tail_ts++;
+    /* release at least the tail frame, and all the frames that are more than
+     * the interleaving tolerance behind the head */
+    target_ts = tail_ts + 1;
+    if (sq->tolerance_us >= 0)
+        target_ts = FFMAX(target_ts, st->head_ts -
+                          av_rescale_q(sq->tolerance_us, AV_TIME_BASE_Q, st->tb));
+
+    /* signal a fake timestamp for all streams that prevent target_ts from being output */
     for (unsigned int i = 0; i < sq->nb_streams; i++) {
         SyncQueueStream *st1 = &sq->streams[i];
         int64_t ts;
 
         if (st == st1 || st1->finished ||
             (st1->head_ts != AV_NOPTS_VALUE &&
-             av_compare_ts(tail_ts, st->tb, st1->head_ts, st1->tb) <= 0))
+             av_compare_ts(target_ts, st->tb, st1->head_ts, st1->tb) <= 0))
             continue;
 
-        ts = av_rescale_q(tail_ts, st->tb, st1->tb);
+        ts = av_rescale_q(target_ts, st->tb, st1->tb);
         if (st1->head_ts != AV_NOPTS_VALUE)
             ts = FFMAX(st1->head_ts + 1, ts);
 
@@ -265,6 +337,9 @@ int sq_send(SyncQueue *sq, unsigned int stream_idx, SyncQueueFrame frame)
         return ret;
     }
 
+    atomic_fetch_add(&sq->nb_buffered, 1);
+    buffered_bytes_update(sq, st, dst, 1);
+
     stream_update_ts(sq, stream_idx, ts);
 
     st->frames_sent++;
@@ -301,9 +376,11 @@ static int receive_for_stream(SyncQueue *sq, unsigned int stream_idx,
          * Frames with no timestamps are just passed through with no conditions.
          */
         if (cmp <= 0 || ts == AV_NOPTS_VALUE) {
+            buffered_bytes_update(sq, st, peek, 0);
             frame_move(sq, frame, peek);
             objpool_release(sq->pool, (void**)&peek);
             av_fifo_drain2(st->fifo, 1);
+            atomic_fetch_sub(&sq->nb_buffered, 1);
             return 0;
         }
     }
@@ -371,6 +448,7 @@ int sq_add_stream(SyncQueue *sq, int limiting)
     st->head_ts = AV_NOPTS_VALUE;
     st->frames_max = UINT64_MAX;
     st->limiting   = limiting;
+    atomic_init(&st->buffered_bytes, 0);
 
     return sq->nb_streams++;
 }
@@ -402,7 +480,8 @@ void sq_limit_frames(SyncQueue *sq, unsigned int stream_idx, uint64_t frames)
         finish_stream(sq, stream_idx);
 }
 
-SyncQueue *sq_alloc(enum SyncQueueType type, int64_t buf_size_us)
+SyncQueue *sq_alloc(enum SyncQueueType type, int64_t buf_size_us,
+                    size_t buf_size_bytes, int64_t tolerance_us)
 {
     SyncQueue *sq = av_mallocz(sizeof(*sq));
 
@@ -411,10 +490,14 @@ SyncQueue *sq_alloc(enum SyncQueueType type, int64_t buf_size_us)
 
     sq->type                 = type;
     sq->buf_size_us          = buf_size_us;
+    sq->buf_size_bytes       = buf_size_bytes;
+    sq->tolerance_us         = tolerance_us;
 
     sq->head_stream          = -1;
     sq->head_finished_stream = -1;
 
+    atomic_init(&sq->nb_buffered, 0);
+
     sq->pool = (type == SYNC_QUEUE_PACKETS) ? objpool_alloc_packets() :
                                               objpool_alloc_frames();
     if (!sq->pool) {
@@ -425,6 +508,17 @@ SyncQueue *sq_alloc(enum SyncQueueType type, int64_t buf_size_us)
     return sq;
 }
 
+unsigned int sq_nb_buffered(SyncQueue *sq)
+{
+    return atomic_load(&sq->nb_buffered);
+}
+
+size_t sq_buffered_bytes(SyncQueue *sq, unsigned int stream_idx)
+{
+    av_assert0(stream_idx < sq->nb_streams);
+    return atomic_load(&sq->streams[stream_idx].buffered_bytes);
+}
+
 void sq_free(SyncQueue **psq)
 {
     SyncQueue *sq = *psq;
@@ -43,9 +43,22 @@ typedef struct SyncQueue SyncQueue;
 /**
  * Allocate a sync queue of the given type.
  *
+ * When the queue overflows, lagging streams are treated as if they had
+ * received a frame with a timestamp chosen so that buffered frames can be
+ * output.
+ *
  * @param buf_size_us maximum duration that will be buffered in microseconds
+ * @param buf_size_bytes maximum size of the data that will be buffered over all
+ *                       the streams in bytes, 0 for no limit; the stream
+ *                       holding the most data is drained first
+ * @param tolerance_us on overflow, all frames that are more than this many
+ *                     microseconds behind the newest frame of their stream
+ *                     are released at once, trading interleaving accuracy
+ *                     for fewer overflows; negative to release one frame
+ *                     per overflow
  */
-SyncQueue *sq_alloc(enum SyncQueueType type, int64_t buf_size_us);
+SyncQueue *sq_alloc(enum SyncQueueType type, int64_t buf_size_us,
+                    size_t buf_size_bytes, int64_t tolerance_us);
 void       sq_free(SyncQueue **sq);
 
 /**
@@ -106,4 +119,16 @@ int sq_send(SyncQueue *sq, unsigned int stream_idx, SyncQueueFrame frame);
  */
 int sq_receive(SyncQueue *sq, int stream_idx, SyncQueueFrame frame);
 
+/**
+ * Get the total number of frames currently buffered in the queue, for
+ * statistics. Unlike the other functions, this may be called from any thread.
+ */
+unsigned int sq_nb_buffered(SyncQueue *sq);
+
+/**
+ * Get the size in bytes of the data currently buffered for the given stream.
+ * May be called from any thread.
+ */
+size_t sq_buffered_bytes(SyncQueue *sq, unsigned int stream_idx);
+
 #endif // FFTOOLS_SYNC_QUEUE_H
@@ -16,10 +16,21 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <string.h>
 
+#include "config.h"
+
+#if HAVE_SCHED_YIELD
+#include <sched.h>
+#endif
+#if HAVE_WINDOWS_H
+#include <windows.h>
+#endif
+
 #include "libavutil/avassert.h"
+#include "libavutil/common.h"
 #include "libavutil/error.h"
 #include "libavutil/fifo.h"
 #include "libavutil/intreadwrite.h"
@@ -29,6 +40,10 @@
 #include "objpool.h"
 #include "thread_queue.h"
 
+/* number of attempts at a lock-free operation, yielding the CPU in between,
+ * before going to sleep on the condition variable */
+#define SPIN_COUNT 4
+
 enum {
     FINISHED_SEND = (1 << 0),
     FINISHED_RECV = (1 << 1),
@@ -39,12 +54,35 @@ typedef struct FifoElem {
     unsigned int stream_idx;
 } FifoElem;
 
+/*
+ * A slot in the lock-free ring. seq is the sequence number of the ring
+ * position the slot is ready for: pos when it is free for writing at pos,
+ * pos + 1 when it holds the item written at pos.
+ */
+typedef struct RingCell {
+    atomic_size_t seq;
+    void         *obj;
+    unsigned int  stream_idx;
+} RingCell;
+
 struct ThreadQueue {
-    int              *finished;
+    atomic_int       *finished;
     unsigned int    nb_streams;
 
+    int flags;
+
     AVFifo  *fifo;
 
+    /* lock-free mode */
+    RingCell     *ring;
+    size_t        ring_mask;
+    atomic_size_t ring_tail;
+    /* only modified by the receiving thread */
+    atomic_size_t ring_head;
+    /* set when a thread is sleeping (or about to sleep) on cond, cleared
+     * when the sleepers are woken up */
+    atomic_int    waiting;
+
     ObjPool *obj_pool;
     void   (*obj_move)(void *dst, void *src);
 
@@ -66,6 +104,12 @@ void tq_free(ThreadQueue **ptq)
     }
     av_fifo_freep2(&tq->fifo);
 
+    if (tq->ring) {
+        for (size_t i = 0; i <= tq->ring_mask; i++)
+            objpool_release(tq->obj_pool, &tq->ring[i].obj);
+    }
+    av_freep(&tq->ring);
+
     objpool_free(&tq->obj_pool);
 
     av_freep(&tq->finished);
@@ -76,8 +120,39 @@ void tq_free(ThreadQueue **ptq)
     av_freep(ptq);
 }
 
+static int ring_alloc(ThreadQueue *tq, size_t queue_size)
+{
+    /* with a single slot, a full slot and a free one cannot be told apart by
+     * the sequence number */
+    size_t ring_size = 2;
+
+    while (ring_size < queue_size)
+        ring_size <<= 1;
+
+    tq->ring = av_calloc(ring_size, sizeof(*tq->ring));
+    if (!tq->ring)
+        return AVERROR(ENOMEM);
+    tq->ring_mask = ring_size - 1;
+
+    /* all items are allocated here, so that the pool (which is not
+     * thread-safe) is never touched by the sending and receiving threads */
+    for (size_t i = 0; i < ring_size; i++) {
+        int ret = objpool_get(tq->obj_pool, &tq->ring[i].obj);
+        if (ret < 0)
+            return ret;
+        atomic_init(&tq->ring[i].seq, i);
+    }
+
+    atomic_init(&tq->ring_tail, 0);
+    atomic_init(&tq->ring_head, 0);
+    atomic_init(&tq->waiting, 0);
+
+    return 0;
+}
+
 ThreadQueue *tq_alloc(unsigned int nb_streams, size_t queue_size,
-                      ObjPool *obj_pool, void (*obj_move)(void *dst, void *src))
+                      ObjPool *obj_pool, void (*obj_move)(void *dst, void *src),
+                      int flags)
 {
     ThreadQueue *tq;
     int ret;
@@ -99,17 +174,26 @@ ThreadQueue *tq_alloc(unsigned int nb_streams, size_t queue_size,
         return NULL;
     }
 
+    tq->obj_pool = obj_pool;
+    tq->obj_move = obj_move;
+    tq->flags    = flags;
+
     tq->finished = av_calloc(nb_streams, sizeof(*tq->finished));
     if (!tq->finished)
         goto fail;
+    for (unsigned int i = 0; i < nb_streams; i++)
+        atomic_init(&tq->finished[i], 0);
     tq->nb_streams = nb_streams;
 
-    tq->fifo = av_fifo_alloc2(queue_size, sizeof(FifoElem), 0);
-    if (!tq->fifo)
-        goto fail;
-
-    tq->obj_pool = obj_pool;
-    tq->obj_move = obj_move;
+    if (flags & TQ_FLAG_LOCKLESS) {
+        ret = ring_alloc(tq, FFMAX(queue_size, 1));
+        if (ret < 0)
+            goto fail;
+    } else {
+        tq->fifo = av_fifo_alloc2(queue_size, sizeof(FifoElem), 0);
+        if (!tq->fifo)
+            goto fail;
+    }
 
     return tq;
 fail:
@@ -117,27 +201,158 @@ fail:
     return NULL;
 }
 
+static void yield_thread(void)
+{
+#if HAVE_SCHED_YIELD
+    sched_yield();
+#elif HAVE_SLEEP
+    Sleep(0);
+#endif
+}
+
+/*
+ * Wake up the threads sleeping on the other side of a lock-free queue, if
+ * there are any. The fence pairs with the one in wait_prepare() and makes sure
+ * that either the sleeper sees our ring update, or we see the sleeper.
+ */
+static void wake_waiting(ThreadQueue *tq)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&tq->waiting, memory_order_relaxed)) {
+        pthread_mutex_lock(&tq->lock);
+        /* the woken threads set the flag again if they go back to sleep */
+        atomic_store_explicit(&tq->waiting, 0, memory_order_relaxed);
+        pthread_cond_broadcast(&tq->cond);
+        pthread_mutex_unlock(&tq->lock);
+    }
+}
+
+/* must be called with the lock held, before checking the ring state */
+static void wait_prepare(ThreadQueue *tq)
+{
+    atomic_store_explicit(&tq->waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+static int ring_write(ThreadQueue *tq, unsigned int stream_idx, void *data)
+{
+    size_t    pos = atomic_load_explicit(&tq->ring_tail, memory_order_relaxed);
+    RingCell *cell;
+
+    while (1) {
+        size_t   seq;
+        intptr_t diff;
+
+        cell = &tq->ring[pos & tq->ring_mask];
+        seq  = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff < 0)
+            return AVERROR(EAGAIN);
+        if (diff > 0) {
+            pos = atomic_load_explicit(&tq->ring_tail, memory_order_relaxed);
+            continue;
+        }
+
+        if (tq->flags & TQ_FLAG_SINGLE_PRODUCER) {
+            atomic_store_explicit(&tq->ring_tail, pos + 1, memory_order_relaxed);
+            break;
+        }
+        if (atomic_compare_exchange_weak_explicit(&tq->ring_tail, &pos, pos + 1,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+            break;
+    }
+
+    cell->stream_idx = stream_idx;
+    tq->obj_move(cell->obj, data);
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    return 0;
+}
+
+static int ring_read(ThreadQueue *tq, int *stream_idx, void *data)
+{
+    size_t    pos  = atomic_load_explicit(&tq->ring_head, memory_order_relaxed);
+    RingCell *cell = &tq->ring[pos & tq->ring_mask];
+
+    if (atomic_load_explicit(&cell->seq, memory_order_acquire) != pos + 1)
+        return AVERROR(EAGAIN);
+
+    tq->obj_move(data, cell->obj);
+    *stream_idx   = cell->stream_idx;
+    atomic_store_explicit(&tq->ring_head, pos + 1, memory_order_relaxed);
+
+    atomic_store_explicit(&cell->seq, pos + tq->ring_mask + 1,
+                          memory_order_release);
+
+    return 0;
+}
+
+static int send_lockless(ThreadQueue *tq, unsigned int stream_idx, void *data)
+{
+    atomic_int *finished = &tq->finished[stream_idx];
+    int ret;
+
+    if (atomic_load(finished) & FINISHED_SEND)
+        return AVERROR(EINVAL);
+
+    ret = AVERROR(EAGAIN);
+    for (int i = 0; i < SPIN_COUNT && !(atomic_load(finished) & FINISHED_RECV); i++) {
+        if (i)
+            yield_thread();
+        ret = ring_write(tq, stream_idx, data);
+        if (ret != AVERROR(EAGAIN))
+            break;
+    }
+    if (ret == AVERROR(EAGAIN)) {
+        pthread_mutex_lock(&tq->lock);
+
+        while (1) {
+            wait_prepare(tq);
+            if (atomic_load(finished) & FINISHED_RECV ||
+                (ret = ring_write(tq, stream_idx, data)) != AVERROR(EAGAIN))
+                break;
+            pthread_cond_wait(&tq->cond, &tq->lock);
+        }
+
+        pthread_mutex_unlock(&tq->lock);
+    }
+
+    if (ret == AVERROR(EAGAIN)) {
+        atomic_fetch_or(finished, FINISHED_SEND);
+        return AVERROR_EOF;
+    }
+
+    wake_waiting(tq);
+
+    return 0;
+}
+
 int tq_send(ThreadQueue *tq, unsigned int stream_idx, void *data)
 {
-    int *finished;
+    atomic_int *finished;
     int ret;
 
     av_assert0(stream_idx < tq->nb_streams);
     finished = &tq->finished[stream_idx];
 
+    if (tq->flags & TQ_FLAG_LOCKLESS)
+        return send_lockless(tq, stream_idx, data);
+
     pthread_mutex_lock(&tq->lock);
 
-    if (*finished & FINISHED_SEND) {
+    if (atomic_load(finished) & FINISHED_SEND) {
         ret = AVERROR(EINVAL);
         goto finish;
     }
 
-    while (!(*finished & FINISHED_RECV) && !av_fifo_can_write(tq->fifo))
+    while (!(atomic_load(finished) & FINISHED_RECV) && !av_fifo_can_write(tq->fifo))
         pthread_cond_wait(&tq->cond, &tq->lock);
 
-    if (*finished & FINISHED_RECV) {
+    if (atomic_load(finished) & FINISHED_RECV) {
         ret = AVERROR_EOF;
-        *finished |= FINISHED_SEND;
+        atomic_fetch_or(finished, FINISHED_SEND);
     } else {
         FifoElem elem = { .stream_idx = stream_idx };
 
@@ -158,13 +373,16 @@ finish:
     return ret;
 }
 
-static int receive_locked(ThreadQueue *tq, int *stream_idx,
+static int receive_item(ThreadQueue *tq, int *stream_idx,
                           void *data)
 {
     FifoElem elem;
     unsigned int nb_finished = 0;
 
-    if (av_fifo_read(tq->fifo, &elem, 1) >= 0) {
+    if (tq->flags & TQ_FLAG_LOCKLESS) {
+        if (ring_read(tq, stream_idx, data) >= 0)
+            return 0;
+    } else if (av_fifo_read(tq->fifo, &elem, 1) >= 0) {
         tq->obj_move(data, elem.obj);
         objpool_release(tq->obj_pool, &elem.obj);
         *stream_idx = elem.stream_idx;
@@ -172,12 +390,26 @@ static int receive_locked(ThreadQueue *tq, int *stream_idx,
     }
 
     for (unsigned int i = 0; i < tq->nb_streams; i++) {
-        if (!(tq->finished[i] & FINISHED_SEND))
+        int finished = atomic_load(&tq->finished[i]);
+
+        if (!(finished & FINISHED_SEND))
             continue;
 
+        /* in lock-free mode, the items sent before the stream was finished
+         * are only guaranteed to be visible after loading the flag, so
+         * check the ring again; a slot that was claimed by a sender but not
+         * yet filled in also has to be waited for */
+        if (tq->flags & TQ_FLAG_LOCKLESS) {
+            if (ring_read(tq, stream_idx, data) >= 0)
+                return 0;
+            if (atomic_load(&tq->ring_tail) !=
+                atomic_load_explicit(&tq->ring_head, memory_order_relaxed))
+                return AVERROR(EAGAIN);
+        }
+
         /* return EOF to the consumer at most once for each stream */
-        if (!(tq->finished[i] & FINISHED_RECV)) {
-            tq->finished[i] |= FINISHED_RECV;
+        if (!(finished & FINISHED_RECV)) {
+            atomic_fetch_or(&tq->finished[i], FINISHED_RECV);
             *stream_idx   = i;
             return AVERROR_EOF;
         }
@@ -188,16 +420,75 @@ static int receive_locked(ThreadQueue *tq, int *stream_idx,
     return nb_finished == tq->nb_streams ? AVERROR_EOF : AVERROR(EAGAIN);
 }
 
+size_t tq_nb_items(ThreadQueue *tq)
+{
+    size_t ret;
+
+    if (tq->flags & TQ_FLAG_LOCKLESS) {
+        size_t head = atomic_load_explicit(&tq->ring_head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&tq->ring_tail, memory_order_relaxed);
+
+        /* when called from a thread other than the receiver, the two loads
+         * are not ordered with respect to each other */
+        ret = tail - head;
+        return ret <= tq->ring_mask + 1 ? ret : 0;
+    }
+
+    pthread_mutex_lock(&tq->lock);
+    ret = av_fifo_can_read(tq->fifo);
+    pthread_mutex_unlock(&tq->lock);
+
+    return ret;
+}
+
+static int receive_lockless(ThreadQueue *tq, int *stream_idx, void *data)
+{
+    int ret;
+
+    for (int i = 0; i < SPIN_COUNT; i++) {
+        if (i)
+            yield_thread();
+        ret = receive_item(tq, stream_idx, data);
+        if (ret != AVERROR(EAGAIN))
+            break;
+    }
+    if (ret == AVERROR(EAGAIN)) {
+        pthread_mutex_lock(&tq->lock);
+
+        while (1) {
+            wait_prepare(tq);
+            ret = receive_item(tq, stream_idx, data);
+            if (ret != AVERROR(EAGAIN))
+                break;
+            pthread_cond_wait(&tq->cond, &tq->lock);
+        }
+
+        pthread_mutex_unlock(&tq->lock);
+    }
+
+    /* senders waiting for space are only woken up once the ring is at most
+     * half full, so that they can write several items in a row instead of
+     * ping-ponging with the receiver on every item */
+    if (ret == 0 &&
+        tq_nb_items(tq) <= (tq->ring_mask + 1) / 2)
+        wake_waiting(tq);
+
+    return ret;
+}
+
 int tq_receive(ThreadQueue *tq, int *stream_idx, void *data)
 {
     int ret;
 
     *stream_idx = -1;
 
+    if (tq->flags & TQ_FLAG_LOCKLESS)
+        return receive_lockless(tq, stream_idx, data);
+
     pthread_mutex_lock(&tq->lock);
 
     while (1) {
-        ret = receive_locked(tq, stream_idx, data);
+        ret = receive_item(tq, stream_idx, data);
         if (ret == AVERROR(EAGAIN)) {
             pthread_cond_wait(&tq->cond, &tq->lock);
             continue;
@@ -223,7 +514,7 @@ void tq_send_finish(ThreadQueue *tq, unsigned int stream_idx)
     /* mark the stream as send-finished;
      * next time the consumer thread tries to read this stream it will get
      * an EOF and recv-finished flag will be set */
-    tq->finished[stream_idx] |= FINISHED_SEND;
+    atomic_fetch_or(&tq->finished[stream_idx], FINISHED_SEND);
     pthread_cond_broadcast(&tq->cond);
 
     pthread_mutex_unlock(&tq->lock);
@@ -238,7 +529,7 @@ void tq_receive_finish(ThreadQueue *tq, unsigned int stream_idx)
     /* mark the stream as recv-finished;
      * next time the producer thread tries to send for this stream, it will
      * get an EOF and send-finished flag will be set */
-    tq->finished[stream_idx] |= FINISHED_RECV;
+    atomic_fetch_or(&tq->finished[stream_idx], FINISHED_RECV);
     pthread_cond_broadcast(&tq->cond);
 
     pthread_mutex_unlock(&tq->lock);
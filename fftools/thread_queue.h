@@ -25,6 +25,25 @@
 
 typedef struct ThreadQueue ThreadQueue;
 
+enum ThreadQueueFlags {
+    /**
+     * Pass the items through a lock-free ring buffer. The mutex is then only
+     * taken when a thread has to sleep because the queue is full or empty,
+     * or when a stream is marked as finished.
+     *
+     * The queue size is rounded up to the nearest power of two (and at least
+     * 2) and all the items are allocated from the pool upfront. Only a single
+     * thread may call tq_receive() on such a queue.
+     */
+    TQ_FLAG_LOCKLESS        = (1 << 0),
+    /**
+     * Only a single thread will ever call tq_send() on this queue, which
+     * allows the lock-free mode to skip atomic read-modify-write operations
+     * on the producer side. Ignored without TQ_FLAG_LOCKLESS.
+     */
+    TQ_FLAG_SINGLE_PRODUCER = (1 << 1),
+};
+
 /**
  * Allocate a queue for sending data between threads.
  *
@@ -35,9 +54,11 @@ typedef struct ThreadQueue ThreadQueue;
  * @param obj_pool object pool that will be used to allocate items stored in the
  *                 queue; the pool becomes owned by the queue
  * @param callback that moves the contents between two data pointers
+ * @param flags a combination of ThreadQueueFlags
  */
 ThreadQueue *tq_alloc(unsigned int nb_streams, size_t queue_size,
-                      ObjPool *obj_pool, void (*obj_move)(void *dst, void *src));
+                      ObjPool *obj_pool, void (*obj_move)(void *dst, void *src),
+                      int flags);
 void         tq_free(ThreadQueue **tq);
 
 /**
@@ -78,4 +99,11 @@ int tq_receive(ThreadQueue *tq, int *stream_idx, void *data);
  */
 void tq_receive_finish(ThreadQueue *tq, unsigned int stream_idx);
 
+/**
+ * Get the number of items currently stored in the queue. May be called from
+ * any thread; the value is only a snapshot when other threads are accessing
+ * the queue, so it should only be used for statistics.
+ */
+size_t tq_nb_items(ThreadQueue *tq);
+
 #endif // FFTOOLS_THREAD_QUEUE_H
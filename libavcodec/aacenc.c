@@ -401,7 +401,7 @@ void ff_quantize_band_cost_cache_init(struct AACEncContext *s)
 {
     ++s->quantize_band_cost_cache_generation;
     if (s->quantize_band_cost_cache_generation == 0) {
-        memset(s->quantize_band_cost_cache, 0, sizeof(s->quantize_band_cost_cache));
+        memset(s->quantize_band_cost_cache, 0, 256 * sizeof(*s->quantize_band_cost_cache));
         s->quantize_band_cost_cache_generation = 1;
     }
 }
@@ -827,18 +827,158 @@ static void copy_input_samples(AACEncContext *s, const AVFrame *frame)
     }
 }
 
+typedef struct AnalyzeChannelArgs {
+    FFPsyWindowInfo *windows;
+    int flushing;
+} AnalyzeChannelArgs;
+
+/**
+ * Choose the window of one channel and transform it. The channels are
+ * independent of each other, so this runs in parallel with slice threading.
+ */
+static int analyze_channel(AVCodecContext *avctx, void *arg, int channel, int threadnr)
+{
+    AACEncContext *s = avctx->priv_data;
+    const AnalyzeChannelArgs *args = arg;
+    FFPsyWindowInfo *wi = &args->windows[channel];
+    SingleChannelElement *sce;
+    IndividualChannelStream *ics;
+    float *samples2, *la, *overlap;
+    float clip_avoidance_factor;
+    int i, w, k, tag, start_ch = 0;
+
+    for (i = 0; ; i++) {
+        int chans = s->chan_map[i+1] == TYPE_CPE ? 2 : 1;
+        if (channel < start_ch + chans)
+            break;
+        start_ch += chans;
+    }
+    tag = s->chan_map[i+1];
+    sce = &s->cpe[i].ch[channel - start_ch];
+    ics = &sce->ics;
+
+    overlap  = &s->planar_samples[channel][0];
+    samples2 = overlap + 1024;
+    la       = samples2 + (448+64);
+    if (args->flushing)
+        la = NULL;
+    if (tag == TYPE_LFE) {
+        wi->window_type[0] = wi->window_type[1] = ONLY_LONG_SEQUENCE;
+        wi->window_shape   = 0;
+        wi->num_windows    = 1;
+        wi->grouping[0]    = 1;
+        wi->clipping[0]    = 0;
+
+        /* Only the lowest 12 coefficients are used in a LFE channel.
+         * The expression below results in only the bottom 8 coefficients
+         * being used for 11.025kHz to 16kHz sample rates.
+         */
+        ics->num_swb = s->samplerate_index >= 8 ? 1 : 3;
+    } else {
+        *wi = s->psy.model->window(&s->psy, samples2, la, channel,
+                                   ics->window_sequence[0]);
+    }
+    ics->window_sequence[1] = ics->window_sequence[0];
+    ics->window_sequence[0] = wi->window_type[0];
+    ics->use_kb_window[1]   = ics->use_kb_window[0];
+    ics->use_kb_window[0]   = wi->window_shape;
+    ics->num_windows        = wi->num_windows;
+    ics->swb_sizes          = s->psy.bands    [ics->num_windows == 8];
+    ics->num_swb            = tag == TYPE_LFE ? ics->num_swb : s->psy.num_bands[ics->num_windows == 8];
+    ics->max_sfb            = FFMIN(ics->max_sfb, ics->num_swb);
+    ics->swb_offset         = wi->window_type[0] == EIGHT_SHORT_SEQUENCE ?
+                                ff_swb_offset_128 [s->samplerate_index]:
+                                ff_swb_offset_1024[s->samplerate_index];
+    ics->tns_max_bands      = wi->window_type[0] == EIGHT_SHORT_SEQUENCE ?
+                                ff_tns_max_bands_128 [s->samplerate_index]:
+                                ff_tns_max_bands_1024[s->samplerate_index];
+
+    for (w = 0; w < ics->num_windows; w++)
+        ics->group_len[w] = wi->grouping[w];
+
+    /* Calculate input sample maximums and evaluate clipping risk */
+    clip_avoidance_factor = 0.0f;
+    for (w = 0; w < ics->num_windows; w++) {
+        const float *wbuf = overlap + w * 128;
+        const int wlen = 2048 / ics->num_windows;
+        float max = 0;
+        int j;
+        /* mdct input is 2 * output */
+        for (j = 0; j < wlen; j++)
+            max = FFMAX(max, fabsf(wbuf[j]));
+        wi->clipping[w] = max;
+    }
+    for (w = 0; w < ics->num_windows; w++) {
+        if (wi->clipping[w] > CLIP_AVOIDANCE_FACTOR) {
+            ics->window_clipping[w] = 1;
+            clip_avoidance_factor = FFMAX(clip_avoidance_factor, wi->clipping[w]);
+        } else {
+            ics->window_clipping[w] = 0;
+        }
+    }
+    if (clip_avoidance_factor > CLIP_AVOIDANCE_FACTOR) {
+        ics->clip_avoidance_factor = CLIP_AVOIDANCE_FACTOR / clip_avoidance_factor;
+    } else {
+        ics->clip_avoidance_factor = 1.0f;
+    }
+
+    apply_window_and_mdct(s, sce, overlap);
+
+    for (k = 0; k < 1024; k++) {
+        if (!(fabs(sce->coeffs[k]) < 1E16)) { // Ensure headroom for energy calculation
+            av_log(avctx, AV_LOG_ERROR, "Input contains (near) NaN/+-Inf\n");
+            return AVERROR(EINVAL);
+        }
+    }
+    avoid_clipping(s, sce);
+
+    return 0;
+}
+
+static void search_for_quantizers(AVCodecContext *avctx, AACEncContext *s,
+                                  SingleChannelElement *sce)
+{
+    if (s->options.pns && s->coder->mark_pns)
+        s->coder->mark_pns(s, avctx, sce);
+    s->coder->search_for_quantizers(avctx, s, sce, s->lambda);
+}
+
+/**
+ * Search the quantizers of one channel of a CPE. The second channel uses
+ * the duplicate context, which has its own scratch buffers.
+ */
+static int search_for_quantizers_thread(AVCodecContext *avctx, void *arg,
+                                        int ch, int threadnr)
+{
+    AACEncContext *s = avctx->priv_data;
+    ChannelElement *cpe = arg;
+
+    search_for_quantizers(avctx, ch ? s->dup_ctx : s, &cpe->ch[ch]);
+    return 0;
+}
+
+static void update_duplicate_context(AACEncContext *dst, const AACEncContext *src)
+{
+    AACQuantizeBandCostCacheEntry (*cache)[128] = dst->quantize_band_cost_cache;
+    uint16_t generation = dst->quantize_band_cost_cache_generation;
+
+    *dst = *src;
+    dst->quantize_band_cost_cache            = cache;
+    dst->quantize_band_cost_cache_generation = generation;
+    dst->dup_ctx                             = NULL;
+}
+
 static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
                             const AVFrame *frame, int *got_packet_ptr)
 {
     AACEncContext *s = avctx->priv_data;
-    float **samples = s->planar_samples, *samples2, *la, *overlap;
     ChannelElement *cpe;
     SingleChannelElement *sce;
-    IndividualChannelStream *ics;
     int i, its, ch, w, chans, tag, start_ch, ret, frame_bits;
     int target_bits, rate_bits, too_many_bits, too_few_bits;
     int ms_mode = 0, is_mode = 0, tns_mode = 0, pred_mode = 0;
     int chan_el_counter[4];
+    int ch_ret[AAC_MAX_CHANNELS];
     FFPsyWindowInfo windows[AAC_MAX_CHANNELS];
 
     /* add current frame to queue */
@@ -857,101 +997,30 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
     if (!avctx->frame_num)
         return 0;
 
-    start_ch = 0;
-    for (i = 0; i < s->chan_map[0]; i++) {
-        FFPsyWindowInfo* wi = windows + start_ch;
-        tag      = s->chan_map[i+1];
-        chans    = tag == TYPE_CPE ? 2 : 1;
-        cpe      = &s->cpe[i];
-        for (ch = 0; ch < chans; ch++) {
-            int k;
-            float clip_avoidance_factor;
-            sce = &cpe->ch[ch];
-            ics = &sce->ics;
-            s->cur_channel = start_ch + ch;
-            overlap  = &samples[s->cur_channel][0];
-            samples2 = overlap + 1024;
-            la       = samples2 + (448+64);
-            if (!frame)
-                la = NULL;
-            if (tag == TYPE_LFE) {
-                wi[ch].window_type[0] = wi[ch].window_type[1] = ONLY_LONG_SEQUENCE;
-                wi[ch].window_shape   = 0;
-                wi[ch].num_windows    = 1;
-                wi[ch].grouping[0]    = 1;
-                wi[ch].clipping[0]    = 0;
-
-                /* Only the lowest 12 coefficients are used in a LFE channel.
-                 * The expression below results in only the bottom 8 coefficients
-                 * being used for 11.025kHz to 16kHz sample rates.
-                 */
-                ics->num_swb = s->samplerate_index >= 8 ? 1 : 3;
-            } else {
-                wi[ch] = s->psy.model->window(&s->psy, samples2, la, s->cur_channel,
-                                              ics->window_sequence[0]);
-            }
-            ics->window_sequence[1] = ics->window_sequence[0];
-            ics->window_sequence[0] = wi[ch].window_type[0];
-            ics->use_kb_window[1]   = ics->use_kb_window[0];
-            ics->use_kb_window[0]   = wi[ch].window_shape;
-            ics->num_windows        = wi[ch].num_windows;
-            ics->swb_sizes          = s->psy.bands    [ics->num_windows == 8];
-            ics->num_swb            = tag == TYPE_LFE ? ics->num_swb : s->psy.num_bands[ics->num_windows == 8];
-            ics->max_sfb            = FFMIN(ics->max_sfb, ics->num_swb);
-            ics->swb_offset         = wi[ch].window_type[0] == EIGHT_SHORT_SEQUENCE ?
-                                        ff_swb_offset_128 [s->samplerate_index]:
-                                        ff_swb_offset_1024[s->samplerate_index];
-            ics->tns_max_bands      = wi[ch].window_type[0] == EIGHT_SHORT_SEQUENCE ?
-                                        ff_tns_max_bands_128 [s->samplerate_index]:
-                                        ff_tns_max_bands_1024[s->samplerate_index];
-
-            for (w = 0; w < ics->num_windows; w++)
-                ics->group_len[w] = wi[ch].grouping[w];
-
-            /* Calculate input sample maximums and evaluate clipping risk */
-            clip_avoidance_factor = 0.0f;
-            for (w = 0; w < ics->num_windows; w++) {
-                const float *wbuf = overlap + w * 128;
-                const int wlen = 2048 / ics->num_windows;
-                float max = 0;
-                int j;
-                /* mdct input is 2 * output */
-                for (j = 0; j < wlen; j++)
-                    max = FFMAX(max, fabsf(wbuf[j]));
-                wi[ch].clipping[w] = max;
-            }
-            for (w = 0; w < ics->num_windows; w++) {
-                if (wi[ch].clipping[w] > CLIP_AVOIDANCE_FACTOR) {
-                    ics->window_clipping[w] = 1;
-                    clip_avoidance_factor = FFMAX(clip_avoidance_factor, wi[ch].clipping[w]);
-                } else {
-                    ics->window_clipping[w] = 0;
-                }
-            }
-            if (clip_avoidance_factor > CLIP_AVOIDANCE_FACTOR) {
-                ics->clip_avoidance_factor = CLIP_AVOIDANCE_FACTOR / clip_avoidance_factor;
-            } else {
-                ics->clip_avoidance_factor = 1.0f;
-            }
-
-            apply_window_and_mdct(s, sce, overlap);
+    ret = 0;
+    avctx->execute2(avctx, analyze_channel, &(AnalyzeChannelArgs){ windows, !frame },
+                    ch_ret, s->channels);
+    for (ch = 0; ch < s->channels; ch++)
+        ret = FFMIN(ret, ch_ret[ch]);
+    if (ret < 0)
+        return ret;
 
-            if (s->options.ltp && s->coder->update_ltp) {
+    if (s->options.ltp && s->coder->update_ltp) {
+        start_ch = 0;
+        for (i = 0; i < s->chan_map[0]; i++) {
+            chans = s->chan_map[i+1] == TYPE_CPE ? 2 : 1;
+            cpe   = &s->cpe[i];
+            for (ch = 0; ch < chans; ch++) {
+                sce = &cpe->ch[ch];
+                s->cur_channel = start_ch + ch;
                 s->coder->update_ltp(s, sce);
                 apply_window[sce->ics.window_sequence[0]](s->fdsp, sce, &sce->ltp_state[0]);
                 s->mdct1024_fn(s->mdct1024, sce->lcoeffs, sce->ret_buf, sizeof(float));
             }
-
-            for (k = 0; k < 1024; k++) {
-                if (!(fabs(cpe->ch[ch].coeffs[k]) < 1E16)) { // Ensure headroom for energy calculation
-                    av_log(avctx, AV_LOG_ERROR, "Input contains (near) NaN/+-Inf\n");
-                    return AVERROR(EINVAL);
-                }
-            }
-            avoid_clipping(s, sce);
+            start_ch += chans;
         }
-        start_ch += chans;
     }
+
     if ((ret = ff_alloc_packet(avctx, avpkt, 8192 * s->channels)) < 0)
         return ret;
     frame_bits = its = 0;
@@ -996,11 +1065,16 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
                 s->psy.bitres.alloc /= chans;
             }
             s->cur_type = tag;
-            for (ch = 0; ch < chans; ch++) {
-                s->cur_channel = start_ch + ch;
-                if (s->options.pns && s->coder->mark_pns)
-                    s->coder->mark_pns(s, avctx, &cpe->ch[ch]);
-                s->coder->search_for_quantizers(avctx, s, &cpe->ch[ch], s->lambda);
+            if (chans > 1 && s->dup_ctx) {
+                s->cur_channel = start_ch;
+                update_duplicate_context(s->dup_ctx, s);
+                s->dup_ctx->cur_channel = start_ch + 1;
+                avctx->execute2(avctx, search_for_quantizers_thread, cpe, NULL, chans);
+            } else {
+                for (ch = 0; ch < chans; ch++) {
+                    s->cur_channel = start_ch + ch;
+                    search_for_quantizers(avctx, s, &cpe->ch[ch]);
+                }
             }
             if (chans > 1
                 && wi[0].window_type[0] == wi[1].window_type[0]
@@ -1185,6 +1259,10 @@ static av_cold int aac_encode_end(AVCodecContext *avctx)
     av_freep(&s->buffer.samples);
     av_freep(&s->cpe);
     av_freep(&s->fdsp);
+    av_freep(&s->quantize_band_cost_cache);
+    if (s->dup_ctx)
+        av_freep(&s->dup_ctx->quantize_band_cost_cache);
+    av_freep(&s->dup_ctx);
     ff_af_queue_close(&s->afq);
     return 0;
 }
@@ -1215,9 +1293,18 @@ static av_cold int alloc_buffers(AVCodecContext *avctx, AACEncContext *s)
 {
     int ch;
     if (!FF_ALLOCZ_TYPED_ARRAY(s->buffer.samples, s->channels * 3 * 1024) ||
-        !FF_ALLOCZ_TYPED_ARRAY(s->cpe,            s->chan_map[0]))
+        !FF_ALLOCZ_TYPED_ARRAY(s->cpe,            s->chan_map[0]) ||
+        !FF_ALLOCZ_TYPED_ARRAY(s->quantize_band_cost_cache, 256))
         return AVERROR(ENOMEM);
 
+    /* the channels of a CPE are quantized in parallel with slice threading */
+    if (avctx->active_thread_type & FF_THREAD_SLICE &&
+        memchr(s->chan_map + 1, TYPE_CPE, s->chan_map[0])) {
+        if (!FF_ALLOCZ_TYPED_ARRAY(s->dup_ctx, 1) ||
+            !FF_ALLOCZ_TYPED_ARRAY(s->dup_ctx->quantize_band_cost_cache, 256))
+            return AVERROR(ENOMEM);
+    }
+
     for(ch = 0; ch < s->channels; ch++)
         s->planar_samples[ch] = s->buffer.samples + 3 * 1024 * ch;
 
@@ -1421,7 +1508,7 @@ const FFCodec ff_aac_encoder = {
     .p.type         = AVMEDIA_TYPE_AUDIO,
     .p.id           = AV_CODEC_ID_AAC,
     .p.capabilities = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_DELAY |
-                      AV_CODEC_CAP_SMALL_LAST_FRAME,
+                      AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_SLICE_THREADS,
     .priv_data_size = sizeof(AACEncContext),
     .init           = aac_encode_init,
     FF_CODEC_ENCODE_CB(aac_encode_frame),
@@ -142,7 +142,7 @@ typedef struct AACEncContext {
     DECLARE_ALIGNED(32, float, scoefs)[1024];    ///< scaled coefficients
 
     uint16_t quantize_band_cost_cache_generation;
-    AACQuantizeBandCostCacheEntry quantize_band_cost_cache[256][128]; ///< memoization area for quantize_band_cost
+    AACQuantizeBandCostCacheEntry (*quantize_band_cost_cache)[128]; ///< memoization area for quantize_band_cost, 256 entries
 
     void (*abs_pow34)(float *out, const float *in, const int size);
     void (*quant_bands)(int *out, const float *in, const float *scaled,
@@ -152,6 +152,13 @@ typedef struct AACEncContext {
     struct {
         float *samples;
     } buffer;
+
+    /**
+     * Copy of this context used to search the quantizers of the second
+     * channel of a CPE in parallel with the first, when slice threading
+     * is enabled.
+     */
+    struct AACEncContext *dup_ctx;
 } AACEncContext;
 
 void ff_aac_dsp_init_x86(AACEncContext *s);
@@ -36,6 +36,7 @@
 #include "libavutil/log.h"
 #include "libavutil/pixfmt.h"
 #include "libavutil/rational.h"
+#include "libavutil/threadpool.h"
 
 #include "codec.h"
 #include "codec_desc.h"
@@ -2075,6 +2076,20 @@ typedef struct AVCodecContext {
      *   an error.
      */
     int64_t frame_num;
+
+    /**
+     * Thread pool to run the slice and frame threading jobs of this context
+     * on, instead of creating threads of its own. The pool is owned by the
+     * caller and may be shared by any number of codec contexts. It must
+     * outlive this context.
+     *
+     * When set, a thread_count of 0 picks the number of threads based on
+     * the size of the pool rather than on the number of CPUs.
+     *
+     * - encoding: May be set by the caller before avcodec_open2().
+     * - decoding: May be set by the caller before avcodec_open2().
+     */
+    AVThreadPool *thread_pool;
 } AVCodecContext;
 
 /**
@@ -88,6 +88,12 @@
  * encoders do.
  */
 #define FF_CODEC_CAP_EOF_FLUSH              (1 << 10)
+/**
+ * The encoder has AV_CODEC_CAP_DELAY set, but supports frame threading when
+ * encoding intra-only (gop_size <= 1, no B-frames), in which case it has no
+ * delay. Such encoders must not set AV_CODEC_CAP_FRAME_THREADS.
+ */
+#define FF_CODEC_CAP_INTRA_ONLY_FRAME_THREADS (1 << 11)
 
 /**
  * FFCodec.codec_tags termination value
@@ -26,7 +26,9 @@
 #include "libavutil/cpu.h"
 #include "libavutil/opt.h"
 #include "libavutil/thread.h"
+#include "libavutil/threadpool_internal.h"
 #include "avcodec.h"
+#include "codec_internal.h"
 #include "encode.h"
 #include "internal.h"
 #include "pthread_internal.h"
@@ -41,11 +43,17 @@
 typedef struct{
     AVFrame  *indata;
     AVPacket *outdata;
+    int64_t   frame_num;
     int       return_code;
     int       finished;
     int       got_packet;
 } Task;
 
+typedef struct PoolJob {
+    AVThreadPoolJob job;
+    AVCodecContext *avctx;
+} PoolJob;
+
 typedef struct{
     AVCodecContext *parent_avctx;
 
@@ -61,9 +69,18 @@ typedef struct{
     unsigned next_task_index;
     unsigned task_index;
     unsigned finished_task_index;
+    int64_t  next_frame_num;
 
     pthread_t worker[MAX_THREADS];
     atomic_int exit;
+
+    /* When running on a thread pool, each codec context has a job instead
+     * of a worker thread. A job encodes tasks until there are none left and
+     * then puts itself on the idle list, guarded by task_fifo_mutex. */
+    AVThreadPool *pool;
+    PoolJob jobs[MAX_THREADS];
+    PoolJob *idle_jobs[MAX_THREADS];
+    int nb_idle_jobs;
 } ThreadContext;
 
 #define OFF(member) offsetof(ThreadContext, member)
@@ -72,15 +89,51 @@ DEFINE_OFFSET_ARRAY(ThreadContext, thread_ctx, pthread_init_cnt,
                     (OFF(task_fifo_cond),  OFF(finished_task_cond)));
 #undef OFF
 
+static void encode_task(AVCodecContext *avctx, ThreadContext *c, unsigned task_index)
+{
+    /* The main thread ensures that any two outstanding tasks have
+     * different indices, ergo each worker thread owns its element
+     * of c->tasks with the exception of finished, which is shared
+     * with the main thread and guarded by finished_task_mutex. */
+    Task *task = &c->tasks[task_index];
+    int ret;
+
+    avctx->frame_num = task->frame_num;
+    ret = ff_encode_encode_cb(avctx, task->outdata, task->indata, &task->got_packet);
+    pthread_mutex_lock(&c->finished_task_mutex);
+    task->return_code = ret;
+    task->finished    = 1;
+    pthread_cond_signal(&c->finished_task_cond);
+    pthread_mutex_unlock(&c->finished_task_mutex);
+}
+
+static void worker_job(void *v)
+{
+    PoolJob *job = v;
+    AVCodecContext *avctx = job->avctx;
+    ThreadContext *c = avctx->internal->frame_thread_encoder;
+
+    pthread_mutex_lock(&c->task_fifo_mutex);
+    while (c->next_task_index != c->task_index) {
+        unsigned task_index = c->next_task_index;
+
+        c->next_task_index = (c->next_task_index + 1) % c->max_tasks;
+        pthread_mutex_unlock(&c->task_fifo_mutex);
+
+        encode_task(avctx, c, task_index);
+
+        pthread_mutex_lock(&c->task_fifo_mutex);
+    }
+    c->idle_jobs[c->nb_idle_jobs++] = job;
+    pthread_cond_broadcast(&c->task_fifo_cond);
+    pthread_mutex_unlock(&c->task_fifo_mutex);
+}
+
 static void * attribute_align_arg worker(void *v){
     AVCodecContext *avctx = v;
     ThreadContext *c = avctx->internal->frame_thread_encoder;
 
     while (!atomic_load(&c->exit)) {
-        int ret;
-        AVPacket *pkt;
-        AVFrame *frame;
-        Task *task;
         unsigned task_index;
 
         pthread_mutex_lock(&c->task_fifo_mutex);
@@ -94,20 +147,8 @@ static void * attribute_align_arg worker(void *v){
         task_index         = c->next_task_index;
         c->next_task_index = (c->next_task_index + 1) % c->max_tasks;
         pthread_mutex_unlock(&c->task_fifo_mutex);
-        /* The main thread ensures that any two outstanding tasks have
-         * different indices, ergo each worker thread owns its element
-         * of c->tasks with the exception of finished, which is shared
-         * with the main thread and guarded by finished_task_mutex. */
-        task  = &c->tasks[task_index];
-        frame = task->indata;
-        pkt   = task->outdata;
-
-        ret = ff_encode_encode_cb(avctx, pkt, frame, &task->got_packet);
-        pthread_mutex_lock(&c->finished_task_mutex);
-        task->return_code = ret;
-        task->finished    = 1;
-        pthread_cond_signal(&c->finished_task_cond);
-        pthread_mutex_unlock(&c->finished_task_mutex);
+
+        encode_task(avctx, c, task_index);
     }
 end:
     avcodec_close(avctx);
@@ -123,9 +164,12 @@ av_cold int ff_frame_thread_encoder_init(AVCodecContext *avctx)
     int ret;
 
     if(   !(avctx->thread_type & FF_THREAD_FRAME)
-       || !(avctx->codec->capabilities & AV_CODEC_CAP_FRAME_THREADS))
+       || !(avctx->codec->capabilities & AV_CODEC_CAP_FRAME_THREADS ||
+            ffcodec(avctx->codec)->caps_internal & FF_CODEC_CAP_INTRA_ONLY_FRAME_THREADS))
         return 0;
 
+    /* with rate control, the output depends on the number of threads, which
+     * must then not depend on the machine by default */
     if(   !avctx->thread_count
        && avctx->codec_id == AV_CODEC_ID_MJPEG
        && !(avctx->flags & AV_CODEC_FLAG_QSCALE)) {
@@ -134,12 +178,35 @@ av_cold int ff_frame_thread_encoder_init(AVCodecContext *avctx)
                "or a constant quantizer if you want to use multiple cpu cores\n");
         avctx->thread_count = 1;
     }
-    if(   avctx->thread_count > 1
-       && avctx->codec_id == AV_CODEC_ID_MJPEG
-       && !(avctx->flags & AV_CODEC_FLAG_QSCALE))
-        av_log(avctx, AV_LOG_WARNING,
-               "MJPEG CBR encoding works badly with frame multi-threading, consider "
-               "using -threads 1, -thread_type slice or a constant quantizer.\n");
+
+    if (avctx->codec_id == AV_CODEC_ID_MPEG1VIDEO ||
+        avctx->codec_id == AV_CODEC_ID_MPEG2VIDEO ||
+        avctx->codec_id == AV_CODEC_ID_MPEG4      ||
+        avctx->codec_id == AV_CODEC_ID_MJPEG) {
+        /* The frame thread contexts of mpegvideo encoders share their rate
+         * control, but nothing else: the frames must not depend on each
+         * other nor on statistics gathered over the previous frames. */
+        int64_t nr = 0, skip_threshold = 0, skip_factor = 0;
+        const char *reason = NULL;
+
+        av_opt_get_int(avctx->priv_data, "noise_reduction", 0, &nr);
+        av_opt_get_int(avctx->priv_data, "skip_threshold",  0, &skip_threshold);
+        av_opt_get_int(avctx->priv_data, "skip_factor",     0, &skip_factor);
+
+        if (ffcodec(avctx->codec)->caps_internal & FF_CODEC_CAP_INTRA_ONLY_FRAME_THREADS &&
+            (avctx->gop_size > 1 || avctx->max_b_frames))
+            reason = "inter frames";
+        else if (avctx->flags & (AV_CODEC_FLAG_PASS1 | AV_CODEC_FLAG_PASS2))
+            reason = "2-pass encoding";
+        else if (nr || skip_threshold || skip_factor)
+            reason = "noise reduction or frame skipping";
+
+        if (reason) {
+            av_log(avctx, AV_LOG_VERBOSE,
+                   "Frame threading is not supported with %s\n", reason);
+            return 0;
+        }
+    }
 
     if (avctx->codec_id == AV_CODEC_ID_HUFFYUV ||
         avctx->codec_id == AV_CODEC_ID_FFVHUFF) {
@@ -162,7 +229,8 @@ av_cold int ff_frame_thread_encoder_init(AVCodecContext *avctx)
     }
 
     if(!avctx->thread_count) {
-        avctx->thread_count = av_cpu_count();
+        avctx->thread_count = avctx->thread_pool ? avpriv_thread_pool_nb_threads(avctx->thread_pool)
+                                                 : av_cpu_count();
         avctx->thread_count = FFMIN(avctx->thread_count, MAX_THREADS);
     }
 
@@ -178,6 +246,7 @@ av_cold int ff_frame_thread_encoder_init(AVCodecContext *avctx)
         return AVERROR(ENOMEM);
 
     c->parent_avctx = avctx;
+    c->pool         = avctx->thread_pool;
 
     ret = ff_pthread_init(c, thread_ctx_offsets);
     if (ret < 0)
@@ -220,7 +289,14 @@ av_cold int ff_frame_thread_encoder_init(AVCodecContext *avctx)
             goto fail;
         av_assert0(!thread_avctx->internal->frame_thread_encoder);
         thread_avctx->internal->frame_thread_encoder = c;
-        if ((ret = pthread_create(&c->worker[i], NULL, worker, thread_avctx))) {
+        if (c->pool) {
+            PoolJob *job = &c->jobs[i];
+
+            job->job.func   = worker_job;
+            job->job.opaque = job;
+            job->avctx      = thread_avctx;
+            c->idle_jobs[c->nb_idle_jobs++] = job;
+        } else if ((ret = pthread_create(&c->worker[i], NULL, worker, thread_avctx))) {
             ret = AVERROR(ret);
             goto fail;
         }
@@ -238,6 +314,13 @@ fail:
     return ret;
 }
 
+AVCodecContext *ff_frame_thread_encoder_parent(const AVCodecContext *avctx)
+{
+    ThreadContext *c = avctx->internal->frame_thread_encoder;
+
+    return c && c->parent_avctx != avctx ? c->parent_avctx : NULL;
+}
+
 av_cold void ff_frame_thread_encoder_free(AVCodecContext *avctx)
 {
     ThreadContext *c= avctx->internal->frame_thread_encoder;
@@ -245,7 +328,18 @@ av_cold void ff_frame_thread_encoder_free(AVCodecContext *avctx)
     /* In case initializing the mutexes/condition variables failed,
      * they must not be used. In this case the thread_count is zero
      * as no thread has been initialized yet. */
-    if (avctx->thread_count > 0) {
+    if (avctx->thread_count > 0 && c->pool) {
+        /* jobs only become idle once there are no tasks left */
+        pthread_mutex_lock(&c->task_fifo_mutex);
+        while (c->nb_idle_jobs < avctx->thread_count)
+            pthread_cond_wait(&c->task_fifo_cond, &c->task_fifo_mutex);
+        pthread_mutex_unlock(&c->task_fifo_mutex);
+
+        for (int i = 0; i < avctx->thread_count; i++) {
+            avcodec_close(c->jobs[i].avctx);
+            av_freep(&c->jobs[i].avctx);
+        }
+    } else if (avctx->thread_count > 0) {
         pthread_mutex_lock(&c->task_fifo_mutex);
         atomic_store(&c->exit, 1);
         pthread_cond_broadcast(&c->task_fifo_cond);
@@ -274,10 +368,14 @@ int ff_thread_video_encode_frame(AVCodecContext *avctx, AVPacket *pkt,
 
     if(frame){
         av_frame_move_ref(c->tasks[c->task_index].indata, frame);
+        c->tasks[c->task_index].frame_num = c->next_frame_num++;
 
         pthread_mutex_lock(&c->task_fifo_mutex);
         c->task_index = (c->task_index + 1) % c->max_tasks;
-        pthread_cond_signal(&c->task_fifo_cond);
+        if (c->pool && c->nb_idle_jobs)
+            avpriv_thread_pool_submit(c->pool, &c->idle_jobs[--c->nb_idle_jobs]->job, 1);
+        else if (!c->pool)
+            pthread_cond_signal(&c->task_fifo_cond);
         pthread_mutex_unlock(&c->task_fifo_mutex);
     }
 
@@ -32,4 +32,15 @@ void ff_frame_thread_encoder_free(AVCodecContext *avctx);
 int ff_thread_video_encode_frame(AVCodecContext *avctx, AVPacket *pkt,
                                  AVFrame *frame, int *got_packet_ptr);
 
+/**
+ * Get the context a frame thread context encodes frames for.
+ *
+ * The frame thread contexts set AVCodecContext.frame_num to the number of
+ * frames sent to the user-facing context before the one being encoded.
+ *
+ * @return the user-facing context if avctx is one of the contexts of the
+ *         frame thread encoder, NULL otherwise
+ */
+AVCodecContext *ff_frame_thread_encoder_parent(const AVCodecContext *avctx);
+
 #endif /* AVCODEC_FRAME_THREAD_ENCODER_H */
@@ -18,7 +18,9 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <stdatomic.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "libavutil/avassert.h"
 #include "libavutil/avutil.h"
@@ -33,6 +35,8 @@
 #include "avcodec.h"
 #include "internal.h"
 
+#define MAX_FRAME_POOLS 4
+
 typedef struct FramePool {
     /**
      * Pools for each data plane. For audio all the planes have the same size,
@@ -52,67 +56,100 @@ typedef struct FramePool {
     int samples;
 } FramePool;
 
-static void frame_pool_free(void *opaque, uint8_t *data)
+/**
+ * The frame pools of a context, kept across changes of the frame
+ * parameters so that going back to previous ones does not allocate.
+ * Shared by the frame thread contexts, which call get_buffer2()
+ * under a lock.
+ */
+typedef struct FramePoolCache {
+    /* most recently used first */
+    FramePool *pools[MAX_FRAME_POOLS];
+    int        nb_pools;
+
+    /* heap allocations of pools and pool buffers */
+    atomic_uint nb_allocs;
+} FramePoolCache;
+
+static void frame_pool_free(FramePool **ppool)
 {
-    FramePool *pool = (FramePool*)data;
+    FramePool *pool = *ppool;
     int i;
 
+    if (!pool)
+        return;
+
     for (i = 0; i < FF_ARRAY_ELEMS(pool->pools); i++)
         av_buffer_pool_uninit(&pool->pools[i]);
 
+    av_freep(ppool);
+}
+
+static void frame_pool_cache_free(void *opaque, uint8_t *data)
+{
+    FramePoolCache *cache = (FramePoolCache*)data;
+
+    for (int i = 0; i < cache->nb_pools; i++)
+        frame_pool_free(&cache->pools[i]);
+
     av_freep(&data);
 }
 
-static AVBufferRef *frame_pool_alloc(void)
+static FramePoolCache *frame_pool_cache_get(AVCodecContext *avctx)
 {
-    FramePool *pool = av_mallocz(sizeof(*pool));
-    AVBufferRef *buf;
+    AVCodecInternal *avci = avctx->internal;
+    FramePoolCache *cache;
 
-    if (!pool)
+    if (avci->pool)
+        return (FramePoolCache*)avci->pool->data;
+
+    cache = av_mallocz(sizeof(*cache));
+    if (!cache)
         return NULL;
 
-    buf = av_buffer_create((uint8_t*)pool, sizeof(*pool),
-                           frame_pool_free, NULL, 0);
-    if (!buf) {
-        av_freep(&pool);
+    avci->pool = av_buffer_create((uint8_t*)cache, sizeof(*cache),
+                                  frame_pool_cache_free, NULL, 0);
+    if (!avci->pool) {
+        av_freep(&cache);
         return NULL;
     }
+    /* the cache itself */
+    atomic_init(&cache->nb_allocs, 1);
 
-    return buf;
+    return cache;
 }
 
-static int update_frame_pool(AVCodecContext *avctx, AVFrame *frame)
+static AVBufferRef *pool_alloc_buffer(void *opaque, size_t size)
 {
-    FramePool *pool = avctx->internal->pool ?
-                      (FramePool*)avctx->internal->pool->data : NULL;
-    AVBufferRef *pool_buf;
-    int i, ret, ch, planes;
+    FramePoolCache *cache = opaque;
 
-    if (avctx->codec_type == AVMEDIA_TYPE_AUDIO) {
-        int planar = av_sample_fmt_is_planar(frame->format);
-        ch     = frame->ch_layout.nb_channels;
-#if FF_API_OLD_CHANNEL_LAYOUT
-FF_DISABLE_DEPRECATION_WARNINGS
-        if (!ch)
-            ch = frame->channels;
-FF_ENABLE_DEPRECATION_WARNINGS
-#endif
-        planes = planar ? ch : 1;
-    }
+    atomic_fetch_add_explicit(&cache->nb_allocs, 1, memory_order_relaxed);
+    return av_buffer_alloc(size);
+}
 
-    if (pool && pool->format == frame->format) {
-        if (avctx->codec_type == AVMEDIA_TYPE_VIDEO &&
-            pool->width == frame->width && pool->height == frame->height)
-            return 0;
-        if (avctx->codec_type == AVMEDIA_TYPE_AUDIO && pool->planes == planes &&
-            pool->channels == ch && frame->nb_samples == pool->samples)
-            return 0;
-    }
+static AVBufferRef *pool_allocz_buffer(void *opaque, size_t size)
+{
+    FramePoolCache *cache = opaque;
 
-    pool_buf = frame_pool_alloc();
-    if (!pool_buf)
-        return AVERROR(ENOMEM);
-    pool = (FramePool*)pool_buf->data;
+    atomic_fetch_add_explicit(&cache->nb_allocs, 1, memory_order_relaxed);
+    return av_buffer_allocz(size);
+}
+
+static int frame_pool_match(const AVCodecContext *avctx, const FramePool *pool,
+                            const AVFrame *frame, int planes, int ch)
+{
+    if (pool->format != frame->format)
+        return 0;
+    if (avctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        return pool->width == frame->width && pool->height == frame->height;
+    return pool->planes == planes && pool->channels == ch &&
+           pool->samples == frame->nb_samples;
+}
+
+static int frame_pool_init(AVCodecContext *avctx, FramePoolCache *cache,
+                           FramePool *pool, AVFrame *frame, int planes, int ch)
+{
+    int i, ret;
 
     switch (avctx->codec_type) {
     case AVMEDIA_TYPE_VIDEO: {
@@ -130,7 +167,7 @@ FF_ENABLE_DEPRECATION_WARNINGS
             // that linesize[0] == 2*linesize[1] in the MPEG-encoder for 4:2:2
             ret = av_image_fill_linesizes(linesize, avctx->pix_fmt, w);
             if (ret < 0)
-                goto fail;
+                return ret;
             // increase alignment of w for next try (rhs gives the lowest bit set in w)
             w += w & ~(w - 1);
 
@@ -143,23 +180,21 @@ FF_ENABLE_DEPRECATION_WARNINGS
             linesize1[i] = linesize[i];
         ret = av_image_fill_plane_sizes(size, avctx->pix_fmt, h, linesize1);
         if (ret < 0)
-            goto fail;
+            return ret;
 
         for (i = 0; i < 4; i++) {
             pool->linesize[i] = linesize[i];
             if (size[i]) {
-                if (size[i] > INT_MAX - (16 + STRIDE_ALIGN - 1)) {
-                    ret = AVERROR(EINVAL);
-                    goto fail;
-                }
-                pool->pools[i] = av_buffer_pool_init(size[i] + 16 + STRIDE_ALIGN - 1,
-                                                     CONFIG_MEMORY_POISONING ?
-                                                        NULL :
-                                                        av_buffer_allocz);
-                if (!pool->pools[i]) {
-                    ret = AVERROR(ENOMEM);
-                    goto fail;
-                }
+                if (size[i] > INT_MAX - (16 + STRIDE_ALIGN - 1))
+                    return AVERROR(EINVAL);
+                pool->pools[i] = av_buffer_pool_init2(size[i] + 16 + STRIDE_ALIGN - 1,
+                                                      cache,
+                                                      CONFIG_MEMORY_POISONING ?
+                                                         pool_alloc_buffer :
+                                                         pool_allocz_buffer,
+                                                      NULL);
+                if (!pool->pools[i])
+                    return AVERROR(ENOMEM);
             }
         }
         pool->format = frame->format;
@@ -172,13 +207,12 @@ FF_ENABLE_DEPRECATION_WARNINGS
         ret = av_samples_get_buffer_size(&pool->linesize[0], ch,
                                          frame->nb_samples, frame->format, 0);
         if (ret < 0)
-            goto fail;
+            return ret;
 
-        pool->pools[0] = av_buffer_pool_init(pool->linesize[0], NULL);
-        if (!pool->pools[0]) {
-            ret = AVERROR(ENOMEM);
-            goto fail;
-        }
+        pool->pools[0] = av_buffer_pool_init2(pool->linesize[0], cache,
+                                              pool_alloc_buffer, NULL);
+        if (!pool->pools[0])
+            return AVERROR(ENOMEM);
 
         pool->format     = frame->format;
         pool->planes     = planes;
@@ -189,18 +223,75 @@ FF_ENABLE_DEPRECATION_WARNINGS
     default: av_assert0(0);
     }
 
-    av_buffer_unref(&avctx->internal->pool);
-    avctx->internal->pool = pool_buf;
+    return 0;
+}
+
+static int update_frame_pool(AVCodecContext *avctx, AVFrame *frame)
+{
+    FramePoolCache *cache = frame_pool_cache_get(avctx);
+    FramePool *pool;
+    int i, ret, ch = 0, planes = 0;
+
+    if (!cache)
+        return AVERROR(ENOMEM);
+
+    if (avctx->codec_type == AVMEDIA_TYPE_AUDIO) {
+        int planar = av_sample_fmt_is_planar(frame->format);
+        ch     = frame->ch_layout.nb_channels;
+#if FF_API_OLD_CHANNEL_LAYOUT
+FF_DISABLE_DEPRECATION_WARNINGS
+        if (!ch)
+            ch = frame->channels;
+FF_ENABLE_DEPRECATION_WARNINGS
+#endif
+        planes = planar ? ch : 1;
+    }
+
+    for (i = 0; i < cache->nb_pools; i++) {
+        if (frame_pool_match(avctx, cache->pools[i], frame, planes, ch)) {
+            pool = cache->pools[i];
+            memmove(&cache->pools[1], &cache->pools[0], i * sizeof(*cache->pools));
+            cache->pools[0] = pool;
+            return 0;
+        }
+    }
+
+    pool = av_mallocz(sizeof(*pool));
+    if (!pool)
+        return AVERROR(ENOMEM);
+    atomic_fetch_add_explicit(&cache->nb_allocs, 1, memory_order_relaxed);
+
+    ret = frame_pool_init(avctx, cache, pool, frame, planes, ch);
+    if (ret < 0) {
+        frame_pool_free(&pool);
+        return ret;
+    }
+
+    if (cache->nb_pools == MAX_FRAME_POOLS)
+        frame_pool_free(&cache->pools[--cache->nb_pools]);
+    memmove(&cache->pools[1], &cache->pools[0],
+            cache->nb_pools++ * sizeof(*cache->pools));
+    cache->pools[0] = pool;
+
+    if (avctx->debug & FF_DEBUG_BUFFERS)
+        av_log(avctx, AV_LOG_DEBUG, "default_get_buffer created pool %d/%d\n",
+               cache->nb_pools, MAX_FRAME_POOLS);
 
     return 0;
-fail:
-    av_buffer_unref(&pool_buf);
-    return ret;
+}
+
+unsigned ff_get_buffer_nb_allocs(const AVCodecContext *avctx)
+{
+    const FramePoolCache *cache = avctx->internal->pool ?
+                                  (FramePoolCache*)avctx->internal->pool->data : NULL;
+
+    return cache ? atomic_load_explicit(&cache->nb_allocs, memory_order_relaxed) : 0;
 }
 
 static int audio_get_buffer(AVCodecContext *avctx, AVFrame *frame)
 {
-    FramePool *pool = (FramePool*)avctx->internal->pool->data;
+    FramePoolCache *cache = (FramePoolCache*)avctx->internal->pool->data;
+    FramePool *pool = cache->pools[0];
     int planes = pool->planes;
     int i;
 
@@ -216,6 +307,7 @@ static int audio_get_buffer(AVCodecContext *avctx, AVFrame *frame)
             av_freep(&frame->extended_buf);
             return AVERROR(ENOMEM);
         }
+        atomic_fetch_add_explicit(&cache->nb_allocs, 2, memory_order_relaxed);
     } else {
         frame->extended_data = frame->data;
         av_assert0(frame->nb_extended_buf == 0);
@@ -245,7 +337,8 @@ fail:
 
 static int video_get_buffer(AVCodecContext *s, AVFrame *pic)
 {
-    FramePool *pool = (FramePool*)s->internal->pool->data;
+    FramePoolCache *cache = (FramePoolCache*)s->internal->pool->data;
+    FramePool *pool = cache->pools[0];
     int i;
 
     if (pic->data[0] || pic->data[1] || pic->data[2] || pic->data[3]) {
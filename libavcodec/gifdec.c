@@ -21,6 +21,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include "libavutil/buffer.h"
+#include "libavutil/imgutils.h"
 #include "libavutil/opt.h"
 #include "avcodec.h"
 #include "bytestream.h"
@@ -28,6 +30,8 @@
 #include "decode.h"
 #include "lzw.h"
 #include "gif.h"
+#include "thread.h"
+#include "threadframe.h"
 
 /* This value is intentionally set to "transparent white" color.
  * It is much better to have white background instead of black
@@ -37,7 +41,8 @@
 
 typedef struct GifState {
     const AVClass *class;
-    AVFrame *frame;
+    ThreadFrame picture;
+    ThreadFrame last_picture;   ///< canvas the current image is drawn onto
     int screen_width;
     int screen_height;
     int has_global_palette;
@@ -48,8 +53,8 @@ typedef struct GifState {
     int color_resolution;
     /* intermediate buffer for storing color indices
      * obtained from lzw-encoded data stream */
-    uint8_t *idx_line;
-    int idx_line_size;
+    uint8_t *idx_buf;
+    unsigned int idx_buf_size;
 
     /* after the frame is displayed, the disposal method is used */
     int gce_prev_disposal;
@@ -58,8 +63,10 @@ typedef struct GifState {
     int gce_l, gce_t, gce_w, gce_h;
     /* depending on disposal method we store either part of the image
      * drawn on the canvas or background color that
-     * should be used upon disposal */
-    uint32_t * stored_img;
+     * should be used upon disposal; the stored image is shared with the
+     * next frame thread and only valid once this frame is complete */
+    AVBufferRef *stored_img;
+    AVBufferPool *stored_img_pool;
     int stored_img_size;
     int stored_bg_color;
 
@@ -127,13 +134,18 @@ static void gif_copy_img_rect(const uint32_t *src, uint32_t *dst,
     }
 }
 
-static int gif_read_image(GifState *s, AVFrame *frame)
+static int gif_read_image(GifState *s)
 {
+    AVCodecContext *avctx = s->avctx;
+    AVBufferRef *restore_img = NULL;
+    AVFrame *frame;
     int left, top, width, height, bits_per_pixel, code_size, flags, pw;
     int is_interleaved, has_local_palette, y, pass, y1, linesize, pal_size, lzwed_len;
-    uint32_t *ptr, *pal, *px, *pr, *ptr1;
+    int prev_disposal, prev_l, prev_t, prev_w, prev_h, prev_bg_color;
+    int transparent_color_index, count, nb_lines;
+    uint32_t *ptr, *pal, *px, *pr, *ptr1, fill_color = 0;
     int ret;
-    uint8_t *idx;
+    const uint8_t *idx;
 
     /* At least 9 bytes of Image Descriptor. */
     if (bytestream2_get_bytes_left(&s->gb) < 9)
@@ -170,12 +182,18 @@ static int gif_read_image(GifState *s, AVFrame *frame)
     if (s->keyframe) {
         if (s->transparent_color_index == -1 && s->has_global_palette) {
             /* transparency wasn't set before the first frame, fill with background color */
-            gif_fill(frame, s->bg_color);
+            fill_color = s->bg_color;
         } else {
             /* otherwise fill with transparent color.
              * this is necessary since by default picture filled with 0x80808080. */
-            gif_fill(frame, s->trans_color);
+            fill_color = s->trans_color;
         }
+    } else if (!s->last_picture.f->data[0] ||
+               s->last_picture.f->width  != avctx->width  ||
+               s->last_picture.f->height != avctx->height ||
+               s->last_picture.f->format != avctx->pix_fmt) {
+        av_log(s->avctx, AV_LOG_ERROR, "cannot decode frame without keyframe\n");
+        return AVERROR_INVALIDDATA;
     }
 
     /* verify that all the image is inside the screen dimensions */
@@ -210,12 +228,29 @@ static int gif_read_image(GifState *s, AVFrame *frame)
         height = s->screen_height - top;
     }
 
-    /* process disposal method */
-    if (s->gce_prev_disposal == GCE_DISPOSAL_BACKGROUND) {
-        gif_fill_rect(frame, s->stored_bg_color, s->gce_l, s->gce_t, s->gce_w, s->gce_h);
-    } else if (s->gce_prev_disposal == GCE_DISPOSAL_RESTORE) {
-        gif_copy_img_rect(s->stored_img, (uint32_t *)frame->data[0],
-            frame->linesize[0] / sizeof(uint32_t), s->gce_l, s->gce_t, s->gce_w, s->gce_h);
+    /* Expect at least 2 bytes: 1 for lzw code size and 1 for block size. */
+    if (bytestream2_get_bytes_left(&s->gb) < 2)
+        return AVERROR_INVALIDDATA;
+
+    if ((ret = ff_thread_get_ext_buffer(avctx, &s->picture, 0)) < 0)
+        return ret;
+    frame    = s->picture.f;
+    linesize = frame->linesize[0] / sizeof(uint32_t);
+
+    frame->pict_type = s->keyframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_P;
+    frame->key_frame = s->keyframe;
+
+    /* the disposal of the previous frame is applied to the canvas below,
+     * the state for the next frame has to be set up before that */
+    prev_disposal = s->gce_prev_disposal;
+    prev_l        = s->gce_l;
+    prev_t        = s->gce_t;
+    prev_w        = s->gce_w;
+    prev_h        = s->gce_h;
+    prev_bg_color = s->stored_bg_color;
+    if (prev_disposal == GCE_DISPOSAL_RESTORE) {
+        restore_img   = s->stored_img;
+        s->stored_img = NULL;
     }
 
     s->gce_prev_disposal = s->gce_disposal;
@@ -230,45 +265,87 @@ static int gif_read_image(GifState *s, AVFrame *frame)
             else
                 s->stored_bg_color = s->bg_color;
         } else if (s->gce_disposal == GCE_DISPOSAL_RESTORE) {
-            av_fast_malloc(&s->stored_img, &s->stored_img_size, frame->linesize[0] * frame->height);
-            if (!s->stored_img)
-                return AVERROR(ENOMEM);
+            int size = frame->linesize[0] * frame->height;
 
-            gif_copy_img_rect((uint32_t *)frame->data[0], s->stored_img,
-                frame->linesize[0] / sizeof(uint32_t), left, top, pw, height);
+            if (size != s->stored_img_size) {
+                av_buffer_pool_uninit(&s->stored_img_pool);
+                s->stored_img_pool = av_buffer_pool_init(size, NULL);
+                s->stored_img_size = s->stored_img_pool ? size : 0;
+            }
+            av_buffer_unref(&s->stored_img);
+            if (s->stored_img_pool)
+                s->stored_img = av_buffer_pool_get(s->stored_img_pool);
+            if (!s->stored_img) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
         }
     }
 
-    /* Expect at least 2 bytes: 1 for lzw code size and 1 for block size. */
-    if (bytestream2_get_bytes_left(&s->gb) < 2)
-        return AVERROR_INVALIDDATA;
+    /* Graphic Control Extension's scope is single frame.
+     * Remove its influence. */
+    transparent_color_index    = s->transparent_color_index;
+    s->transparent_color_index = -1;
+    s->gce_disposal = GCE_DISPOSAL_NONE;
+
+    /* fail before the next frame thread can start from this picture */
+    av_fast_malloc(&s->idx_buf, &s->idx_buf_size, width * height);
+    if (!s->idx_buf) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
 
-    /* now get the image data */
     code_size = bytestream2_get_byteu(&s->gb);
     if ((ret = ff_lzw_decode_init(s->lzw, code_size, s->gb.buffer,
                                   bytestream2_get_bytes_left(&s->gb), FF_LZW_GIF)) < 0) {
         av_log(s->avctx, AV_LOG_ERROR, "LZW init failed\n");
-        return ret;
+        goto end;
+    }
+
+    ff_thread_finish_setup(avctx);
+
+    /* now get the image data, this does not depend on the previous frame */
+    count    = ff_lzw_decode(s->lzw, s->idx_buf, width * height);
+    nb_lines = count / width;
+    if (count % width)
+        av_log(s->avctx, AV_LOG_ERROR, "LZW decode failed\n");
+
+    /* read the garbage data until end marker is found */
+    lzwed_len = ff_lzw_decode_tail(s->lzw);
+    bytestream2_skipu(&s->gb, lzwed_len);
+
+    /* compose the image onto the canvas */
+    if (s->keyframe) {
+        gif_fill(frame, fill_color);
+    } else {
+        ff_thread_await_progress(&s->last_picture, INT_MAX, 0);
+        av_image_copy_plane(frame->data[0], frame->linesize[0],
+                            s->last_picture.f->data[0], s->last_picture.f->linesize[0],
+                            frame->width * sizeof(uint32_t), frame->height);
+    }
+
+    /* process disposal method */
+    if (prev_disposal == GCE_DISPOSAL_BACKGROUND) {
+        gif_fill_rect(frame, prev_bg_color, prev_l, prev_t, prev_w, prev_h);
+    } else if (prev_disposal == GCE_DISPOSAL_RESTORE && restore_img) {
+        gif_copy_img_rect((uint32_t *)restore_img->data, (uint32_t *)frame->data[0],
+                          linesize, prev_l, prev_t, prev_w, prev_h);
     }
 
+    if (s->gce_prev_disposal == GCE_DISPOSAL_RESTORE)
+        gif_copy_img_rect((uint32_t *)frame->data[0], (uint32_t *)s->stored_img->data,
+                          linesize, left, top, pw, height);
+
     /* read all the image */
-    linesize = frame->linesize[0] / sizeof(uint32_t);
     ptr1 = (uint32_t *)frame->data[0] + top * linesize + left;
     ptr = ptr1;
     pass = 0;
     y1 = 0;
-    for (y = 0; y < height; y++) {
-        int count = ff_lzw_decode(s->lzw, s->idx_line, width);
-        if (count != width) {
-            if (count)
-                av_log(s->avctx, AV_LOG_ERROR, "LZW decode failed\n");
-            goto decode_tail;
-        }
-
+    for (y = 0; y < height && y < nb_lines; y++) {
         pr = ptr + pw;
 
-        for (px = ptr, idx = s->idx_line; px < pr; px++, idx++) {
-            if (*idx != s->transparent_color_index)
+        for (px = ptr, idx = s->idx_buf + y * width; px < pr; px++, idx++) {
+            if (*idx != transparent_color_index)
                 *px = pal[*idx];
         }
 
@@ -298,18 +375,15 @@ static int gif_read_image(GifState *s, AVFrame *frame)
             ptr += linesize;
         }
     }
+    ret = 0;
 
- decode_tail:
-    /* read the garbage data until end marker is found */
-    lzwed_len = ff_lzw_decode_tail(s->lzw);
-    bytestream2_skipu(&s->gb, lzwed_len);
-
-    /* Graphic Control Extension's scope is single frame.
-     * Remove its influence. */
-    s->transparent_color_index = -1;
-    s->gce_disposal = GCE_DISPOSAL_NONE;
-
-    return 0;
+end:
+    ff_thread_report_progress(&s->picture, INT_MAX, 0);
+    /* an uncomposited picture must not become the next canvas */
+    if (ret < 0)
+        ff_thread_release_ext_buffer(avctx, &s->picture);
+    av_buffer_unref(&restore_img);
+    return ret;
 }
 
 static int gif_read_extension(GifState *s)
@@ -422,7 +496,7 @@ static int gif_read_header1(GifState *s)
     return 0;
 }
 
-static int gif_parse_next_image(GifState *s, AVFrame *frame)
+static int gif_parse_next_image(GifState *s)
 {
     while (bytestream2_get_bytes_left(&s->gb) > 0) {
         int code = bytestream2_get_byte(&s->gb);
@@ -432,7 +506,7 @@ static int gif_parse_next_image(GifState *s, AVFrame *frame)
 
         switch (code) {
         case GIF_IMAGE_SEPARATOR:
-            return gif_read_image(s, frame);
+            return gif_read_image(s);
         case GIF_EXTENSION_INTRODUCER:
             if ((ret = gif_read_extension(s)) < 0)
                 return ret;
@@ -455,8 +529,9 @@ static av_cold int gif_decode_init(AVCodecContext *avctx)
     s->avctx = avctx;
 
     avctx->pix_fmt = AV_PIX_FMT_RGB32;
-    s->frame = av_frame_alloc();
-    if (!s->frame)
+    s->picture.f      = av_frame_alloc();
+    s->last_picture.f = av_frame_alloc();
+    if (!s->picture.f || !s->last_picture.f)
         return AVERROR(ENOMEM);
     ff_lzw_decode_open(&s->lzw);
     if (!s->lzw)
@@ -472,10 +547,6 @@ static int gif_decode_frame(AVCodecContext *avctx, AVFrame *rframe,
 
     bytestream2_init(&s->gb, avpkt->data, avpkt->size);
 
-    s->frame->pts     = avpkt->pts;
-    s->frame->pkt_dts = avpkt->dts;
-    s->frame->duration = avpkt->duration;
-
     if (avpkt->size >= 6) {
         s->keyframe = memcmp(avpkt->data, gif87a_sig, 6) == 0 ||
                       memcmp(avpkt->data, gif89a_sig, 6) == 0;
@@ -483,58 +554,109 @@ static int gif_decode_frame(AVCodecContext *avctx, AVFrame *rframe,
         s->keyframe = 0;
     }
 
+    ff_thread_release_ext_buffer(avctx, &s->picture);
+
     if (s->keyframe) {
         s->keyframe_ok = 0;
         s->gce_prev_disposal = GCE_DISPOSAL_NONE;
-        if ((ret = gif_read_header1(s)) < 0)
-            return ret;
-
-        if ((ret = ff_set_dimensions(avctx, s->screen_width, s->screen_height)) < 0)
-            return ret;
+        if ((ret = gif_read_header1(s)) < 0 ||
+            (ret = ff_set_dimensions(avctx, s->screen_width, s->screen_height)) < 0)
+            goto fail_keyframe;
 
-        av_frame_unref(s->frame);
-        if ((ret = ff_get_buffer(avctx, s->frame, 0)) < 0)
-            return ret;
-
-        av_fast_malloc(&s->idx_line, &s->idx_line_size, s->screen_width);
-        if (!s->idx_line)
-            return AVERROR(ENOMEM);
-
-        s->frame->pict_type = AV_PICTURE_TYPE_I;
-        s->frame->key_frame = 1;
         s->keyframe_ok = 1;
     } else {
         if (!s->keyframe_ok) {
             av_log(avctx, AV_LOG_ERROR, "cannot decode frame without keyframe\n");
             return AVERROR_INVALIDDATA;
         }
-
-        if ((ret = ff_reget_buffer(avctx, s->frame, 0)) < 0)
-            return ret;
-
-        s->frame->pict_type = AV_PICTURE_TYPE_P;
-        s->frame->key_frame = 0;
     }
 
-    ret = gif_parse_next_image(s, s->frame);
-    if (ret < 0)
+    ret = gif_parse_next_image(s);
+    if (ret < 0) {
+        if (s->keyframe)
+            goto fail_keyframe;
         return ret;
+    }
 
-    if ((ret = av_frame_ref(rframe, s->frame)) < 0)
+    if ((ret = av_frame_ref(rframe, s->picture.f)) < 0)
         return ret;
+
+    if (!(avctx->active_thread_type & FF_THREAD_FRAME)) {
+        ff_thread_release_ext_buffer(avctx, &s->last_picture);
+        FFSWAP(ThreadFrame, s->picture, s->last_picture);
+    }
+
     *got_frame = 1;
 
     return bytestream2_tell(&s->gb);
+
+fail_keyframe:
+    /* the frames following a broken keyframe cannot be decoded */
+    s->keyframe_ok = 0;
+    ff_thread_release_ext_buffer(avctx, &s->last_picture);
+    return ret;
+}
+
+#if HAVE_THREADS
+static int gif_update_thread_context(AVCodecContext *dst, const AVCodecContext *src)
+{
+    GifState *sdst = dst->priv_data;
+    const GifState *ssrc = src->priv_data;
+    const ThreadFrame *src_frame;
+    int ret;
+
+    if (dst == src)
+        return 0;
+
+    sdst->screen_width            = ssrc->screen_width;
+    sdst->screen_height           = ssrc->screen_height;
+    sdst->has_global_palette      = ssrc->has_global_palette;
+    sdst->bits_per_pixel          = ssrc->bits_per_pixel;
+    sdst->bg_color                = ssrc->bg_color;
+    sdst->background_color_index  = ssrc->background_color_index;
+    sdst->transparent_color_index = ssrc->transparent_color_index;
+    sdst->color_resolution        = ssrc->color_resolution;
+    sdst->gce_prev_disposal       = ssrc->gce_prev_disposal;
+    sdst->gce_disposal            = ssrc->gce_disposal;
+    sdst->gce_l                   = ssrc->gce_l;
+    sdst->gce_t                   = ssrc->gce_t;
+    sdst->gce_w                   = ssrc->gce_w;
+    sdst->gce_h                   = ssrc->gce_h;
+    sdst->stored_bg_color         = ssrc->stored_bg_color;
+    sdst->keyframe_ok             = ssrc->keyframe_ok;
+    memcpy(sdst->global_palette, ssrc->global_palette, sizeof(sdst->global_palette));
+
+    ret = av_buffer_replace(&sdst->stored_img, ssrc->stored_img);
+    if (ret < 0)
+        return ret;
+
+    /* a frame that failed before allocating its picture leaves the canvas
+     * unchanged */
+    src_frame = ssrc->picture.f->data[0] ? &ssrc->picture : &ssrc->last_picture;
+
+    ff_thread_release_ext_buffer(dst, &sdst->last_picture);
+    if (src_frame->f->data[0]) {
+        ret = ff_thread_ref_frame(&sdst->last_picture, src_frame);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
 }
+#endif
 
 static av_cold int gif_decode_close(AVCodecContext *avctx)
 {
     GifState *s = avctx->priv_data;
 
     ff_lzw_decode_close(&s->lzw);
-    av_frame_free(&s->frame);
-    av_freep(&s->idx_line);
-    av_freep(&s->stored_img);
+    ff_thread_release_ext_buffer(avctx, &s->picture);
+    av_frame_free(&s->picture.f);
+    ff_thread_release_ext_buffer(avctx, &s->last_picture);
+    av_frame_free(&s->last_picture.f);
+    av_freep(&s->idx_buf);
+    av_buffer_unref(&s->stored_img);
+    av_buffer_pool_uninit(&s->stored_img_pool);
 
     return 0;
 }
@@ -564,7 +686,9 @@ const FFCodec ff_gif_decoder = {
     .init           = gif_decode_init,
     .close          = gif_decode_close,
     FF_CODEC_DECODE_CB(gif_decode_frame),
-    .p.capabilities = AV_CODEC_CAP_DR1,
-    .caps_internal  = FF_CODEC_CAP_INIT_CLEANUP,
+    UPDATE_THREAD_CONTEXT(gif_update_thread_context),
+    .p.capabilities = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_FRAME_THREADS,
+    .caps_internal  = FF_CODEC_CAP_INIT_CLEANUP |
+                      FF_CODEC_CAP_ALLOCATE_PROGRESS,
     .p.priv_class   = &decoder_class,
 };
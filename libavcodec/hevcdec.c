@@ -3498,7 +3498,7 @@ static av_cold int hevc_decode_free(AVCodecContext *avctx)
     av_freep(&s->sh.size);
 
     if (s->HEVClcList) {
-        for (i = 1; i < s->threads_number; i++) {
+        for (i = 1; i < s->nb_local_ctx; i++) {
             av_freep(&s->HEVClcList[i]);
         }
     }
@@ -3523,6 +3523,8 @@ static av_cold int hevc_init_context(AVCodecContext *avctx)
     s->HEVClcList = av_mallocz(sizeof(HEVCLocalContext*) * s->threads_number);
     if (!s->HEVClc || !s->HEVClcList)
         return AVERROR(ENOMEM);
+    /* threads_number may be lowered later on, e.g. for tiles */
+    s->nb_local_ctx = s->threads_number;
     s->HEVClc->parent = s;
     s->HEVClc->logctx = avctx;
     s->HEVClc->common_cabac_state = &s->cabac;
@@ -3610,7 +3612,7 @@ static int hevc_update_thread_context(AVCodecContext *dst,
     s->is_nalff        = s0->is_nalff;
     s->nal_length_size = s0->nal_length_size;
 
-    s->threads_number      = s0->threads_number;
+    s->threads_number      = FFMIN(s0->threads_number, s->nb_local_ctx);
     s->threads_type        = s0->threads_type;
 
     if (s0->eos) {
@@ -3664,6 +3666,18 @@ static av_cold int hevc_decode_init(AVCodecContext *avctx)
         ret = ff_slice_thread_init_progress(avctx);
         if (ret < 0)
             return ret;
+    } else if (avctx->active_thread_type & FF_THREAD_FRAME &&
+               avctx->thread_type & FF_THREAD_SLICE && s->wpp_threads != 1) {
+        /* hybrid threading: each frame thread decodes WPP rows in parallel */
+        ret = ff_slice_thread_init_hybrid(avctx, s->wpp_threads);
+        if (ret < 0)
+            return ret;
+        s->threads_number = ret;
+        if (s->threads_number > 1) {
+            ret = ff_slice_thread_init_progress(avctx);
+            if (ret < 0)
+                return ret;
+        }
     } else
         s->threads_number = 1;
 
@@ -3713,6 +3727,8 @@ static const AVOption options[] = {
         AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, PAR },
     { "strict-displaywin", "stricly apply default display window size", OFFSET(apply_defdispwin),
         AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, PAR },
+    { "wpp_threads", "Number of threads decoding the WPP rows of each frame with frame threading (0 = auto, 1 = disabled)",
+        OFFSET(wpp_threads), AV_OPT_TYPE_INT, {.i64 = 1}, 0, 64, PAR },
     { NULL },
 };
 
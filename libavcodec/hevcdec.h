@@ -500,7 +500,8 @@ typedef struct HEVCContext {
     HEVCLocalContext    *HEVClc;
 
     uint8_t             threads_type;
-    uint8_t             threads_number;
+    uint8_t             threads_number; ///< number of threads decoding the WPP rows
+    uint8_t             nb_local_ctx;   ///< number of entries allocated in HEVClcList
 
     int                 width;
     int                 height;
@@ -592,6 +593,7 @@ typedef struct HEVCContext {
     int is_nalff;           ///< this flag is != 0 if bitstream is encapsulated
                             ///< as a format defined in 14496-15
     int apply_defdispwin;
+    int wpp_threads;        ///< number of slice threads per frame thread
 
     int nal_length_size;    ///< Number of bytes used for nal length (1, 2 or 4)
     int nuh_layer_id;
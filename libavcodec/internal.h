@@ -68,9 +68,18 @@ typedef struct AVCodecInternal {
      */
     int pad_samples;
 
+    /**
+     * Frame pools of avcodec_default_get_buffer2(), one for each recently
+     * used set of frame parameters.
+     */
     AVBufferRef *pool;
 
     void *thread_ctx;
+    /**
+     * Slice threading context. Separate from thread_ctx, so that frame
+     * threads can run slice threads of their own.
+     */
+    void *slice_thread_ctx;
 
     /**
      * This packet is used to hold the packet given to decoders
@@ -175,6 +184,15 @@ unsigned int ff_toupper4(unsigned int x);
 
 void ff_color_frame(AVFrame *frame, const int color[4]);
 
+/**
+ * Get the number of heap allocations avcodec_default_get_buffer2() made for
+ * the frame pools of avctx and the buffers in them. The number stays
+ * constant once frames with each set of parameters in use, up to 4 of them,
+ * have been allocated and released, so it can be used to check that
+ * decoding allocates no frame data in steady state.
+ */
+unsigned ff_get_buffer_nb_allocs(const AVCodecContext *avctx);
+
 /**
  * Maximum size in bytes of extradata.
  * This value was chosen such that every bit of the buffer is
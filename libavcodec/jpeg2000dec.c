@@ -90,8 +90,18 @@ typedef struct Jpeg2000Tile {
     GetByteContext      packed_headers_stream;  // byte context corresponding to packed headers
     uint16_t tp_idx;                    // Tile-part index
     int coord[2][2];                    // border coordinates {{x0, x1}, {y0, y1}}
+    uint8_t coded[4];                   // whether a component has any coded codeblock
 } Jpeg2000Tile;
 
+/* a codeblock decoded by its own job, when there are fewer tiles than threads */
+typedef struct Jpeg2000CblkJob {
+    Jpeg2000Component   *comp;
+    Jpeg2000CodingStyle *codsty;
+    Jpeg2000Band        *band;
+    Jpeg2000Cblk        *cblk;
+    int                 bandpos;
+} Jpeg2000CblkJob;
+
 typedef struct Jpeg2000DecoderContext {
     AVClass         *class;
     AVCodecContext  *avctx;
@@ -134,6 +144,10 @@ typedef struct Jpeg2000DecoderContext {
     Jpeg2000Tile    *tile;
     Jpeg2000DSPContext dsp;
 
+    Jpeg2000CblkJob *cblk_jobs;
+    unsigned int    cblk_jobs_size;
+    int             nb_cblk_jobs;
+
     /*options parameters*/
     int             reduction_factor;
 } Jpeg2000DecoderContext;
@@ -1941,6 +1955,31 @@ static inline void roi_scale_cblk(Jpeg2000Cblk *cblk,
     }
 }
 
+static int tile_codeblock(const Jpeg2000DecoderContext *s, Jpeg2000T1Context *t1,
+                          Jpeg2000Component *comp, Jpeg2000CodingStyle *codsty,
+                          Jpeg2000Band *band, Jpeg2000Cblk *cblk, int bandpos)
+{
+    int x, y;
+    int ret = decode_cblk(s, codsty, t1, cblk,
+                          cblk->coord[0][1] - cblk->coord[0][0],
+                          cblk->coord[1][1] - cblk->coord[1][0],
+                          bandpos, comp->roi_shift);
+    if (!ret)
+        return 0;
+    x = cblk->coord[0][0] - band->coord[0][0];
+    y = cblk->coord[1][0] - band->coord[1][0];
+
+    if (comp->roi_shift)
+        roi_scale_cblk(cblk, comp, t1);
+    if (codsty->transform == FF_DWT97)
+        dequantization_float(x, y, cblk, comp, t1, band);
+    else if (codsty->transform == FF_DWT97_INT)
+        dequantization_int_97(x, y, cblk, comp, t1, band);
+    else
+        dequantization_int(x, y, cblk, comp, t1, band);
+    return 1;
+}
+
 static inline void tile_codeblocks(const Jpeg2000DecoderContext *s, Jpeg2000Tile *tile)
 {
     Jpeg2000T1Context t1;
@@ -1979,27 +2018,9 @@ static inline void tile_codeblocks(const Jpeg2000DecoderContext *s, Jpeg2000Tile
                     for (cblkno = 0;
                          cblkno < prec->nb_codeblocks_width * prec->nb_codeblocks_height;
                          cblkno++) {
-                        int x, y;
-                        Jpeg2000Cblk *cblk = prec->cblk + cblkno;
-                        int ret = decode_cblk(s, codsty, &t1, cblk,
-                                    cblk->coord[0][1] - cblk->coord[0][0],
-                                    cblk->coord[1][1] - cblk->coord[1][0],
-                                    bandpos, comp->roi_shift);
-                        if (ret)
+                        if (tile_codeblock(s, &t1, comp, codsty, band,
+                                           prec->cblk + cblkno, bandpos))
                             coded = 1;
-                        else
-                            continue;
-                        x = cblk->coord[0][0] - band->coord[0][0];
-                        y = cblk->coord[1][0] - band->coord[1][0];
-
-                        if (comp->roi_shift)
-                            roi_scale_cblk(cblk, comp, &t1);
-                        if (codsty->transform == FF_DWT97)
-                            dequantization_float(x, y, cblk, comp, &t1, band);
-                        else if (codsty->transform == FF_DWT97_INT)
-                            dequantization_int_97(x, y, cblk, comp, &t1, band);
-                        else
-                            dequantization_int(x, y, cblk, comp, &t1, band);
                    } /* end cblk */
                 } /*end prec */
             } /* end band */
@@ -2079,15 +2100,9 @@ WRITE_FRAME(16, uint16_t)
 
 #undef WRITE_FRAME
 
-static int jpeg2000_decode_tile(AVCodecContext *avctx, void *td,
-                                int jobnr, int threadnr)
+static void write_tile(const Jpeg2000DecoderContext *s, Jpeg2000Tile *tile,
+                       AVFrame *picture)
 {
-    const Jpeg2000DecoderContext *s = avctx->priv_data;
-    AVFrame *picture = td;
-    Jpeg2000Tile *tile = s->tile + jobnr;
-
-    tile_codeblocks(s, tile);
-
     /* inverse MCT transformation */
     if (tile->codsty[0].mct)
         mct_decode(s, tile);
@@ -2102,6 +2117,134 @@ static int jpeg2000_decode_tile(AVCodecContext *avctx, void *td,
 
         write_frame_16(s, tile, picture, precision);
     }
+}
+
+static int jpeg2000_decode_tile(AVCodecContext *avctx, void *td,
+                                int jobnr, int threadnr)
+{
+    const Jpeg2000DecoderContext *s = avctx->priv_data;
+    Jpeg2000Tile *tile = s->tile + jobnr;
+
+    tile_codeblocks(s, tile);
+    write_tile(s, tile, td);
+
+    return 0;
+}
+
+/**
+ * List the codeblocks with coded data of all tiles into jobs, if not NULL,
+ * and mark the components they belong to as coded.
+ * @return the number of codeblocks
+ */
+static int list_cblk_jobs(const Jpeg2000DecoderContext *s, Jpeg2000CblkJob *jobs)
+{
+    int nb_jobs = 0;
+
+    for (int tileno = 0; tileno < s->numXtiles * s->numYtiles; tileno++) {
+        Jpeg2000Tile *tile = s->tile + tileno;
+
+        for (int compno = 0; compno < s->ncomponents; compno++) {
+            Jpeg2000Component *comp     = tile->comp + compno;
+            Jpeg2000CodingStyle *codsty = tile->codsty + compno;
+
+            tile->coded[compno] = 0;
+            for (int reslevelno = 0; reslevelno < codsty->nreslevels2decode; reslevelno++) {
+                Jpeg2000ResLevel *rlevel = comp->reslevel + reslevelno;
+
+                for (int bandno = 0; bandno < rlevel->nbands; bandno++) {
+                    Jpeg2000Band *band = rlevel->band + bandno;
+                    int nb_precincts   = rlevel->num_precincts_x * rlevel->num_precincts_y;
+
+                    if (band->coord[0][0] == band->coord[0][1] ||
+                        band->coord[1][0] == band->coord[1][1])
+                        continue;
+
+                    for (int precno = 0; precno < nb_precincts; precno++) {
+                        Jpeg2000Prec *prec = band->prec + precno;
+                        int nb_cblks = prec->nb_codeblocks_width * prec->nb_codeblocks_height;
+
+                        for (int cblkno = 0; cblkno < nb_cblks; cblkno++) {
+                            if (!prec->cblk[cblkno].length)
+                                continue;
+                            if (jobs)
+                                jobs[nb_jobs] = (Jpeg2000CblkJob) {
+                                    .comp    = comp,
+                                    .codsty  = codsty,
+                                    .band    = band,
+                                    .cblk    = prec->cblk + cblkno,
+                                    .bandpos = bandno + (reslevelno > 0),
+                                };
+                            tile->coded[compno] = 1;
+                            nb_jobs++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return nb_jobs;
+}
+
+static int jpeg2000_decode_cblk(AVCodecContext *avctx, void *td,
+                                int jobnr, int threadnr)
+{
+    const Jpeg2000DecoderContext *s = avctx->priv_data;
+    const Jpeg2000CblkJob *job      = s->cblk_jobs + jobnr;
+    Jpeg2000T1Context t1;
+
+    t1.stride = (1 << job->codsty->log2_cblk_width) + 2;
+    tile_codeblock(s, &t1, job->comp, job->codsty, job->band, job->cblk,
+                   job->bandpos);
+
+    return 0;
+}
+
+static int jpeg2000_dwt_component(AVCodecContext *avctx, void *td,
+                                  int jobnr, int threadnr)
+{
+    const Jpeg2000DecoderContext *s = avctx->priv_data;
+    Jpeg2000Tile *tile       = s->tile + jobnr / s->ncomponents;
+    int compno               = jobnr % s->ncomponents;
+    Jpeg2000Component *comp  = tile->comp + compno;
+
+    if (tile->coded[compno])
+        ff_dwt_decode(&comp->dwt, tile->codsty[compno].transform == FF_DWT97 ?
+                                  (void*)comp->f_data : (void*)comp->i_data);
+
+    return 0;
+}
+
+static int jpeg2000_write_tile(AVCodecContext *avctx, void *td,
+                               int jobnr, int threadnr)
+{
+    const Jpeg2000DecoderContext *s = avctx->priv_data;
+
+    write_tile(s, s->tile + jobnr, td);
+
+    return 0;
+}
+
+/**
+ * Decode the tiles with their codeblocks, then their components, spread
+ * over the threads: used when there are not enough tiles to keep them busy.
+ */
+static int decode_tiles_by_cblk(AVCodecContext *avctx, AVFrame *picture)
+{
+    Jpeg2000DecoderContext *s = avctx->priv_data;
+    int nb_tiles = s->numXtiles * s->numYtiles;
+
+    s->nb_cblk_jobs = list_cblk_jobs(s, NULL);
+    av_fast_malloc(&s->cblk_jobs, &s->cblk_jobs_size,
+                   s->nb_cblk_jobs * sizeof(*s->cblk_jobs));
+    if (!s->cblk_jobs)
+        return AVERROR(ENOMEM);
+    list_cblk_jobs(s, s->cblk_jobs);
+
+    if (s->nb_cblk_jobs)
+        avctx->execute2(avctx, jpeg2000_decode_cblk, NULL, NULL, s->nb_cblk_jobs);
+    avctx->execute2(avctx, jpeg2000_dwt_component, NULL, NULL, nb_tiles * s->ncomponents);
+    avctx->execute2(avctx, jpeg2000_write_tile, picture, NULL, nb_tiles);
 
     return 0;
 }
@@ -2548,7 +2691,13 @@ static int jpeg2000_decode_frame(AVCodecContext *avctx, AVFrame *picture,
         }
     }
 
-    avctx->execute2(avctx, jpeg2000_decode_tile, picture, NULL, s->numXtiles * s->numYtiles);
+    if (avctx->active_thread_type & FF_THREAD_SLICE &&
+        s->numXtiles * s->numYtiles < avctx->thread_count) {
+        if ((ret = decode_tiles_by_cblk(avctx, picture)) < 0)
+            goto end;
+    } else {
+        avctx->execute2(avctx, jpeg2000_decode_tile, picture, NULL, s->numXtiles * s->numYtiles);
+    }
 
     jpeg2000_dec_cleanup(s);
 
@@ -2564,6 +2713,16 @@ end:
     return ret;
 }
 
+static av_cold int jpeg2000_decode_close(AVCodecContext *avctx)
+{
+    Jpeg2000DecoderContext *s = avctx->priv_data;
+
+    av_freep(&s->cblk_jobs);
+    s->cblk_jobs_size = 0;
+
+    return 0;
+}
+
 #define OFFSET(x) offsetof(Jpeg2000DecoderContext, x)
 #define VD AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_DECODING_PARAM
 
@@ -2588,6 +2747,7 @@ const FFCodec ff_jpeg2000_decoder = {
     .p.capabilities   = AV_CODEC_CAP_SLICE_THREADS | AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_DR1,
     .priv_data_size   = sizeof(Jpeg2000DecoderContext),
     .init             = jpeg2000_decode_init,
+    .close            = jpeg2000_decode_close,
     FF_CODEC_DECODE_CB(jpeg2000_decode_frame),
     .p.priv_class     = &jpeg2000_class,
     .p.max_lowres     = 5,
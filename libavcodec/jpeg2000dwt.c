@@ -25,6 +25,8 @@
  * Discrete wavelet transform
  */
 
+#include <string.h>
+
 #include "libavutil/error.h"
 #include "libavutil/macros.h"
 #include "libavutil/mem.h"
@@ -47,6 +49,11 @@
 #define I_LFTG_X       53274ll
 #define I_PRESHIFT 8
 
+/* Number of columns the vertical pass of the inverse transform lifts at
+ * once: each row of them is contiguous in memory, so the lifting steps
+ * vectorize and every load from the image uses whole cache lines. */
+#define DWT_COLS 16
+
 static inline void extend53(int *p, int i0, int i1)
 {
     p[i0 - 1] = p[i0 + 1];
@@ -322,11 +329,41 @@ static void sr_1d53(unsigned *p, int i0, int i1)
         p[2 * i + 1] += (int)(p[2 * i] + p[2 * i + 2]) >> 1;
 }
 
+/* vertical lifting of DWT_COLS columns at once, p[i * DWT_COLS + c] */
+static void sr_col53(unsigned *p, int i0, int i1, int cols)
+{
+    int i, c;
+
+    if (i1 <= i0 + 1) {
+        if (i0 == 1)
+            for (c = 0; c < cols; c++)
+                p[DWT_COLS + c] = (int)p[DWT_COLS + c] >> 1;
+        return;
+    }
+
+    memcpy(p + (i0 - 1) * DWT_COLS, p + (i0 + 1) * DWT_COLS, cols * sizeof(*p));
+    memcpy(p +  i1      * DWT_COLS, p + (i1 - 2) * DWT_COLS, cols * sizeof(*p));
+    memcpy(p + (i0 - 2) * DWT_COLS, p + (i0 + 2) * DWT_COLS, cols * sizeof(*p));
+    memcpy(p + (i1 + 1) * DWT_COLS, p + (i1 - 3) * DWT_COLS, cols * sizeof(*p));
+
+    for (i = (i0 >> 1); i < (i1 >> 1) + 1; i++) {
+        unsigned *r = p + 2 * i * DWT_COLS;
+        for (c = 0; c < cols; c++)
+            r[c] -= (int)(r[c - DWT_COLS] + r[c + DWT_COLS] + 2) >> 2;
+    }
+    for (i = (i0 >> 1); i < (i1 >> 1); i++) {
+        unsigned *r = p + (2 * i + 1) * DWT_COLS;
+        for (c = 0; c < cols; c++)
+            r[c] += (int)(r[c - DWT_COLS] + r[c + DWT_COLS]) >> 1;
+    }
+}
+
 static void dwt_decode53(DWTContext *s, int *t)
 {
     int lev;
     int w     = s->linelen[s->ndeclevels - 1][0];
     int32_t *line = s->i_linebuf;
+    int32_t *col  = s->i_linebuf + 3 * DWT_COLS;
     line += 3;
 
     for (lev = 0; lev < s->ndeclevels; lev++) {
@@ -354,19 +391,19 @@ static void dwt_decode53(DWTContext *s, int *t)
         }
 
         // VER_SD
-        l = line + mv;
-        for (lp = 0; lp < lh; lp++) {
-            int i, j = 0;
+        l = col + mv * DWT_COLS;
+        for (lp = 0; lp < lh; lp += DWT_COLS) {
+            int i, j = 0, cols = FFMIN(DWT_COLS, lh - lp);
             // copy with interleaving
             for (i = mv; i < lv; i += 2, j++)
-                l[i] = t[w * j + lp];
+                memcpy(l + i * DWT_COLS, t + w * j + lp, cols * sizeof(*l));
             for (i = 1 - mv; i < lv; i += 2, j++)
-                l[i] = t[w * j + lp];
+                memcpy(l + i * DWT_COLS, t + w * j + lp, cols * sizeof(*l));
 
-            sr_1d53(line, mv, mv + lv);
+            sr_col53(col, mv, mv + lv, cols);
 
             for (i = 0; i < lv; i++)
-                t[w * i + lp] = l[i];
+                memcpy(t + w * i + lp, l + i * DWT_COLS, cols * sizeof(*l));
         }
     }
 }
@@ -398,11 +435,44 @@ static void sr_1d97_float(float *p, int i0, int i1)
         p[2 * i + 1] += F_LFTG_ALPHA * (p[2 * i]     + p[2 * i + 2]);
 }
 
+static void sr_col97_float(float *p, int i0, int i1, int cols)
+{
+    int i, c;
+
+    if (i1 <= i0 + 1) {
+        if (i0 == 1)
+            for (c = 0; c < cols; c++)
+                p[DWT_COLS + c] *= F_LFTG_K/2;
+        else
+            for (c = 0; c < cols; c++)
+                p[c] *= F_LFTG_X;
+        return;
+    }
+
+    for (i = 1; i <= 4; i++) {
+        memcpy(p + (i0 - i)     * DWT_COLS, p + (i0 + i)     * DWT_COLS, cols * sizeof(*p));
+        memcpy(p + (i1 + i - 1) * DWT_COLS, p + (i1 - i - 1) * DWT_COLS, cols * sizeof(*p));
+    }
+
+#define LIFT(start, end, odd, op, coef)                                     \
+    for (i = start; i < end; i++) {                                         \
+        float *r = p + (2 * i + odd) * DWT_COLS;                            \
+        for (c = 0; c < cols; c++)                                          \
+            r[c] op coef * (r[c - DWT_COLS] + r[c + DWT_COLS]);             \
+    }
+    LIFT((i0 >> 1) - 1, (i1 >> 1) + 2, 0, -=, F_LFTG_DELTA)
+    LIFT((i0 >> 1) - 1, (i1 >> 1) + 1, 1, -=, F_LFTG_GAMMA)
+    LIFT((i0 >> 1),     (i1 >> 1) + 1, 0, +=, F_LFTG_BETA)
+    LIFT((i0 >> 1),     (i1 >> 1),     1, +=, F_LFTG_ALPHA)
+#undef LIFT
+}
+
 static void dwt_decode97_float(DWTContext *s, float *t)
 {
     int lev;
     int w       = s->linelen[s->ndeclevels - 1][0];
     float *line = s->f_linebuf;
+    float *col  = s->f_linebuf + 5 * DWT_COLS;
     float *data = t;
     /* position at index O of line range [0-5,w+5] cf. extend function */
     line += 5;
@@ -431,19 +501,19 @@ static void dwt_decode97_float(DWTContext *s, float *t)
         }
 
         // VER_SD
-        l = line + mv;
-        for (lp = 0; lp < lh; lp++) {
-            int i, j = 0;
+        l = col + mv * DWT_COLS;
+        for (lp = 0; lp < lh; lp += DWT_COLS) {
+            int i, j = 0, cols = FFMIN(DWT_COLS, lh - lp);
             // copy with interleaving
             for (i = mv; i < lv; i += 2, j++)
-                l[i] = data[w * j + lp];
+                memcpy(l + i * DWT_COLS, data + w * j + lp, cols * sizeof(*l));
             for (i = 1 - mv; i < lv; i += 2, j++)
-                l[i] = data[w * j + lp];
+                memcpy(l + i * DWT_COLS, data + w * j + lp, cols * sizeof(*l));
 
-            sr_1d97_float(line, mv, mv + lv);
+            sr_col97_float(col, mv, mv + lv, cols);
 
             for (i = 0; i < lv; i++)
-                data[w * i + lp] = l[i];
+                memcpy(data + w * i + lp, l + i * DWT_COLS, cols * sizeof(*l));
         }
     }
 }
@@ -475,6 +545,39 @@ static void sr_1d97_int(int32_t *p, int i0, int i1)
         p[2 * i + 1] += (I_LFTG_ALPHA * (p[2 * i]     + (int64_t)p[2 * i + 2]) + (1 << 15)) >> 16;
 }
 
+static void sr_col97_int(int32_t *p, int i0, int i1, int cols)
+{
+    int i, c;
+
+    if (i1 <= i0 + 1) {
+        if (i0 == 1)
+            for (c = 0; c < cols; c++)
+                p[DWT_COLS + c] = (p[DWT_COLS + c] * I_LFTG_K + (1<<16)) >> 17;
+        else
+            for (c = 0; c < cols; c++)
+                p[c] = (p[c] * I_LFTG_X + (1<<15)) >> 16;
+        return;
+    }
+
+    for (i = 1; i <= 4; i++) {
+        memcpy(p + (i0 - i)     * DWT_COLS, p + (i0 + i)     * DWT_COLS, cols * sizeof(*p));
+        memcpy(p + (i1 + i - 1) * DWT_COLS, p + (i1 - i - 1) * DWT_COLS, cols * sizeof(*p));
+    }
+
+#define LIFT(start, end, odd, op, coef)                                     \
+    for (i = start; i < end; i++) {                                         \
+        int32_t *r = p + (2 * i + odd) * DWT_COLS;                          \
+        for (c = 0; c < cols; c++)                                          \
+            r[c] op (coef * (r[c - DWT_COLS] + (int64_t)r[c + DWT_COLS]) +  \
+                     (1 << 15)) >> 16;                                      \
+    }
+    LIFT((i0 >> 1) - 1, (i1 >> 1) + 2, 0, -=, I_LFTG_DELTA)
+    LIFT((i0 >> 1) - 1, (i1 >> 1) + 1, 1, -=, I_LFTG_GAMMA)
+    LIFT((i0 >> 1),     (i1 >> 1) + 1, 0, +=, I_LFTG_BETA)
+    LIFT((i0 >> 1),     (i1 >> 1),     1, +=, I_LFTG_ALPHA)
+#undef LIFT
+}
+
 static void dwt_decode97_int(DWTContext *s, int32_t *t)
 {
     int lev;
@@ -482,6 +585,7 @@ static void dwt_decode97_int(DWTContext *s, int32_t *t)
     int h       = s->linelen[s->ndeclevels - 1][1];
     int i;
     int32_t *line = s->i_linebuf;
+    int32_t *col  = s->i_linebuf + 5 * DWT_COLS;
     int32_t *data = t;
     /* position at index O of line range [0-5,w+5] cf. extend function */
     line += 5;
@@ -513,19 +617,20 @@ static void dwt_decode97_int(DWTContext *s, int32_t *t)
         }
 
         // VER_SD
-        l = line + mv;
-        for (lp = 0; lp < lh; lp++) {
-            int i, j = 0;
+        l = col + mv * DWT_COLS;
+        for (lp = 0; lp < lh; lp += DWT_COLS) {
+            int i, j = 0, c, cols = FFMIN(DWT_COLS, lh - lp);
             // rescale with interleaving
             for (i = mv; i < lv; i += 2, j++)
-                l[i] = ((data[w * j + lp] * I_LFTG_K) + (1 << 15)) >> 16;
+                for (c = 0; c < cols; c++)
+                    l[i * DWT_COLS + c] = ((data[w * j + lp + c] * I_LFTG_K) + (1 << 15)) >> 16;
             for (i = 1 - mv; i < lv; i += 2, j++)
-                l[i] = data[w * j + lp];
+                memcpy(l + i * DWT_COLS, data + w * j + lp, cols * sizeof(*l));
 
-            sr_1d97_int(line, mv, mv + lv);
+            sr_col97_int(col, mv, mv + lv, cols);
 
             for (i = 0; i < lv; i++)
-                data[w * i + lp] = l[i];
+                memcpy(data + w * i + lp, l + i * DWT_COLS, cols * sizeof(*l));
         }
     }
 
@@ -557,17 +662,17 @@ int ff_jpeg2000_dwt_init(DWTContext *s, int border[2][2],
         }
     switch (type) {
     case FF_DWT97:
-        s->f_linebuf = av_malloc_array((maxlen + 12), sizeof(*s->f_linebuf));
+        s->f_linebuf = av_malloc_array((maxlen + 12) * DWT_COLS, sizeof(*s->f_linebuf));
         if (!s->f_linebuf)
             return AVERROR(ENOMEM);
         break;
      case FF_DWT97_INT:
-        s->i_linebuf = av_malloc_array((maxlen + 12), sizeof(*s->i_linebuf));
+        s->i_linebuf = av_malloc_array((maxlen + 12) * DWT_COLS, sizeof(*s->i_linebuf));
         if (!s->i_linebuf)
             return AVERROR(ENOMEM);
         break;
     case FF_DWT53:
-        s->i_linebuf = av_malloc_array((maxlen +  6), sizeof(*s->i_linebuf));
+        s->i_linebuf = av_malloc_array((maxlen +  6) * DWT_COLS, sizeof(*s->i_linebuf));
         if (!s->i_linebuf)
             return AVERROR(ENOMEM);
         break;
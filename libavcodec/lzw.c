@@ -63,6 +63,7 @@ struct LZWState {
     uint8_t stack[LZW_SIZTABLE];
     uint8_t suffix[LZW_SIZTABLE];
     uint16_t prefix[LZW_SIZTABLE];
+    uint16_t length[LZW_SIZTABLE]; ///< length of the string of each code
     int bs;                     ///< current buffer size for GIF
 };
 
@@ -153,6 +154,9 @@ int ff_lzw_decode_init(LZWState *p, int csize, const uint8_t *buf, int buf_size,
 
     s->mode = mode;
     s->extra_slot = s->mode == FF_LZW_TIFF;
+
+    for (int i = 0; i < s->clear_code; i++)
+        s->length[i] = 1;
     return 0;
 }
 
@@ -161,13 +165,17 @@ int ff_lzw_decode_init(LZWState *p, int csize, const uint8_t *buf, int buf_size,
  * NOTE: the algorithm here is inspired from the LZW GIF decoder
  *  written by Steven A. Bennett in 1987.
  *
+ * Strings that fit in the output buffer are written to it directly, back to
+ * front, using the string lengths stored in the table. Only a string that
+ * crosses the end of the buffer goes through the stack.
+ *
  * @param p LZW context
  * @param buf output buffer
  * @param len number of bytes to decode
  * @return number of bytes decoded
  */
 int ff_lzw_decode(LZWState *p, uint8_t *buf, int len){
-    int l, c, code, oc, fc;
+    int l, c, code, oc, fc, size;
     uint8_t *sp;
     struct LZWState *s = (struct LZWState *)p;
 
@@ -197,17 +205,37 @@ int ff_lzw_decode(LZWState *p, uint8_t *buf, int len){
         } else {
             code = c;
             if (code == s->slot && fc>=0) {
-                *sp++ = fc;
+                size = s->length[oc] + 1;
                 code = oc;
-            }else if(code >= s->slot)
+            }else if(code >= s->slot) {
                 break;
-            while (code >= s->newcodes) {
-                *sp++ = s->suffix[code];
-                code = s->prefix[code];
+            } else {
+                size = s->length[code];
+                fc   = -1;
+            }
+            if (size <= l) {
+                uint8_t *dst = buf + size;
+                if (fc >= 0)
+                    *--dst = fc;
+                while (code >= s->newcodes) {
+                    *--dst = s->suffix[code];
+                    code = s->prefix[code];
+                }
+                *--dst = code;
+                buf += size;
+                l   -= size;
+            } else {
+                if (fc >= 0)
+                    *sp++ = fc;
+                while (code >= s->newcodes) {
+                    *sp++ = s->suffix[code];
+                    code = s->prefix[code];
+                }
+                *sp++ = code;
             }
-            *sp++ = code;
             if (s->slot < s->top_slot && oc>=0) {
                 s->suffix[s->slot] = code;
+                s->length[s->slot] = s->length[oc] + 1;
                 s->prefix[s->slot++] = oc;
             }
             fc = code;
@@ -218,6 +246,8 @@ int ff_lzw_decode(LZWState *p, uint8_t *buf, int len){
                     s->curmask = mask[++s->cursize];
                 }
             }
+            if (!l)
+                goto the_end;
         }
     }
     s->end_code = -1;
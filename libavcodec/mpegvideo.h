@@ -333,6 +333,7 @@ typedef struct MpegEncContext {
     int stuffing_bits;             ///< bits used for stuffing
     int next_lambda;               ///< next lambda used for retrying to encode a frame
     RateControlContext rc_context; ///< contains stuff only accessed in ratecontrol.c
+    int frame_thread;              ///< encoding the frames of a frame threaded encoder independently
 
     /* statistics, used for 2-pass encoding */
     int mv_bits;
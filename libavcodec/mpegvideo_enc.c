@@ -45,6 +45,7 @@
 #include "avcodec.h"
 #include "dct.h"
 #include "encode.h"
+#include "frame_thread_encoder.h"
 #include "idctdsp.h"
 #include "mpeg12codecs.h"
 #include "mpeg12data.h"
@@ -1102,6 +1103,15 @@ static int load_input_picture(MpegEncContext *s, const AVFrame *pic_arg)
     int flush_offset = 1;
     int direct = 1;
 
+    if (s->frame_thread) {
+        /* the previous frames were encoded by other contexts */
+        s->input_picture_number = s->coded_picture_number = s->avctx->frame_num;
+        s->user_specified_pts   = AV_NOPTS_VALUE;
+        if (!s->avctx->frame_num && pic_arg)
+            s->dts_delta = FFMAX(pic_arg->duration, 1);
+        encoding_delay = 0;
+    }
+
     if (pic_arg) {
         pts = pic_arg->pts;
         display_picture_number = s->input_picture_number++;
@@ -1744,8 +1754,8 @@ static int frame_start(MpegEncContext *s)
     return 0;
 }
 
-int ff_mpv_encode_picture(AVCodecContext *avctx, AVPacket *pkt,
-                          const AVFrame *pic_arg, int *got_packet)
+static int mpv_encode_picture(AVCodecContext *avctx, AVPacket *pkt,
+                              const AVFrame *pic_arg, int *got_packet)
 {
     MpegEncContext *s = avctx->priv_data;
     int i, stuffing_count, ret;
@@ -1812,6 +1822,9 @@ vbv_retry:
        if ((CONFIG_MJPEG_ENCODER || CONFIG_AMV_ENCODER) && s->out_format == FMT_MJPEG)
             ff_mjpeg_encode_picture_trailer(&s->pb, s->header_bits);
 
+        if (CONFIG_FRAME_THREAD_ENCODER && s->frame_thread)
+            ff_rate_control_thread_wait(s);
+
         if (avctx->rc_buffer_size) {
             RateControlContext *rcc = &s->rc_context;
             int max_size = FFMAX(rcc->buffer_index * avctx->rc_max_available_vbv_use, rcc->buffer_index - 500);
@@ -1965,6 +1978,9 @@ vbv_retry:
         } else
             pkt->dts = pkt->pts;
 
+        if (CONFIG_FRAME_THREAD_ENCODER && s->frame_thread)
+            ff_rate_control_thread_finish(s);
+
         // the no-delay case is handled in generic code
         if (avctx->codec->capabilities & AV_CODEC_CAP_DELAY) {
             ret = ff_encode_reordered_opaque(avctx, pkt, s->current_picture.f);
@@ -1993,6 +2009,23 @@ vbv_retry:
     return 0;
 }
 
+int ff_mpv_encode_picture(AVCodecContext *avctx, AVPacket *pkt,
+                          const AVFrame *pic_arg, int *got_packet)
+{
+    MpegEncContext *s = avctx->priv_data;
+    int ret;
+
+    if (!CONFIG_FRAME_THREAD_ENCODER || !ff_frame_thread_encoder_parent(avctx))
+        return mpv_encode_picture(avctx, pkt, pic_arg, got_packet);
+
+    s->frame_thread = 1;
+    ff_rate_control_thread_start_frame(s);
+    ret = mpv_encode_picture(avctx, pkt, pic_arg, got_packet);
+    ff_rate_control_thread_end_frame(s);
+
+    return ret;
+}
+
 static inline void dct_single_coeff_elimination(MpegEncContext *s,
                                                 int n, int threshold)
 {
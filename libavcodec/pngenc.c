@@ -25,6 +25,7 @@
 #include "bytestream.h"
 #include "lossless_videoencdsp.h"
 #include "png.h"
+#include "pngencdsp.h"
 #include "apng.h"
 #include "zlib_wrapper.h"
 
@@ -39,6 +40,7 @@
 #include <zlib.h>
 
 #define IOBUF_SIZE 4096
+#define WINDOW_SIZE (1 << MAX_WBITS)
 
 typedef struct APNGFctlChunk {
     uint32_t sequence_number;
@@ -48,9 +50,23 @@ typedef struct APNGFctlChunk {
     uint8_t dispose_op, blend_op;
 } APNGFctlChunk;
 
+typedef struct PNGEncSlice {
+    FFZStream zstream;           ///< raw deflate stream, without zlib header
+    uint8_t *crow_base;
+    unsigned int crow_size;
+    uint8_t *dict;               ///< filtered rows preceding the slice
+    unsigned int dict_size;
+    uint8_t *buf;                ///< compressed rows
+    unsigned int buf_size;
+    int len;
+    uLong adler;                 ///< Adler-32 of the filtered rows
+    int ret;
+} PNGEncSlice;
+
 typedef struct PNGEncContext {
     AVClass *class;
     LLVidEncDSPContext llvidencdsp;
+    PNGEncDSPContext pngencdsp;
 
     uint8_t *bytestream;
     uint8_t *bytestream_start;
@@ -60,6 +76,13 @@ typedef struct PNGEncContext {
 
     FFZStream zstream;
     uint8_t buf[IOBUF_SIZE];
+    int compression_level;
+
+    /* The rows are split into slices deflated independently, each ending
+     * on a byte boundary, and concatenated into a single zlib stream. */
+    PNGEncSlice *slices;
+    int nb_slices;
+
     int dpi;                     ///< Physical pixel density, in dots per inch, if set
     int dpm;                     ///< Physical pixel density, in dots per meter, if set
 
@@ -121,34 +144,6 @@ static void png_get_interlaced_row(uint8_t *dst, int row_size,
     }
 }
 
-static void sub_png_paeth_prediction(uint8_t *dst, const uint8_t *src, const uint8_t *top,
-                                     int w, int bpp)
-{
-    int i;
-    for (i = 0; i < w; i++) {
-        int a, b, c, p, pa, pb, pc;
-
-        a = src[i - bpp];
-        b = top[i];
-        c = top[i - bpp];
-
-        p  = b - c;
-        pc = a - c;
-
-        pa = abs(p);
-        pb = abs(pc);
-        pc = abs(p + pc);
-
-        if (pa <= pb && pa <= pc)
-            p = a;
-        else if (pb <= pc)
-            p = b;
-        else
-            p = c;
-        dst[i] = src[i] - p;
-    }
-}
-
 static void sub_left_prediction(PNGEncContext *c, uint8_t *dst, const uint8_t *src, int bpp, int size)
 {
     const uint8_t *src1 = src + bpp;
@@ -183,13 +178,12 @@ static void png_filter_row(PNGEncContext *c, uint8_t *dst, int filter_type,
     case PNG_FILTER_VALUE_AVG:
         for (i = 0; i < bpp; i++)
             dst[i] = src[i] - (top[i] >> 1);
-        for (; i < size; i++)
-            dst[i] = src[i] - ((src[i - bpp] + top[i]) >> 1);
+        c->pngencdsp.sub_avg_prediction(dst + i, src + i, top + i, size - i, bpp);
         break;
     case PNG_FILTER_VALUE_PAETH:
         for (i = 0; i < bpp; i++)
             dst[i] = src[i] - top[i];
-        sub_png_paeth_prediction(dst + i, src + i, top + i, size - i, bpp);
+        c->pngencdsp.sub_paeth_prediction(dst + i, src + i, top + i, size - i, bpp);
         break;
     }
 }
@@ -472,6 +466,131 @@ static int encode_headers(AVCodecContext *avctx, const AVFrame *pict)
     return 0;
 }
 
+static int encode_slice(AVCodecContext *avctx, void *arg, int jobnr, int threadnr)
+{
+    PNGEncContext *s        = avctx->priv_data;
+    const AVFrame *const p  = arg;
+    PNGEncSlice *const sl   = &s->slices[jobnr];
+    z_stream *const zstream = &sl->zstream.zstream;
+    const int nb_slices     = FFMIN(s->nb_slices, p->height);
+    const int last          = jobnr == nb_slices - 1;
+    const int row_size      = (p->width * s->bits_per_pixel + 7) >> 3;
+    const int bpp           = s->bits_per_pixel >> 3;
+    const int y_start       = p->height *  jobnr      / nb_slices;
+    const int y_end         = p->height * (jobnr + 1) / nb_slices;
+    const uint8_t *top      = y_start ? p->data[0] + (y_start - 1) * p->linesize[0] : NULL;
+    uint8_t *crow_buf, *crow;
+    uLong bound;
+    int y, ret;
+
+    /* returned as is on zlib failures */
+    sl->ret = AVERROR_EXTERNAL;
+    sl->len = 0;
+    av_fast_malloc(&sl->crow_base, &sl->crow_size,
+                   (row_size + 32) << (s->filter_type == PNG_FILTER_VALUE_MIXED));
+    if (!sl->crow_base)
+        return sl->ret = AVERROR(ENOMEM);
+    crow_buf = sl->crow_base + 15;
+
+    deflateReset(zstream);
+
+    /* Prime the window with the rows preceding the slice, so that matches
+     * can reach back into them like they would in a single stream. */
+    if (y_start) {
+        int y0        = FFMAX(y_start - (WINDOW_SIZE + row_size) / (row_size + 1), 0);
+        int dict_size = (y_start - y0) * (row_size + 1);
+        const uint8_t *dict_top = y0 ? p->data[0] + (y0 - 1) * p->linesize[0] : NULL;
+
+        av_fast_malloc(&sl->dict, &sl->dict_size, dict_size);
+        if (!sl->dict)
+            return sl->ret = AVERROR(ENOMEM);
+        for (y = y0; y < y_start; y++) {
+            const uint8_t *ptr = p->data[0] + y * p->linesize[0];
+            crow = png_choose_filter(s, crow_buf, ptr, dict_top, row_size, bpp);
+            memcpy(sl->dict + (y - y0) * (row_size + 1), crow, row_size + 1);
+            dict_top = ptr;
+        }
+        if (dict_size > WINDOW_SIZE) {
+            if (deflateSetDictionary(zstream, sl->dict + dict_size - WINDOW_SIZE,
+                                     WINDOW_SIZE) != Z_OK)
+                return sl->ret;
+        } else if (deflateSetDictionary(zstream, sl->dict, dict_size) != Z_OK) {
+            return sl->ret;
+        }
+    }
+
+    /* room for the zlib header, the empty block of the sync flush and the
+     * Adler-32 of the whole stream */
+    bound = deflateBound(zstream, (uLong)(y_end - y_start) * (row_size + 1)) + 16;
+    if (bound > INT_MAX)
+        return sl->ret = AVERROR(ENOMEM);
+    av_fast_malloc(&sl->buf, &sl->buf_size, bound);
+    if (!sl->buf)
+        return sl->ret = AVERROR(ENOMEM);
+    zstream->next_out  = sl->buf + (jobnr ? 0 : 2);
+    zstream->avail_out = bound - 6;
+
+    sl->adler = adler32(0, NULL, 0);
+    for (y = y_start; y < y_end; y++) {
+        const uint8_t *ptr = p->data[0] + y * p->linesize[0];
+        crow = png_choose_filter(s, crow_buf, ptr, top, row_size, bpp);
+        sl->adler = adler32(sl->adler, crow, row_size + 1);
+        zstream->next_in  = crow;
+        zstream->avail_in = row_size + 1;
+        if (deflate(zstream, Z_NO_FLUSH) != Z_OK || zstream->avail_in)
+            return sl->ret;
+        top = ptr;
+    }
+    /* only the last slice terminates the deflate stream */
+    ret = deflate(zstream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (ret != (last ? Z_STREAM_END : Z_OK) || !zstream->avail_out)
+        return sl->ret;
+
+    sl->len = zstream->next_out - sl->buf;
+    return sl->ret = 0;
+}
+
+static int encode_frame_slices(AVCodecContext *avctx, const AVFrame *pict)
+{
+    PNGEncContext *s    = avctx->priv_data;
+    const int nb_slices = FFMIN(s->nb_slices, pict->height);
+    const int row_size  = (pict->width * s->bits_per_pixel + 7) >> 3;
+    const int level     = s->compression_level == Z_DEFAULT_COMPRESSION ? 6 :
+                          s->compression_level;
+    PNGEncSlice *last   = &s->slices[nb_slices - 1];
+    unsigned header;
+    uLong adler;
+
+    avctx->execute2(avctx, encode_slice, (void *)pict, NULL, nb_slices);
+
+    for (int i = 0; i < nb_slices; i++)
+        if (s->slices[i].ret < 0)
+            return s->slices[i].ret;
+
+    /* zlib header: deflate with a 32K window and the compression level */
+    header  = 0x7800 | (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+    header += 31 - header % 31;
+    AV_WB16(s->slices[0].buf, header);
+
+    adler = s->slices[0].adler;
+    for (int i = 1; i < nb_slices; i++) {
+        int rows = pict->height * (i + 1) / nb_slices - pict->height * i / nb_slices;
+        adler = adler32_combine(adler, s->slices[i].adler,
+                                (z_off_t)rows * (row_size + 1));
+    }
+    AV_WB32(last->buf + last->len, adler);
+    last->len += 4;
+
+    for (int i = 0; i < nb_slices; i++) {
+        PNGEncSlice *sl = &s->slices[i];
+        if (s->bytestream_end - s->bytestream < sl->len + 16)
+            return AVERROR_BUG;
+        png_write_image_data(avctx, sl->buf, sl->len);
+    }
+
+    return 0;
+}
+
 static int encode_frame(AVCodecContext *avctx, const AVFrame *pict)
 {
     PNGEncContext *s       = avctx->priv_data;
@@ -484,6 +603,9 @@ static int encode_frame(AVCodecContext *avctx, const AVFrame *pict)
     uint8_t *progressive_buf = NULL;
     uint8_t *top_buf         = NULL;
 
+    if (s->nb_slices > 1 && pict->height > 1)
+        return encode_frame_slices(avctx, pict);
+
     row_size = (pict->width * s->bits_per_pixel + 7) >> 3;
 
     crow_base = av_malloc((row_size + 32) << (s->filter_type == PNG_FILTER_VALUE_MIXED));
@@ -1090,6 +1212,7 @@ static av_cold int png_enc_init(AVCodecContext *avctx)
     }
 
     ff_llvidencdsp_init(&s->llvidencdsp);
+    ff_pngencdsp_init(&s->pngencdsp);
 
     if (avctx->pix_fmt == AV_PIX_FMT_MONOBLACK)
         s->filter_type = PNG_FILTER_VALUE_NONE;
@@ -1151,6 +1274,26 @@ static av_cold int png_enc_init(AVCodecContext *avctx)
     compression_level = avctx->compression_level == FF_COMPRESSION_DEFAULT
                       ? Z_DEFAULT_COMPRESSION
                       : av_clip(avctx->compression_level, 0, 9);
+    s->compression_level = compression_level;
+
+    if (avctx->slices > 1) {
+        if (s->is_progressive) {
+            av_log(avctx, AV_LOG_WARNING,
+                   "Slices are not supported with interlacing, ignoring\n");
+        } else {
+            s->nb_slices = FFMIN(avctx->slices, avctx->height);
+            s->slices    = av_calloc(s->nb_slices, sizeof(*s->slices));
+            if (!s->slices)
+                return AVERROR(ENOMEM);
+            for (int i = 0; i < s->nb_slices; i++) {
+                int ret = ff_deflate_init2(&s->slices[i].zstream, compression_level,
+                                           -MAX_WBITS, avctx);
+                if (ret < 0)
+                    return ret;
+            }
+        }
+    }
+
     return ff_deflate_init(&s->zstream, compression_level, avctx);
 }
 
@@ -1159,6 +1302,14 @@ static av_cold int png_enc_close(AVCodecContext *avctx)
     PNGEncContext *s = avctx->priv_data;
 
     ff_deflate_end(&s->zstream);
+    for (int i = 0; i < s->nb_slices; i++) {
+        PNGEncSlice *sl = &s->slices[i];
+        ff_deflate_end(&sl->zstream);
+        av_freep(&sl->crow_base);
+        av_freep(&sl->dict);
+        av_freep(&sl->buf);
+    }
+    av_freep(&s->slices);
     av_frame_free(&s->last_frame);
     av_frame_free(&s->prev_frame);
     av_freep(&s->last_frame_packet);
@@ -1195,6 +1346,7 @@ const FFCodec ff_png_encoder = {
     .p.type         = AVMEDIA_TYPE_VIDEO,
     .p.id           = AV_CODEC_ID_PNG,
     .p.capabilities = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_FRAME_THREADS |
+                      AV_CODEC_CAP_SLICE_THREADS |
                       AV_CODEC_CAP_ENCODER_REORDERED_OPAQUE,
     .priv_data_size = sizeof(PNGEncContext),
     .init           = png_enc_init,
@@ -1218,6 +1370,7 @@ const FFCodec ff_apng_encoder = {
     .p.type         = AVMEDIA_TYPE_VIDEO,
     .p.id           = AV_CODEC_ID_APNG,
     .p.capabilities = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_DELAY |
+                      AV_CODEC_CAP_SLICE_THREADS |
                       AV_CODEC_CAP_ENCODER_REORDERED_OPAQUE,
     .priv_data_size = sizeof(PNGEncContext),
     .init           = png_enc_init,
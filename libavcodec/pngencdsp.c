@@ -0,0 +1,66 @@
+/*
+ * PNG encoder DSP functions
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/attributes.h"
+#include "libavutil/common.h"
+#include "libavutil/intreadwrite.h"
+#include "pngencdsp.h"
+
+#define pb_7f (UINT64_C(0x7f7f7f7f7f7f7f7f))
+#define pb_80 (UINT64_C(0x8080808080808080))
+#define pb_fe (UINT64_C(0xfefefefefefefefe))
+
+static void sub_avg_prediction_c(uint8_t *dst, const uint8_t *src,
+                                 const uint8_t *top, int w, int bpp)
+{
+    int i;
+
+    for (i = 0; i <= w - 8; i += 8) {
+        uint64_t a = AV_RN64(src + i - bpp);
+        uint64_t b = AV_RN64(top + i);
+        uint64_t s = AV_RN64(src + i);
+        /* bytewise (a + b) >> 1 and s - avg */
+        uint64_t avg = (a & b) + (((a ^ b) & pb_fe) >> 1);
+        AV_WN64(dst + i, ((s | pb_80) - (avg & pb_7f)) ^ ((s ^ avg ^ pb_80) & pb_80));
+    }
+    for (; i < w; i++)
+        dst[i] = src[i] - ((src[i - bpp] + top[i]) >> 1);
+}
+
+static void sub_paeth_prediction_c(uint8_t *dst, const uint8_t *src,
+                                   const uint8_t *top, int w, int bpp)
+{
+    /* branchless, so that the compiler can vectorize it */
+    for (int i = 0; i < w; i++) {
+        int a = src[i - bpp], b = top[i], c = top[i - bpp];
+        int pa = FFABS(b - c);
+        int pb = FFABS(a - c);
+        int pc = FFABS(a + b - 2 * c);
+        int p  = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+
+        dst[i] = src[i] - p;
+    }
+}
+
+av_cold void ff_pngencdsp_init(PNGEncDSPContext *c)
+{
+    c->sub_avg_prediction   = sub_avg_prediction_c;
+    c->sub_paeth_prediction = sub_paeth_prediction_c;
+}
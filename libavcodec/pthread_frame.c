@@ -47,6 +47,7 @@
 #include "libavutil/mem.h"
 #include "libavutil/opt.h"
 #include "libavutil/thread.h"
+#include "libavutil/threadpool_internal.h"
 
 enum {
     ///< Set when the thread is awaiting a packet.
@@ -80,6 +81,7 @@ typedef struct PerThreadContext {
     struct FrameThreadContext *parent;
 
     pthread_t      thread;
+    AVThreadPoolJob job;            ///< Used instead of thread when running on a thread pool.
     int            thread_init;
     unsigned       pthread_init_cnt;///< Number of successfully initialized mutexes/conditions
     pthread_cond_t input_cond;      ///< Used to wait for a new packet from the main thread.
@@ -88,6 +90,12 @@ typedef struct PerThreadContext {
 
     pthread_mutex_t mutex;          ///< Mutex used to protect the contents of the PerThreadContext.
     pthread_mutex_t progress_mutex; ///< Mutex used to protect frame progress values and progress_cond.
+    /**
+     * Number of threads blocked in ff_thread_await_progress() on a frame
+     * owned by this thread. Progress reports only take progress_mutex and
+     * broadcast progress_cond when it is nonzero.
+     */
+    atomic_int progress_waiters;
 
     AVCodecContext *avctx;          ///< Context used to decode packets passed to this thread.
 
@@ -113,6 +121,7 @@ typedef struct PerThreadContext {
 typedef struct FrameThreadContext {
     PerThreadContext *threads;     ///< The contexts for each thread.
     PerThreadContext *prev_thread; ///< The last thread submit_packet() was called on.
+    AVThreadPool *pool;            ///< Thread pool the packets are decoded on, if any.
 
     unsigned    pthread_init_cnt;  ///< Number of successfully initialized mutexes/conditions
     pthread_mutex_t buffer_mutex;  ///< Mutex used to protect get/release_buffer().
@@ -170,87 +179,109 @@ static void thread_set_name(PerThreadContext *p)
 }
 
 /**
- * Codec worker thread.
+ * Decode the packet submitted to a codec thread, called with p->mutex held.
  *
  * Automatically calls ff_thread_finish_setup() if the codec does
  * not provide an update_thread_context method, or if the codec returns
  * before calling it.
  */
-static attribute_align_arg void *frame_worker_thread(void *arg)
+static void decode_submitted_packet(PerThreadContext *p)
 {
-    PerThreadContext *p = arg;
     AVCodecContext *avctx = p->avctx;
     const FFCodec *codec = ffcodec(avctx->codec);
 
-    thread_set_name(p);
+    if (!codec->update_thread_context)
+        ff_thread_finish_setup(avctx);
 
-    pthread_mutex_lock(&p->mutex);
-    while (1) {
-        while (atomic_load(&p->state) == STATE_INPUT_READY && !p->die)
-            pthread_cond_wait(&p->input_cond, &p->mutex);
+    /* If a decoder supports hwaccel, then it must call ff_get_format().
+     * Since that call must happen before ff_thread_finish_setup(), the
+     * decoder is required to implement update_thread_context() and call
+     * ff_thread_finish_setup() manually. Therefore the above
+     * ff_thread_finish_setup() call did not happen and hwaccel_serializing
+     * cannot be true here. */
+    av_assert0(!p->hwaccel_serializing);
 
-        if (p->die) break;
+    /* if the previous thread uses hwaccel then we take the lock to ensure
+     * the threads don't run concurrently */
+    if (avctx->hwaccel) {
+        pthread_mutex_lock(&p->parent->hwaccel_mutex);
+        p->hwaccel_serializing = 1;
+    }
 
-        if (!codec->update_thread_context)
-            ff_thread_finish_setup(avctx);
-
-        /* If a decoder supports hwaccel, then it must call ff_get_format().
-         * Since that call must happen before ff_thread_finish_setup(), the
-         * decoder is required to implement update_thread_context() and call
-         * ff_thread_finish_setup() manually. Therefore the above
-         * ff_thread_finish_setup() call did not happen and hwaccel_serializing
-         * cannot be true here. */
-        av_assert0(!p->hwaccel_serializing);
-
-        /* if the previous thread uses hwaccel then we take the lock to ensure
-         * the threads don't run concurrently */
-        if (avctx->hwaccel) {
-            pthread_mutex_lock(&p->parent->hwaccel_mutex);
-            p->hwaccel_serializing = 1;
-        }
+    av_frame_unref(p->frame);
+    p->got_frame = 0;
+    p->result = codec->cb.decode(avctx, p->frame, &p->got_frame, p->avpkt);
 
-        av_frame_unref(p->frame);
-        p->got_frame = 0;
-        p->result = codec->cb.decode(avctx, p->frame, &p->got_frame, p->avpkt);
+    if ((p->result < 0 || !p->got_frame) && p->frame->buf[0])
+        ff_thread_release_buffer(avctx, p->frame);
 
-        if ((p->result < 0 || !p->got_frame) && p->frame->buf[0])
-            ff_thread_release_buffer(avctx, p->frame);
+    if (atomic_load(&p->state) == STATE_SETTING_UP)
+        ff_thread_finish_setup(avctx);
 
-        if (atomic_load(&p->state) == STATE_SETTING_UP)
-            ff_thread_finish_setup(avctx);
+    if (p->hwaccel_serializing) {
+        /* wipe hwaccel state to avoid stale pointers lying around;
+         * the state was transferred to FrameThreadContext in
+         * ff_thread_finish_setup(), so nothing is leaked */
+        avctx->hwaccel                     = NULL;
+        avctx->hwaccel_context             = NULL;
+        avctx->internal->hwaccel_priv_data = NULL;
 
-        if (p->hwaccel_serializing) {
-            /* wipe hwaccel state to avoid stale pointers lying around;
-             * the state was transferred to FrameThreadContext in
-             * ff_thread_finish_setup(), so nothing is leaked */
-            avctx->hwaccel                     = NULL;
-            avctx->hwaccel_context             = NULL;
-            avctx->internal->hwaccel_priv_data = NULL;
+        p->hwaccel_serializing = 0;
+        pthread_mutex_unlock(&p->parent->hwaccel_mutex);
+    }
+    av_assert0(!avctx->hwaccel);
 
-            p->hwaccel_serializing = 0;
-            pthread_mutex_unlock(&p->parent->hwaccel_mutex);
-        }
-        av_assert0(!avctx->hwaccel);
+    if (p->async_serializing) {
+        p->async_serializing = 0;
 
-        if (p->async_serializing) {
-            p->async_serializing = 0;
+        async_unlock(p->parent);
+    }
 
-            async_unlock(p->parent);
-        }
+    pthread_mutex_lock(&p->progress_mutex);
 
-        pthread_mutex_lock(&p->progress_mutex);
+    atomic_store(&p->state, STATE_INPUT_READY);
 
-        atomic_store(&p->state, STATE_INPUT_READY);
+    pthread_cond_broadcast(&p->progress_cond);
+    pthread_cond_signal(&p->output_cond);
+    pthread_mutex_unlock(&p->progress_mutex);
+}
 
-        pthread_cond_broadcast(&p->progress_cond);
-        pthread_cond_signal(&p->output_cond);
-        pthread_mutex_unlock(&p->progress_mutex);
+/**
+ * Codec worker thread.
+ */
+static attribute_align_arg void *frame_worker_thread(void *arg)
+{
+    PerThreadContext *p = arg;
+
+    thread_set_name(p);
+
+    pthread_mutex_lock(&p->mutex);
+    while (1) {
+        while (atomic_load(&p->state) == STATE_INPUT_READY && !p->die)
+            pthread_cond_wait(&p->input_cond, &p->mutex);
+
+        if (p->die) break;
+
+        decode_submitted_packet(p);
     }
     pthread_mutex_unlock(&p->mutex);
 
     return NULL;
 }
 
+/**
+ * Thread pool job decoding a single packet, used instead of
+ * frame_worker_thread() when the codec threads run on a thread pool.
+ */
+static void frame_worker_job(void *arg)
+{
+    PerThreadContext *p = arg;
+
+    pthread_mutex_lock(&p->mutex);
+    decode_submitted_packet(p);
+    pthread_mutex_unlock(&p->mutex);
+}
+
 /**
  * Update the next thread's AVCodecContext with values from the reference thread's context.
  *
@@ -451,7 +482,10 @@ static int submit_packet(PerThreadContext *p, AVCodecContext *user_avctx,
     }
 
     atomic_store(&p->state, STATE_SETTING_UP);
-    pthread_cond_signal(&p->input_cond);
+    if (fctx->pool)
+        avpriv_thread_pool_submit(fctx->pool, &p->job, 1);
+    else
+        pthread_cond_signal(&p->input_cond);
     pthread_mutex_unlock(&p->mutex);
 
     fctx->prev_thread = p;
@@ -560,10 +594,16 @@ void ff_thread_report_progress(ThreadFrame *f, int n, int field)
         av_log(f->owner[field], AV_LOG_DEBUG,
                "%p finished %d field %d\n", progress, n, field);
 
-    pthread_mutex_lock(&p->progress_mutex);
+    /* The store and the load of progress_waiters are both sequentially
+     * consistent, and so are the increment and the load of the progress in
+     * ff_thread_await_progress(): either the waiter sees the new value, or
+     * this sees the waiter and wakes it up under the mutex. */
+    atomic_store(&progress[field], n);
 
-    atomic_store_explicit(&progress[field], n, memory_order_release);
+    if (!atomic_load(&p->progress_waiters))
+        return;
 
+    pthread_mutex_lock(&p->progress_mutex);
     pthread_cond_broadcast(&p->progress_cond);
     pthread_mutex_unlock(&p->progress_mutex);
 }
@@ -584,8 +624,10 @@ void ff_thread_await_progress(const ThreadFrame *f, int n, int field)
                "thread awaiting %d field %d from %p\n", n, field, progress);
 
     pthread_mutex_lock(&p->progress_mutex);
-    while (atomic_load_explicit(&progress[field], memory_order_relaxed) < n)
+    atomic_fetch_add(&p->progress_waiters, 1);
+    while (atomic_load(&progress[field]) < n)
         pthread_cond_wait(&p->progress_cond, &p->progress_mutex);
+    atomic_fetch_sub_explicit(&p->progress_waiters, 1, memory_order_relaxed);
     pthread_mutex_unlock(&p->progress_mutex);
 }
 
@@ -673,7 +715,11 @@ void ff_frame_thread_free(AVCodecContext *avctx, int thread_count)
         AVCodecContext *ctx = p->avctx;
 
         if (ctx->internal) {
-            if (p->thread_init == INITIALIZED) {
+            if (p->thread_init == INITIALIZED && fctx->pool) {
+                /* the last job may still be about to release the mutex */
+                pthread_mutex_lock(&p->mutex);
+                pthread_mutex_unlock(&p->mutex);
+            } else if (p->thread_init == INITIALIZED) {
                 pthread_mutex_lock(&p->mutex);
                 p->die = 1;
                 pthread_cond_signal(&p->input_cond);
@@ -683,6 +729,8 @@ void ff_frame_thread_free(AVCodecContext *avctx, int thread_count)
             }
             if (codec->close && p->thread_init != UNINITIALIZED)
                 codec->close(ctx);
+            if (ctx->internal->slice_thread_ctx)
+                ff_slice_thread_free(ctx);
 
             if (ctx->priv_data) {
                 if (codec->p.priv_class)
@@ -794,9 +842,14 @@ static av_cold int init_thread(PerThreadContext *p, int *threads_to_free,
 
     atomic_init(&p->debug_threads, (copy->debug & FF_DEBUG_THREADS) != 0);
 
-    err = AVERROR(pthread_create(&p->thread, NULL, frame_worker_thread, p));
-    if (err < 0)
-        return err;
+    if (fctx->pool) {
+        p->job.func   = frame_worker_job;
+        p->job.opaque = p;
+    } else {
+        err = AVERROR(pthread_create(&p->thread, NULL, frame_worker_thread, p));
+        if (err < 0)
+            return err;
+    }
     p->thread_init = INITIALIZED;
 
     return 0;
@@ -807,10 +860,16 @@ int ff_frame_thread_init(AVCodecContext *avctx)
     int thread_count = avctx->thread_count;
     const FFCodec *codec = ffcodec(avctx->codec);
     FrameThreadContext *fctx;
+    AVThreadPool *pool = avctx->thread_pool;
     int err, i = 0;
 
+    /* A non async-safe hwaccel makes the codec threads wait for the caller
+     * to call back into the decoder, which must not tie up pool threads. */
+    if (avctx->hw_device_ctx || avctx->hw_frames_ctx || avctx->hwaccel_context)
+        pool = NULL;
+
     if (!thread_count) {
-        int nb_cpus = av_cpu_count();
+        int nb_cpus = pool ? avpriv_thread_pool_nb_threads(pool) : av_cpu_count();
         // use number of cores + 1 as thread count if there is more than one
         if (nb_cpus > 1)
             thread_count = avctx->thread_count = FFMIN(nb_cpus + 1, MAX_AUTO_THREADS);
@@ -836,6 +895,7 @@ int ff_frame_thread_init(AVCodecContext *avctx)
 
     fctx->async_lock = 1;
     fctx->delaying = 1;
+    fctx->pool = pool;
 
     if (codec->p.type == AVMEDIA_TYPE_VIDEO)
         avctx->delay = avctx->thread_count - 1;
@@ -36,6 +36,7 @@
 #include "libavutil/mem.h"
 #include "libavutil/thread.h"
 #include "libavutil/slicethread.h"
+#include "libavutil/threadpool_internal.h"
 
 typedef int (action_func)(AVCodecContext *c, void *arg);
 typedef int (action_func2)(AVCodecContext *c, void *arg, int jobnr, int threadnr);
@@ -59,18 +60,21 @@ typedef struct SliceThreadContext {
     int entries_count;
     int thread_count;
     Progress *progress;
+
+    /* number of threads in the pool */
+    int nb_threads;
 } SliceThreadContext;
 
 static void main_function(void *priv) {
     AVCodecContext *avctx = priv;
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
     c->mainfunc(avctx);
 }
 
 static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
 {
     AVCodecContext *avctx = priv;
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
     int ret;
 
     ret = c->func ? c->func(avctx, (char *)c->args + c->job_size * jobnr)
@@ -79,9 +83,18 @@ static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb
         c->rets[jobnr] = ret;
 }
 
+static int slicethread_create(AVCodecContext *avctx, SliceThreadContext *c,
+                              void (*mainfunc)(void *), int thread_count)
+{
+    if (avctx->thread_pool)
+        return avpriv_slicethread_create_pool(&c->thread, avctx->thread_pool, avctx,
+                                              worker_func, mainfunc, thread_count);
+    return avpriv_slicethread_create(&c->thread, avctx, worker_func, mainfunc, thread_count);
+}
+
 void ff_slice_thread_free(AVCodecContext *avctx)
 {
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
     int i;
 
     avpriv_slicethread_free(&c->thread);
@@ -94,14 +107,14 @@ void ff_slice_thread_free(AVCodecContext *avctx)
 
     av_freep(&c->entries);
     av_freep(&c->progress);
-    av_freep(&avctx->internal->thread_ctx);
+    av_freep(&avctx->internal->slice_thread_ctx);
 }
 
 static int thread_execute(AVCodecContext *avctx, action_func* func, void *arg, int *ret, int job_count, int job_size)
 {
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
 
-    if (!(avctx->active_thread_type&FF_THREAD_SLICE) || avctx->thread_count <= 1)
+    if (!(avctx->active_thread_type&FF_THREAD_SLICE) || !c)
         return avcodec_default_execute(avctx, func, arg, ret, job_count, job_size);
 
     if (job_count <= 0)
@@ -118,14 +131,14 @@ static int thread_execute(AVCodecContext *avctx, action_func* func, void *arg, i
 
 static int thread_execute2(AVCodecContext *avctx, action_func2* func2, void *arg, int *ret, int job_count)
 {
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
     c->func2 = func2;
     return thread_execute(avctx, NULL, arg, ret, job_count, 0);
 }
 
 int ff_slice_thread_execute_with_mainfunc(AVCodecContext *avctx, action_func2* func2, main_func *mainfunc, void *arg, int *ret, int job_count)
 {
-    SliceThreadContext *c = avctx->internal->thread_ctx;
+    SliceThreadContext *c = avctx->internal->slice_thread_ctx;
     c->func2 = func2;
     c->mainfunc = mainfunc;
     return thread_execute(avctx, NULL, arg, ret, job_count, 0);
@@ -144,7 +157,8 @@ int ff_slice_thread_init(AVCodecContext *avctx)
         thread_count = avctx->thread_count = 1;
 
     if (!thread_count) {
-        int nb_cpus = av_cpu_count();
+        int nb_cpus = avctx->thread_pool ? avpriv_thread_pool_nb_threads(avctx->thread_pool)
+                                         : av_cpu_count();
         if  (avctx->height)
             nb_cpus = FFMIN(nb_cpus, (avctx->height+15)/16);
         // use number of cores + 1 as thread count if there is more than one
@@ -159,27 +173,65 @@ int ff_slice_thread_init(AVCodecContext *avctx)
         return 0;
     }
 
-    avctx->internal->thread_ctx = c = av_mallocz(sizeof(*c));
+    avctx->internal->slice_thread_ctx = c = av_mallocz(sizeof(*c));
     mainfunc = ffcodec(avctx->codec)->caps_internal & FF_CODEC_CAP_SLICE_THREAD_HAS_MF ? &main_function : NULL;
-    if (!c || (thread_count = avpriv_slicethread_create(&c->thread, avctx, worker_func, mainfunc, thread_count)) <= 1) {
+    if (!c || (thread_count = slicethread_create(avctx, c, mainfunc, thread_count)) <= 1) {
         if (c)
             avpriv_slicethread_free(&c->thread);
-        av_freep(&avctx->internal->thread_ctx);
+        av_freep(&avctx->internal->slice_thread_ctx);
         avctx->thread_count = 1;
         avctx->active_thread_type = 0;
         return 0;
     }
-    avctx->thread_count = thread_count;
+    avctx->thread_count = c->nb_threads = thread_count;
 
     avctx->execute = thread_execute;
     avctx->execute2 = thread_execute2;
     return 0;
 }
 
+int ff_slice_thread_init_hybrid(AVCodecContext *avctx, int thread_count)
+{
+    SliceThreadContext *c;
+    void (*mainfunc)(void *);
+    int ret;
+
+    av_assert0(avctx->active_thread_type == FF_THREAD_FRAME);
+
+    if (!thread_count) {
+        /* share the CPUs between the frame threads */
+        int nb_cpus = avctx->thread_pool ? avpriv_thread_pool_nb_threads(avctx->thread_pool)
+                                         : av_cpu_count();
+        thread_count = (nb_cpus + avctx->thread_count - 1) / avctx->thread_count;
+        if (avctx->height)
+            thread_count = FFMIN(thread_count, (avctx->height + 15) / 16);
+        thread_count = FFMIN(thread_count, MAX_AUTO_THREADS);
+    }
+    if (thread_count <= 1)
+        return 1;
+
+    avctx->internal->slice_thread_ctx = c = av_mallocz(sizeof(*c));
+    if (!c)
+        return AVERROR(ENOMEM);
+
+    mainfunc = ffcodec(avctx->codec)->caps_internal & FF_CODEC_CAP_SLICE_THREAD_HAS_MF ? &main_function : NULL;
+    ret = slicethread_create(avctx, c, mainfunc, thread_count);
+    if (ret < 0) {
+        av_freep(&avctx->internal->slice_thread_ctx);
+        return ret;
+    }
+    c->nb_threads = ret;
+
+    avctx->active_thread_type |= FF_THREAD_SLICE;
+    avctx->execute  = thread_execute;
+    avctx->execute2 = thread_execute2;
+    return c->nb_threads;
+}
+
 int av_cold ff_slice_thread_init_progress(AVCodecContext *avctx)
 {
-    SliceThreadContext *const p = avctx->internal->thread_ctx;
-    int err, i = 0, thread_count = avctx->thread_count;
+    SliceThreadContext *const p = avctx->internal->slice_thread_ctx;
+    int err, i = 0, thread_count = p->nb_threads;
 
     p->progress = av_calloc(thread_count, sizeof(*p->progress));
     if (!p->progress) {
@@ -209,7 +261,7 @@ fail:
 
 void ff_thread_report_progress2(AVCodecContext *avctx, int field, int thread, int n)
 {
-    SliceThreadContext *p = avctx->internal->thread_ctx;
+    SliceThreadContext *p = avctx->internal->slice_thread_ctx;
     Progress *const progress = &p->progress[thread];
     int *entries = p->entries;
 
@@ -221,7 +273,7 @@ void ff_thread_report_progress2(AVCodecContext *avctx, int field, int thread, in
 
 void ff_thread_await_progress2(AVCodecContext *avctx, int field, int thread, int shift)
 {
-    SliceThreadContext *p  = avctx->internal->thread_ctx;
+    SliceThreadContext *p  = avctx->internal->slice_thread_ctx;
     Progress *progress;
     int *entries      = p->entries;
 
@@ -240,7 +292,7 @@ void ff_thread_await_progress2(AVCodecContext *avctx, int field, int thread, int
 int ff_slice_thread_allocz_entries(AVCodecContext *avctx, int count)
 {
     if (avctx->active_thread_type & FF_THREAD_SLICE)  {
-        SliceThreadContext *p = avctx->internal->thread_ctx;
+        SliceThreadContext *p = avctx->internal->slice_thread_ctx;
 
         if (p->entries_count == count) {
             memset(p->entries, 0, p->entries_count * sizeof(*p->entries));
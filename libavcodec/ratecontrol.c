@@ -25,10 +25,16 @@
  * Rate control for video encoders.
  */
 
+#include "config.h"
+
 #include "libavutil/attributes.h"
 #include "libavutil/internal.h"
+#include "libavutil/mem.h"
+#include "libavutil/thread.h"
 
 #include "avcodec.h"
+#include "frame_thread_encoder.h"
+#include "internal.h"
 #include "ratecontrol.h"
 #include "mpegutils.h"
 #include "mpegvideoenc.h"
@@ -468,6 +474,105 @@ static int init_pass2(MpegEncContext *s)
     return 0;
 }
 
+#if CONFIG_FRAME_THREAD_ENCODER
+/**
+ * Rate control state of a frame encoded by a frame thread context.
+ */
+typedef struct RateControlThreadFrame {
+    int     pict_type;
+    double  qscale;
+    int64_t var;                ///< complexity the quantizer was estimated with
+    double  predicted_bits;
+    int64_t pts;
+
+    /* set once the frame is finished */
+    int     bits;
+    int     stuffing_bits;
+    int64_t total_bits;         ///< size of all frames up to this one
+    double  buffer_index;       ///< VBV fullness after this frame
+} RateControlThreadFrame;
+
+typedef struct RateControlThread {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+
+    /* state of the rate control of the user-facing context, which is
+     * loaded into the frame thread context whose turn it is */
+    RateControlContext *rcc;
+    int             delay;          ///< number of frames encoded in parallel
+    int64_t         nb_estimated;   ///< number of frames whose quantizer is known
+    int64_t         nb_finished;    ///< number of frames whose size is known
+    int64_t         nb_learned;     ///< number of frames the predictors have seen
+    int64_t         reordered_pts;
+    int64_t         last_pts;       ///< pts of the frame before the one being estimated
+    double          initial_buffer_index;
+    /* size model of the frames encoded in parallel: the normalized size of
+     * the last finished frame of each type, scaled by (ref_q / q)^alpha */
+    double          alpha;
+    double          ref_qscale[5];
+    double          ref_norm[5];
+    /* the last delay + 1 frames, indexed by frame number */
+    RateControlThreadFrame *frames;
+} RateControlThread;
+
+enum {
+    TURN_ESTIMATE = 1 << 0,
+    TURN_FINISH   = 1 << 1,
+};
+
+static av_cold int thread_init(MpegEncContext *s)
+{
+    RateControlContext *rcc = &s->rc_context;
+    RateControlThread *t;
+    int ret;
+
+    t = av_mallocz(sizeof(*t));
+    if (!t)
+        return AVERROR(ENOMEM);
+    rcc->thread = t;
+
+    t->rcc   = rcc;
+    t->delay = s->avctx->thread_count;
+    t->initial_buffer_index = rcc->buffer_index;
+    t->alpha = 1;
+    t->frames = av_calloc(t->delay + 1, sizeof(*t->frames));
+    if (!t->frames)
+        return AVERROR(ENOMEM);
+
+    if ((ret = pthread_mutex_init(&t->mutex, NULL))) {
+        av_freep(&t->frames);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_cond_init(&t->cond, NULL))) {
+        pthread_mutex_destroy(&t->mutex);
+        av_freep(&t->frames);
+        return AVERROR(ret);
+    }
+
+    return 0;
+}
+
+static av_cold void thread_uninit(MpegEncContext *s)
+{
+    RateControlContext *rcc = &s->rc_context;
+    RateControlThread *t    = rcc->thread;
+
+    /* the frame thread contexts only borrow the state of their parent */
+    if (!t || t->rcc != rcc) {
+        rcc->thread = NULL;
+        return;
+    }
+
+    if (t->frames) {
+        pthread_cond_destroy(&t->cond);
+        pthread_mutex_destroy(&t->mutex);
+        av_freep(&t->frames);
+    }
+    av_freep(&rcc->thread);
+}
+
+#endif /* CONFIG_FRAME_THREAD_ENCODER */
+
 av_cold int ff_rate_control_init(MpegEncContext *s)
 {
     RateControlContext *rcc = &s->rc_context;
@@ -665,6 +770,16 @@ av_cold int ff_rate_control_init(MpegEncContext *s)
         }
     }
 
+#if CONFIG_FRAME_THREAD_ENCODER
+    if (s->avctx->internal->frame_thread_encoder) {
+        int ret = thread_init(s);
+        if (ret < 0) {
+            ff_rate_control_uninit(s);
+            return ret;
+        }
+    }
+#endif
+
     return 0;
 }
 
@@ -675,6 +790,10 @@ av_cold void ff_rate_control_uninit(MpegEncContext *s)
 
     av_expr_free(rcc->rc_eq_eval);
     av_freep(&rcc->entry);
+
+#if CONFIG_FRAME_THREAD_ENCODER
+    thread_uninit(s);
+#endif
 }
 
 int ff_vbv_update(MpegEncContext *s, int frame_size)
@@ -863,7 +982,7 @@ void ff_get_2pass_fcode(MpegEncContext *s)
 
 // FIXME rd or at least approx for dquant
 
-float ff_rate_estimate_qscale(MpegEncContext *s, int dry_run)
+static float estimate_qscale(MpegEncContext *s, int dry_run)
 {
     float q;
     int qmin, qmax;
@@ -880,22 +999,10 @@ float ff_rate_estimate_qscale(MpegEncContext *s, int dry_run)
     double rate_factor;
     int64_t var;
     const int pict_type = s->pict_type;
-    emms_c();
 
     get_qminmax(&qmin, &qmax, s, pict_type);
 
     fps = get_fps(s->avctx);
-    /* update predictors */
-    if (picture_number > 2 && !dry_run) {
-        const int64_t last_var =
-            s->last_pict_type == AV_PICTURE_TYPE_I ? rcc->last_mb_var_sum
-                                                   : rcc->last_mc_mb_var_sum;
-        av_assert1(s->frame_bits >= s->stuffing_bits);
-        update_predictor(&rcc->pred[s->last_pict_type],
-                         rcc->last_qscale,
-                         sqrt(last_var),
-                         s->frame_bits - s->stuffing_bits);
-    }
 
     if (s->avctx->flags & AV_CODEC_FLAG_PASS2) {
         av_assert0(picture_number >= 0);
@@ -907,6 +1014,7 @@ float ff_rate_estimate_qscale(MpegEncContext *s, int dry_run)
         wanted_bits = rce->expected_bits;
     } else {
         Picture *dts_pic;
+        int64_t dts;
         rce = &local_rce;
 
         /* FIXME add a dts field to AVFrame and ensure it is set and use it
@@ -916,11 +1024,17 @@ float ff_rate_estimate_qscale(MpegEncContext *s, int dry_run)
             dts_pic = s->current_picture_ptr;
         else
             dts_pic = s->last_picture_ptr;
-
-        if (!dts_pic || dts_pic->f->pts == AV_NOPTS_VALUE)
+        dts = dts_pic ? dts_pic->f->pts : AV_NOPTS_VALUE;
+#if CONFIG_FRAME_THREAD_ENCODER
+        /* the previous frame was encoded by another context */
+        if (rcc->thread && dts_pic != s->current_picture_ptr)
+            dts = rcc->thread->last_pts;
+#endif
+
+        if (dts == AV_NOPTS_VALUE)
             wanted_bits = (uint64_t)(s->bit_rate * (double)picture_number / fps);
         else
-            wanted_bits = (uint64_t)(s->bit_rate * (double)dts_pic->f->pts / fps);
+            wanted_bits = (uint64_t)(s->bit_rate * (double)dts / fps);
     }
 
     diff = s->total_bits - wanted_bits;
@@ -1023,3 +1137,251 @@ float ff_rate_estimate_qscale(MpegEncContext *s, int dry_run)
     }
     return q;
 }
+
+#if CONFIG_FRAME_THREAD_ENCODER
+
+/**
+ * Copy the state of a rate control context, without what is allocated
+ * by each context.
+ */
+static void copy_rc_state(RateControlContext *dst, const RateControlContext *src)
+{
+    RateControlContext tmp = *dst;
+
+    *dst             = *src;
+    dst->num_entries = tmp.num_entries;
+    dst->entry       = tmp.entry;
+    dst->rc_eq_eval  = tmp.rc_eq_eval;
+    dst->thread      = tmp.thread;
+    dst->thread_turns = tmp.thread_turns;
+}
+
+static RateControlThreadFrame *thread_frame(RateControlThread *t, int64_t n)
+{
+    return &t->frames[n % (t->delay + 1)];
+}
+
+static void thread_predict_vbv(MpegEncContext *s, double frame_size)
+{
+    RateControlContext *rcc = &s->rc_context;
+    const double fps        = get_fps(s->avctx);
+    const int buffer_size   = s->avctx->rc_buffer_size;
+    const double min_rate   = s->avctx->rc_min_rate / fps;
+    const double max_rate   = s->avctx->rc_max_rate / fps;
+
+    if (!buffer_size)
+        return;
+
+    /* as in ff_vbv_update(), without the messages */
+    rcc->buffer_index  = FFMAX(rcc->buffer_index - frame_size, 0);
+    rcc->buffer_index += av_clip(buffer_size - rcc->buffer_index - 1,
+                                 min_rate, max_rate);
+    rcc->buffer_index  = FFMIN(rcc->buffer_index, buffer_size);
+}
+
+static void thread_update_size_model(RateControlThread *t,
+                                     const RateControlThreadFrame *f)
+{
+    const int type = f->pict_type;
+    double norm, ref_q = t->ref_qscale[type];
+
+    if (f->qscale <= 0 || f->var <= 0 || f->bits <= f->stuffing_bits)
+        return;
+
+    norm = (f->bits - f->stuffing_bits) / sqrt(f->var);
+    /* only learn the exponent from frames whose quantizer moved enough */
+    if (ref_q > 0 && fabs(log(ref_q / f->qscale)) > 0.05) {
+        double a = log(norm / t->ref_norm[type]) / log(ref_q / f->qscale);
+        t->alpha = 0.7 * t->alpha + 0.3 * av_clipd(a, 0.5, 3);
+    }
+    t->ref_qscale[type] = f->qscale;
+    t->ref_norm[type]   = norm;
+}
+
+static double thread_predict_size(const RateControlThread *t,
+                                  const RateControlThreadFrame *f)
+{
+    const int type = f->pict_type;
+
+    if (t->ref_qscale[type] <= 0 || f->qscale <= 0)
+        return f->predicted_bits;
+    return t->ref_norm[type] * sqrt(f->var) *
+           pow(t->ref_qscale[type] / f->qscale, t->alpha);
+}
+
+static float thread_estimate_qscale(MpegEncContext *s)
+{
+    RateControlContext *rcc = &s->rc_context;
+    RateControlThread *t    = rcc->thread;
+    const int64_t n         = s->avctx->frame_num;
+    /* the first frames are estimated serially, so that the predictors are
+     * trained before they are used for the frames encoded in parallel */
+    const int64_t last      = n < 4 ? n - 1 : FFMAX(n - t->delay, 3);
+    RateControlThreadFrame *cur = thread_frame(t, n);
+    float q;
+
+    pthread_mutex_lock(&t->mutex);
+    while (t->nb_estimated < n || t->nb_finished <= last)
+        pthread_cond_wait(&t->cond, &t->mutex);
+
+    copy_rc_state(rcc, t->rcc);
+
+    /* update the predictors with the last frame whose size is known, and
+     * take the size of the frames encoded in parallel from the size model */
+    if (last >= 0) {
+        const RateControlThreadFrame *f = thread_frame(t, last);
+
+        if (last >= t->nb_learned) {
+            if (last >= 2 && f->qscale > 0)
+                update_predictor(&rcc->pred[f->pict_type], f->qscale, sqrt(f->var),
+                                 f->bits - f->stuffing_bits);
+            thread_update_size_model(t, f);
+            t->nb_learned = last + 1;
+        }
+        s->total_bits     = f->total_bits;
+        rcc->buffer_index = f->buffer_index;
+    } else {
+        s->total_bits     = 0;
+        rcc->buffer_index = t->initial_buffer_index;
+    }
+    for (int64_t i = FFMAX(last + 1, 0); i < n; i++) {
+        const double bits = thread_predict_size(t, thread_frame(t, i));
+
+        s->total_bits += bits;
+        thread_predict_vbv(s, bits);
+    }
+    t->last_pts = n ? thread_frame(t, n - 1)->pts : AV_NOPTS_VALUE;
+
+    q = estimate_qscale(s, 0);
+
+    copy_rc_state(t->rcc, rcc);
+    cur->pict_type      = s->pict_type;
+    cur->qscale         = q;
+    cur->var            = s->pict_type == AV_PICTURE_TYPE_I ? s->mb_var_sum
+                                                             : s->mc_mb_var_sum;
+    cur->predicted_bits = q > 0 ? predict_size(&rcc->pred[cur->pict_type], q,
+                                               sqrt(cur->var)) : 0;
+    cur->pts            = s->current_picture_ptr->f->pts;
+
+    t->nb_estimated++;
+    rcc->thread_turns |= TURN_ESTIMATE;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->mutex);
+
+    return q;
+}
+
+void ff_rate_control_thread_start_frame(MpegEncContext *s)
+{
+    RateControlContext *rcc = &s->rc_context;
+
+    if (!rcc->thread) {
+        const AVCodecContext *parent = ff_frame_thread_encoder_parent(s->avctx);
+        const MpegEncContext *p = parent->priv_data;
+
+        rcc->thread = p->rc_context.thread;
+    }
+    rcc->thread_turns = 0;
+}
+
+void ff_rate_control_thread_wait(MpegEncContext *s)
+{
+    RateControlContext *rcc = &s->rc_context;
+    RateControlThread *t    = rcc->thread;
+    const int64_t n         = s->avctx->frame_num;
+
+    pthread_mutex_lock(&t->mutex);
+    while (t->nb_finished < n)
+        pthread_cond_wait(&t->cond, &t->mutex);
+
+    if (n) {
+        const RateControlThreadFrame *prev = thread_frame(t, n - 1);
+
+        s->total_bits     = prev->total_bits;
+        rcc->buffer_index = prev->buffer_index;
+    } else {
+        s->total_bits     = 0;
+        rcc->buffer_index = t->initial_buffer_index;
+    }
+    s->reordered_pts = t->reordered_pts;
+    pthread_mutex_unlock(&t->mutex);
+}
+
+void ff_rate_control_thread_finish(MpegEncContext *s)
+{
+    RateControlContext *rcc = &s->rc_context;
+    RateControlThread *t    = rcc->thread;
+    RateControlThreadFrame *cur = thread_frame(t, s->avctx->frame_num);
+
+    pthread_mutex_lock(&t->mutex);
+    cur->bits          = s->frame_bits;
+    cur->stuffing_bits = s->stuffing_bits;
+    cur->total_bits    = s->total_bits;
+    cur->buffer_index  = rcc->buffer_index;
+    t->reordered_pts   = s->reordered_pts;
+
+    t->nb_finished++;
+    rcc->thread_turns |= TURN_FINISH;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->mutex);
+}
+
+void ff_rate_control_thread_end_frame(MpegEncContext *s)
+{
+    RateControlContext *rcc = &s->rc_context;
+    RateControlThread *t    = rcc->thread;
+    const int64_t n         = s->avctx->frame_num;
+
+    if (!(rcc->thread_turns & TURN_ESTIMATE)) {
+        /* constant quantizer, or encoding failed */
+        RateControlThreadFrame *cur = thread_frame(t, n);
+
+        pthread_mutex_lock(&t->mutex);
+        while (t->nb_estimated < n)
+            pthread_cond_wait(&t->cond, &t->mutex);
+        cur->pict_type      = AV_PICTURE_TYPE_I;
+        cur->qscale         = 0;
+        cur->var            = 0;
+        cur->predicted_bits = 0;
+        cur->pts            = AV_NOPTS_VALUE;
+        t->nb_estimated++;
+        pthread_cond_broadcast(&t->cond);
+        pthread_mutex_unlock(&t->mutex);
+    }
+
+    if (!(rcc->thread_turns & TURN_FINISH)) {
+        /* encoding failed, leave the state as it was */
+        ff_rate_control_thread_wait(s);
+        s->frame_bits    = 0;
+        s->stuffing_bits = 0;
+        ff_rate_control_thread_finish(s);
+    }
+}
+
+#endif /* CONFIG_FRAME_THREAD_ENCODER */
+
+float ff_rate_estimate_qscale(MpegEncContext *s, int dry_run)
+{
+    RateControlContext *rcc = &s->rc_context;
+
+    emms_c();
+
+#if CONFIG_FRAME_THREAD_ENCODER
+    if (rcc->thread && !dry_run)
+        return thread_estimate_qscale(s);
+#endif
+
+    /* update predictors */
+    if (s->picture_number > 2 && !dry_run) {
+        const int64_t last_var =
+            s->last_pict_type == AV_PICTURE_TYPE_I ? rcc->last_mb_var_sum
+                                                   : rcc->last_mc_mb_var_sum;
+        av_assert1(s->frame_bits >= s->stuffing_bits);
+        update_predictor(&rcc->pred[s->last_pict_type],
+                         rcc->last_qscale,
+                         sqrt(last_var),
+                         s->frame_bits - s->stuffing_bits);
+    }
+
+    return estimate_qscale(s, dry_run);
+}
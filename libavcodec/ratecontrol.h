@@ -81,6 +81,10 @@ typedef struct RateControlContext{
     int last_non_b_pict_type;
 
     AVExpr * rc_eq_eval;
+
+    /* frame threading, see ff_rate_control_thread_start_frame() */
+    struct RateControlThread *thread;
+    int thread_turns;             ///< turns taken by the current frame
 }RateControlContext;
 
 struct MpegEncContext;
@@ -93,4 +97,36 @@ void ff_rate_control_uninit(struct MpegEncContext *s);
 int ff_vbv_update(struct MpegEncContext *s, int frame_size);
 void ff_get_2pass_fcode(struct MpegEncContext *s);
 
+/**
+ * Prepare a frame thread context for encoding a frame.
+ *
+ * The frame thread contexts of an encoder share the rate control of the
+ * user-facing context. They take turns in frame order twice per frame:
+ * in ff_rate_estimate_qscale(), and from ff_rate_control_thread_wait() to
+ * ff_rate_control_thread_finish() to update the VBV with the size of the
+ * frame. The quantizer of a frame is estimated with the actual sizes of
+ * the frames up to thread_count before it and the predicted sizes of the
+ * following ones, so the output depends on the number of threads but not
+ * on their timing.
+ */
+void ff_rate_control_thread_start_frame(struct MpegEncContext *s);
+
+/**
+ * Wait until all previous frames are finished and load the rate control
+ * state they left, in particular the VBV fullness.
+ */
+void ff_rate_control_thread_wait(struct MpegEncContext *s);
+
+/**
+ * Store the rate control state after the current frame and let the next
+ * frame finish.
+ */
+void ff_rate_control_thread_finish(struct MpegEncContext *s);
+
+/**
+ * Take the turns the current frame skipped, so that the following frames
+ * do not wait for it, e.g. if encoding it failed.
+ */
+void ff_rate_control_thread_end_frame(struct MpegEncContext *s);
+
 #endif /* AVCODEC_RATECONTROL_H */
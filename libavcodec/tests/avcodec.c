@@ -158,6 +158,11 @@ int main(void){
             if (codec->capabilities & AV_CODEC_CAP_FRAME_THREADS &&
                 codec->capabilities & AV_CODEC_CAP_DELAY)
                 ERR("Frame-threaded encoder %s claims to have delay\n");
+            if (codec2->caps_internal & FF_CODEC_CAP_INTRA_ONLY_FRAME_THREADS &&
+                (codec->capabilities & AV_CODEC_CAP_FRAME_THREADS ||
+                 !(codec->capabilities & AV_CODEC_CAP_DELAY)))
+                ERR("Encoder %s frame-threaded when intra-only must only "
+                    "have delay\n");
 
             if (codec2->caps_internal & FF_CODEC_CAP_EOF_FLUSH &&
                 !(codec->capabilities & AV_CODEC_CAP_DELAY))
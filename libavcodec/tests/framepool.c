@@ -0,0 +1,125 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Switch between the renditions of an adaptive bitrate ladder the way a
+ * player does, and check that the default get_buffer2() allocates no frame
+ * data once every rendition has been seen.
+ */
+
+#include <stdio.h>
+
+#include "libavutil/frame.h"
+#include "libavutil/lfg.h"
+#include "libavutil/pixdesc.h"
+
+#include "libavcodec/avcodec.h"
+#include "libavcodec/internal.h"
+
+#define NB_REFS   3     /* frames held at once by the decoder */
+#define NB_SWITCH 200
+
+static const struct {
+    enum AVPixelFormat pix_fmt;
+    int width, height;
+} ladder[] = {
+    { AV_PIX_FMT_YUV420P,    1280, 720 },
+    { AV_PIX_FMT_YUV420P,     640, 360 },
+    { AV_PIX_FMT_YUV420P,     416, 234 },
+    { AV_PIX_FMT_YUV420P10LE, 1280, 720 },
+    { AV_PIX_FMT_YUV420P,    1920, 1080 },
+};
+
+static int decode_frames(AVCodecContext *avctx, AVFrame **frames, int rung,
+                         int nb_frames)
+{
+    avctx->pix_fmt = ladder[rung].pix_fmt;
+    avctx->width   = avctx->coded_width  = ladder[rung].width;
+    avctx->height  = avctx->coded_height = ladder[rung].height;
+
+    for (int i = 0; i < nb_frames; i++) {
+        AVFrame *frame = frames[i % NB_REFS];
+        int ret;
+
+        av_frame_unref(frame);
+        frame->format = avctx->pix_fmt;
+        frame->width  = avctx->width;
+        frame->height = avctx->height;
+        if ((ret = avcodec_default_get_buffer2(avctx, frame, 0)) < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_RAWVIDEO);
+    AVCodecContext *avctx = NULL;
+    AVFrame *frames[NB_REFS] = { NULL };
+    unsigned nb_allocs;
+    AVLFG lfg;
+    int ret = 1;
+
+    avctx = avcodec_alloc_context3(codec);
+    if (!avctx)
+        return 1;
+    avctx->width   = ladder[0].width;
+    avctx->height  = ladder[0].height;
+    avctx->pix_fmt = ladder[0].pix_fmt;
+    if (avcodec_open2(avctx, codec, NULL) < 0)
+        goto end;
+    for (int i = 0; i < NB_REFS; i++)
+        if (!(frames[i] = av_frame_alloc()))
+            goto end;
+
+    /* start-up: the first 4 renditions */
+    for (int rung = 0; rung < 4; rung++) {
+        nb_allocs = ff_get_buffer_nb_allocs(avctx);
+        if (decode_frames(avctx, frames, rung, 2 * NB_REFS) < 0)
+            goto end;
+        printf("%dx%d %s: %u allocations\n", ladder[rung].width,
+               ladder[rung].height, av_get_pix_fmt_name(ladder[rung].pix_fmt),
+               ff_get_buffer_nb_allocs(avctx) - nb_allocs);
+    }
+
+    /* steady state: switching between them */
+    av_lfg_init(&lfg, 0xf2a3e);
+    nb_allocs = ff_get_buffer_nb_allocs(avctx);
+    for (int i = 0; i < NB_SWITCH; i++)
+        if (decode_frames(avctx, frames, av_lfg_get(&lfg) % 4,
+                          1 + av_lfg_get(&lfg) % (2 * NB_REFS)) < 0)
+            goto end;
+    printf("%d switches: %u allocations\n", NB_SWITCH,
+           ff_get_buffer_nb_allocs(avctx) - nb_allocs);
+
+    /* a fifth rendition evicts the least recently used one */
+    nb_allocs = ff_get_buffer_nb_allocs(avctx);
+    if (decode_frames(avctx, frames, 4, NB_REFS) < 0)
+        goto end;
+    printf("%dx%d %s: %u allocations\n", ladder[4].width, ladder[4].height,
+           av_get_pix_fmt_name(ladder[4].pix_fmt),
+           ff_get_buffer_nb_allocs(avctx) - nb_allocs);
+
+    ret = 0;
+end:
+    for (int i = 0; i < NB_REFS; i++)
+        av_frame_free(&frames[i]);
+    avcodec_free_context(&avctx);
+    return ret;
+}
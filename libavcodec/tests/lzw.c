@@ -0,0 +1,166 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/lfg.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+#include "libavutil/time.h"
+
+#include "libavcodec/lzw.c"
+
+#define WIDTH  317
+#define HEIGHT 211
+#define SIZE   (WIDTH * HEIGHT)
+
+/* image-like data: runs and gradients, with some noise, in 1 << bits colors */
+static void fill_data(uint8_t *data, int size, int bits, AVLFG *prng)
+{
+    int mask = (1 << bits) - 1;
+
+    for (int i = 0; i < size; i++) {
+        unsigned r = av_lfg_get(prng);
+        if (r % 13 == 0)
+            data[i] = (r >> 8) & mask;
+        else if (i % WIDTH && r % 5)
+            data[i] = data[i - 1];
+        else
+            data[i] = (i / 7 + i / WIDTH) & mask;
+    }
+}
+
+static int encode(uint8_t *dst, int dst_size, const uint8_t *src, int size,
+                  enum FF_LZW_MODES mode)
+{
+    struct LZWEncodeState *s = av_mallocz(ff_lzw_encode_state_size);
+    uint8_t *buf = av_malloc(dst_size);
+    uint8_t *p = dst;
+    int len = 0;
+
+    if (!s || !buf) {
+        av_free(s);
+        av_free(buf);
+        return -1;
+    }
+
+    ff_lzw_encode_init(s, buf, dst_size, 12, mode, mode == FF_LZW_GIF);
+    for (int i = 0; i < size; i += WIDTH)
+        len += ff_lzw_encode(s, src + i, FFMIN(WIDTH, size - i));
+    len += ff_lzw_encode_flush(s);
+
+    if (mode == FF_LZW_GIF) {
+        /* split into GIF sub-blocks */
+        for (int i = 0; i < len; i += 255) {
+            int n = FFMIN(255, len - i);
+            *p++ = n;
+            memcpy(p, buf + i, n);
+            p += n;
+        }
+        *p++ = 0;
+    } else {
+        memcpy(p, buf, len);
+        p += len;
+    }
+
+    av_free(s);
+    av_free(buf);
+    return p - dst;
+}
+
+static int decode(LZWState *lzw, uint8_t *dst, const uint8_t *src, int src_size,
+                  int csize, enum FF_LZW_MODES mode, int chunk)
+{
+    int pos = 0;
+
+    if (ff_lzw_decode_init(lzw, csize, src, src_size, mode) < 0)
+        return -1;
+    while (pos < SIZE) {
+        int ret = ff_lzw_decode(lzw, dst + pos, FFMIN(chunk, SIZE - pos));
+        if (ret <= 0)
+            break;
+        pos += ret;
+    }
+    return pos;
+}
+
+int main(int argc, char **argv)
+{
+    static const int chunks[] = { 1, 3, 64, WIDTH, SIZE };
+    int bench = argc > 1 && !strcmp(argv[1], "-b");
+    uint8_t *data = av_malloc(SIZE);
+    uint8_t *enc  = av_malloc(2 * SIZE + 1024);
+    uint8_t *dec  = av_malloc(SIZE);
+    LZWState *lzw;
+    AVLFG prng;
+    int ret = 1;
+
+    ff_lzw_decode_open(&lzw);
+    if (!data || !enc || !dec || !lzw)
+        goto end;
+
+    av_lfg_init(&prng, 1);
+    for (int bits = 1; bits <= 8; bits++) {
+        for (int mode = FF_LZW_GIF; mode <= FF_LZW_TIFF; mode++) {
+            int enc_size;
+
+            fill_data(data, SIZE, bits, &prng);
+            enc_size = encode(enc, 2 * SIZE + 1024, data, SIZE, mode);
+            if (enc_size < 0)
+                goto end;
+
+            for (int i = 0; i < FF_ARRAY_ELEMS(chunks); i++) {
+                int n;
+
+                memset(dec, 0, SIZE);
+                /* the encoder always starts with 8 bit symbols */
+                n = decode(lzw, dec, enc, enc_size, 8, mode, chunks[i]);
+                if (n != SIZE || memcmp(dec, data, SIZE)) {
+                    av_log(NULL, AV_LOG_ERROR,
+                           "mismatch: bits %d mode %d chunk %d decoded %d\n",
+                           bits, mode, chunks[i], n);
+                    goto end;
+                }
+            }
+
+            if (bench) {
+                int64_t t = av_gettime_relative();
+                int runs = 0;
+
+                do {
+                    decode(lzw, dec, enc, enc_size, 8, mode, WIDTH);
+                    runs++;
+                } while (av_gettime_relative() - t < 200000);
+                t = av_gettime_relative() - t;
+                printf("bits %d %s: %.1f MB/s\n", bits,
+                       mode == FF_LZW_GIF ? "gif " : "tiff",
+                       (double)SIZE * runs / t);
+            }
+        }
+    }
+    ret = 0;
+
+end:
+    ff_lzw_decode_close(&lzw);
+    av_free(data);
+    av_free(enc);
+    av_free(dec);
+    return ret;
+}
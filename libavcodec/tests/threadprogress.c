@@ -0,0 +1,170 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Emulate frame threaded decoding of a stream in which every frame
+ * references the previous one, with per-row progress reporting, and check
+ * that ff_thread_await_progress() never returns early nor hangs.
+ * Run with -b to benchmark ff_thread_report_progress() and
+ * ff_thread_await_progress().
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+
+#include "libavcodec/pthread_frame.c"
+
+#define NB_THREADS 32
+#define NB_FRAMES  (4 * NB_THREADS)
+#define NB_ROWS    68   /* 1080p in 16x16 macroblocks */
+#define ROW_DELAY  2    /* rows of the reference needed to decode a row */
+
+typedef struct Worker {
+    PerThreadContext p;
+    AVCodecContext   avctx;
+    AVCodecInternal  internal;
+    pthread_t        thread;
+    int              index;
+    int              error;
+} Worker;
+
+static Worker     workers[NB_THREADS];
+static ThreadFrame frames[NB_FRAMES];
+
+static void *worker_thread(void *arg)
+{
+    Worker *w = arg;
+
+    for (int f = w->index; f < NB_FRAMES; f += NB_THREADS) {
+        for (int row = 0; row < NB_ROWS; row++) {
+            if (f) {
+                int ref_row = FFMIN(row + ROW_DELAY, NB_ROWS - 1);
+                const atomic_int *ref = (atomic_int*)frames[f - 1].progress->data;
+
+                ff_thread_await_progress(&frames[f - 1], ref_row, 0);
+                if (atomic_load_explicit(ref, memory_order_relaxed) < ref_row)
+                    w->error = 1;
+            }
+            ff_thread_report_progress(&frames[f], row, 0);
+        }
+    }
+
+    return NULL;
+}
+
+static void reset_frames(void)
+{
+    for (int f = 0; f < NB_FRAMES; f++) {
+        atomic_int *progress = (atomic_int*)frames[f].progress->data;
+
+        atomic_init(&progress[0], -1);
+        atomic_init(&progress[1], -1);
+    }
+}
+
+static int run_pipeline(void)
+{
+    int ret = 0;
+
+    reset_frames();
+    for (int i = 0; i < NB_THREADS; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i])) {
+            av_log(NULL, AV_LOG_ERROR, "pthread_create failed\n");
+            return -1;
+        }
+    }
+    for (int i = 0; i < NB_THREADS; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ret |= workers[i].error;
+    }
+    for (int f = 0; f < NB_FRAMES; f++)
+        if (atomic_load(&((atomic_int*)frames[f].progress->data)[0]) != NB_ROWS - 1)
+            ret = 1;
+
+    return ret ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int bench = argc > 1 && !strcmp(argv[1], "-b");
+    int ret = 1;
+
+    for (int i = 0; i < NB_THREADS; i++) {
+        Worker *w = &workers[i];
+
+        w->index                 = i;
+        w->avctx.internal        = &w->internal;
+        w->internal.thread_ctx   = &w->p;
+        w->p.avctx               = &w->avctx;
+        if (pthread_mutex_init(&w->p.progress_mutex, NULL) ||
+            pthread_cond_init(&w->p.progress_cond, NULL))
+            return 1;
+    }
+    for (int f = 0; f < NB_FRAMES; f++) {
+        frames[f].owner[0] = frames[f].owner[1] = &workers[f % NB_THREADS].avctx;
+        frames[f].progress = av_buffer_alloc(2 * sizeof(atomic_int));
+        if (!frames[f].progress)
+            goto end;
+    }
+
+    if (run_pipeline() < 0) {
+        av_log(NULL, AV_LOG_ERROR, "progress mismatch\n");
+        goto end;
+    }
+
+    if (bench) {
+        int64_t t = av_gettime_relative();
+        int runs = 0;
+
+        /* uncontended: nobody waits for the reported rows */
+        do {
+            reset_frames();
+            for (int f = 0; f < NB_FRAMES; f++)
+                for (int row = 0; row < NB_ROWS; row++)
+                    ff_thread_report_progress(&frames[f], row, 0);
+            runs++;
+        } while (av_gettime_relative() - t < 200000);
+        t = av_gettime_relative() - t;
+        printf("report:   %.1f ns/row\n",
+               1000.0 * t / ((int64_t)runs * NB_FRAMES * NB_ROWS));
+
+        t    = av_gettime_relative();
+        runs = 0;
+        do {
+            if (run_pipeline() < 0)
+                goto end;
+            runs++;
+        } while (av_gettime_relative() - t < 1000000);
+        t = av_gettime_relative() - t;
+        printf("pipeline: %.1f ns/row, %d threads\n",
+               1000.0 * t / ((int64_t)runs * NB_FRAMES * NB_ROWS), NB_THREADS);
+    }
+    ret = 0;
+
+end:
+    for (int f = 0; f < NB_FRAMES; f++)
+        av_buffer_unref(&frames[f].progress);
+    for (int i = 0; i < NB_THREADS; i++) {
+        pthread_mutex_destroy(&workers[i].p.progress_mutex);
+        pthread_cond_destroy(&workers[i].p.progress_cond);
+    }
+    return ret;
+}
@@ -94,6 +94,17 @@ int ff_slice_thread_execute_with_mainfunc(AVCodecContext *avctx,
 void ff_thread_free(AVCodecContext *s);
 int ff_slice_thread_allocz_entries(AVCodecContext *avctx, int count);
 int ff_slice_thread_init_progress(AVCodecContext *avctx);
+
+/**
+ * Start slice threads for a frame thread's codec context (hybrid threading).
+ * To be called from the codec init, only when frame threading is active.
+ *
+ * @param thread_count the number of slice threads, 0 to share the CPUs
+ *                     between the frame threads
+ * @return the number of slice threads, 1 if no slice threads were started,
+ *         or a negative error code
+ */
+int ff_slice_thread_init_hybrid(AVCodecContext *avctx, int thread_count);
 void ff_thread_report_progress2(AVCodecContext *avctx, int field, int thread, int n);
 void ff_thread_await_progress2(AVCodecContext *avctx,  int field, int thread, int shift);
 
@@ -101,7 +101,10 @@ AVFrame *ff_get_audio_buffer(AVFilterLink *link, int nb_samples)
 {
     AVFrame *ret = NULL;
 
-    if (link->dstpad->get_buffer.audio)
+    /* with frame threading, the callback could run concurrently with the
+     * source or destination filter */
+    if (link->dstpad->get_buffer.audio &&
+        !((link->src->thread_type | link->dst->thread_type) & AVFILTER_THREAD_FRAME))
         ret = link->dstpad->get_buffer.audio(link, nb_samples);
 
     if (!ret)
@@ -43,6 +43,7 @@
 #include "formats.h"
 #include "framepool.h"
 #include "internal.h"
+#include "thread.h"
 
 static void tlog_ref(void *ctx, AVFrame *ref, int end)
 {
@@ -185,6 +186,7 @@ int avfilter_link(AVFilterContext *src, unsigned srcpad,
     av_assert0(AV_PIX_FMT_NONE == -1 && AV_SAMPLE_FMT_NONE == -1);
     link->format  = -1;
     ff_framequeue_init(&link->fifo, &src->graph->internal->frame_queues);
+    ff_framequeue_init(&link->pipeline_fifo, &src->graph->internal->frame_queues);
 
     return 0;
 }
@@ -194,7 +196,10 @@ void avfilter_link_free(AVFilterLink **link)
     if (!*link)
         return;
 
+    if ((*link)->source_wanted)
+        (*link)->src->graph->internal->nb_sources_wanted--;
     ff_framequeue_free(&(*link)->fifo);
+    ff_framequeue_free(&(*link)->pipeline_fifo);
     ff_frame_pool_uninit((FFFramePool**)&(*link)->frame_pool);
     av_channel_layout_uninit(&(*link)->ch_layout);
 
@@ -203,7 +208,26 @@ void avfilter_link_free(AVFilterLink **link)
 
 void ff_filter_set_ready(AVFilterContext *filter, unsigned priority)
 {
-    filter->ready = FFMAX(filter->ready, priority);
+    if (priority <= filter->ready)
+        return;
+    filter->ready = priority;
+    if (filter->graph && !filter->internal->pipeline_busy)
+        ff_filter_graph_ready_update(filter);
+}
+
+/**
+ * Update source_wanted after a change of frame_wanted_out, frame_blocked_in
+ * or status_in.
+ */
+static void update_source_wanted(AVFilterLink *link)
+{
+    int wanted = !link->src->nb_inputs && link->frame_wanted_out &&
+                 link->frame_blocked_in && !link->status_in;
+
+    if (wanted != link->source_wanted && link->src->graph) {
+        link->source_wanted = wanted;
+        link->src->graph->internal->nb_sources_wanted += wanted ? 1 : -1;
+    }
 }
 
 /**
@@ -214,8 +238,10 @@ static void filter_unblock(AVFilterContext *filter)
 {
     unsigned i;
 
-    for (i = 0; i < filter->nb_outputs; i++)
+    for (i = 0; i < filter->nb_outputs; i++) {
         filter->outputs[i]->frame_blocked_in = 0;
+        update_source_wanted(filter->outputs[i]);
+    }
 }
 
 
@@ -228,6 +254,7 @@ void ff_avfilter_link_set_in_status(AVFilterLink *link, int status, int64_t pts)
     link->status_in_pts = pts;
     link->frame_wanted_out = 0;
     link->frame_blocked_in = 0;
+    update_source_wanted(link);
     filter_unblock(link->dst);
     ff_filter_set_ready(link->dst, 200);
 }
@@ -433,6 +460,7 @@ int ff_request_frame(AVFilterLink *link)
         }
     }
     link->frame_wanted_out = 1;
+    update_source_wanted(link);
     ff_filter_set_ready(link->src, 100);
     return 0;
 }
@@ -462,6 +490,7 @@ static int ff_request_frame_to_filter(AVFilterLink *link)
     FF_TPRINTF_START(NULL, request_frame_to_filter); ff_tlog_link(NULL, link, 1);
     /* Assume the filter is blocked, let the method clear it if not */
     link->frame_blocked_in = 1;
+    update_source_wanted(link);
     if (link->srcpad->request_frame)
         ret = link->srcpad->request_frame(link);
     else if (link->src->inputs[0])
@@ -544,8 +573,19 @@ void ff_update_link_current_pts(AVFilterLink *link, int64_t pts)
         ff_avfilter_graph_update_heap(link->graph, link);
 }
 
+static void pipeline_drain(AVFilterGraph *graph)
+{
+    while (graph->internal->nb_inflight)
+        ff_graph_pipeline_flush(graph, 1);
+}
+
 int avfilter_process_command(AVFilterContext *filter, const char *cmd, const char *arg, char *res, int res_len, int flags)
 {
+    /* a command may reconfigure the outputs, which the filters downstream
+       could be reading on pipeline threads */
+    if (filter->graph)
+        pipeline_drain(filter->graph);
+
     if(!strcmp(cmd, "ping")){
         char local_res[256] = {0};
 
@@ -600,8 +640,9 @@ static const AVClass *filter_child_class_iterate(void **iter)
 #define TFLAGS AV_OPT_FLAG_FILTERING_PARAM|AV_OPT_FLAG_RUNTIME_PARAM
 static const AVOption avfilter_options[] = {
     { "thread_type", "Allowed thread types", OFFSET(thread_type), AV_OPT_TYPE_FLAGS,
-        { .i64 = AVFILTER_THREAD_SLICE }, 0, INT_MAX, FLAGS, "thread_type" },
+        { .i64 = AVFILTER_THREAD_SLICE | AVFILTER_THREAD_FRAME }, 0, INT_MAX, FLAGS, "thread_type" },
         { "slice", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_SLICE }, .flags = FLAGS, .unit = "thread_type" },
+        { "frame", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_FRAME }, .flags = FLAGS, .unit = "thread_type" },
     { "enable", "set enable expression", OFFSET(enable_str), AV_OPT_TYPE_STRING, {.str=NULL}, .flags = TFLAGS },
     { "threads", "Allowed number of threads", OFFSET(nb_threads), AV_OPT_TYPE_INT,
         { .i64 = 0 }, 0, INT_MAX, FLAGS },
@@ -669,6 +710,7 @@ AVFilterContext *ff_filter_alloc(const AVFilter *filter, const char *inst_name)
     if (!ret->internal)
         goto err;
     ret->internal->execute = default_execute;
+    ret->internal->ready_index = -1;
 
     ret->nb_inputs  = filter->nb_inputs;
     if (ret->nb_inputs ) {
@@ -735,6 +777,9 @@ void avfilter_free(AVFilterContext *filter)
     if (!filter)
         return;
 
+    while (filter->internal->pipeline_busy)
+        ff_graph_pipeline_flush(filter->graph, 1);
+
     if (filter->graph)
         ff_filter_graph_remove_filter(filter->graph, filter);
 
@@ -770,6 +815,7 @@ void avfilter_free(AVFilterContext *filter)
     av_expr_free(filter->enable);
     filter->enable = NULL;
     av_freep(&filter->var_values);
+    av_freep(&filter->internal->pipeline_job);
     av_freep(&filter->internal);
     av_free(filter);
 }
@@ -854,7 +900,7 @@ int ff_filter_process_command(AVFilterContext *ctx, const char *cmd,
 
 int avfilter_init_dict(AVFilterContext *ctx, AVDictionary **options)
 {
-    int ret = 0;
+    int thread_type, ret = 0;
 
     if (ctx->internal->initialized) {
         av_log(ctx, AV_LOG_ERROR, "Filter already initialized\n");
@@ -867,14 +913,18 @@ int avfilter_init_dict(AVFilterContext *ctx, AVDictionary **options)
         return ret;
     }
 
+    thread_type = ctx->thread_type & ctx->graph->thread_type;
+    ctx->thread_type = 0;
     if (ctx->filter->flags & AVFILTER_FLAG_SLICE_THREADS &&
-        ctx->thread_type & ctx->graph->thread_type & AVFILTER_THREAD_SLICE &&
+        thread_type & AVFILTER_THREAD_SLICE &&
         ctx->graph->internal->thread_execute) {
         ctx->thread_type       = AVFILTER_THREAD_SLICE;
         ctx->internal->execute = ctx->graph->internal->thread_execute;
-    } else {
-        ctx->thread_type = 0;
     }
+    if (ctx->filter->flags_internal & FF_FILTER_FLAG_FRAME_THREADS &&
+        thread_type & AVFILTER_THREAD_FRAME &&
+        ctx->graph->internal->thread)
+        ctx->thread_type |= AVFILTER_THREAD_FRAME;
 
     if (ctx->filter->init)
         ret = ctx->filter->init(ctx);
@@ -935,6 +985,26 @@ static int default_filter_frame(AVFilterLink *link, AVFrame *frame)
     return ff_filter_frame(link->dst->outputs[0], frame);
 }
 
+/**
+ * Check if the frame parameters differ from the link ones: the filter may
+ * then reconfigure its outputs, which must not happen while the filters
+ * downstream are running on pipeline threads.
+ */
+static int pipeline_params_changed(AVFilterLink *link, const AVFrame *frame)
+{
+    return link->type == AVMEDIA_TYPE_VIDEO &&
+           (frame->width  != link->w ||
+            frame->height != link->h ||
+            frame->format != link->format ||
+            /* exact, like the filters comparing it to reconfigure */
+            frame->sample_aspect_ratio.num != link->sample_aspect_ratio.num ||
+            frame->sample_aspect_ratio.den != link->sample_aspect_ratio.den);
+}
+
+/**
+ * @return 1 if the frame was submitted to a pipeline thread, the result of
+ *         filter_frame() otherwise
+ */
 static int ff_filter_frame_framed(AVFilterLink *link, AVFrame *frame)
 {
     int (*filter_frame)(AVFilterLink *, AVFrame *);
@@ -957,6 +1027,12 @@ static int ff_filter_frame_framed(AVFilterLink *link, AVFrame *frame)
     if (dstctx->is_disabled &&
         (dstctx->filter->flags & AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC))
         filter_frame = default_filter_frame;
+    else if (dstctx->thread_type & AVFILTER_THREAD_FRAME) {
+        if (pipeline_params_changed(link, frame))
+            pipeline_drain(dstctx->graph);
+        else if (ff_filter_pipeline_submit(link, filter_frame, frame))
+            return 1;
+    }
     ret = filter_frame(link, frame);
     link->frame_count_out++;
     return ret;
@@ -997,7 +1073,16 @@ int ff_filter_frame(AVFilterLink *link, AVFrame *frame)
         }
     }
 
+    if (link->src->internal->pipeline_busy) {
+        /* called from a pipeline thread, see ff_filter_pipeline_done() */
+        ret = ff_framequeue_add(&link->pipeline_fifo, frame);
+        if (ret < 0)
+            av_frame_free(&frame);
+        return ret;
+    }
+
     link->frame_blocked_in = link->frame_wanted_out = 0;
+    update_source_wanted(link);
     link->frame_count_in++;
     link->sample_count_in += frame->nb_samples;
     filter_unblock(link->dst);
@@ -1080,6 +1165,18 @@ static int take_samples(AVFilterLink *link, unsigned min, unsigned max,
     return 0;
 }
 
+static int filter_frame_done(AVFilterLink *link, int ret)
+{
+    if (ret < 0 && ret != link->status_out) {
+        ff_avfilter_link_set_out_status(link, ret, AV_NOPTS_VALUE);
+    } else {
+        /* Run once again, to see if several frames were available, or if
+           the input status has also changed, or any other reason. */
+        ff_filter_set_ready(link->dst, 300);
+    }
+    return ret;
+}
+
 static int ff_filter_frame_to_filter(AVFilterLink *link)
 {
     AVFrame *frame = NULL;
@@ -1102,14 +1199,35 @@ static int ff_filter_frame_to_filter(AVFilterLink *link)
        before the frame; ff_filter_frame_framed() will re-increment it. */
     link->frame_count_out--;
     ret = ff_filter_frame_framed(link, frame);
-    if (ret < 0 && ret != link->status_out) {
-        ff_avfilter_link_set_out_status(link, ret, AV_NOPTS_VALUE);
-    } else {
-        /* Run once again, to see if several frames were available, or if
-           the input status has also changed, or any other reason. */
-        ff_filter_set_ready(dst, 300);
+    if (ret > 0) {
+        /* The frame is being filtered on a pipeline thread: meanwhile, let
+           the source work on the next one. */
+        if (!samples_ready(link, link->min_samples) && !link->frame_wanted_out &&
+            !link->status_in && !link->status_out)
+            ff_inlink_request_frame(link);
+        return 0;
     }
-    return ret;
+    return filter_frame_done(link, ret);
+}
+
+void ff_filter_pipeline_done(AVFilterLink *link, int ret)
+{
+    AVFilterContext *dst = link->dst;
+
+    dst->internal->pipeline_busy = 0;
+    for (unsigned i = 0; i < dst->nb_outputs; i++) {
+        AVFilterLink *outlink = dst->outputs[i];
+
+        while (ff_framequeue_queued_frames(&outlink->pipeline_fifo)) {
+            int err = ff_filter_frame(outlink, ff_framequeue_take(&outlink->pipeline_fifo));
+            if (err < 0 && ret >= 0)
+                ret = err;
+        }
+    }
+    link->frame_count_out++;
+    if (dst->ready)
+        ff_filter_graph_ready_update(dst);
+    filter_frame_done(link, ret);
 }
 
 static int forward_status_change(AVFilterContext *filter, AVFilterLink *in)
@@ -1238,7 +1356,7 @@ static int ff_filter_activate_default(AVFilterContext *filter)
      ff_avfilter_link_set_out_status().
 
    Filters are activated according to the ready field, set using the
-   ff_filter_set_ready(). Eventually, a priority queue will be used.
+   ff_filter_set_ready(), which keeps the graph's ready queue up to date.
    ff_filter_set_ready() is called whenever anything could cause progress to
    be possible. Marking a filter ready when it is not is not a problem,
    except for the small overhead it causes.
@@ -1308,6 +1426,8 @@ int ff_filter_activate(AVFilterContext *filter)
     av_assert1(!(filter->filter->flags & AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC &&
                  filter->filter->activate));
     filter->ready = 0;
+    if (filter->graph)
+        ff_filter_graph_ready_remove(filter);
     ret = filter->filter->activate ? filter->filter->activate(filter) :
           ff_filter_activate_default(filter);
     if (ret == FFERROR_NOT_READY)
@@ -1483,6 +1603,7 @@ void ff_inlink_request_frame(AVFilterLink *link)
     av_assert1(!link->status_in);
     av_assert1(!link->status_out);
     link->frame_wanted_out = 1;
+    update_source_wanted(link);
     ff_filter_set_ready(link->src, 100);
 }
 
@@ -1492,6 +1613,7 @@ void ff_inlink_set_status(AVFilterLink *link, int status)
         return;
     link->frame_wanted_out = 0;
     link->frame_blocked_in = 0;
+    update_source_wanted(link);
     ff_avfilter_link_set_out_status(link, status, AV_NOPTS_VALUE);
     while (ff_framequeue_queued_frames(&link->fifo)) {
            AVFrame *frame = ff_framequeue_take(&link->fifo);
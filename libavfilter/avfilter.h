@@ -46,6 +46,7 @@
 #include "libavutil/samplefmt.h"
 #include "libavutil/pixfmt.h"
 #include "libavutil/rational.h"
+#include "libavutil/threadpool.h"
 
 #include "libavfilter/version_major.h"
 #ifndef HAVE_AV_CONFIG_H
@@ -385,6 +386,11 @@ unsigned avfilter_filter_pad_count(const AVFilter *filter, int is_output);
  * Process multiple parts of the frame concurrently.
  */
 #define AVFILTER_THREAD_SLICE (1 << 0)
+/**
+ * Filter different frames in different filters concurrently, like the
+ * stages of a pipeline.
+ */
+#define AVFILTER_THREAD_FRAME (1 << 1)
 
 typedef struct AVFilterInternal AVFilterInternal;
 
@@ -675,6 +681,12 @@ struct AVFilterLink {
      */
     FFFrameQueue fifo;
 
+    /**
+     * Frames sent by the source filter while it runs on another thread with
+     * AVFILTER_THREAD_FRAME, moved to fifo once it is done.
+     */
+    FFFrameQueue pipeline_fifo;
+
     /**
      * If set, the source filter can not generate a frame as is.
      * The goal is to avoid repeatedly calling the request_frame() method on
@@ -682,6 +694,13 @@ struct AVFilterLink {
      */
     int frame_blocked_in;
 
+    /**
+     * Set if the source filter is a source of the graph and is blocked while
+     * a frame is wanted, i.e. the application is expected to push more input.
+     * Counted in AVFilterGraphInternal.nb_sources_wanted.
+     */
+    int source_wanted;
+
     /**
      * Link input status.
      * If not zero, all attempts of filter_frame will fail with the
@@ -864,7 +883,9 @@ typedef struct AVFilterGraph {
      * of AVFILTER_THREAD_* flags.
      *
      * May be set by the caller at any point, the setting will apply to all
-     * filters initialized after that. The default is allowing everything.
+     * filters initialized after that. The default is allowing
+     * AVFILTER_THREAD_SLICE only. AVFILTER_THREAD_FRAME must be set before
+     * adding any filters to the graph.
      *
      * When a filter in this graph is initialized, this field is combined using
      * bit AND with AVFilterContext.thread_type to get the final mask used for
@@ -908,6 +929,19 @@ typedef struct AVFilterGraph {
 
     char *aresample_swr_opts; ///< swr options to use for the auto-inserted aresample filters, Access ONLY through AVOptions
 
+    /**
+     * Thread pool to run the slice threading jobs of the filters on, instead
+     * of creating threads of its own. The pool is owned by the caller, may
+     * be shared with other filter graphs and codec contexts, and must
+     * outlive the graph.
+     *
+     * May be set by the caller immediately after allocating the graph and
+     * before adding any filters to it. When set, a nb_threads of 0 picks
+     * the number of threads based on the size of the pool. It is ignored
+     * if the execute callback is set.
+     */
+    AVThreadPool *thread_pool;
+
     /**
      * Private fields
      *
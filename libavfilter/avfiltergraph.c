@@ -48,6 +48,7 @@ static const AVOption filtergraph_options[] = {
     { "thread_type", "Allowed thread types", OFFSET(thread_type), AV_OPT_TYPE_FLAGS,
         { .i64 = AVFILTER_THREAD_SLICE }, 0, INT_MAX, F|V|A, "thread_type" },
         { "slice", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_SLICE }, .flags = F|V|A, .unit = "thread_type" },
+        { "frame", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_FRAME }, .flags = F|V|A, .unit = "thread_type" },
     { "threads",     "Maximum number of threads", OFFSET(nb_threads), AV_OPT_TYPE_INT,
         { .i64 = 0 }, 0, INT_MAX, F|V|A, "threads"},
         {"auto", "autodetect a suitable number of threads to use", 0, AV_OPT_TYPE_CONST, {.i64 = 0 }, .flags = F|V|A, .unit = "threads"},
@@ -77,6 +78,17 @@ int ff_graph_thread_init(AVFilterGraph *graph)
     graph->nb_threads  = 1;
     return 0;
 }
+
+int ff_filter_pipeline_submit(AVFilterLink *link,
+                              int (*filter_frame)(AVFilterLink *, AVFrame *),
+                              AVFrame *frame)
+{
+    return 0;
+}
+
+void ff_graph_pipeline_flush(AVFilterGraph *graph, int wait)
+{
+}
 #endif
 
 AVFilterGraph *avfilter_graph_alloc(void)
@@ -103,9 +115,16 @@ void ff_filter_graph_remove_filter(AVFilterGraph *graph, AVFilterContext *filter
     int i, j;
     for (i = 0; i < graph->nb_filters; i++) {
         if (graph->filters[i] == filter) {
+            AVFilterContext *last = graph->filters[graph->nb_filters - 1];
+
+            ff_filter_graph_ready_remove(filter);
             FFSWAP(AVFilterContext*, graph->filters[i],
                    graph->filters[graph->nb_filters - 1]);
             graph->nb_filters--;
+            last->internal->graph_index = i;
+            /* a lower index ranks the swapped filter higher on ties */
+            if (last->internal->ready_index >= 0)
+                ff_filter_graph_ready_update(last);
             filter->graph = NULL;
             for (j = 0; j<filter->nb_outputs; j++)
                 if (filter->outputs[j])
@@ -121,6 +140,9 @@ void avfilter_graph_free(AVFilterGraph **graph)
     if (!*graph)
         return;
 
+    while ((*graph)->internal->nb_inflight)
+        ff_graph_pipeline_flush(*graph, 1);
+
     while ((*graph)->nb_filters)
         avfilter_free((*graph)->filters[0]);
 
@@ -131,6 +153,7 @@ void avfilter_graph_free(AVFilterGraph **graph)
     av_opt_free(*graph);
 
     av_freep(&(*graph)->filters);
+    av_freep(&(*graph)->internal->ready_queue);
     av_freep(&(*graph)->internal);
     av_freep(graph);
 }
@@ -170,6 +193,8 @@ AVFilterContext *avfilter_graph_alloc_filter(AVFilterGraph *graph,
 
     if (graph->thread_type && !graph->internal->thread_execute) {
         if (graph->execute) {
+            /* the frame pipeline needs our own thread pool */
+            graph->thread_type &= ~AVFILTER_THREAD_FRAME;
             graph->internal->thread_execute = graph->execute;
         } else {
             int ret = ff_graph_thread_init(graph);
@@ -185,10 +210,17 @@ AVFilterContext *avfilter_graph_alloc_filter(AVFilterGraph *graph,
         return NULL;
     graph->filters = filters;
 
+    filters = av_realloc_array(graph->internal->ready_queue,
+                               graph->nb_filters + 1, sizeof(*filters));
+    if (!filters)
+        return NULL;
+    graph->internal->ready_queue = filters;
+
     s = ff_filter_alloc(filter, name);
     if (!s)
         return NULL;
 
+    s->internal->graph_index = graph->nb_filters;
     graph->filters[graph->nb_filters++] = s;
 
     s->graph = graph;
@@ -1337,17 +1369,103 @@ int avfilter_graph_request_oldest(AVFilterGraph *graph)
     return 0;
 }
 
-int ff_filter_graph_run_once(AVFilterGraph *graph)
+/**
+ * Ready queue ordering: the highest ready value first, then the filter
+ * that comes first in graph->filters, i.e. the filter a linear scan for
+ * the maximum would pick.
+ */
+static int ready_before(const AVFilterContext *a, const AVFilterContext *b)
 {
-    AVFilterContext *filter;
-    unsigned i;
+    if (a->ready != b->ready)
+        return a->ready > b->ready;
+    return a->internal->graph_index < b->internal->graph_index;
+}
+
+static void ready_queue_set(AVFilterGraphInternal *graphi, unsigned idx,
+                            AVFilterContext *filter)
+{
+    graphi->ready_queue[idx]      = filter;
+    filter->internal->ready_index = idx;
+}
+
+static void ready_queue_sift_up(AVFilterGraphInternal *graphi, unsigned idx)
+{
+    AVFilterContext *filter = graphi->ready_queue[idx];
 
+    while (idx) {
+        unsigned parent = (idx - 1) >> 1;
+        if (!ready_before(filter, graphi->ready_queue[parent]))
+            break;
+        ready_queue_set(graphi, idx, graphi->ready_queue[parent]);
+        idx = parent;
+    }
+    ready_queue_set(graphi, idx, filter);
+}
+
+static void ready_queue_sift_down(AVFilterGraphInternal *graphi, unsigned idx)
+{
+    AVFilterContext *filter = graphi->ready_queue[idx];
+
+    for (;;) {
+        unsigned child = 2 * idx + 1;
+        if (child >= graphi->nb_ready)
+            break;
+        if (child + 1 < graphi->nb_ready &&
+            ready_before(graphi->ready_queue[child + 1], graphi->ready_queue[child]))
+            child++;
+        if (!ready_before(graphi->ready_queue[child], filter))
+            break;
+        ready_queue_set(graphi, idx, graphi->ready_queue[child]);
+        idx = child;
+    }
+    ready_queue_set(graphi, idx, filter);
+}
+
+void ff_filter_graph_ready_update(AVFilterContext *filter)
+{
+    AVFilterGraphInternal *graphi = filter->graph->internal;
+    int idx = filter->internal->ready_index;
+
+    if (idx < 0) {
+        av_assert1(graphi->nb_ready < filter->graph->nb_filters);
+        idx = graphi->nb_ready++;
+        ready_queue_set(graphi, idx, filter);
+    }
+    ready_queue_sift_up(graphi, idx);
+}
+
+void ff_filter_graph_ready_remove(AVFilterContext *filter)
+{
+    AVFilterGraphInternal *graphi = filter->graph->internal;
+    int idx = filter->internal->ready_index;
+    AVFilterContext *last;
+
+    if (idx < 0)
+        return;
+    filter->internal->ready_index = -1;
+    last = graphi->ready_queue[--graphi->nb_ready];
+    if (last == filter)
+        return;
+    ready_queue_set(graphi, idx, last);
+    ready_queue_sift_up(graphi, idx);
+    ready_queue_sift_down(graphi, last->internal->ready_index);
+}
+
+int ff_filter_graph_run_once(AVFilterGraph *graph)
+{
     av_assert0(graph->nb_filters);
-    filter = graph->filters[0];
-    for (i = 1; i < graph->nb_filters; i++)
-        if (graph->filters[i]->ready > filter->ready)
-            filter = graph->filters[i];
-    if (!filter->ready)
+    if (graph->internal->nb_inflight) {
+        ff_graph_pipeline_flush(graph, 0);
+        /* With nothing else to do, wait for the pipeline threads, unless
+           more input can be pushed meanwhile: the frames being filtered
+           will be flushed by a later call. */
+        while (!graph->internal->nb_ready && graph->internal->nb_inflight) {
+            if (graph->internal->nb_sources_wanted)
+                return AVERROR(EAGAIN);
+            ff_graph_pipeline_flush(graph, 1);
+        }
+    }
+    if (!graph->internal->nb_ready)
         return AVERROR(EAGAIN);
-    return ff_filter_activate(filter);
+    return ff_filter_activate(graph->internal->ready_queue[0]);
 }
@@ -133,6 +133,20 @@ struct AVFilterGraphInternal {
     void *thread;
     avfilter_execute_func *thread_execute;
     FFFrameQueueGlobal frame_queues;
+
+    /**
+     * Binary heap of the filters with a nonzero ready value, the one to
+     * activate next first. Allocated for nb_filters entries so that
+     * inserting never fails.
+     */
+    AVFilterContext **ready_queue;
+    unsigned nb_ready;
+
+    // number of frames being filtered on pipeline threads
+    int nb_inflight;
+
+    // number of links with source_wanted set
+    int nb_sources_wanted;
 };
 
 struct AVFilterInternal {
@@ -141,6 +155,16 @@ struct AVFilterInternal {
     // 1 when avfilter_init_*() was successfully called on this filter
     // 0 otherwise
     int initialized;
+
+    // index in graph->filters
+    unsigned graph_index;
+    // index in graph->internal->ready_queue, -1 if not queued
+    int ready_index;
+
+    // 1 while a frame is being filtered on a pipeline thread; the filter
+    // is not activated until the frame is done
+    int pipeline_busy;
+    struct PipelineJob *pipeline_job;
 };
 
 static av_always_inline int ff_filter_execute(AVFilterContext *ctx, avfilter_action_func *func,
@@ -373,11 +397,44 @@ void ff_filter_graph_remove_filter(AVFilterGraph *graph, AVFilterContext *filter
  */
 #define FF_FILTER_FLAG_HWFRAME_AWARE (1 << 0)
 
+/**
+ * The filter supports AVFILTER_THREAD_FRAME: the filter_frame() callback of
+ * its inputs may run on another thread, concurrently with the rest of the
+ * graph. It must only use the filter private context, the frame, and its
+ * output links through ff_get_*_buffer() and ff_filter_frame(). The other
+ * callbacks still run on the thread driving the graph, never concurrently
+ * with filter_frame().
+ *
+ * Video frames whose size, format or aspect ratio differ from the link ones
+ * are filtered on the thread driving the graph once no frame is in flight
+ * anymore, so the filter may reconfigure its outputs then; the same holds
+ * for process_command().
+ */
+#define FF_FILTER_FLAG_FRAME_THREADS (1 << 1)
+
 /**
  * Run one round of processing on a filter graph.
  */
 int ff_filter_graph_run_once(AVFilterGraph *graph);
 
+/**
+ * Update the position of a filter in the ready queue of its graph after its
+ * ready value has increased.
+ */
+void ff_filter_graph_ready_update(AVFilterContext *filter);
+
+/**
+ * Remove a filter from the ready queue of its graph, if it is queued.
+ */
+void ff_filter_graph_ready_remove(AVFilterContext *filter);
+
+/**
+ * Finish filtering a frame on a pipeline thread: forward the frames the
+ * destination filter has output and handle the return value of its
+ * filter_frame() callback.
+ */
+void ff_filter_pipeline_done(AVFilterLink *link, int ret);
+
 /**
  * Get number of threads for current filter instance.
  * This number is always same or less than graph->nb_threads.
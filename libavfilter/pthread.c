@@ -27,11 +27,26 @@
 #include "libavutil/macros.h"
 #include "libavutil/mem.h"
 #include "libavutil/slicethread.h"
+#include "libavutil/thread.h"
+#include "libavutil/threadpool.h"
+#include "libavutil/threadpool_internal.h"
 
 #include "avfilter.h"
 #include "internal.h"
 #include "thread.h"
 
+typedef struct PipelineJob {
+    AVThreadPoolJob job;
+    struct ThreadContext *c;
+
+    AVFilterLink *link;
+    int (*filter_frame)(AVFilterLink *, AVFrame *);
+    AVFrame *frame;
+    int ret;
+
+    struct PipelineJob *next;       ///< next job in the list of done jobs
+} PipelineJob;
+
 typedef struct ThreadContext {
     AVFilterGraph *graph;
     AVSliceThread *thread;
@@ -41,6 +56,18 @@ typedef struct ThreadContext {
     AVFilterContext *ctx;
     void *arg;
     int   *rets;
+
+    /* AVFILTER_THREAD_FRAME */
+    AVThreadPool *pool;
+    AVThreadPool *own_pool;
+    int pipeline;
+    int max_inflight;
+    /* serializes the slice threading of the filters running concurrently */
+    pthread_mutex_t execute_mutex;
+    pthread_mutex_t done_mutex;
+    pthread_cond_t  done_cond;
+    PipelineJob  *done;
+    PipelineJob **done_tail;
 } ThreadContext;
 
 static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
@@ -54,6 +81,12 @@ static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb
 static void slice_thread_uninit(ThreadContext *c)
 {
     avpriv_slicethread_free(&c->thread);
+    if (c->pipeline) {
+        pthread_mutex_destroy(&c->execute_mutex);
+        pthread_mutex_destroy(&c->done_mutex);
+        pthread_cond_destroy(&c->done_cond);
+    }
+    av_thread_pool_free(&c->own_pool);
 }
 
 static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
@@ -63,18 +96,112 @@ static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
 
     if (nb_jobs <= 0)
         return 0;
+    if (c->pipeline)
+        pthread_mutex_lock(&c->execute_mutex);
     c->ctx         = ctx;
     c->arg         = arg;
     c->func        = func;
     c->rets        = ret;
 
     avpriv_slicethread_execute(c->thread, nb_jobs, 0);
+    if (c->pipeline)
+        pthread_mutex_unlock(&c->execute_mutex);
+    return 0;
+}
+
+static int pipeline_init(ThreadContext *c, int nb_threads)
+{
+    int ret;
+
+    if ((ret = pthread_mutex_init(&c->execute_mutex, NULL)))
+        return AVERROR(ret);
+    if ((ret = pthread_mutex_init(&c->done_mutex, NULL))) {
+        pthread_mutex_destroy(&c->execute_mutex);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_cond_init(&c->done_cond, NULL))) {
+        pthread_mutex_destroy(&c->done_mutex);
+        pthread_mutex_destroy(&c->execute_mutex);
+        return AVERROR(ret);
+    }
+    c->pipeline     = 1;
+    c->max_inflight = nb_threads;
+    c->done_tail    = &c->done;
     return 0;
 }
 
-static int thread_init_internal(ThreadContext *c, int nb_threads)
+static void pipeline_worker(void *opaque)
+{
+    PipelineJob *j = opaque;
+    ThreadContext *c = j->c;
+
+    j->ret = j->filter_frame(j->link, j->frame);
+
+    pthread_mutex_lock(&c->done_mutex);
+    j->next       = NULL;
+    *c->done_tail = j;
+    c->done_tail  = &j->next;
+    pthread_cond_signal(&c->done_cond);
+    pthread_mutex_unlock(&c->done_mutex);
+}
+
+int ff_filter_pipeline_submit(AVFilterLink *link,
+                              int (*filter_frame)(AVFilterLink *, AVFrame *),
+                              AVFrame *frame)
+{
+    AVFilterContext *ctx = link->dst;
+    AVFilterGraphInternal *graphi = ctx->graph->internal;
+    ThreadContext *c = graphi->thread;
+    PipelineJob *j = ctx->internal->pipeline_job;
+
+    if (graphi->nb_inflight >= c->max_inflight)
+        return 0;
+    if (!j) {
+        j = av_mallocz(sizeof(*j));
+        if (!j)
+            return 0;
+        j->job.func   = pipeline_worker;
+        j->job.opaque = j;
+        j->c          = c;
+        ctx->internal->pipeline_job = j;
+    }
+    j->link         = link;
+    j->filter_frame = filter_frame;
+    j->frame        = frame;
+
+    ctx->internal->pipeline_busy = 1;
+    graphi->nb_inflight++;
+    avpriv_thread_pool_submit(c->pool, &j->job, 1);
+    return 1;
+}
+
+void ff_graph_pipeline_flush(AVFilterGraph *graph, int wait)
+{
+    ThreadContext *c = graph->internal->thread;
+    PipelineJob *j, *next;
+
+    pthread_mutex_lock(&c->done_mutex);
+    while (wait && !c->done)
+        pthread_cond_wait(&c->done_cond, &c->done_mutex);
+    j            = c->done;
+    c->done      = NULL;
+    c->done_tail = &c->done;
+    pthread_mutex_unlock(&c->done_mutex);
+
+    for (; j; j = next) {
+        next = j->next;
+        graph->internal->nb_inflight--;
+        ff_filter_pipeline_done(j->link, j->ret);
+    }
+}
+
+static int thread_init_internal(ThreadContext *c, AVThreadPool *pool, int nb_threads)
 {
-    nb_threads = avpriv_slicethread_create(&c->thread, c, worker_func, NULL, nb_threads);
+    if (pool)
+        nb_threads = avpriv_slicethread_create_pool(&c->thread, pool, c, worker_func,
+                                                    NULL, nb_threads);
+    else
+        nb_threads = avpriv_slicethread_create(&c->thread, c, worker_func, NULL, nb_threads);
     if (nb_threads <= 1)
         avpriv_slicethread_free(&c->thread);
     return FFMAX(nb_threads, 1);
@@ -82,6 +209,7 @@ static int thread_init_internal(ThreadContext *c, int nb_threads)
 
 int ff_graph_thread_init(AVFilterGraph *graph)
 {
+    ThreadContext *c;
     int ret;
 
     if (graph->nb_threads == 1) {
@@ -89,12 +217,24 @@ int ff_graph_thread_init(AVFilterGraph *graph)
         return 0;
     }
 
-    graph->internal->thread = av_mallocz(sizeof(ThreadContext));
+    c = graph->internal->thread = av_mallocz(sizeof(ThreadContext));
     if (!graph->internal->thread)
         return AVERROR(ENOMEM);
 
-    ret = thread_init_internal(graph->internal->thread, graph->nb_threads);
+    /* the pipeline jobs need a pool; let the slices share it */
+    c->pool = graph->thread_pool;
+    if (graph->thread_type & AVFILTER_THREAD_FRAME && !c->pool) {
+        ret = av_thread_pool_alloc(&c->own_pool, graph->nb_threads);
+        if (ret < 0) {
+            av_freep(&graph->internal->thread);
+            return ret;
+        }
+        c->pool = c->own_pool;
+    }
+
+    ret = thread_init_internal(c, c->pool, graph->nb_threads);
     if (ret <= 1) {
+        slice_thread_uninit(c);
         av_freep(&graph->internal->thread);
         graph->thread_type = 0;
         graph->nb_threads  = 1;
@@ -104,6 +244,15 @@ int ff_graph_thread_init(AVFilterGraph *graph)
 
     graph->internal->thread_execute = thread_execute;
 
+    if (graph->thread_type & AVFILTER_THREAD_FRAME) {
+        ret = pipeline_init(c, graph->nb_threads);
+        if (ret < 0) {
+            ff_graph_thread_free(graph);
+            graph->internal->thread_execute = NULL;
+            return ret;
+        }
+    }
+
     return 0;
 }
 
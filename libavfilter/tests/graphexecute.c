@@ -0,0 +1,117 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Run a graph with the different combinations of thread types, with the
+ * internal threading and with a caller-provided AVFilterGraph.execute, and
+ * print the number of frames and a checksum of the output.
+ */
+
+#include <stdio.h>
+
+#include "libavutil/adler32.h"
+#include "libavutil/frame.h"
+
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+
+static int nb_execute_jobs;
+
+static int serial_execute(AVFilterContext *ctx, avfilter_action_func *func,
+                          void *arg, int *ret, int nb_jobs)
+{
+    for (int i = 0; i < nb_jobs; i++) {
+        int r = func(ctx, arg, i, nb_jobs);
+        if (ret)
+            ret[i] = r;
+    }
+    nb_execute_jobs += nb_jobs;
+    return 0;
+}
+
+static int run_graph(int custom_execute, int thread_type, int *nb_frames,
+                     uint32_t *checksum)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *sink;
+    AVFrame *frame = av_frame_alloc();
+    int ret = AVERROR(ENOMEM);
+
+    if (!graph || !frame)
+        goto end;
+    if (custom_execute)
+        graph->execute = serial_execute;
+    graph->thread_type = thread_type;
+    graph->nb_threads  = 4;
+
+    ret = avfilter_graph_parse_ptr(graph, "testsrc2=d=1,hflip,unsharp,buffersink",
+                                   NULL, NULL, NULL);
+    if (ret < 0)
+        goto end;
+    if ((ret = avfilter_graph_config(graph, NULL)) < 0)
+        goto end;
+    sink = avfilter_graph_get_filter(graph, "Parsed_buffersink_3");
+
+    *nb_frames = 0;
+    *checksum  = 0;
+    while ((ret = av_buffersink_get_frame(sink, frame)) >= 0) {
+        for (int y = 0; y < frame->height; y++)
+            *checksum = av_adler32_update(*checksum,
+                                          frame->data[0] + y * frame->linesize[0],
+                                          frame->width);
+        (*nb_frames)++;
+        av_frame_unref(frame);
+    }
+    if (ret == AVERROR_EOF)
+        ret = 0;
+
+end:
+    avfilter_graph_free(&graph);
+    av_frame_free(&frame);
+    return ret;
+}
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        int thread_type;
+    } types[] = {
+        { "none",        0 },
+        { "slice",       AVFILTER_THREAD_SLICE },
+        { "frame",       AVFILTER_THREAD_FRAME },
+        { "slice+frame", AVFILTER_THREAD_SLICE | AVFILTER_THREAD_FRAME },
+    };
+    uint32_t checksum;
+    int nb_frames;
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    for (int custom = 0; custom <= 1; custom++) {
+        for (int i = 0; i < FF_ARRAY_ELEMS(types); i++) {
+            nb_execute_jobs = 0;
+            if (run_graph(custom, types[i].thread_type, &nb_frames, &checksum) < 0)
+                return 1;
+            printf("%s execute, thread_type %s: %d frames, checksum %08"PRIx32"%s\n",
+                   custom ? "custom" : "internal", types[i].name, nb_frames,
+                   checksum, nb_execute_jobs ? ", custom execute called" : "");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Run a source split into many branches of null filters, each ending in a
+ * buffersink, and print how many filter activations it takes to pull a
+ * number of frames out of every sink. Run with -b to measure activations
+ * per second as the graph grows.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/frame.h"
+#include "libavutil/time.h"
+
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/filters.h"
+#include "libavfilter/internal.h"
+
+#define DEPTH     4     /* null filters per branch */
+#define NB_FRAMES 16
+
+static AVFilterGraph *build_graph(int nb_branches, AVFilterContext **sinks)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *src, *split, *prev;
+    char args[16];
+
+    if (!graph)
+        return NULL;
+    snprintf(args, sizeof(args), "%d", nb_branches);
+    if (avfilter_graph_create_filter(&src, avfilter_get_by_name("nullsrc"),
+                                     "src", "size=16x16", NULL, graph) < 0 ||
+        avfilter_graph_create_filter(&split, avfilter_get_by_name("split"),
+                                     "split", args, NULL, graph) < 0 ||
+        avfilter_link(src, 0, split, 0) < 0)
+        goto fail;
+
+    for (int i = 0; i < nb_branches; i++) {
+        prev = split;
+        for (int j = 0; j < DEPTH; j++) {
+            AVFilterContext *null;
+            if (avfilter_graph_create_filter(&null, avfilter_get_by_name("null"),
+                                             NULL, NULL, NULL, graph) < 0 ||
+                avfilter_link(prev, prev == split ? i : 0, null, 0) < 0)
+                goto fail;
+            prev = null;
+        }
+        if (avfilter_graph_create_filter(&sinks[i], avfilter_get_by_name("buffersink"),
+                                         NULL, NULL, NULL, graph) < 0 ||
+            avfilter_link(prev, 0, sinks[i], 0) < 0)
+            goto fail;
+    }
+
+    if (avfilter_graph_config(graph, NULL) < 0)
+        goto fail;
+    return graph;
+
+fail:
+    avfilter_graph_free(&graph);
+    return NULL;
+}
+
+/* av_buffersink_get_frame(), counting the activations it triggers */
+static int get_frame(AVFilterContext *sink, AVFrame *frame, int64_t *activations)
+{
+    AVFilterLink *inlink = sink->inputs[0];
+    int ret;
+
+    while ((ret = av_buffersink_get_frame_flags(sink, frame,
+                                                AV_BUFFERSINK_FLAG_NO_REQUEST)) == AVERROR(EAGAIN)) {
+        if (!inlink->frame_wanted_out) {
+            ff_inlink_request_frame(inlink);
+        } else {
+            if ((ret = ff_filter_graph_run_once(sink->graph)) < 0)
+                return ret;
+            (*activations)++;
+        }
+    }
+    return ret;
+}
+
+static int run_graph(int nb_branches, int nb_frames, int64_t *activations,
+                     int64_t *elapsed)
+{
+    AVFilterContext **sinks = av_calloc(nb_branches, sizeof(*sinks));
+    AVFilterGraph *graph = NULL;
+    AVFrame *frame = av_frame_alloc();
+    int ret = AVERROR(ENOMEM);
+
+    if (!sinks || !frame)
+        goto end;
+    ret = AVERROR(EINVAL);
+    if (!(graph = build_graph(nb_branches, sinks)))
+        goto end;
+
+    *activations = 0;
+    *elapsed     = av_gettime_relative();
+    for (int n = 0; n < nb_frames; n++) {
+        for (int i = 0; i < nb_branches; i++) {
+            if ((ret = get_frame(sinks[i], frame, activations)) < 0)
+                goto end;
+            if (frame->pts != n) {
+                ret = AVERROR_BUG;
+                goto end;
+            }
+            av_frame_unref(frame);
+        }
+    }
+    *elapsed = av_gettime_relative() - *elapsed;
+    ret = graph->nb_filters;
+
+end:
+    avfilter_graph_free(&graph);
+    av_frame_free(&frame);
+    av_freep(&sinks);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    static const int branches[] = { 1, 4, 16, 64 };
+    int bench = argc > 1 && !strcmp(argv[1], "-b");
+    int64_t activations, elapsed;
+    int ret;
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(branches); i++) {
+        if ((ret = run_graph(branches[i], NB_FRAMES, &activations, &elapsed)) < 0)
+            return 1;
+        printf("%d branches, %d filters: %"PRId64" activations for %d frames\n",
+               branches[i], ret, activations, NB_FRAMES);
+    }
+
+    if (bench) {
+        for (int nb_branches = 2; nb_branches <= 256; nb_branches *= 2) {
+            int64_t t = 0, total = 0;
+            int nb_frames = FFMAX(4096 / nb_branches, 8);
+
+            do {
+                if ((ret = run_graph(nb_branches, nb_frames, &activations, &elapsed)) < 0)
+                    return 1;
+                total += activations;
+                t     += elapsed;
+            } while (t < 500000);
+            printf("%4d filters: %.0f activations/s\n", ret, total * 1e6 / t);
+        }
+    }
+
+    return 0;
+}
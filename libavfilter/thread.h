@@ -25,4 +25,24 @@ int ff_graph_thread_init(AVFilterGraph *graph);
 
 void ff_graph_thread_free(AVFilterGraph *graph);
 
+/**
+ * Call filter_frame(link, frame) on a pipeline thread, for a filter using
+ * AVFILTER_THREAD_FRAME. ff_filter_pipeline_done() is called when the
+ * graph is flushed after it has returned.
+ *
+ * @return 1 if the frame was submitted, 0 if too many frames are already
+ *         being filtered and it must be filtered on the calling thread
+ */
+int ff_filter_pipeline_submit(AVFilterLink *link,
+                              int (*filter_frame)(AVFilterLink *, AVFrame *),
+                              AVFrame *frame);
+
+/**
+ * Finish the frames done on pipeline threads.
+ *
+ * @param wait if set, wait until at least one frame is done; at least one
+ *             must be in flight
+ */
+void ff_graph_pipeline_flush(AVFilterGraph *graph, int wait);
+
 #endif /* AVFILTER_THREAD_H */
@@ -148,6 +148,8 @@ enum expansion_mode {
     EXP_STRFTIME,
 };
 
+#define MAX_SLICES 32
+
 typedef struct DrawTextContext {
     const AVClass *class;
     int exp_mode;                   ///< expansion mode to use for the text
@@ -162,7 +164,13 @@ typedef struct DrawTextContext {
     AVBPrint expanded_fontcolor;    ///< used to contain the expanded fontcolor spec
     int ft_load_flags;              ///< flags used for loading fonts, see FT_LOAD_*
     FT_Vector *positions;           ///< positions for each element in the text
+    struct Glyph **layout_glyphs;   ///< glyph drawn for each element in the text, or NULL
     size_t nb_positions;            ///< number of elements of positions array
+    AVBPrint layout_text;           ///< text the positions were computed for
+    unsigned int layout_fontsize;   ///< font size the positions were computed for, 0 if none
+    int layout_nb_glyphs;           ///< number of elements of the text
+    int layout_w, layout_h;         ///< size of the text with the computed positions
+    int layout_y_max, layout_y_min; ///< ascent and descent of the computed positions
     char *textfile;                 ///< file with text to be drawn
     int x;                          ///< x position to start drawing text
     int y;                          ///< y position to start drawing text
@@ -183,6 +191,7 @@ typedef struct DrawTextContext {
     int fix_bounds;                 ///< do we let it go out of frame bounds - t/f
 
     FFDrawContext dc;
+    int slices_ret[MAX_SLICES];     ///< return values of the draw_text_slice() jobs
     FFDrawColor fontcolor;          ///< foreground color
     FFDrawColor shadowcolor;        ///< shadow color
     FFDrawColor bordercolor;        ///< border color
@@ -215,6 +224,16 @@ typedef struct DrawTextContext {
     AVDictionary *metadata;
 } DrawTextContext;
 
+typedef struct DrawTextThreadData {
+    AVFrame *frame;
+    int y_start, y_end;             ///< rows covered by the box and the glyphs
+    int box_w, box_h;
+    FFDrawColor fontcolor;
+    FFDrawColor shadowcolor;
+    FFDrawColor bordercolor;
+    FFDrawColor boxcolor;
+} DrawTextThreadData;
+
 #define OFFSET(x) offsetof(DrawTextContext, x)
 #define FLAGS AV_OPT_FLAG_FILTERING_PARAM|AV_OPT_FLAG_VIDEO_PARAM
 
@@ -822,6 +841,7 @@ static av_cold int init(AVFilterContext *ctx)
 
     av_bprint_init(&s->expanded_text, 0, AV_BPRINT_SIZE_UNLIMITED);
     av_bprint_init(&s->expanded_fontcolor, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprint_init(&s->layout_text, 0, AV_BPRINT_SIZE_UNLIMITED);
 
     return 0;
 }
@@ -853,7 +873,9 @@ static av_cold void uninit(AVFilterContext *ctx)
     s->x_pexpr = s->y_pexpr = s->a_pexpr = s->fontsize_pexpr = NULL;
 
     av_freep(&s->positions);
+    av_freep(&s->layout_glyphs);
     s->nb_positions = 0;
+    s->layout_fontsize = 0;
 
     av_tree_enumerate(s->glyphs, NULL, NULL, glyph_enu_free);
     av_tree_destroy(s->glyphs);
@@ -865,6 +887,7 @@ static av_cold void uninit(AVFilterContext *ctx)
 
     av_bprint_finalize(&s->expanded_text, NULL);
     av_bprint_finalize(&s->expanded_fontcolor, NULL);
+    av_bprint_finalize(&s->layout_text, NULL);
 }
 
 static int config_input(AVFilterLink *inlink)
@@ -1318,31 +1341,21 @@ static int expand_text(AVFilterContext *ctx, char *text, AVBPrint *bp)
     return 0;
 }
 
-static int draw_glyphs(DrawTextContext *s, AVFrame *frame,
+static int draw_glyphs(DrawTextContext *s, uint8_t *dst[], int dst_linesize[],
                        int width, int height,
                        FFDrawColor *color,
                        int x, int y, int borderw)
 {
-    char *text = s->expanded_text.str;
-    uint32_t code = 0;
     int i, x1, y1;
-    uint8_t *p;
-    Glyph *glyph = NULL;
 
-    for (i = 0, p = text; *p; i++) {
+    for (i = 0; i < s->layout_nb_glyphs; i++) {
+        const Glyph *glyph = s->layout_glyphs[i];
         FT_Bitmap bitmap;
-        Glyph dummy = { 0 };
-        GET_UTF8(code, *p ? *p++ : 0, code = 0xfffd; goto continue_on_invalid;);
-continue_on_invalid:
 
-        /* skip new line chars, just go to new line */
-        if (code == '\n' || code == '\r' || code == '\t')
+        /* new line chars are not drawn */
+        if (!glyph)
             continue;
 
-        dummy.code = code;
-        dummy.fontsize = s->fontsize;
-        glyph = av_tree_find(s->glyphs, &dummy, glyph_cmp, NULL);
-
         bitmap = borderw ? glyph->border_bitmap : glyph->bitmap;
 
         if (glyph->bitmap.pixel_mode != FT_PIXEL_MODE_MONO &&
@@ -1353,7 +1366,7 @@ continue_on_invalid:
         y1 = s->positions[i].y+s->y+y - borderw;
 
         ff_blend_mask(&s->dc, color,
-                      frame->data, frame->linesize, width, height,
+                      dst, dst_linesize, width, height,
                       bitmap.buffer, bitmap.pitch,
                       bitmap.width, bitmap.rows,
                       bitmap.pixel_mode == FT_PIXEL_MODE_MONO ? 0 : 3,
@@ -1363,6 +1376,52 @@ continue_on_invalid:
     return 0;
 }
 
+static int draw_text_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    DrawTextContext *s = ctx->priv;
+    DrawTextThreadData *td = arg;
+    AVFrame *frame = td->frame;
+    const int row_mask = (1 << s->dc.vsub_max) - 1;
+    const int rows  = td->y_end - td->y_start;
+    /* slices start on chroma rows, so that blending subsampled planes gives
+       the same result however the text is sliced */
+    const int slice_start = td->y_start + (rows * jobnr / nb_jobs & ~row_mask);
+    const int slice_end   = jobnr == nb_jobs - 1 ? td->y_end :
+                            td->y_start + (rows * (jobnr + 1) / nb_jobs & ~row_mask);
+    const int height = slice_end - slice_start;
+    uint8_t *dst[MAX_PLANES];
+    int ret;
+
+    if (height <= 0)
+        return 0;
+    for (int i = 0; i < s->dc.nb_planes; i++)
+        dst[i] = frame->data[i] + (slice_start >> s->dc.vsub[i]) * frame->linesize[i];
+
+    /* draw box */
+    if (s->draw_box)
+        ff_blend_rectangle(&s->dc, &td->boxcolor,
+                           dst, frame->linesize, frame->width, height,
+                           s->x - s->boxborderw, s->y - s->boxborderw - slice_start,
+                           td->box_w + s->boxborderw * 2, td->box_h + s->boxborderw * 2);
+
+    if (s->shadowx || s->shadowy) {
+        if ((ret = draw_glyphs(s, dst, frame->linesize, frame->width, height,
+                               &td->shadowcolor, s->shadowx,
+                               s->shadowy - slice_start, 0)) < 0)
+            return ret;
+    }
+
+    if (s->borderw) {
+        if ((ret = draw_glyphs(s, dst, frame->linesize, frame->width, height,
+                               &td->bordercolor, 0, -slice_start, s->borderw)) < 0)
+            return ret;
+    }
+    if ((ret = draw_glyphs(s, dst, frame->linesize, frame->width, height,
+                           &td->fontcolor, 0, -slice_start, 0)) < 0)
+        return ret;
+
+    return 0;
+}
 
 static void update_color_with_alpha(DrawTextContext *s, FFDrawColor *color, const FFDrawColor incolor)
 {
@@ -1386,17 +1445,16 @@ static void update_alpha(DrawTextContext *s)
         s->alpha = 256 * alpha;
 }
 
-static int draw_text(AVFilterContext *ctx, AVFrame *frame,
-                     int width, int height)
+/**
+ * Load the glyphs of the expanded text and compute their positions.
+ */
+static int layout_glyphs(AVFilterContext *ctx)
 {
     DrawTextContext *s = ctx->priv;
-    AVFilterLink *inlink = ctx->inputs[0];
-
     uint32_t code = 0, prev_code = 0;
     int x = 0, y = 0, i = 0, ret;
     int max_text_line_w = 0, len;
-    int box_w, box_h;
-    char *text;
+    char *text = s->expanded_text.str;
     uint8_t *p;
     int y_min = 32000, y_max = -32000;
     int x_min = 32000, x_max = -32000;
@@ -1404,71 +1462,16 @@ static int draw_text(AVFilterContext *ctx, AVFrame *frame,
     Glyph *glyph = NULL, *prev_glyph = NULL;
     Glyph dummy = { 0 };
 
-    time_t now = time(0);
-    struct tm ltime;
-    AVBPrint *bp = &s->expanded_text;
-
-    FFDrawColor fontcolor;
-    FFDrawColor shadowcolor;
-    FFDrawColor bordercolor;
-    FFDrawColor boxcolor;
-
-    av_bprint_clear(bp);
-
-    if(s->basetime != AV_NOPTS_VALUE)
-        now= frame->pts*av_q2d(ctx->inputs[0]->time_base) + s->basetime/1000000;
-
-    switch (s->exp_mode) {
-    case EXP_NONE:
-        av_bprintf(bp, "%s", s->text);
-        break;
-    case EXP_NORMAL:
-        if ((ret = expand_text(ctx, s->text, &s->expanded_text)) < 0)
-            return ret;
-        break;
-    case EXP_STRFTIME:
-        localtime_r(&now, &ltime);
-        av_bprint_strftime(bp, s->text, &ltime);
-        break;
-    }
-
-    if (s->tc_opt_string) {
-        char tcbuf[AV_TIMECODE_STR_SIZE];
-        av_timecode_make_string(&s->tc, tcbuf, inlink->frame_count_out);
-        av_bprint_clear(bp);
-        av_bprintf(bp, "%s%s", s->text, tcbuf);
-    }
-
-    if (!av_bprint_is_complete(bp))
-        return AVERROR(ENOMEM);
-    text = s->expanded_text.str;
+    s->layout_fontsize = 0;
     if ((len = s->expanded_text.len) > s->nb_positions) {
         if (!(s->positions =
-              av_realloc(s->positions, len*sizeof(*s->positions))))
+              av_realloc(s->positions, len*sizeof(*s->positions))) ||
+            !(s->layout_glyphs =
+              av_realloc(s->layout_glyphs, len*sizeof(*s->layout_glyphs))))
             return AVERROR(ENOMEM);
         s->nb_positions = len;
     }
 
-    if (s->fontcolor_expr[0]) {
-        /* If expression is set, evaluate and replace the static value */
-        av_bprint_clear(&s->expanded_fontcolor);
-        if ((ret = expand_text(ctx, s->fontcolor_expr, &s->expanded_fontcolor)) < 0)
-            return ret;
-        if (!av_bprint_is_complete(&s->expanded_fontcolor))
-            return AVERROR(ENOMEM);
-        av_log(s, AV_LOG_DEBUG, "Evaluated fontcolor is '%s'\n", s->expanded_fontcolor.str);
-        ret = av_parse_color(s->fontcolor.rgba, s->expanded_fontcolor.str, -1, s);
-        if (ret)
-            return ret;
-        ff_draw_color(&s->dc, &s->fontcolor, s->fontcolor.rgba);
-    }
-
-    x = 0;
-    y = 0;
-
-    if ((ret = update_fontsize(ctx)) < 0)
-        return ret;
-
     /* load and cache glyphs */
     for (i = 0, p = text; *p; i++) {
         GET_UTF8(code, *p ? *p++ : 0, code = 0xfffd; goto continue_on_invalid;);
@@ -1488,7 +1491,12 @@ continue_on_invalid:
         y_max = FFMAX(glyph->bbox.yMax, y_max);
         x_min = FFMIN(glyph->bbox.xMin, x_min);
         x_max = FFMAX(glyph->bbox.xMax, x_max);
+
+        /* new line chars are skipped when drawing */
+        s->layout_glyphs[i] = code == '\n' || code == '\r' || code == '\t' ?
+                              NULL : glyph;
     }
+    s->layout_nb_glyphs = i;
     s->max_glyph_h = y_max - y_min;
     s->max_glyph_w = x_max - x_min;
 
@@ -1531,15 +1539,97 @@ continue_on_invalid2:
         else              x += glyph->advance;
     }
 
-    max_text_line_w = FFMAX(x, max_text_line_w);
+    s->layout_w     = FFMAX(x, max_text_line_w);
+    s->layout_h     = y + s->max_glyph_h;
+    s->layout_y_max = y_max;
+    s->layout_y_min = y_min;
+
+    av_bprint_clear(&s->layout_text);
+    av_bprintf(&s->layout_text, "%s", text);
+    if (!av_bprint_is_complete(&s->layout_text))
+        return AVERROR(ENOMEM);
+    s->layout_fontsize = s->fontsize;
+
+    return 0;
+}
+
+/**
+ * Expand and lay out the text, and find the rows of the frame it covers.
+ */
+static int draw_text(AVFilterContext *ctx, AVFrame *frame,
+                     int width, int height, DrawTextThreadData *td)
+{
+    DrawTextContext *s = ctx->priv;
+    AVFilterLink *inlink = ctx->inputs[0];
+
+    int ret;
+    int box_w, box_h;
+
+    time_t now = time(0);
+    struct tm ltime;
+    AVBPrint *bp = &s->expanded_text;
+
+    av_bprint_clear(bp);
+
+    if(s->basetime != AV_NOPTS_VALUE)
+        now= frame->pts*av_q2d(ctx->inputs[0]->time_base) + s->basetime/1000000;
+
+    switch (s->exp_mode) {
+    case EXP_NONE:
+        av_bprintf(bp, "%s", s->text);
+        break;
+    case EXP_NORMAL:
+        if ((ret = expand_text(ctx, s->text, &s->expanded_text)) < 0)
+            return ret;
+        break;
+    case EXP_STRFTIME:
+        localtime_r(&now, &ltime);
+        av_bprint_strftime(bp, s->text, &ltime);
+        break;
+    }
+
+    if (s->tc_opt_string) {
+        char tcbuf[AV_TIMECODE_STR_SIZE];
+        av_timecode_make_string(&s->tc, tcbuf, inlink->frame_count_out);
+        av_bprint_clear(bp);
+        av_bprintf(bp, "%s%s", s->text, tcbuf);
+    }
+
+    if (!av_bprint_is_complete(bp))
+        return AVERROR(ENOMEM);
+
+    if (s->fontcolor_expr[0]) {
+        /* If expression is set, evaluate and replace the static value */
+        av_bprint_clear(&s->expanded_fontcolor);
+        if ((ret = expand_text(ctx, s->fontcolor_expr, &s->expanded_fontcolor)) < 0)
+            return ret;
+        if (!av_bprint_is_complete(&s->expanded_fontcolor))
+            return AVERROR(ENOMEM);
+        av_log(s, AV_LOG_DEBUG, "Evaluated fontcolor is '%s'\n", s->expanded_fontcolor.str);
+        ret = av_parse_color(s->fontcolor.rgba, s->expanded_fontcolor.str, -1, s);
+        if (ret)
+            return ret;
+        ff_draw_color(&s->dc, &s->fontcolor, s->fontcolor.rgba);
+    }
+
+    if ((ret = update_fontsize(ctx)) < 0)
+        return ret;
+
+    /* the glyphs are only laid out again when the text or its size change,
+       e.g. once per second for a timecode */
+    if (s->layout_fontsize != s->fontsize ||
+        strcmp(s->layout_text.str, s->expanded_text.str)) {
+        if ((ret = layout_glyphs(ctx)) < 0)
+            return ret;
+    }
 
-    s->var_values[VAR_TW] = s->var_values[VAR_TEXT_W] = max_text_line_w;
-    s->var_values[VAR_TH] = s->var_values[VAR_TEXT_H] = y + s->max_glyph_h;
+    s->var_values[VAR_TW] = s->var_values[VAR_TEXT_W] = s->layout_w;
+    s->var_values[VAR_TH] = s->var_values[VAR_TEXT_H] = s->layout_h;
 
     s->var_values[VAR_MAX_GLYPH_W] = s->max_glyph_w;
     s->var_values[VAR_MAX_GLYPH_H] = s->max_glyph_h;
-    s->var_values[VAR_MAX_GLYPH_A] = s->var_values[VAR_ASCENT ] = y_max;
-    s->var_values[VAR_MAX_GLYPH_D] = s->var_values[VAR_DESCENT] = y_min;
+    s->var_values[VAR_MAX_GLYPH_A] = s->var_values[VAR_ASCENT ] = s->layout_y_max;
+    s->var_values[VAR_MAX_GLYPH_D] = s->var_values[VAR_DESCENT] = s->layout_y_min;
 
     s->var_values[VAR_LINE_H] = s->var_values[VAR_LH] = s->max_glyph_h;
 
@@ -1554,13 +1644,13 @@ continue_on_invalid2:
     }
 
     update_alpha(s);
-    update_color_with_alpha(s, &fontcolor  , s->fontcolor  );
-    update_color_with_alpha(s, &shadowcolor, s->shadowcolor);
-    update_color_with_alpha(s, &bordercolor, s->bordercolor);
-    update_color_with_alpha(s, &boxcolor   , s->boxcolor   );
+    update_color_with_alpha(s, &td->fontcolor  , s->fontcolor  );
+    update_color_with_alpha(s, &td->shadowcolor, s->shadowcolor);
+    update_color_with_alpha(s, &td->bordercolor, s->bordercolor);
+    update_color_with_alpha(s, &td->boxcolor   , s->boxcolor   );
 
-    box_w = max_text_line_w;
-    box_h = y + s->max_glyph_h;
+    box_w = s->layout_w;
+    box_h = s->layout_h;
 
     if (s->fix_bounds) {
 
@@ -1588,27 +1678,60 @@ continue_on_invalid2:
             s->y = FFMAX(height - box_h - offsetbottom, 0);
     }
 
-    /* draw box */
-    if (s->draw_box)
-        ff_blend_rectangle(&s->dc, &boxcolor,
-                           frame->data, frame->linesize, width, height,
-                           s->x - s->boxborderw, s->y - s->boxborderw,
-                           box_w + s->boxborderw * 2, box_h + s->boxborderw * 2);
-
-    if (s->shadowx || s->shadowy) {
-        if ((ret = draw_glyphs(s, frame, width, height,
-                               &shadowcolor, s->shadowx, s->shadowy, 0)) < 0)
-            return ret;
+    /* find the rows covered by the box and the glyphs, and split them among
+       the slice threads */
+    td->frame   = frame;
+    td->box_w   = box_w;
+    td->box_h   = box_h;
+    td->y_start = INT_MAX;
+    td->y_end   = INT_MIN;
+    if (s->draw_box) {
+        td->y_start = s->y - s->boxborderw;
+        td->y_end   = s->y + box_h + s->boxborderw;
     }
+    for (int i = 0; i < s->layout_nb_glyphs; i++) {
+        const Glyph *glyph = s->layout_glyphs[i];
+        int top;
 
-    if (s->borderw) {
-        if ((ret = draw_glyphs(s, frame, width, height,
-                               &bordercolor, 0, 0, s->borderw)) < 0)
-            return ret;
+        if (!glyph)
+            continue;
+        top = s->y + s->positions[i].y;
+        if (s->shadowx || s->shadowy) {
+            td->y_start = FFMIN(td->y_start, top + s->shadowy);
+            td->y_end   = FFMAX(td->y_end,   top + s->shadowy + (int)glyph->bitmap.rows);
+        }
+        if (s->borderw) {
+            td->y_start = FFMIN(td->y_start, top - s->borderw);
+            td->y_end   = FFMAX(td->y_end,   top - s->borderw + (int)glyph->border_bitmap.rows);
+        }
+        td->y_start = FFMIN(td->y_start, top);
+        td->y_end   = FFMAX(td->y_end,   top + (int)glyph->bitmap.rows);
     }
-    if ((ret = draw_glyphs(s, frame, width, height,
-                           &fontcolor, 0, 0, 0)) < 0)
-        return ret;
+    td->y_start = FFMAX(td->y_start, 0) & ~((1 << s->dc.vsub_max) - 1);
+    td->y_end   = FFMIN(td->y_end, height);
+
+    return 0;
+}
+
+/**
+ * Blend the text laid out by draw_text() with the slice threads.
+ */
+static int blend_text(AVFilterContext *ctx, DrawTextThreadData *td)
+{
+    DrawTextContext *s = ctx->priv;
+    int nb_jobs;
+
+    if (td->y_start >= td->y_end)
+        return 0;
+
+    nb_jobs = FFMIN3(ff_filter_get_nb_threads(ctx),
+                     (td->y_end - td->y_start) >> s->dc.vsub_max, MAX_SLICES);
+    nb_jobs = FFMAX(nb_jobs, 1);
+    memset(s->slices_ret, 0, nb_jobs * sizeof(*s->slices_ret));
+    ff_filter_execute(ctx, draw_text_slice, td, s->slices_ret, nb_jobs);
+    for (int i = 0; i < nb_jobs; i++)
+        if (s->slices_ret[i] < 0)
+            return s->slices_ret[i];
 
     return 0;
 }
@@ -1622,6 +1745,7 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *frame)
     const AVDetectionBBoxHeader *header = NULL;
     const AVDetectionBBox *bbox;
     AVFrameSideData *sd;
+    DrawTextThreadData td;
     int loop = 1;
 
     if (s->text_source == AV_FRAME_DATA_DETECTION_BBOXES) {
@@ -1680,7 +1804,19 @@ FF_ENABLE_DEPRECATION_WARNINGS
             s->x = bbox->x;
             s->y = bbox->y - s->fontsize;
         }
-        draw_text(ctx, frame, frame->width, frame->height);
+        /* a text that cannot be expanded or laid out is only dropped for
+           this frame, while failing to blend it fails the frame */
+        ret = draw_text(ctx, frame, frame->width, frame->height, &td);
+        if (ret < 0) {
+            av_log(ctx, AV_LOG_WARNING, "Failed to draw the text: %s\n",
+                   av_err2str(ret));
+            continue;
+        }
+        ret = blend_text(ctx, &td);
+        if (ret < 0) {
+            av_frame_free(&frame);
+            return ret;
+        }
     }
 
     av_log(ctx, AV_LOG_DEBUG, "n:%d t:%f text_w:%d text_h:%d x:%d y:%d\n",
@@ -1719,5 +1855,5 @@ const AVFilter ff_vf_drawtext = {
     FILTER_OUTPUTS(avfilter_vf_drawtext_outputs),
     FILTER_QUERY_FUNC(query_formats),
     .process_command = command,
-    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
 };
@@ -352,6 +352,10 @@ static av_cold int init(AVFilterContext *ctx)
 
     scale->in_frame_range = AVCOL_RANGE_UNSPECIFIED;
 
+    /* per-frame evaluation reconfigures the output link on every frame */
+    if (scale->eval_mode == EVAL_MODE_FRAME)
+        ctx->thread_type &= ~AVFILTER_THREAD_FRAME;
+
     return 0;
 }
 
@@ -503,40 +507,15 @@ fail:
     return ret;
 }
 
-static int config_props(AVFilterLink *outlink)
+/* (re)create the scaling contexts for the current link properties */
+static int scale_init_sws(AVFilterContext *ctx, AVFilterLink *outlink)
 {
-    AVFilterContext *ctx = outlink->src;
-    AVFilterLink *inlink0 = outlink->src->inputs[0];
-    AVFilterLink *inlink  = ctx->filter == &ff_vf_scale2ref ?
-                            outlink->src->inputs[1] :
-                            outlink->src->inputs[0];
+    AVFilterLink *inlink0 = ctx->inputs[0];
     enum AVPixelFormat outfmt = outlink->format;
-    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(inlink->format);
     ScaleContext *scale = ctx->priv;
-    uint8_t *flags_val = NULL;
     int ret;
 
-    if ((ret = scale_eval_dimensions(ctx)) < 0)
-        goto fail;
-
-    outlink->w = scale->w;
-    outlink->h = scale->h;
-
-    ff_scale_adjust_dimensions(inlink, &outlink->w, &outlink->h,
-                               scale->force_original_aspect_ratio,
-                               scale->force_divisible_by);
-
-    if (outlink->w > INT_MAX ||
-        outlink->h > INT_MAX ||
-        (outlink->h * inlink->w) > INT_MAX ||
-        (outlink->w * inlink->h) > INT_MAX)
-        av_log(ctx, AV_LOG_ERROR, "Rescaled value for width or height is too big.\n");
-
-    /* TODO: make algorithm configurable */
-
-    scale->input_is_pal = desc->flags & AV_PIX_FMT_FLAG_PAL;
     if (outfmt == AV_PIX_FMT_PAL8) outfmt = AV_PIX_FMT_BGR8;
-    scale->output_is_pal = av_pix_fmt_desc_get(outfmt)->flags & AV_PIX_FMT_FLAG_PAL;
 
     if (scale->sws)
         sws_freeContext(scale->sws);
@@ -605,6 +584,47 @@ static int config_props(AVFilterLink *outlink)
         }
     }
 
+    return 0;
+}
+
+static int config_props(AVFilterLink *outlink)
+{
+    AVFilterContext *ctx = outlink->src;
+    AVFilterLink *inlink0 = outlink->src->inputs[0];
+    AVFilterLink *inlink  = ctx->filter == &ff_vf_scale2ref ?
+                            outlink->src->inputs[1] :
+                            outlink->src->inputs[0];
+    enum AVPixelFormat outfmt = outlink->format;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(inlink->format);
+    ScaleContext *scale = ctx->priv;
+    uint8_t *flags_val = NULL;
+    int ret;
+
+    if ((ret = scale_eval_dimensions(ctx)) < 0)
+        goto fail;
+
+    outlink->w = scale->w;
+    outlink->h = scale->h;
+
+    ff_scale_adjust_dimensions(inlink, &outlink->w, &outlink->h,
+                               scale->force_original_aspect_ratio,
+                               scale->force_divisible_by);
+
+    if (outlink->w > INT_MAX ||
+        outlink->h > INT_MAX ||
+        (outlink->h * inlink->w) > INT_MAX ||
+        (outlink->w * inlink->h) > INT_MAX)
+        av_log(ctx, AV_LOG_ERROR, "Rescaled value for width or height is too big.\n");
+
+    /* TODO: make algorithm configurable */
+
+    scale->input_is_pal = desc->flags & AV_PIX_FMT_FLAG_PAL;
+    if (outfmt == AV_PIX_FMT_PAL8) outfmt = AV_PIX_FMT_BGR8;
+    scale->output_is_pal = av_pix_fmt_desc_get(outfmt)->flags & AV_PIX_FMT_FLAG_PAL;
+
+    if ((ret = scale_init_sws(ctx, outlink)) < 0)
+        return ret;
+
     if (inlink0->sample_aspect_ratio.num){
         outlink->sample_aspect_ratio = av_mul_q((AVRational){outlink->h * inlink0->w, outlink->w * inlink0->h}, inlink0->sample_aspect_ratio);
     } else
@@ -710,7 +730,7 @@ static int scale_frame(AVFilterLink *link, AVFrame *in, AVFrame **frame_out)
     char buf[32];
     int ret;
     int in_range;
-    int frame_changed;
+    int frame_changed, range_changed = 0;
 
     *frame_out = NULL;
     if (in->colorspace == AVCOL_SPC_YCGCO)
@@ -726,7 +746,7 @@ static int scale_frame(AVFilterLink *link, AVFrame *in, AVFrame **frame_out)
         scale->in_range == AVCOL_RANGE_UNSPECIFIED &&
         in->color_range != scale->in_frame_range) {
         scale->in_frame_range = in->color_range;
-        frame_changed = 1;
+        range_changed = 1;
     }
 
     if (scale->eval_mode == EVAL_MODE_FRAME || frame_changed) {
@@ -736,7 +756,7 @@ static int scale_frame(AVFilterLink *link, AVFrame *in, AVFrame **frame_out)
         av_expr_count_vars(scale->h_pexpr, vars_h, VARS_NB);
 
         if (scale->eval_mode == EVAL_MODE_FRAME &&
-            !frame_changed &&
+            !frame_changed && !range_changed &&
             ctx->filter != &ff_vf_scale2ref &&
             !(vars_w[VAR_N] || vars_w[VAR_T] || vars_w[VAR_POS]) &&
             !(vars_h[VAR_N] || vars_h[VAR_T] || vars_h[VAR_POS]) &&
@@ -777,6 +797,11 @@ static int scale_frame(AVFilterLink *link, AVFrame *in, AVFrame **frame_out)
 
         if ((ret = config_props(outlink)) < 0)
             return ret;
+    } else if (range_changed) {
+        /* only the scaling contexts depend on the range; leave the links
+         * alone, this may run on a pipeline thread */
+        if ((ret = scale_init_sws(ctx, outlink)) < 0)
+            return ret;
     }
 
 scale:
@@ -1049,6 +1074,7 @@ const AVFilter ff_vf_scale = {
     FILTER_OUTPUTS(avfilter_vf_scale_outputs),
     FILTER_QUERY_FUNC(query_formats),
     .process_command = process_command,
+    .flags_internal  = FF_FILTER_FLAG_FRAME_THREADS,
 };
 
 static const AVFilterPad avfilter_vf_scale2ref_inputs[] = {
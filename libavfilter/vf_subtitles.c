@@ -61,8 +61,17 @@ typedef struct AssContext {
     int original_w, original_h;
     int shaping;
     FFDrawContext draw;
+    FFDrawColor *colors;       ///< colors of the images of the last render
+    unsigned int colors_size;
+    int nb_images;             ///< number of images of the last render
+    int y_start, y_end;        ///< rows covered by the images of the last render
 } AssContext;
 
+typedef struct ThreadData {
+    AVFrame *frame;
+    const ASS_Image *image;
+} ThreadData;
+
 #define OFFSET(x) offsetof(AssContext, x)
 #define FLAGS AV_OPT_FLAG_FILTERING_PARAM|AV_OPT_FLAG_VIDEO_PARAM
 
@@ -127,6 +136,7 @@ static av_cold void uninit(AVFilterContext *ctx)
 {
     AssContext *ass = ctx->priv;
 
+    av_freep(&ass->colors);
     if (ass->track)
         ass_free_track(ass->track);
     if (ass->renderer)
@@ -145,6 +155,9 @@ static int config_input(AVFilterLink *inlink)
     AssContext *ass = inlink->dst->priv;
 
     ff_draw_init(&ass->draw, inlink->format, ass->alpha ? FF_DRAW_PROCESS_ALPHA : 0);
+    /* the colors of the last render were converted for the previous format,
+       which libass does not know about */
+    ass->nb_images = 0;
 
     ass_set_frame_size  (ass->renderer, inlink->w, inlink->h);
     if (ass->original_w && ass->original_h) {
@@ -166,19 +179,69 @@ static int config_input(AVFilterLink *inlink)
 #define AB(c)  (((c)>>8) &0xFF)
 #define AA(c)  ((0xFF-(c)) &0xFF)
 
-static void overlay_ass_image(AssContext *ass, AVFrame *picref,
-                              const ASS_Image *image)
+/**
+ * Convert the colors of the images and find the rows they cover.
+ */
+static int prepare_ass_images(AssContext *ass, const ASS_Image *image, int height)
 {
-    for (; image; image = image->next) {
-        uint8_t rgba_color[] = {AR(image->color), AG(image->color), AB(image->color), AA(image->color)};
-        FFDrawColor color;
-        ff_draw_color(&ass->draw, &color, rgba_color);
-        ff_blend_mask(&ass->draw, &color,
-                      picref->data, picref->linesize,
-                      picref->width, picref->height,
-                      image->bitmap, image->stride, image->w, image->h,
-                      3, 0, image->dst_x, image->dst_y);
+    const ASS_Image *img;
+    int i;
+
+    ass->nb_images = 0;
+    for (img = image; img; img = img->next)
+        ass->nb_images++;
+    if (!ass->nb_images)
+        return 0;
+    av_fast_malloc(&ass->colors, &ass->colors_size,
+                   ass->nb_images * sizeof(*ass->colors));
+    if (!ass->colors) {
+        ass->nb_images = 0;
+        return AVERROR(ENOMEM);
+    }
+
+    ass->y_start = INT_MAX;
+    ass->y_end   = INT_MIN;
+    for (img = image, i = 0; img; img = img->next, i++) {
+        uint8_t rgba_color[] = {AR(img->color), AG(img->color), AB(img->color), AA(img->color)};
+        ff_draw_color(&ass->draw, &ass->colors[i], rgba_color);
+        ass->y_start = FFMIN(ass->y_start, img->dst_y);
+        ass->y_end   = FFMAX(ass->y_end,   img->dst_y + img->h);
     }
+    ass->y_start = FFMAX(ass->y_start, 0) & ~((1 << ass->draw.vsub_max) - 1);
+    ass->y_end   = FFMIN(ass->y_end, height);
+
+    return 0;
+}
+
+static int overlay_ass_image_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    AssContext *ass = ctx->priv;
+    ThreadData *td = arg;
+    AVFrame *picref = td->frame;
+    const ASS_Image *image;
+    const int row_mask = (1 << ass->draw.vsub_max) - 1;
+    const int rows     = ass->y_end - ass->y_start;
+    /* slices start on chroma rows, so that blending subsampled planes gives
+       the same result however the images are sliced */
+    const int slice_start = ass->y_start + (rows * jobnr / nb_jobs & ~row_mask);
+    const int slice_end   = jobnr == nb_jobs - 1 ? ass->y_end :
+                            ass->y_start + (rows * (jobnr + 1) / nb_jobs & ~row_mask);
+    uint8_t *dst[MAX_PLANES];
+    int i;
+
+    if (slice_start >= slice_end)
+        return 0;
+    for (i = 0; i < ass->draw.nb_planes; i++)
+        dst[i] = picref->data[i] + (slice_start >> ass->draw.vsub[i]) * picref->linesize[i];
+
+    for (image = td->image, i = 0; image; image = image->next, i++)
+        ff_blend_mask(&ass->draw, &ass->colors[i],
+                      dst, picref->linesize,
+                      picref->width, slice_end - slice_start,
+                      image->bitmap, image->stride, image->w, image->h,
+                      3, 0, image->dst_x, image->dst_y - slice_start);
+
+    return 0;
 }
 
 static int filter_frame(AVFilterLink *inlink, AVFrame *picref)
@@ -190,11 +253,28 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *picref)
     double time_ms = picref->pts * av_q2d(inlink->time_base) * 1000;
     ASS_Image *image = ass_render_frame(ass->renderer, ass->track,
                                         time_ms, &detect_change);
+    ThreadData td;
+    int ret;
 
     if (detect_change)
         av_log(ctx, AV_LOG_DEBUG, "Change happened at time ms:%f\n", time_ms);
 
-    overlay_ass_image(ass, picref, image);
+    /* without any change, libass returns the same images as for the
+       previous frame: their colors and the rows they cover still hold */
+    if (detect_change || !image || !ass->nb_images) {
+        if ((ret = prepare_ass_images(ass, image, picref->height)) < 0) {
+            av_frame_free(&picref);
+            return ret;
+        }
+    }
+
+    if (ass->nb_images && ass->y_start < ass->y_end) {
+        td.frame = picref;
+        td.image = image;
+        ff_filter_execute(ctx, overlay_ass_image_slice, &td, NULL,
+                          FFMAX(1, FFMIN((ass->y_end - ass->y_start) >> ass->draw.vsub_max,
+                                         ff_filter_get_nb_threads(ctx))));
+    }
 
     return ff_filter_frame(outlink, picref);
 }
@@ -259,6 +339,7 @@ const AVFilter ff_vf_ass = {
     FILTER_INPUTS(ass_inputs),
     FILTER_OUTPUTS(ass_outputs),
     FILTER_QUERY_FUNC(query_formats),
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
     .priv_class    = &ass_class,
 };
 #endif
@@ -499,6 +580,7 @@ const AVFilter ff_vf_subtitles = {
     FILTER_INPUTS(ass_inputs),
     FILTER_OUTPUTS(ass_outputs),
     FILTER_QUERY_FUNC(query_formats),
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
     .priv_class    = &subtitles_class,
 };
 #endif
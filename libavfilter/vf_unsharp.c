@@ -370,4 +370,5 @@ const AVFilter ff_vf_unsharp = {
     FILTER_OUTPUTS(avfilter_vf_unsharp_outputs),
     FILTER_PIXFMTS_ARRAY(pix_fmts),
     .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
+    .flags_internal = FF_FILTER_FLAG_FRAME_THREADS,
 };
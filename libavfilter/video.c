@@ -104,7 +104,10 @@ AVFrame *ff_get_video_buffer(AVFilterLink *link, int w, int h)
 
     FF_TPRINTF_START(NULL, get_video_buffer); ff_tlog_link(NULL, link, 1);
 
-    if (link->dstpad->get_buffer.video)
+    /* with frame threading, the callback could run concurrently with the
+     * source or destination filter */
+    if (link->dstpad->get_buffer.video &&
+        !((link->src->thread_type | link->dst->thread_type) & AVFILTER_THREAD_FRAME))
         ret = link->dstpad->get_buffer.video(link, w, h);
 
     if (!ret)
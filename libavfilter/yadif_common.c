@@ -77,7 +77,8 @@ static int checkstride(YADIFContext *yadif, const AVFrame *a, const AVFrame *b)
 
 static void fixstride(AVFilterLink *link, AVFrame *f)
 {
-    AVFrame *dst = ff_default_get_video_buffer(link, f->width, f->height);
+    /* allocate from the output link, which is owned by this filter */
+    AVFrame *dst = ff_default_get_video_buffer(link->dst->outputs[0], f->width, f->height);
     if(!dst)
         return;
     av_frame_copy_props(dst, f);
@@ -22,6 +22,7 @@
 #include "slicethread.h"
 #include "mem.h"
 #include "thread.h"
+#include "threadpool_internal.h"
 #include "avassert.h"
 
 #define MAX_AUTO_THREADS 16
@@ -52,6 +53,11 @@ struct AVSliceThread {
     void            *priv;
     void            (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads);
     void            (*main_func)(void *priv);
+
+    /* set when the jobs run on a thread pool instead of on the workers */
+    AVThreadPool    *pool;
+    AVThreadPoolJob pool_job;
+    int             nb_pool_runs;   ///< pool runs neither finished nor cancelled, protected by done_mutex
 };
 
 static int run_jobs(AVSliceThread *ctx)
@@ -68,6 +74,34 @@ static int run_jobs(AVSliceThread *ctx)
     return current_job == nb_jobs + nb_active_threads - 1;
 }
 
+/**
+ * Run jobs on behalf of a thread pool. Unlike with own workers, any number
+ * of runs up to nb_active_threads may be cancelled, so no job is reserved
+ * for a particular run.
+ */
+static void run_pool_jobs(AVSliceThread *ctx)
+{
+    unsigned nb_jobs           = ctx->nb_jobs;
+    unsigned nb_active_threads = ctx->nb_active_threads;
+    unsigned threadnr = atomic_fetch_add_explicit(&ctx->first_job, 1, memory_order_acq_rel);
+    unsigned jobnr;
+
+    while ((jobnr = atomic_fetch_add_explicit(&ctx->current_job, 1, memory_order_acq_rel)) < nb_jobs)
+        ctx->worker_func(ctx->priv, jobnr, threadnr, nb_jobs, nb_active_threads);
+}
+
+static void pool_worker(void *v)
+{
+    AVSliceThread *ctx = v;
+
+    run_pool_jobs(ctx);
+
+    pthread_mutex_lock(&ctx->done_mutex);
+    if (!--ctx->nb_pool_runs)
+        pthread_cond_signal(&ctx->done_cond);
+    pthread_mutex_unlock(&ctx->done_mutex);
+}
+
 static void *attribute_align_arg thread_worker(void *v)
 {
     WorkerContext *w = v;
@@ -165,11 +199,94 @@ int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
     return nb_threads;
 }
 
+int avpriv_slicethread_create_pool(AVSliceThread **pctx, AVThreadPool *pool, void *priv,
+                                   void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                                   void (*main_func)(void *priv),
+                                   int nb_threads)
+{
+    AVSliceThread *ctx;
+    int ret;
+
+    av_assert0(nb_threads >= 0);
+    if (!nb_threads)
+        nb_threads = FFMIN(avpriv_thread_pool_nb_threads(pool) + 1, MAX_AUTO_THREADS);
+
+    *pctx = ctx = av_mallocz(sizeof(*ctx));
+    if (!ctx)
+        return AVERROR(ENOMEM);
+
+    if ((ret = pthread_mutex_init(&ctx->done_mutex, NULL))) {
+        av_freep(pctx);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_cond_init(&ctx->done_cond, NULL))) {
+        pthread_mutex_destroy(&ctx->done_mutex);
+        av_freep(pctx);
+        return AVERROR(ret);
+    }
+
+    ctx->priv        = priv;
+    ctx->worker_func = worker_func;
+    ctx->main_func   = main_func;
+    ctx->nb_threads  = nb_threads;
+    ctx->pool        = pool;
+    ctx->pool_job.func   = pool_worker;
+    ctx->pool_job.opaque = ctx;
+    atomic_init(&ctx->first_job, 0);
+    atomic_init(&ctx->current_job, 0);
+
+    return nb_threads;
+}
+
+static void execute_pool(AVSliceThread *ctx, int execute_main)
+{
+    int nb_runs = ctx->nb_active_threads, nb_cancelled = 0;
+
+    atomic_store_explicit(&ctx->first_job, 0, memory_order_relaxed);
+    atomic_store_explicit(&ctx->current_job, 0, memory_order_relaxed);
+    if (!ctx->main_func || !execute_main)
+        nb_runs--;
+
+    if (nb_runs) {
+        ctx->nb_pool_runs = nb_runs;
+        avpriv_thread_pool_submit(ctx->pool, &ctx->pool_job, nb_runs);
+    }
+
+    if (ctx->main_func && execute_main) {
+        ctx->main_func(ctx->priv);
+        /* take over the runs the pool has not started yet, if any */
+        nb_cancelled = avpriv_thread_pool_cancel(ctx->pool, &ctx->pool_job);
+        if (nb_cancelled)
+            run_pool_jobs(ctx);
+    } else {
+        run_pool_jobs(ctx);
+        /* all jobs have been taken, so the runs that have not started
+         * yet would not find anything to do */
+        if (nb_runs)
+            nb_cancelled = avpriv_thread_pool_cancel(ctx->pool, &ctx->pool_job);
+    }
+
+    if (nb_runs) {
+        pthread_mutex_lock(&ctx->done_mutex);
+        ctx->nb_pool_runs -= nb_cancelled;
+        while (ctx->nb_pool_runs)
+            pthread_cond_wait(&ctx->done_cond, &ctx->done_mutex);
+        pthread_mutex_unlock(&ctx->done_mutex);
+    }
+}
+
 void avpriv_slicethread_execute(AVSliceThread *ctx, int nb_jobs, int execute_main)
 {
     int nb_workers, i, is_last = 0;
 
     av_assert0(nb_jobs > 0);
+    if (ctx->pool) {
+        ctx->nb_jobs           = nb_jobs;
+        ctx->nb_active_threads = FFMIN(nb_jobs, ctx->nb_threads);
+        execute_pool(ctx, execute_main);
+        return;
+    }
+
     ctx->nb_jobs           = nb_jobs;
     ctx->nb_active_threads = FFMIN(nb_jobs, ctx->nb_threads);
     atomic_store_explicit(&ctx->first_job, 0, memory_order_relaxed);
@@ -209,6 +326,13 @@ void avpriv_slicethread_free(AVSliceThread **pctx)
         return;
 
     ctx = *pctx;
+    if (ctx->pool) {
+        pthread_cond_destroy(&ctx->done_cond);
+        pthread_mutex_destroy(&ctx->done_mutex);
+        av_freep(pctx);
+        return;
+    }
+
     nb_workers = ctx->nb_threads;
     if (!ctx->main_func)
         nb_workers--;
@@ -246,6 +370,15 @@ int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
     return AVERROR(ENOSYS);
 }
 
+int avpriv_slicethread_create_pool(AVSliceThread **pctx, AVThreadPool *pool, void *priv,
+                                   void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                                   void (*main_func)(void *priv),
+                                   int nb_threads)
+{
+    *pctx = NULL;
+    return AVERROR(ENOSYS);
+}
+
 void avpriv_slicethread_execute(AVSliceThread *ctx, int nb_jobs, int execute_main)
 {
     av_assert0(0);
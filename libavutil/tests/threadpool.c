@@ -0,0 +1,153 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Run slice threading contexts from several threads at once on a shared
+ * pool, including contexts executed from within the jobs of another one,
+ * and check that every job runs exactly once with a valid thread number.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/lfg.h"
+#include "libavutil/slicethread.h"
+#include "libavutil/thread.h"
+#include "libavutil/threadpool.h"
+
+#define NB_CONTEXTS   4
+#define NB_EXECUTIONS 300
+#define MAX_JOBS      40
+#define NB_THREADS    4
+
+typedef struct Context {
+    AVSliceThread *thread;
+    struct Context *nested;
+    AVLFG lfg;
+    int nb_threads;
+    int use_main;
+
+    atomic_int busy[NB_THREADS];
+    atomic_int runs[MAX_JOBS];
+    atomic_int main_runs;
+    int error;
+} Context;
+
+static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
+{
+    Context *c = priv;
+
+    if (threadnr < 0 || threadnr >= nb_threads || nb_threads > c->nb_threads ||
+        atomic_fetch_add(&c->busy[threadnr], 1)) {
+        c->error = 1;
+        return;
+    }
+    atomic_fetch_add(&c->runs[jobnr], 1);
+
+    /* execute another context from a pool thread */
+    if (c->nested && !jobnr)
+        avpriv_slicethread_execute(c->nested->thread, MAX_JOBS, 0);
+
+    atomic_fetch_sub(&c->busy[threadnr], 1);
+}
+
+static void main_func(void *priv)
+{
+    Context *c = priv;
+    atomic_fetch_add(&c->main_runs, 1);
+}
+
+static int check_runs(Context *c, int nb_jobs, int expected)
+{
+    for (int i = 0; i < nb_jobs; i++) {
+        if (atomic_load(&c->runs[i]) != expected)
+            return 1;
+        atomic_store(&c->runs[i], 0);
+    }
+    return c->error;
+}
+
+static void *thread_main(void *arg)
+{
+    Context *c = arg;
+
+    for (int i = 0; i < NB_EXECUTIONS && !c->error; i++) {
+        int nb_jobs = 1 + av_lfg_get(&c->lfg) % MAX_JOBS;
+
+        avpriv_slicethread_execute(c->thread, nb_jobs, c->use_main);
+        if (check_runs(c, nb_jobs, 1))
+            c->error = 1;
+        if (c->nested && check_runs(c->nested, MAX_JOBS, 1))
+            c->error = 1;
+    }
+    if (c->use_main && atomic_load(&c->main_runs) != NB_EXECUTIONS)
+        c->error = 1;
+    return NULL;
+}
+
+int main(void)
+{
+    static Context contexts[NB_CONTEXTS + 1];
+    pthread_t threads[NB_CONTEXTS];
+    AVThreadPool *pool;
+    int ret;
+
+    if ((ret = av_thread_pool_alloc(&pool, 3)) != 3) {
+        fprintf(stderr, "av_thread_pool_alloc failed: %d\n", ret);
+        return 1;
+    }
+
+    for (int i = 0; i <= NB_CONTEXTS; i++) {
+        Context *c = &contexts[i];
+
+        av_lfg_init(&c->lfg, i);
+        c->use_main = i == 1;
+        ret = avpriv_slicethread_create_pool(&c->thread, pool, c, worker_func,
+                                             c->use_main ? main_func : NULL,
+                                             i == 2 ? NB_THREADS - 1 : 0);
+        if (ret < 0 || ret > NB_THREADS) {
+            fprintf(stderr, "avpriv_slicethread_create_pool failed: %d\n", ret);
+            return 1;
+        }
+        c->nb_threads = ret;
+    }
+    /* the last context is only executed by the jobs of the first one */
+    contexts[0].nested = &contexts[NB_CONTEXTS];
+
+    for (int i = 0; i < NB_CONTEXTS; i++) {
+        if ((ret = pthread_create(&threads[i], NULL, thread_main, &contexts[i]))) {
+            fprintf(stderr, "pthread_create failed: %s.\n", strerror(ret));
+            return 1;
+        }
+    }
+    for (int i = 0; i < NB_CONTEXTS; i++)
+        pthread_join(threads[i], NULL);
+
+    ret = 0;
+    for (int i = 0; i <= NB_CONTEXTS; i++) {
+        if (contexts[i].error) {
+            fprintf(stderr, "context %d failed\n", i);
+            ret = 1;
+        }
+        avpriv_slicethread_free(&contexts[i].thread);
+    }
+    av_thread_pool_free(&pool);
+
+    return ret;
+}
@@ -0,0 +1,237 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+
+#include "avassert.h"
+#include "cpu.h"
+#include "error.h"
+#include "mem.h"
+#include "thread.h"
+#include "threadpool.h"
+#include "threadpool_internal.h"
+
+#if HAVE_THREADS
+
+typedef struct WorkerContext {
+    AVThreadPool *pool;
+    pthread_t     thread;
+    int           index;
+} WorkerContext;
+
+struct AVThreadPool {
+    WorkerContext   *workers;
+    int              nb_threads;
+
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;
+    /* FIFO of jobs with pending runs; a job leaves it once all of its runs
+     * have been started or cancelled */
+    AVThreadPoolJob *first;
+    AVThreadPoolJob *last;
+    int              finished;
+};
+
+static void unlink_job(AVThreadPool *pool, AVThreadPoolJob *job)
+{
+    AVThreadPoolJob **p = &pool->first, *prev = NULL;
+
+    while (*p != job) {
+        prev = *p;
+        p    = &(*p)->next;
+    }
+    *p = job->next;
+    if (pool->last == job)
+        pool->last = prev;
+    job->next = NULL;
+}
+
+static void *attribute_align_arg thread_worker(void *v)
+{
+    WorkerContext *w = v;
+    AVThreadPool *pool = w->pool;
+    char name[16];
+
+    snprintf(name, sizeof(name), "av:pool:%d", w->index);
+    ff_thread_setname(name);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        AVThreadPoolJob *job;
+
+        while (!pool->first && !pool->finished)
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        if (pool->finished)
+            break;
+
+        /* the first job stays at the head of the queue until all of its
+         * runs have started, so idle threads join it in parallel */
+        job = pool->first;
+        if (!--job->nb_pending)
+            unlink_job(pool, job);
+        pthread_mutex_unlock(&pool->mutex);
+
+        job->func(job->opaque);
+
+        pthread_mutex_lock(&pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+int av_thread_pool_alloc(AVThreadPool **ppool, int nb_threads)
+{
+    AVThreadPool *pool;
+    int i, ret;
+
+    av_assert0(nb_threads >= 0);
+    if (!nb_threads)
+        nb_threads = av_cpu_count();
+
+    *ppool = pool = av_mallocz(sizeof(*pool));
+    if (!pool)
+        return AVERROR(ENOMEM);
+
+    pool->workers = av_calloc(nb_threads, sizeof(*pool->workers));
+    if (!pool->workers) {
+        av_freep(ppool);
+        return AVERROR(ENOMEM);
+    }
+
+    if ((ret = pthread_mutex_init(&pool->mutex, NULL))) {
+        av_freep(&pool->workers);
+        av_freep(ppool);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_cond_init(&pool->cond, NULL))) {
+        pthread_mutex_destroy(&pool->mutex);
+        av_freep(&pool->workers);
+        av_freep(ppool);
+        return AVERROR(ret);
+    }
+
+    for (i = 0; i < nb_threads; i++) {
+        WorkerContext *w = &pool->workers[i];
+
+        w->pool  = pool;
+        w->index = i;
+        if ((ret = pthread_create(&w->thread, NULL, thread_worker, w))) {
+            av_thread_pool_free(ppool);
+            return AVERROR(ret);
+        }
+        pool->nb_threads++;
+    }
+
+    return nb_threads;
+}
+
+void av_thread_pool_free(AVThreadPool **ppool)
+{
+    AVThreadPool *pool = *ppool;
+
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    av_assert0(!pool->first);
+    pool->finished = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->nb_threads; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    av_freep(&pool->workers);
+    av_freep(ppool);
+}
+
+int avpriv_thread_pool_nb_threads(const AVThreadPool *pool)
+{
+    return pool->nb_threads;
+}
+
+void avpriv_thread_pool_submit(AVThreadPool *pool, AVThreadPoolJob *job, int nb_runs)
+{
+    av_assert0(nb_runs > 0);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (!job->nb_pending) {
+        job->next = NULL;
+        if (pool->last)
+            pool->last->next = job;
+        else
+            pool->first = job;
+        pool->last = job;
+    }
+    job->nb_pending += nb_runs;
+
+    if (nb_runs > 1)
+        pthread_cond_broadcast(&pool->cond);
+    else
+        pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+int avpriv_thread_pool_cancel(AVThreadPool *pool, AVThreadPoolJob *job)
+{
+    int nb_cancelled;
+
+    pthread_mutex_lock(&pool->mutex);
+    nb_cancelled = job->nb_pending;
+    if (nb_cancelled)
+        unlink_job(pool, job);
+    job->nb_pending = 0;
+    pthread_mutex_unlock(&pool->mutex);
+
+    return nb_cancelled;
+}
+
+#else /* HAVE_THREADS */
+
+int av_thread_pool_alloc(AVThreadPool **pool, int nb_threads)
+{
+    *pool = NULL;
+    return AVERROR(ENOSYS);
+}
+
+void av_thread_pool_free(AVThreadPool **pool)
+{
+    av_assert0(!pool || !*pool);
+}
+
+int avpriv_thread_pool_nb_threads(const AVThreadPool *pool)
+{
+    av_assert0(0);
+    return 0;
+}
+
+void avpriv_thread_pool_submit(AVThreadPool *pool, AVThreadPoolJob *job, int nb_runs)
+{
+    av_assert0(0);
+}
+
+int avpriv_thread_pool_cancel(AVThreadPool *pool, AVThreadPoolJob *job)
+{
+    av_assert0(0);
+    return 0;
+}
+
+#endif /* HAVE_THREADS */
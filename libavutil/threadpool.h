@@ -0,0 +1,55 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVUTIL_THREADPOOL_H
+#define AVUTIL_THREADPOOL_H
+
+/**
+ * A fixed set of worker threads that can be shared between codec contexts
+ * and filter graphs.
+ *
+ * By default, every AVCodecContext and AVFilterGraph that uses
+ * multithreading creates threads of its own. A caller running many of them
+ * at once can instead allocate a single pool and attach it through
+ * AVCodecContext.thread_pool and AVFilterGraph.thread_pool, so that their
+ * slice and frame threading jobs all run on the threads of the pool.
+ *
+ * The pool is owned by the caller. It must outlive every codec context and
+ * filter graph it is attached to.
+ */
+typedef struct AVThreadPool AVThreadPool;
+
+/**
+ * Allocate a thread pool and start its worker threads.
+ *
+ * @param pool       pointer to the thread pool
+ * @param nb_threads number of worker threads, 0 for one per CPU
+ * @return  the number of worker threads on success; <0 for error, in
+ *          particular AVERROR(ENOSYS) if lavu was built without thread
+ *          support
+ */
+int av_thread_pool_alloc(AVThreadPool **pool, int nb_threads);
+
+/**
+ * Stop the worker threads and free the pool.
+ *
+ * All codec contexts and filter graphs using the pool must have been freed.
+ */
+void av_thread_pool_free(AVThreadPool **pool);
+
+#endif /* AVUTIL_THREADPOOL_H */
@@ -0,0 +1,61 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVUTIL_THREADPOOL_INTERNAL_H
+#define AVUTIL_THREADPOOL_INTERNAL_H
+
+#include "threadpool.h"
+
+/**
+ * A job that can be queued on a thread pool.
+ *
+ * The job is owned by the submitter and must stay valid until all of its
+ * runs have either returned or been cancelled.
+ *
+ * Jobs are started in the order they were submitted. A job may therefore
+ * block waiting for a job submitted before it, but never for one submitted
+ * after it, nor for a free pool thread.
+ */
+typedef struct AVThreadPoolJob {
+    void (*func)(void *opaque);
+    void *opaque;
+
+    /* The following fields are owned by the pool. */
+    int nb_pending;                 ///< runs queued but not started yet
+    struct AVThreadPoolJob *next;
+} AVThreadPoolJob;
+
+/**
+ * @return the number of worker threads of the pool
+ */
+int avpriv_thread_pool_nb_threads(const AVThreadPool *pool);
+
+/**
+ * Queue nb_runs calls of job->func(job->opaque), which may run in parallel
+ * on different pool threads.
+ */
+void avpriv_thread_pool_submit(AVThreadPool *pool, AVThreadPoolJob *job, int nb_runs);
+
+/**
+ * Remove the runs of the job that have not started yet from the queue.
+ *
+ * @return the number of runs removed
+ */
+int avpriv_thread_pool_cancel(AVThreadPool *pool, AVThreadPoolJob *job);
+
+#endif /* AVUTIL_THREADPOOL_INTERNAL_H */
@@ -125,6 +125,18 @@ probegaplessinfo(){
     tail -n 9 "$framefile1"
 }
 
+probe_input_list(){
+    jobs=$1
+    shift
+    listfile="${outdir}/${test}.list"
+    cleanfiles="$cleanfiles $listfile"
+    for input in "$@"; do
+        target_path $input
+    done > "$listfile"
+    run ffprobe${PROGSUF}${EXECSUF} -bitexact -jobs $jobs -input_list $(target_path $listfile) \
+        -show_entries format=format_name,nb_streams,size -of compact
+}
+
 ffmpeg(){
     dec_opts="-hwaccel $hwaccel -threads $threads -thread_type $thread_type"
     ffmpeg_args="-nostdin -nostats -noauto_conversion_filters -cpuflags $cpuflags"
@@ -572,6 +584,32 @@ venc_data(){
     run tools/venc_data_dump${EXECSUF} ${file} ${stream} ${frames} ${threads} ${thread_type}
 }
 
+stats_pipeline(){
+    statsfile="${outdir}/${test}.jsonl"
+    cleanfiles="$cleanfiles $statsfile"
+    ffmpeg -stats_pipeline $(target_path $statsfile) "$@" -f null - || return
+    # only the last line is stable, and without the times
+    tail -n 1 $statsfile | sed 's/[0-9]*\.[0-9]*/T/g'
+}
+
+filter_threads_cmp(){
+    # the output must be the same with and without filter threads
+    out1="${outdir}/${test}.1.crc"
+    out2="${outdir}/${test}.2.crc"
+    cleanfiles="$cleanfiles $out1 $out2"
+    ffmpeg -filter_threads 1 "$@" -bitexact -f framecrc - >$out1 || return
+    ffmpeg -filter_threads 4 "$@" -bitexact -f framecrc - >$out2 || return
+    diff $out1 $out2
+}
+
+worker(){
+    # each argument is a job, run one after the other; keep the job output
+    # and the result reported for each job
+    printf '%s\n' "$@" |
+        run ffmpeg${PROGSUF}${EXECSUF} -nostdin -nostats -v verbose -worker - 2>&1 |
+        grep -e '^Job [0-9]* ' -e '^[#0-9]'
+}
+
 null(){
     :
 }
@@ -100,6 +100,14 @@ fate-acodec-adpcm-ms-trellis:      FMT = wav
 fate-acodec-adpcm-swf-trellis:     FMT = flv
 fate-acodec-adpcm-yamaha-trellis:  FMT = wav
 
+# the output must not depend on the number of threads
+FATE_ACODEC-$(call ENCMUX, AAC, ADTS, ARESAMPLE_FILTER) += fate-acodec-aac fate-acodec-aac-threads
+fate-acodec-aac fate-acodec-aac-threads: AACOPTS = -c:a aac -b:a 128k -flags +bitexact -af aresample -f adts
+fate-acodec-aac: CMD = md5 -i $(TARGET_PATH)/$(SRC) $(AACOPTS) -threads 1
+fate-acodec-aac-threads: CMD = md5 -i $(TARGET_PATH)/$(SRC) $(AACOPTS) -threads 4 -thread_type slice
+fate-acodec-aac fate-acodec-aac-threads: CMP = oneline
+fate-acodec-aac fate-acodec-aac-threads: REF = 68de565e33894fc218bde01f49d6d19b
+
 FATE_ACODEC-$(call ENCDEC, MP2, MP2 MP3, ARESAMPLE_FILTER) += fate-acodec-mp2
 fate-acodec-mp2: FMT = mp2
 fate-acodec-mp2: CMP_SHIFT = -1924
@@ -129,13 +137,21 @@ fate-acodec-dca2: CMP_SHIFT = -2048
 fate-acodec-dca2: CMP_TARGET = 534
 fate-acodec-dca2: SIZE_TOLERANCE = 1632
 
-FATE_ACODEC-$(call ENCDEC, FLAC, FLAC) += fate-acodec-flac fate-acodec-flac-exact-rice
+FATE_ACODEC-$(call ENCDEC, FLAC, FLAC) += fate-acodec-flac fate-acodec-flac-exact-rice \
+                                          fate-acodec-flac-level12 fate-acodec-flac-threads
 fate-acodec-flac: FMT = flac
 fate-acodec-flac: CODEC = flac -compression_level 2
 
 fate-acodec-flac-exact-rice: FMT = flac
 fate-acodec-flac-exact-rice: CODEC = flac -compression_level 2 -exact_rice_parameters 1
 
+# the output must not depend on the number of threads
+fate-acodec-flac-level12 fate-acodec-flac-threads: FLACOPTS = -c:a flac -compression_level 12 -flags +bitexact -f flac
+fate-acodec-flac-level12: CMD = md5 -i $(TARGET_PATH)/$(SRC) $(FLACOPTS) -threads 1
+fate-acodec-flac-threads: CMD = md5 -i $(TARGET_PATH)/$(SRC) $(FLACOPTS) -threads 4 -thread_type slice
+fate-acodec-flac-level12 fate-acodec-flac-threads: CMP = oneline
+fate-acodec-flac-level12 fate-acodec-flac-threads: REF = 3f7a3a365fc127fbf8553925e4ccb104
+
 FATE_ACODEC-$(call ENCDEC, G723_1, G723_1, ARESAMPLE_FILTER) += fate-acodec-g723_1
 fate-acodec-g723_1: tests/data/asynth-8000-1.wav
 fate-acodec-g723_1: SRC = tests/data/asynth-8000-1.wav
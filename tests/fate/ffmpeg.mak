@@ -41,6 +41,22 @@ fate-ffmpeg-filter_colorkey: CMD = framecrc -auto_conversion_filters -idct simpl
 FATE_FFMPEG-$(call FILTERFRAMECRC, COLOR) += fate-ffmpeg-lavfi
 fate-ffmpeg-lavfi: CMD = framecrc -lavfi color=d=1:r=5 -fflags +bitexact
 
+# the frames held by the encoders, including the B-frames of mpeg4 and the
+# priming of aac, must all be accounted for at the end
+FATE_FFMPEG-$(call ALLYES, TESTSRC2_FILTER SINE_FILTER ARESAMPLE_FILTER LAVFI_INDEV \
+                           MPEG4_ENCODER AAC_ENCODER NULL_MUXER) += fate-ffmpeg-stats-pipeline
+fate-ffmpeg-stats-pipeline: CMD = stats_pipeline -f lavfi -i testsrc2=d=1 -f lavfi -i sine=d=1 \
+    -c:v mpeg4 -bf 2 -c:a aac -af aresample
+
+# jobs read from stdin by a worker, the second one fails
+FATE_FFMPEG_FORK-$(call ALLYES, TESTSRC2_FILTER COLOR_FILTER LAVFI_INDEV \
+                                RAWVIDEO_ENCODER FRAMECRC_MUXER NULL_MUXER) += fate-ffmpeg-worker
+fate-ffmpeg-worker: CMD = worker \
+    "-f lavfi -i testsrc2=d=0.2 -flags +bitexact -fflags +bitexact -f framecrc -" \
+    "-i $(TARGET_PATH)/tests/data/fate/ffmpeg-worker.nonexistent -f null -" \
+    "-f lavfi -i 'color=c=red:s=16x16:d=0.12' -flags +bitexact -fflags +bitexact -f framecrc -"
+FATE_FFMPEG-$(HAVE_FORK) += $(FATE_FFMPEG_FORK-yes)
+
 FATE_SAMPLES_FFMPEG-$(call ENCDEC2, MPEG4, RAWVIDEO, AVI, RAWVIDEO_DEMUXER FRAMECRC_MUXER) += fate-force_key_frames
 fate-force_key_frames: tests/data/vsynth_lena.yuv
 fate-force_key_frames: CMD = enc_dec \
@@ -107,6 +123,20 @@ fate-shortest-sub: CMD = transcode
         "-filter_complex 'color=s=1x1:rate=1:duration=400' -pix_fmt rgb24 -allow_raw_vfw 1 -c:s copy -c:v rawvideo"  \
         "-map 0 -c copy -shortest -shortest_buf_duration 40 -max_delay 1"
 
+# the sparse stream ends at 1s, but the buffer only holds about three raw
+# frames, so the dense stream is released past that point as it overflows
+FATE_FFMPEG-$(call TRANSCODE, RAWVIDEO, NUT, COLOR_FILTER RAWVIDEO_DEMUXER) += fate-shortest-buf-size
+fate-shortest-buf-size: tests/data/vsynth1.yuv
+fate-shortest-buf-size: CMD = transcode rawvideo $(TARGET_PATH)/tests/data/vsynth1.yuv nut \
+        "-filter_complex 'color=s=16x16:rate=2:duration=1[sparse]' -map 0:v -map '[sparse]' -c:v rawvideo" \
+        "-map 0 -c copy -shortest -shortest_buf_size 500000" "" "" "" "-s 352x288 -pix_fmt yuv420p"
+
+# each GOP is encoded by its own encoder, the timestamps must be continuous
+FATE_FFMPEG-$(call ENCMUX, MPEG2VIDEO, FRAMECRC, RAWVIDEO_DEMUXER RAWVIDEO_DECODER) += fate-ffmpeg-enc-segments
+fate-ffmpeg-enc-segments: tests/data/vsynth1.yuv
+fate-ffmpeg-enc-segments: CMD = framecrc -f rawvideo -s 352x288 -pix_fmt yuv420p \
+        -i $(TARGET_PATH)/tests/data/vsynth1.yuv -c:v mpeg2video -g 12 -bf 2 -enc_segments 3
+
 # Basic test for fix_sub_duration, which calculates duration based on the
 # following subtitle's pts.
 FATE_SAMPLES_FFMPEG-$(call FILTERDEMDECENCMUX, MOVIE, MPEGVIDEO, \
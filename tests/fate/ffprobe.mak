@@ -29,6 +29,28 @@ FATE_FFPROBE-$(CONFIG_AVDEVICE) += fate-ffprobe_xml
 fate-ffprobe_xml: $(FFPROBE_TEST_FILE)
 fate-ffprobe_xml: CMD = run $(FFPROBE_COMMAND) -of xml
 
+FATE_FFPROBE-$(call ALLYES, AVDEVICE MOV_MUXER MOV_DEMUXER) += fate-ffprobe_index
+fate-ffprobe_index: tests/data/ffprobe-test.mov
+fate-ffprobe_index: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -index_only -count_packets -show_entries packet:stream=index,nb_read_packets -bitexact -of compact $(TARGET_PATH)/tests/data/ffprobe-test.mov
+
+# the NUT syncpoints and the Matroska cues only give positions to seek to, the
+# packet sizes are read from the file
+FATE_FFPROBE-$(CONFIG_AVDEVICE) += fate-ffprobe_index_nut
+fate-ffprobe_index_nut: $(FFPROBE_TEST_FILE)
+fate-ffprobe_index_nut: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -index_only -count_packets -show_entries packet:stream=index,nb_read_packets -bitexact -of compact $(TARGET_PATH)/$(FFPROBE_TEST_FILE)
+
+FATE_FFPROBE-$(call ALLYES, AVDEVICE MATROSKA_MUXER MATROSKA_DEMUXER) += fate-ffprobe_index_mkv
+fate-ffprobe_index_mkv: tests/data/ffprobe-test.mkv
+fate-ffprobe_index_mkv: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -index_only -count_packets -show_entries packet:stream=index,nb_read_packets -bitexact -of compact $(TARGET_PATH)/tests/data/ffprobe-test.mkv
+
+# the inputs are probed in parallel, but must be printed in the list order
+FATE_FFPROBE_FORK-$(call ALLYES, AVDEVICE MOV_MUXER MOV_DEMUXER) += fate-ffprobe_input_list
+fate-ffprobe_input_list: $(FFPROBE_TEST_FILE) tests/data/ffprobe-test.mov
+fate-ffprobe_input_list: CMD = probe_input_list 3 $(FFPROBE_TEST_FILE) tests/data/ffprobe-test.mov \
+    tests/data/ffprobe-test.mov $(FFPROBE_TEST_FILE) tests/data/ffprobe-test.mov $(FFPROBE_TEST_FILE)
+
+FATE_FFPROBE-$(HAVE_FORK) += $(FATE_FFPROBE_FORK-yes)
+
 FATE_FFPROBE_SCHEMA-$(CONFIG_AVDEVICE) += fate-ffprobe_xsd
 fate-ffprobe_xsd: $(FFPROBE_TEST_FILE)
 fate-ffprobe_xsd: CMD = run $(FFPROBE_COMMAND) -noprivate -of xml=q=1:x=1 | \
@@ -8,6 +8,12 @@ fate-filter-owdenoise-sample: CMP_TARGET = 1
 fate-filter-owdenoise-sample: FUZZ = 3539
 fate-filter-owdenoise-sample: CMP = oneoff
 
+# the rendering depends on the fonts available, only the blending is checked
+FATE_FILTER_SAMPLES-$(call FILTERDEMDEC, TESTSRC2 SUBTITLES, ASS, ASS) += fate-filter-subtitles-threads
+fate-filter-subtitles-threads: CMD = filter_threads_cmp \
+    -filter_complex testsrc2=s=320x240:r=5:d=20,subtitles=$(TARGET_SAMPLES)/sub/1ededcbd7b.ass
+fate-filter-subtitles-threads: CMP = null
+
 FATE_FILTER_SAMPLES-$(call FILTERDEMDEC, PERMS DELOGO, RM, RV30) += fate-filter-delogo
 fate-filter-delogo: CMD = framecrc -i $(TARGET_SAMPLES)/real/rv30.rm -vf perms=random,delogo=show=0:x=290:y=25:w=26:h=16 -an
 
@@ -720,6 +726,24 @@ FATE_FILTER-$(call ALLYES, TESTSRC2_FILTER SPLIT_FILTER AVGBLUR_FILTER        \
                            METADATA_FILTER WRAPPED_AVFRAME_ENCODER NULL_MUXER \
                            PIPE_PROTOCOL) += $(FATE_FILTER_REFCMP_METADATA-yes)
 
+FATE_FILTER-$(call ALLYES, NULLSRC_FILTER SPLIT_FILTER NULL_FILTER) += fate-filter-graphsched
+fate-filter-graphsched: libavfilter/tests/graphsched$(EXESUF)
+fate-filter-graphsched: CMD = run libavfilter/tests/graphsched$(EXESUF)
+
+FATE_FILTER-$(call ALLYES, TESTSRC2_FILTER HFLIP_FILTER UNSHARP_FILTER) += fate-filter-graphexecute
+fate-filter-graphexecute: libavfilter/tests/graphexecute$(EXESUF)
+fate-filter-graphexecute: CMD = run libavfilter/tests/graphexecute$(EXESUF)
+
+FATE_FILTER-$(call FILTERFRAMECRC, TESTSRC2 SETFIELD YADIF HFLIP UNSHARP BWDIF) += fate-filter-pipeline
+fate-filter-pipeline: CMD = framecrc -filter_thread_type frame -filter_complex_threads 4 -lavfi testsrc2=r=7:d=4,setfield=tff,yadif=1,hflip,unsharp,bwdif,hflip
+
+FATE_FILTER-$(call FILTERFRAMECRC, TESTSRC2 SPLIT SCALE HFLIP UNSHARP HSTACK) += fate-filter-pipeline-split
+fate-filter-pipeline-split: CMD = framecrc -filter_thread_type frame -filter_complex_threads 4 -lavfi "sws_flags=+accurate_rnd+bitexact\;testsrc2=s=320x180:d=1,split=4[a][b][c][d]\;[a]scale=80:45[a1]\;[b]scale=120:45:flags=lanczos+accurate_rnd+bitexact[b1]\;[c]hflip,scale=100:45[c1]\;[d]unsharp,scale=60:45[d1]\;[a1][b1][c1][d1]hstack=4"
+
+# the color range of the input changes midway, reconfiguring scale
+FATE_FILTER-$(call FILTERFRAMECRC, TESTSRC2 SETPARAMS CONCAT SCALE HFLIP) += fate-filter-pipeline-scale-range
+fate-filter-pipeline-scale-range: CMD = framecrc -filter_thread_type frame -filter_complex_threads 4 -lavfi "sws_flags=+accurate_rnd+bitexact\;testsrc2=s=160x90:d=1,format=yuv420p[a]\;testsrc2=s=160x90:d=1,format=yuv420p,setparams=range=pc[b]\;[a][b]concat,scale=80:45,hflip,format=rgb24"
+
 FATE_SAMPLES_FFPROBE += $(FATE_METADATA_FILTER-yes)
 FATE_SAMPLES_FFMPEG += $(FATE_FILTER_SAMPLES-yes)
 FATE_FFMPEG += $(FATE_FILTER-yes)
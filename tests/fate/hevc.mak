@@ -210,6 +210,19 @@ FATE_HEVC-$(call FRAMECRC, HEVC, HEVC, HEVC_PARSER SCALE_FILTER) +=         \
                                                     $(HEVC_TESTS_422_10BIN) \
                                                     $(HEVC_TESTS_444_12BIT) \
 
+# the WPP streams decoded with frame and WPP threading combined, checked
+# against the refs of the conformance tests above
+HEVC_TESTS_WPP_8BIT  = $(addprefix fate-hevc-wpp-threads-, $(filter WPP_%, $(HEVC_SAMPLES_8BIT)))
+HEVC_TESTS_WPP_10BIT = $(addprefix fate-hevc-wpp-threads-, $(filter WPP_%, $(HEVC_SAMPLES_10BIT)))
+
+$(HEVC_TESTS_WPP_8BIT): SCALE_OPTS := -pix_fmt yuv420p
+$(HEVC_TESTS_WPP_10BIT): SCALE_OPTS := -pix_fmt yuv420p10le -vf scale
+fate-hevc-wpp-threads-%: CMD = threads=2 thread_type=frame+slice framecrc -wpp_threads 4 -flags unaligned -i $(TARGET_SAMPLES)/hevc-conformance/$(subst fate-hevc-wpp-threads-,,$(@)).bit $(SCALE_OPTS)
+fate-hevc-wpp-threads-%: REF = $(SRC_PATH)/tests/ref/fate/$(subst fate-hevc-wpp-threads-,hevc-conformance-,$(@))
+
+FATE_HEVC-$(call FRAMECRC, HEVC, HEVC, HEVC_PARSER) += $(HEVC_TESTS_WPP_8BIT)
+FATE_HEVC-$(call FRAMECRC, HEVC, HEVC, HEVC_PARSER SCALE_FILTER) += $(HEVC_TESTS_WPP_10BIT)
+
 fate-hevc-paramchange-yuv420p-yuv420p10: CMD = framecrc -vsync passthrough -i $(TARGET_SAMPLES)/hevc/paramchange_yuv420p_yuv420p10.hevc -sws_flags area+accurate_rnd+bitexact
 FATE_HEVC-$(call FRAMECRC, HEVC, HEVC, HEVC_PARSER SCALE_FILTER LARGE_TESTS) += fate-hevc-paramchange-yuv420p-yuv420p10
 
@@ -70,6 +70,11 @@ FATE_LIBAVCODEC-$(CONFIG_IIRFILTER) += fate-iirfilter
 fate-iirfilter: libavcodec/tests/iirfilter$(EXESUF)
 fate-iirfilter: CMD = run libavcodec/tests/iirfilter$(EXESUF)
 
+FATE_LIBAVCODEC-$(CONFIG_GIF_ENCODER) += fate-lzw
+fate-lzw: libavcodec/tests/lzw$(EXESUF)
+fate-lzw: CMD = run libavcodec/tests/lzw$(EXESUF)
+fate-lzw: CMP = null
+
 FATE_LIBAVCODEC-$(CONFIG_MPEGVIDEO) += fate-mpeg12framerate
 fate-mpeg12framerate: libavcodec/tests/mpeg12framerate$(EXESUF)
 fate-mpeg12framerate: CMD = run libavcodec/tests/mpeg12framerate$(EXESUF)
@@ -103,5 +108,14 @@ FATE_LIBAVCODEC-yes += fate-libavcodec-htmlsubtitles
 fate-libavcodec-htmlsubtitles: libavcodec/tests/htmlsubtitles$(EXESUF)
 fate-libavcodec-htmlsubtitles: CMD = run libavcodec/tests/htmlsubtitles$(EXESUF)
 
+FATE_LIBAVCODEC-$(CONFIG_RAWVIDEO_DECODER) += fate-framepool
+fate-framepool: libavcodec/tests/framepool$(EXESUF)
+fate-framepool: CMD = run libavcodec/tests/framepool$(EXESUF)
+
+FATE_LIBAVCODEC-$(HAVE_THREADS) += fate-threadprogress
+fate-threadprogress: libavcodec/tests/threadprogress$(EXESUF)
+fate-threadprogress: CMD = run libavcodec/tests/threadprogress$(EXESUF)
+fate-threadprogress: CMP = null
+
 FATE-$(CONFIG_AVCODEC) += $(FATE_LIBAVCODEC-yes)
 fate-libavcodec: $(FATE_LIBAVCODEC-yes)
@@ -492,3 +492,34 @@ fate-vsynth2: $(FATE_VSYNTH2)
 fate-vsynth_lena: $(FATE_VSYNTH_LENA)
 fate-vsynth3: $(FATE_VSYNTH3)
 fate-vcodec:  fate-vsynth1 fate-vsynth_lena fate-vsynth2 fate-vsynth3
+
+# intra-only encoding with frame threads sharing the rate control
+FATE_VCODEC_FRAMECRC-$(call ALLYES, RAWVIDEO_DEMUXER MPEG2VIDEO_ENCODER FRAMECRC_MUXER) += fate-mpeg2-intra-frame-thread
+fate-mpeg2-intra-frame-thread: tests/data/vsynth1.yuv
+fate-mpeg2-intra-frame-thread: CMD = framecrc -f rawvideo -s 352x288 -pix_fmt yuv420p \
+  -i $(TARGET_PATH)/tests/data/vsynth1.yuv -c:v mpeg2video -g 1 \
+  -b:v 8M -maxrate 8M -minrate 8M -bufsize 1835k -threads 3 -thread_type frame
+
+# the bitrate with more frame threads than the rate control has frames to learn from
+FATE_VCODEC_TRANSCODE-$(call TRANSCODE, MPEG2VIDEO, NUT, RAWVIDEO_DEMUXER) += fate-mpeg2-intra-frame-thread-cbr
+fate-mpeg2-intra-frame-thread-cbr: tests/data/vsynth1.yuv
+fate-mpeg2-intra-frame-thread-cbr: CMD = transcode rawvideo $(TARGET_PATH)/tests/data/vsynth1.yuv nut \
+  "-c:v mpeg2video -g 1 -b:v 8M -maxrate 8M -minrate 8M -bufsize 1835k -threads 8 -thread_type frame" \
+  "-c copy" "-show_entries format=bit_rate" "" "" "-s 352x288 -pix_fmt yuv420p"
+
+# rows deflated in slices, decoded back to check the resulting zlib stream
+FATE_VCODEC_TRANSCODE-$(call TRANSCODE, PNG, NUT, RAWVIDEO_DEMUXER SCALE_FILTER) += fate-png-slices
+fate-png-slices: tests/data/vsynth1.yuv
+fate-png-slices: CMD = transcode rawvideo $(TARGET_PATH)/tests/data/vsynth1.yuv nut \
+  "-auto_conversion_filters -c:v png -pix_fmt rgb24 -pred mixed -slices 5 -threads 2 -thread_type slice -frames:v 5" \
+  "" "" "" "" "-s 352x288 -pix_fmt yuv420p"
+
+# a single tile, decoded by codeblock with slice threads
+FATE_VCODEC_TRANSCODE-$(call TRANSCODE, JPEG2000, NUT, RAWVIDEO_DEMUXER SCALE_FILTER) += fate-jpeg2000-single-tile
+fate-jpeg2000-single-tile: tests/data/vsynth1.yuv
+fate-jpeg2000-single-tile: CMD = transcode rawvideo $(TARGET_PATH)/tests/data/vsynth1.yuv nut \
+  "-auto_conversion_filters -c:v jpeg2000 -strict experimental -pix_fmt rgb24 -tile_width 352 -tile_height 288 -frames:v 5" \
+  "" "" "" "-threads 4 -thread_type slice" "-s 352x288 -pix_fmt yuv420p"
+
+FATE_AVCONV += $(FATE_VCODEC_FRAMECRC-yes) $(FATE_VCODEC_TRANSCODE-yes)
+fate-vcodec: $(FATE_VCODEC_FRAMECRC-yes) $(FATE_VCODEC_TRANSCODE-yes)
@@ -0,0 +1,207 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Measure the throughput of the fftools thread queue, by passing empty
+ * packets from one or more producer threads to a single consumer, in both
+ * the mutex-based and the lock-free mode.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavcodec/packet.h"
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+
+#include "fftools/objpool.h"
+#include "fftools/thread_queue.h"
+
+#define MAX_PRODUCERS 64
+
+typedef struct Producer {
+    ThreadQueue *tq;
+    unsigned int idx;
+    int64_t      nb_messages;
+    int          ret;
+} Producer;
+
+static void pkt_move(void *dst, void *src)
+{
+    av_packet_move_ref(dst, src);
+}
+
+static void *producer_thread(void *arg)
+{
+    Producer *p = arg;
+    AVPacket *pkt = av_packet_alloc();
+    int ret = 0;
+
+    if (!pkt) {
+        ret = AVERROR(ENOMEM);
+        goto finish;
+    }
+
+    for (int64_t i = 0; i < p->nb_messages; i++) {
+        pkt->pts = i;
+        ret = tq_send(p->tq, p->idx, pkt);
+        if (ret < 0)
+            break;
+    }
+
+finish:
+    tq_send_finish(p->tq, p->idx);
+    av_packet_free(&pkt);
+    p->ret = ret;
+    return NULL;
+}
+
+static int run(int flags, unsigned int nb_producers, size_t queue_size,
+               int64_t nb_messages)
+{
+    Producer   producers[MAX_PRODUCERS];
+    pthread_t  threads[MAX_PRODUCERS];
+    int64_t    next_pts[MAX_PRODUCERS] = { 0 };
+    ThreadQueue *tq;
+    ObjPool     *op;
+    AVPacket   *pkt;
+    int64_t     start, elapsed, received = 0;
+    unsigned int nb_started = 0;
+    int ret = 0;
+
+    pkt = av_packet_alloc();
+    op  = objpool_alloc_packets();
+    if (!pkt || !op) {
+        objpool_free(&op);
+        av_packet_free(&pkt);
+        return AVERROR(ENOMEM);
+    }
+
+    tq = tq_alloc(nb_producers, queue_size, op, pkt_move, flags);
+    if (!tq) {
+        objpool_free(&op);
+        av_packet_free(&pkt);
+        return AVERROR(ENOMEM);
+    }
+
+    start = av_gettime_relative();
+
+    for (; nb_started < nb_producers; nb_started++) {
+        Producer *p = &producers[nb_started];
+
+        p->tq          = tq;
+        p->idx         = nb_started;
+        p->nb_messages = nb_messages / nb_producers;
+        p->ret         = 0;
+
+        ret = pthread_create(&threads[nb_started], NULL, producer_thread, p);
+        if (ret) {
+            ret = AVERROR(ret);
+            break;
+        }
+    }
+    /* streams without a producer are finished immediately */
+    for (unsigned int i = nb_started; i < nb_producers; i++)
+        tq_send_finish(tq, i);
+
+    while (1) {
+        int stream_idx;
+
+        ret = tq_receive(tq, &stream_idx, pkt);
+        if (stream_idx < 0) {
+            ret = 0;
+            break;
+        }
+        if (ret < 0)
+            continue;
+
+        if (pkt->pts != next_pts[stream_idx]) {
+            fprintf(stderr, "Stream %d: got packet %"PRId64", expected %"PRId64"\n",
+                    stream_idx, pkt->pts, next_pts[stream_idx]);
+            ret = AVERROR_BUG;
+        }
+        next_pts[stream_idx]++;
+        received++;
+        av_packet_unref(pkt);
+    }
+
+    elapsed = av_gettime_relative() - start;
+
+    for (unsigned int i = 0; i < nb_started; i++) {
+        pthread_join(threads[i], NULL);
+        if (producers[i].ret < 0 && ret >= 0)
+            ret = producers[i].ret;
+    }
+
+    if (ret >= 0)
+        printf("%-9s producers: %2u queue: %4zu  %10"PRId64" msgs in %8.3f ms"
+               "  %12.0f msgs/s\n",
+               flags & TQ_FLAG_LOCKLESS ? "lockless" : "mutex",
+               nb_producers, queue_size, received, elapsed / 1000.0,
+               elapsed ? received * 1000000.0 / elapsed : 0.0);
+
+    tq_free(&tq);
+    av_packet_free(&pkt);
+
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int nb_producers = 1;
+    size_t       queue_size   = 8;
+    int64_t      nb_messages  = 1000000;
+    int          lockless_flags, ret;
+
+    if (argc > 4 || (argc > 1 && !strcmp(argv[1], "-h"))) {
+        fprintf(stderr, "Usage: %s [producers [queue_size [messages]]]\n",
+                argv[0]);
+        return 1;
+    }
+
+    if (argc > 1)
+        nb_producers = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        queue_size   = strtoul(argv[2], NULL, 0);
+    if (argc > 3)
+        nb_messages  = strtoll(argv[3], NULL, 0);
+
+    if (!nb_producers || nb_producers > MAX_PRODUCERS || !queue_size ||
+        nb_messages <= 0) {
+        fprintf(stderr, "Invalid parameters\n");
+        return 1;
+    }
+
+    lockless_flags = TQ_FLAG_LOCKLESS;
+    if (nb_producers == 1)
+        lockless_flags |= TQ_FLAG_SINGLE_PRODUCER;
+
+    ret = run(0, nb_producers, queue_size, nb_messages);
+    if (ret >= 0)
+        ret = run(lockless_flags, nb_producers, queue_size, nb_messages);
+
+    if (ret < 0) {
+        fprintf(stderr, "Benchmark failed: %s\n", av_err2str(ret));
+        return 1;
+    }
+
+    return 0;
+}